@@ -62,11 +62,74 @@ static bool started_expanding = false;
  */
 static unsigned int expand_bucket = 0;
 
+#ifdef HAVE_LOCKFREE_READS
+/*
+ * Read-optimized table used with -o lockfree_reads.
+ *
+ * Each bucket is one cache line holding a handful of item pointers plus a
+ * 16-bit tag (high bits of the hash) per slot, so most lookups touch a single
+ * line instead of walking h_next chains. A bucket that fills up grows a chain
+ * of overflow buckets; those are only released together with the table.
+ *
+ * Writers still serialize on item_lock(): a bucket index is the low
+ * hashpower bits of hv and the item lock index is a subset of them, so every
+ * writer to a bucket (and its overflow chain) holds the same item lock.
+ * Writers bump the head bucket's version to an odd value while they modify
+ * the chain and back to even afterwards. Readers take no lock: they sample
+ * the version, scan the chain, take a reference on the candidate and then
+ * re-check the version, retrying if a writer got in between.
+ *
+ * Expansion is incremental and does not pause the workers. The maintenance
+ * thread publishes a new primary table and migrates one old bucket at a time
+ * under its item lock, flagging it LF_BUCKET_MOVED so that readers and
+ * writers move on to the primary. The old table is freed once every worker
+ * has left any lookup that might still be using it.
+ */
+#define LF_BUCKET_SLOTS 5
+#define LF_BUCKET_MOVED 1
+#define LF_MAX_RETRIES 16
+#define LF_TAG(hv) ((uint16_t)((hv) >> 16))
+
+typedef struct _lf_bucket {
+  uint32_t version; /* odd while a writer is modifying the chain */
+  uint16_t flags;   /* LF_BUCKET_* above, head bucket only */
+  uint16_t tags[LF_BUCKET_SLOTS];
+  item *slots[LF_BUCKET_SLOTS];
+  struct _lf_bucket *next; /* overflow chain */
+} lf_bucket;
+
+typedef struct {
+  lf_bucket *buckets;
+  unsigned int power;
+} lf_table;
+
+static lf_table *lf_primary = NULL;
+static lf_table *lf_old = NULL;
+
+#define lf_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define lf_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static void assoc_lockfree_init(void);
+static lf_bucket *lf_head(const uint32_t hv);
+static item *lf_find(const char *key, const size_t nkey, const uint32_t hv);
+static void lf_insert(item *it, const uint32_t hv);
+static void lf_delete(const char *key, const size_t nkey, const uint32_t hv);
+static void lf_expand(void);
+static void lf_move_bucket(unsigned int bucket);
+static void lf_expand_done(void);
+#endif
+
 // 初始化 Hash table，哈希表的长度
 void assoc_init(const int hashtable_init) {
   if (hashtable_init) {
     hashpower = hashtable_init; //默认大小为16
   }
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads) {
+    assoc_lockfree_init();
+    return;
+  }
+#endif
   // 申请哈希表空间
   primary_hashtable = calloc(hashsize(hashpower), sizeof(void *));
   if (!primary_hashtable) {
@@ -84,6 +147,10 @@ void assoc_init(const int hashtable_init) {
 item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
   item *it;
   unsigned int oldbucket;
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads)
+    return lf_find(key, nkey, hv);
+#endif
   // https://sq.163yun.com/blog/article/197772233171603456
   if (expanding &&
       (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket) {
@@ -129,6 +196,51 @@ item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
   return ret;
 }
 
+#if defined(__GNUC__)
+#define assoc_prefetch(p) __builtin_prefetch((p), 0, 3)
+#else
+#define assoc_prefetch(p)
+#endif
+
+/*
+ * Prefetch helpers for multiget batches: all keys of a batch get their
+ * bucket prefetched, then (lockfree_reads only) the matching item headers,
+ * before any of them is looked up for real.
+ *
+ * They run without the item lock, so the table may be changing underneath
+ * and at worst a prefetch is wasted. The classic table is never read here:
+ * an expansion can free the old one under us. With lockfree_reads the caller
+ * is inside lockfree_read_begin/end, so the buckets may be read.
+ */
+void assoc_prefetch_bucket(const uint32_t hv) {
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads) {
+    lf_table *p = lf_load(&lf_primary);
+    assoc_prefetch(&p->buckets[hv & hashmask(p->power)]);
+    return;
+  }
+#endif
+  assoc_prefetch(&primary_hashtable[hv & hashmask(hashpower)]);
+}
+
+void assoc_prefetch_item(const uint32_t hv) {
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads) {
+    lf_bucket *b = lf_head(hv);
+    uint16_t tag = LF_TAG(hv);
+    int i;
+    for (i = 0; i < LF_BUCKET_SLOTS; i++) {
+      if (b->tags[i] == tag) {
+        item *it = lf_load(&b->slots[i]);
+        if (it != NULL)
+          assoc_prefetch(it);
+        return;
+      }
+    }
+  }
+#endif
+}
+
 /* returns the address of the item pointer before the key.  if *item == 0,
    the item wasn't found */
 // 返回前驱节点的 h_next 成员地址
@@ -156,6 +268,12 @@ static item **_hashitem_before(const char *key, const size_t nkey,
 /* grows the hashtable to the next power of 2. */
 // 申请 2 倍长度的哈希表
 static void assoc_expand(void) {
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads) {
+    lf_expand();
+    return;
+  }
+#endif
   old_hashtable = primary_hashtable;
 
   primary_hashtable = calloc(hashsize(hashpower + 1), sizeof(void *));
@@ -195,6 +313,11 @@ int assoc_insert(item *it, const uint32_t hv) {
   //    assert(assoc_find(ITEM_key(it), it->nkey) == 0);  /* shouldn't have
   //    duplicately named things defined */
   //如果已经进行扩容且目前进行扩容还没到需要插入元素的桶，则将元素添加到旧桶中  
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads) {
+    lf_insert(it, hv);
+  } else
+#endif
   if (expanding &&
       (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket) {
     it->h_next = old_hashtable[oldbucket];
@@ -220,6 +343,16 @@ int assoc_insert(item *it, const uint32_t hv) {
 
 // 删除 item
 void assoc_delete(const char *key, const size_t nkey, const uint32_t hv) {
+#ifdef HAVE_LOCKFREE_READS
+  if (settings.lockfree_reads) {
+    lf_delete(key, nkey, hv);
+    pthread_mutex_lock(&hash_items_counter_lock);
+    hash_items--;
+    pthread_mutex_unlock(&hash_items_counter_lock);
+    MEMCACHED_ASSOC_DELETE(key, nkey, hash_items);
+    return;
+  }
+#endif
   item **before = _hashitem_before(
       key, nkey, hv); // 找到要删除 item 的前驱节点的 h_next 成员地址 
 
@@ -287,6 +420,11 @@ static void *assoc_maintenance_thread(void *arg) {
        *  also the lowest M bits of hv, and N is greater than M.
        *  So we can process expanding with only one item_lock. cool! */
       if ((item_lock = item_trylock(expand_bucket))) {
+#ifdef HAVE_LOCKFREE_READS
+        if (settings.lockfree_reads) {
+          lf_move_bucket(expand_bucket);
+        } else
+#endif
         // 迁移到新的哈希表中
         for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
           next = it->h_next;
@@ -295,17 +433,25 @@ static void *assoc_maintenance_thread(void *arg) {
           primary_hashtable[bucket] = it;
         }
 
-        old_hashtable[expand_bucket] = NULL;
+        if (old_hashtable)
+          old_hashtable[expand_bucket] = NULL;
 
         expand_bucket++;
         // 全部数据迁移完毕  
         if (expand_bucket == hashsize(hashpower - 1)) {
           expanding = false;
-          free(old_hashtable);
-          STATS_LOCK();
-          stats_state.hash_bytes -= hashsize(hashpower - 1) * sizeof(void *);
-          stats_state.hash_is_expanding = false;
-          STATS_UNLOCK();
+#ifdef HAVE_LOCKFREE_READS
+          if (settings.lockfree_reads) {
+            /* Freed below, once the item lock has been dropped. */
+          } else
+#endif
+          {
+            free(old_hashtable);
+            STATS_LOCK();
+            stats_state.hash_bytes -= hashsize(hashpower - 1) * sizeof(void *);
+            stats_state.hash_is_expanding = false;
+            STATS_UNLOCK();
+          }
           if (settings.verbose > 1)
             fprintf(stderr, "Hash table expansion done\n");
         }
@@ -318,6 +464,10 @@ static void *assoc_maintenance_thread(void *arg) {
         item_trylock_unlock(item_lock);
         item_lock = NULL;
       }
+#ifdef HAVE_LOCKFREE_READS
+      if (settings.lockfree_reads && !expanding)
+        lf_expand_done();
+#endif
     }
 
     // 不需要扩容哈希表
@@ -332,9 +482,18 @@ static void *assoc_maintenance_thread(void *arg) {
        * allow dynamic hash table expansion without causing significant
        * wait times.
        */
-      pause_threads(PAUSE_ALL_THREADS);
-      assoc_expand(); // 申请更大的哈希表
-      pause_threads(RESUME_ALL_THREADS);
+#ifdef HAVE_LOCKFREE_READS
+      if (settings.lockfree_reads) {
+        /* Lock-free readers already cope with the table being swapped
+         * underneath them, so nobody needs to be paused. */
+        assoc_expand();
+      } else
+#endif
+      {
+        pause_threads(PAUSE_ALL_THREADS);
+        assoc_expand(); // 申请更大的哈希表
+        pause_threads(RESUME_ALL_THREADS);
+      }
     }
   }
   return NULL;
@@ -372,3 +531,293 @@ void stop_assoc_maintenance_thread() {
   /* Wait for the maintenance thread to stop */
   pthread_join(maintenance_tid, NULL); // 等待扩容线程终止
 }
+
+#ifdef HAVE_LOCKFREE_READS
+static lf_table *lf_table_new(const unsigned int power) {
+  lf_table *t = calloc(1, sizeof(lf_table));
+  void *buckets = NULL;
+  if (t == NULL)
+    return NULL;
+  if (posix_memalign(&buckets, 64, hashsize(power) * sizeof(lf_bucket)) != 0) {
+    free(t);
+    return NULL;
+  }
+  memset(buckets, 0, hashsize(power) * sizeof(lf_bucket));
+  t->buckets = buckets;
+  t->power = power;
+  return t;
+}
+
+static void lf_table_free(lf_table *t) {
+  ub4 i;
+  for (i = 0; i < hashsize(t->power); i++) {
+    lf_bucket *b = t->buckets[i].next;
+    while (b) {
+      lf_bucket *next = b->next;
+      free(b);
+      b = next;
+    }
+  }
+  free(t->buckets);
+  free(t);
+}
+
+static void assoc_lockfree_init(void) {
+  lf_primary = lf_table_new(hashpower);
+  if (!lf_primary) {
+    fprintf(stderr, "Failed to init hashtable.\n");
+    exit(EXIT_FAILURE);
+  }
+  STATS_LOCK();
+  stats_state.hash_power_level = hashpower;
+  stats_state.hash_bytes = hashsize(hashpower) * sizeof(lf_bucket);
+  STATS_UNLOCK();
+}
+
+/* Head bucket currently responsible for hv. The primary pointer is loaded
+ * before the old one: lf_expand() publishes them in the opposite order, so a
+ * new primary always comes with its old table. */
+static lf_bucket *lf_head(const uint32_t hv) {
+  lf_table *p = lf_load(&lf_primary);
+  lf_table *o = lf_load(&lf_old);
+  if (o != NULL) {
+    lf_bucket *b = &o->buckets[hv & hashmask(o->power)];
+    if ((lf_load(&b->flags) & LF_BUCKET_MOVED) == 0)
+      return b;
+  }
+  return &p->buckets[hv & hashmask(p->power)];
+}
+
+static inline void lf_write_begin(lf_bucket *b) {
+  __atomic_store_n(&b->version, b->version + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void lf_write_end(lf_bucket *b) {
+  lf_store(&b->version, b->version + 1);
+}
+
+static item *lf_scan(lf_bucket *b, const char *key, const size_t nkey,
+                     const uint16_t tag) {
+  int depth = 0;
+  for (; b != NULL; b = lf_load(&b->next)) {
+    int i;
+    for (i = 0; i < LF_BUCKET_SLOTS; i++) {
+      item *it = lf_load(&b->slots[i]);
+      if (it != NULL && b->tags[i] == tag && nkey == it->nkey &&
+          memcmp(key, ITEM_key(it), nkey) == 0) {
+        MEMCACHED_ASSOC_FIND(key, nkey, depth);
+        return it;
+      }
+      ++depth;
+    }
+  }
+  MEMCACHED_ASSOC_FIND(key, nkey, depth);
+  return NULL;
+}
+
+/* Caller holds the item lock for hv. */
+static item *lf_find(const char *key, const size_t nkey, const uint32_t hv) {
+  return lf_scan(lf_head(hv), key, nkey, LF_TAG(hv));
+}
+
+static void lf_link(lf_bucket *head, item *it, const uint32_t hv) {
+  lf_bucket *b = head, *last = NULL;
+  void *nb = NULL;
+  int i;
+
+  for (; b != NULL; last = b, b = b->next) {
+    for (i = 0; i < LF_BUCKET_SLOTS; i++) {
+      if (b->slots[i] == NULL) {
+        b->tags[i] = LF_TAG(hv);
+        lf_store(&b->slots[i], it);
+        return;
+      }
+    }
+  }
+
+  /* Bucket and its overflow chain are full. */
+  if (posix_memalign(&nb, 64, sizeof(lf_bucket)) != 0) {
+    fprintf(stderr, "Failed to allocate hash overflow bucket\n");
+    abort();
+  }
+  memset(nb, 0, sizeof(lf_bucket));
+  b = nb;
+  b->tags[0] = LF_TAG(hv);
+  b->slots[0] = it;
+  lf_store(&last->next, b);
+  STATS_LOCK();
+  stats_state.hash_bytes += sizeof(lf_bucket);
+  STATS_UNLOCK();
+}
+
+static void lf_insert(item *it, const uint32_t hv) {
+  lf_bucket *head = lf_head(hv);
+  lf_write_begin(head);
+  lf_link(head, it, hv);
+  lf_write_end(head);
+}
+
+static void lf_delete(const char *key, const size_t nkey, const uint32_t hv) {
+  lf_bucket *head = lf_head(hv);
+  lf_bucket *b;
+  uint16_t tag = LF_TAG(hv);
+  int i;
+
+  for (b = head; b != NULL; b = b->next) {
+    for (i = 0; i < LF_BUCKET_SLOTS; i++) {
+      item *it = b->slots[i];
+      if (it != NULL && b->tags[i] == tag && nkey == it->nkey &&
+          memcmp(key, ITEM_key(it), nkey) == 0) {
+        lf_write_begin(head);
+        lf_store(&b->slots[i], NULL);
+        lf_write_end(head);
+        return;
+      }
+    }
+  }
+  /* Note:  we never actually get here.  the callers don't delete things
+     they can't find. */
+  assert(b != NULL);
+}
+
+/* Takes a reference on an item found without the item lock. Refuses items
+ * whose refcount is zero: those are free (or being freed) and may already be
+ * sitting on a slab freelist. */
+static bool lf_refcount_acquire(item *it) {
+  unsigned short refcount = lf_load(&it->refcount);
+  while (refcount != 0) {
+    if (__atomic_compare_exchange_n(&it->refcount, &refcount, refcount + 1,
+                                    false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Lock-free lookup used by worker threads. Must be called between
+ * lockfree_read_begin() and lockfree_read_end().
+ *
+ * Returns true if the lookup was answered: *itp is either NULL (miss) or an
+ * item the caller now holds a reference on, exactly as if it had been
+ * fetched with assoc_find() + refcount_incr() under the item lock. Returns
+ * false if writers kept getting in the way; the caller should retry under
+ * item_lock().
+ */
+bool assoc_find_lockfree(const char *key, const size_t nkey, const uint32_t hv,
+                         item **itp) {
+  uint16_t tag = LF_TAG(hv);
+  int tries;
+
+  for (tries = 0; tries < LF_MAX_RETRIES; tries++) {
+    lf_bucket *head = lf_head(hv);
+    uint32_t version = lf_load(&head->version);
+    item *it;
+
+    if ((version & 1) ||
+        (lf_load(&head->flags) & LF_BUCKET_MOVED)) {
+      continue;
+    }
+
+    it = lf_scan(head, key, nkey, tag);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (it == NULL) {
+      if (__atomic_load_n(&head->version, __ATOMIC_RELAXED) == version) {
+        *itp = NULL;
+        return true;
+      }
+      continue;
+    }
+
+    if (!lf_refcount_acquire(it))
+      continue;
+    /* The CAS above is a full barrier. If the version still matches, the
+     * item was linked into this bucket when we took our reference. */
+    if (__atomic_load_n(&head->version, __ATOMIC_RELAXED) == version) {
+      *itp = it;
+      return true;
+    }
+    /* Lost a race with a writer. Our reference is real, even if the memory
+     * has since been reused for another item, so drop it the normal way. */
+    item_remove(it);
+  }
+  return false;
+}
+
+/* Called from the maintenance thread, which is the only writer of
+ * lf_primary/lf_old. */
+static void lf_expand(void) {
+  lf_table *t = lf_table_new(hashpower + 1);
+  if (t == NULL) {
+    /* Bad news, but we can keep running. */
+    return;
+  }
+  if (settings.verbose > 1)
+    fprintf(stderr, "Hash table expansion starting\n");
+  lf_store(&lf_old, lf_primary);
+  lf_store(&lf_primary, t);
+  hashpower++;
+  expanding = true;
+  expand_bucket = 0;
+  STATS_LOCK();
+  stats_state.hash_power_level = hashpower;
+  stats_state.hash_bytes += hashsize(hashpower) * sizeof(lf_bucket);
+  stats_state.hash_is_expanding = true;
+  STATS_UNLOCK();
+}
+
+/* Moves an old bucket into the primary table. Caller holds the item lock,
+ * which also covers both destination buckets. */
+static void lf_move_bucket(unsigned int bucket) {
+  lf_bucket *head = &lf_old->buckets[bucket];
+  lf_bucket *b;
+  int i;
+
+  lf_write_begin(head);
+  for (b = head; b != NULL; b = b->next) {
+    for (i = 0; i < LF_BUCKET_SLOTS; i++) {
+      item *it = b->slots[i];
+      if (it != NULL) {
+        uint32_t hv = hash(ITEM_key(it), it->nkey);
+        lf_bucket *dst = &lf_primary->buckets[hv & hashmask(hashpower)];
+        lf_write_begin(dst);
+        lf_link(dst, it, hv);
+        lf_write_end(dst);
+        lf_store(&b->slots[i], NULL);
+      }
+    }
+  }
+  lf_store(&head->flags, head->flags | LF_BUCKET_MOVED);
+  lf_write_end(head);
+}
+
+/* Retires the old table once expansion has finished. Must be called without
+ * holding any item locks: it waits for in-flight lock-free readers. */
+static void lf_expand_done(void) {
+  lf_table *o = lf_old;
+  size_t bytes = 0;
+  ub4 i;
+
+  if (o == NULL)
+    return;
+  lf_store(&lf_old, NULL);
+  lockfree_read_sync();
+  /* Writers look at lf_old under their item lock; cycling through every
+   * lock waits out any of them that loaded it before it was cleared. */
+  for (i = 0; i < hashsize(item_lock_hashpower); i++) {
+    item_lock(i);
+    item_unlock(i);
+  }
+
+  for (i = 0; i < hashsize(o->power); i++) {
+    lf_bucket *b;
+    for (b = &o->buckets[i]; b != NULL; b = b->next)
+      bytes += sizeof(lf_bucket);
+  }
+  lf_table_free(o);
+  STATS_LOCK();
+  stats_state.hash_bytes -= bytes;
+  stats_state.hash_is_expanding = false;
+  STATS_UNLOCK();
+}
+#endif
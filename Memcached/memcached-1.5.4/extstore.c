@@ -14,7 +14,14 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include "extstore.h"
 
 // TODO: better if an init option turns this on/off.
@@ -48,6 +55,7 @@ typedef struct __store_wbuf {
     unsigned int free;
     unsigned int size;
     unsigned int offset; /* offset into page this write starts at */
+    int buf_index; /* index of this buffer when registered with io_uring */
     bool full; /* done writing to this page */
     bool flushed; /* whether wbuf has been flushed to disk */
 } _store_wbuf;
@@ -77,6 +85,11 @@ typedef struct {
     pthread_cond_t cond;
     obj_io *queue;
     store_engine *e;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    bool use_ring; /* submit through the ring instead of pread/pwrite */
+    bool fixed_bufs; /* wbufs are registered with the ring */
+#endif
 } store_io_thread;
 
 typedef struct {
@@ -138,6 +151,10 @@ static uint64_t _next_version(store_engine *e) {
 
 static void *extstore_io_thread(void *arg);
 static void *extstore_maint_thread(void *arg);
+#ifdef HAVE_LIBURING
+static void _io_uring_init(store_engine *e, store_io_thread *t,
+        unsigned int wbuf_count);
+#endif
 
 /* Copies stats internal to engine and computes any derived values */
 void extstore_get_stats(void *ptr, struct extstore_stats *st) {
@@ -165,6 +182,41 @@ void extstore_get_page_data(void *ptr, struct extstore_stats *st) {
     STAT_UL(e);
 }
 
+int extstore_compact_pick(struct extstore_stats *st, uint64_t max_used,
+        unsigned int skip_buckets) {
+    struct extstore_page_data *pd = st->page_data;
+    uint64_t newest = 0;
+    double best = 0;
+    int x, pick = -1;
+
+    for (x = 0; x < st->page_count; x++) {
+        if (pd[x].version > newest)
+            newest = pd[x].version;
+    }
+
+    for (x = 0; x < st->page_count; x++) {
+        double freed, age, score;
+        if (pd[x].version == 0 || pd[x].active || pd[x].obj_count == 0 ||
+                pd[x].bytes_used >= max_used ||
+                pd[x].bytes_used >= st->page_size ||
+                (skip_buckets & (1U << pd[x].bucket)))
+            continue;
+        // age in pages allocated since, levelling off after about one
+        // turnover of the store. young pages are still emptying on their
+        // own; the survivors of old ones are cold and worth moving once.
+        freed = st->page_size - pd[x].bytes_used;
+        age = newest - pd[x].version + 1;
+        age = age / (age + st->page_count);
+        score = freed * age / (st->page_size + pd[x].bytes_used);
+        if (score > best) {
+            best = score;
+            pick = x;
+        }
+    }
+
+    return pick;
+}
+
 const char *extstore_err(enum extstore_res res) {
     char *rv = "unknown error";
     switch (res) {
@@ -280,6 +332,7 @@ void *extstore_init(char *fn, struct extstore_conf *cf,
         _store_wbuf *w = wbuf_new(cf->wbuf_size);
         obj_io *io = calloc(1, sizeof(obj_io));
         /* TODO: on error, loop again and free stack. */
+        w->buf_index = i;
         w->next = e->wbuf_stack;
         e->wbuf_stack = w;
         io->next = e->io_stack;
@@ -297,6 +350,10 @@ void *extstore_init(char *fn, struct extstore_conf *cf,
         pthread_mutex_init(&e->io_threads[i].mutex, NULL);
         pthread_cond_init(&e->io_threads[i].cond, NULL);
         e->io_threads[i].e = e;
+#ifdef HAVE_LIBURING
+        if (cf->io_uring)
+            _io_uring_init(e, &e->io_threads[i], cf->wbuf_count);
+#endif
         // FIXME: error handling
         pthread_create(&thread, NULL, extstore_io_thread, &e->io_threads[i]);
     }
@@ -319,6 +376,7 @@ void extstore_run_maint(void *ptr) {
 static store_page *_allocate_page(store_engine *e, unsigned int bucket) {
     assert(!e->page_buckets[bucket] || e->page_buckets[bucket]->allocated == e->page_size);
     store_page *tmp = e->page_freelist;
+    struct extstore_page_data *pd;
     E_DEBUG("EXTSTORE: allocating new page\n");
     if (e->page_free > 0) {
         assert(e->page_freelist != NULL);
@@ -331,7 +389,15 @@ static store_page *_allocate_page(store_engine *e, unsigned int bucket) {
         tmp->version = _next_version(e);
         tmp->bucket = bucket;
         e->page_free--;
-        STAT_INCR(e, page_allocs, 1);
+        STAT_L(e);
+        e->stats.page_allocs++;
+        pd = &e->stats.page_data[tmp->id];
+        pd->version = tmp->version;
+        pd->bytes_used = 0;
+        pd->obj_count = 0;
+        pd->bucket = bucket;
+        pd->active = true;
+        STAT_UL(e);
     } else {
         extstore_run_maint(e);
     }
@@ -383,8 +449,12 @@ static void _wbuf_cb(void *ep, obj_io *io, int ret) {
     p->written += w->size;
     p->wbuf = NULL;
 
-    if (p->written == e->page_size)
+    if (p->written == e->page_size) {
         p->active = false;
+        STAT_L(e);
+        e->stats.page_data[p->id].active = false;
+        STAT_UL(e);
+    }
 
     // return the wbuf
     pthread_mutex_lock(&e->mutex);
@@ -484,24 +554,40 @@ int extstore_write_request(void *ptr, unsigned int bucket, obj_io *io) {
     return ret;
 }
 
+int extstore_write_request_batch(void *ptr, unsigned int bucket, obj_io *io) {
+    store_engine *e = (store_engine *)ptr;
+    int ret = extstore_write_request(ptr, bucket, io);
+    // on success the page is left locked, so the wbuf can't move.
+    if (ret == 0)
+        io->len = e->pages[io->page_id].wbuf->free;
+    return ret;
+}
+
 /* _must_ be called after a successful write_request.
  * fills the rest of io structure.
  */
 void extstore_write(void *ptr, obj_io *io) {
+    extstore_write_batch(ptr, io, 1);
+}
+
+void extstore_write_batch(void *ptr, obj_io *io, unsigned int count) {
     store_engine *e = (store_engine *)ptr;
     store_page *p = &e->pages[io->page_id];
+    struct extstore_page_data *pd = &e->stats.page_data[io->page_id];
 
     io->offset = p->wbuf->offset + (p->wbuf->size - p->wbuf->free);
     io->page_version = p->version;
     p->wbuf->buf_pos += io->len;
     p->wbuf->free -= io->len;
     p->bytes_used += io->len;
-    p->obj_count++;
+    p->obj_count += count;
     STAT_L(e);
     e->stats.bytes_written += io->len;
     e->stats.bytes_used += io->len;
-    e->stats.objects_written++;
-    e->stats.objects_used++;
+    e->stats.objects_written += count;
+    e->stats.objects_used += count;
+    pd->bytes_used = p->bytes_used;
+    pd->obj_count = p->obj_count;
     STAT_UL(e);
 
     pthread_mutex_unlock(&p->mutex);
@@ -564,6 +650,8 @@ int extstore_delete(void *ptr, unsigned int page_id, uint64_t page_version,
         STAT_L(e);
         e->stats.bytes_used -= bytes;
         e->stats.objects_used -= count;
+        e->stats.page_data[page_id].bytes_used = p->bytes_used;
+        e->stats.page_data[page_id].obj_count = p->obj_count;
         STAT_UL(e);
 
         if (p->obj_count == 0) {
@@ -596,6 +684,9 @@ void extstore_close_page(void *ptr, unsigned int page_id, uint64_t page_version)
     pthread_mutex_lock(&p->mutex);
     if (!p->closed && p->version == page_version) {
         p->closed = true;
+        STAT_L(e);
+        e->stats.page_data[page_id].version = 0;
+        STAT_UL(e);
         extstore_run_maint(e);
     }
     pthread_mutex_unlock(&p->mutex);
@@ -626,6 +717,179 @@ static inline int _read_from_wbuf(store_page *p, obj_io *io) {
     return io->len;
 }
 
+/* Checks a read against its page before it goes to disk. Returns true if the
+ * read has to be issued, in which case a page reference is held until the
+ * IO's callback has run. Otherwise *ret holds the result: either the read
+ * was served from the page's wbuf, or the page is gone.
+ */
+static bool _read_prepare(store_engine *e, store_page *p, obj_io *io, int *ret) {
+    bool do_op = true;
+    // Page is currently open. deal if read is past the end.
+    pthread_mutex_lock(&p->mutex);
+    if (!p->free && !p->closed && p->version == io->page_version) {
+        if (p->active && io->offset >= p->written) {
+            *ret = _read_from_wbuf(p, io);
+            do_op = false;
+        } else {
+            p->refcount++;
+        }
+        STAT_L(e);
+        e->stats.bytes_read += io->len;
+        e->stats.objects_read++;
+        STAT_UL(e);
+    } else {
+        do_op = false;
+        *ret = -2; // TODO: enum in IO for status?
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return do_op;
+}
+
+#ifdef HAVE_LIBURING
+/* Sets up a submission ring for an IO thread. Write buffers are registered
+ * with the ring so wbuf flushes don't have to map their pages on every
+ * write. Any failure leaves the thread on the pread/pwrite path.
+ */
+static void _io_uring_init(store_engine *e, store_io_thread *t,
+        unsigned int wbuf_count) {
+    struct iovec *iov;
+    _store_wbuf *w;
+    // a batch pulled off the queue is at most io_depth IO's
+    unsigned int entries = e->io_depth > 0 ? e->io_depth : 1;
+
+    if (io_uring_queue_init(entries, &t->ring, 0) != 0) {
+        E_DEBUG("EXTSTORE: io_uring unavailable, using pread/pwrite\n");
+        return;
+    }
+    t->use_ring = true;
+
+    iov = calloc(wbuf_count, sizeof(struct iovec));
+    if (iov == NULL)
+        return;
+    for (w = e->wbuf_stack; w != NULL; w = w->next) {
+        iov[w->buf_index].iov_base = w->buf;
+        iov[w->buf_index].iov_len = w->size;
+    }
+    // can fail on RLIMIT_MEMLOCK; unregistered writes still work.
+    if (io_uring_register_buffers(&t->ring, iov, wbuf_count) == 0)
+        t->fixed_bufs = true;
+    free(iov);
+}
+
+/* Runs the callback for one completed IO and drops the page reference taken
+ * by _read_prepare().
+ */
+static void _io_uring_complete(store_engine *e, obj_io *io, int res) {
+    store_page *p = &e->pages[io->page_id];
+    bool is_read = (io->mode == OBJ_IO_READ);
+    int ret = res;
+
+    if (res < 0) {
+        // match the pread/pwrite convention callbacks expect.
+        errno = -res;
+        ret = -1;
+#ifdef EXTSTORE_DEBUG
+        perror("read/write op failed");
+#endif
+    } else if (res == 0) {
+        E_DEBUG("read returned nothing\n");
+    }
+    // io may be reused once the callback returns.
+    io->cb(e, io, ret);
+    if (is_read) {
+        pthread_mutex_lock(&p->mutex);
+        p->refcount--;
+        pthread_mutex_unlock(&p->mutex);
+    }
+}
+
+/* Submits what's queued and reaps completions until at most 'target' IO's
+ * remain in flight. Returns the new in-flight count.
+ */
+static unsigned int _io_uring_reap(store_io_thread *me, unsigned int inflight,
+        unsigned int target) {
+    struct io_uring *ring = &me->ring;
+    struct io_uring_cqe *cqe;
+
+    io_uring_submit(ring);
+    while (inflight > target) {
+        unsigned int head;
+        unsigned int seen = 0;
+        if (io_uring_wait_cqe(ring, &cqe) != 0)
+            continue;
+        io_uring_for_each_cqe(ring, head, cqe) {
+            _io_uring_complete(me->e, io_uring_cqe_get_data(cqe), cqe->res);
+            seen++;
+        }
+        io_uring_cq_advance(ring, seen);
+        inflight -= seen;
+    }
+    return inflight;
+}
+
+/* io_uring version of the IO thread's batch loop. The whole batch goes out
+ * in a single submission and completions are reaped in bulk; callbacks run
+ * in completion order rather than queue order.
+ */
+static void _io_uring_run(store_io_thread *me, obj_io *io_stack) {
+    store_engine *e = me->e;
+    obj_io *cur_io = io_stack;
+    unsigned int inflight = 0;
+
+    while (cur_io) {
+        obj_io *next = cur_io->next;
+        store_page *p = &e->pages[cur_io->page_id];
+        struct io_uring_sqe *sqe;
+        int ret = 0;
+
+        if (cur_io->mode == OBJ_IO_READ &&
+                !_read_prepare(e, p, cur_io, &ret)) {
+            cur_io->cb(e, cur_io, ret);
+            cur_io = next;
+            continue;
+        }
+
+        sqe = io_uring_get_sqe(&me->ring);
+        if (sqe == NULL) {
+            // ring is full; drain it before queueing more.
+            inflight = _io_uring_reap(me, inflight, 0);
+            sqe = io_uring_get_sqe(&me->ring);
+            assert(sqe != NULL);
+        }
+
+        switch (cur_io->mode) {
+            case OBJ_IO_READ:
+                if (cur_io->iov == NULL) {
+                    io_uring_prep_read(sqe, p->fd, cur_io->buf, cur_io->len,
+                            p->offset + cur_io->offset);
+                } else {
+                    io_uring_prep_readv(sqe, p->fd, cur_io->iov,
+                            cur_io->iovcnt, p->offset + cur_io->offset);
+                }
+                break;
+            case OBJ_IO_WRITE:
+                // FIXME: Should hold refcount during write. doesn't
+                // currently matter since page can't free while active.
+                if (me->fixed_bufs) {
+                    _store_wbuf *w = (_store_wbuf *) cur_io->data;
+                    io_uring_prep_write_fixed(sqe, p->fd, cur_io->buf,
+                            cur_io->len, p->offset + cur_io->offset,
+                            w->buf_index);
+                } else {
+                    io_uring_prep_write(sqe, p->fd, cur_io->buf, cur_io->len,
+                            p->offset + cur_io->offset);
+                }
+                break;
+        }
+        io_uring_sqe_set_data(sqe, cur_io);
+        inflight++;
+        cur_io = next;
+    }
+
+    _io_uring_reap(me, inflight, 0);
+}
+#endif
+
 /* engine IO thread; takes engine context
  * manage writes/reads
  * runs IO callbacks inline after each IO
@@ -659,6 +923,12 @@ static void *extstore_io_thread(void *arg) {
         }
         pthread_mutex_unlock(&me->mutex);
 
+#ifdef HAVE_LIBURING
+        if (me->use_ring) {
+            _io_uring_run(me, io_stack);
+            continue;
+        }
+#endif
         obj_io *cur_io = io_stack;
         while (cur_io) {
             // We need to note next before the callback in case the obj_io
@@ -670,24 +940,7 @@ static void *extstore_io_thread(void *arg) {
             // TODO: loop if not enough bytes were read/written.
             switch (cur_io->mode) {
                 case OBJ_IO_READ:
-                    // Page is currently open. deal if read is past the end.
-                    pthread_mutex_lock(&p->mutex);
-                    if (!p->free && !p->closed && p->version == cur_io->page_version) {
-                        if (p->active && cur_io->offset >= p->written) {
-                            ret = _read_from_wbuf(p, cur_io);
-                            do_op = 0;
-                        } else {
-                            p->refcount++;
-                        }
-                        STAT_L(e);
-                        e->stats.bytes_read += cur_io->len;
-                        e->stats.objects_read++;
-                        STAT_UL(e);
-                    } else {
-                        do_op = 0;
-                        ret = -2; // TODO: enum in IO for status?
-                    }
-                    pthread_mutex_unlock(&p->mutex);
+                    do_op = _read_prepare(e, p, cur_io, &ret);
                     if (do_op) {
                         if (cur_io->iov == NULL) {
                             ret = pread(p->fd, cur_io->buf, cur_io->len, p->offset + cur_io->offset);
@@ -734,6 +987,7 @@ static void _free_page(store_engine *e, store_page *p) {
     e->stats.objects_used -= p->obj_count;
     e->stats.bytes_used -= p->bytes_used;
     e->stats.page_reclaims++;
+    memset(&e->stats.page_data[p->id], 0, sizeof(struct extstore_page_data));
     STAT_UL(e);
     pthread_mutex_lock(&e->mutex);
     // unlink page from bucket list
@@ -784,8 +1038,6 @@ static void _free_page(store_engine *e, store_page *p) {
 static void *extstore_maint_thread(void *arg) {
     store_maint_thread *me = (store_maint_thread *)arg;
     store_engine *e = me->e;
-    struct extstore_page_data *pd =
-        calloc(e->page_count, sizeof(struct extstore_page_data));
     pthread_mutex_lock(&me->mutex);
     while (1) {
         int i;
@@ -799,7 +1051,6 @@ static void *extstore_maint_thread(void *arg) {
             do_evict = true;
         }
         pthread_mutex_unlock(&e->mutex);
-        memset(pd, 0, sizeof(struct extstore_page_data) * e->page_count);
 
         for (i = 0; i < e->page_count; i++) {
             store_page *p = &e->pages[i];
@@ -809,9 +1060,6 @@ static void *extstore_maint_thread(void *arg) {
                 continue;
             }
             if (p->obj_count > 0 && !p->closed) {
-                pd[p->id].version = p->version;
-                pd[p->id].bytes_used = p->bytes_used;
-                pd[p->id].bucket = p->bucket;
                 if (p->version < low_version) {
                     low_version = p->version;
                     low_page = i;
@@ -833,6 +1081,7 @@ static void *extstore_maint_thread(void *arg) {
             if (!p->closed) {
                 p->closed = true;
                 STAT_L(e);
+                e->stats.page_data[p->id].version = 0;
                 e->stats.page_evictions++;
                 e->stats.objects_evicted += p->obj_count;
                 e->stats.bytes_evicted += p->bytes_used;
@@ -843,13 +1092,6 @@ static void *extstore_maint_thread(void *arg) {
             }
             pthread_mutex_unlock(&p->mutex);
         }
-
-        // copy the page data into engine context so callers can use it from
-        // the stats lock.
-        STAT_L(e);
-        memcpy(e->stats.page_data, pd,
-                sizeof(struct extstore_page_data) * e->page_count);
-        STAT_UL(e);
     }
 
     return NULL;
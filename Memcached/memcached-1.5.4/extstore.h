@@ -2,12 +2,15 @@
 #define EXTSTORE_H
 
 /* A safe-to-read dataset for determining compaction.
- * id is the array index.
+ * id is the array index. Kept up to date on every write and delete; version
+ * is 0 for free pages and pages closed for compaction or eviction.
  */
 struct extstore_page_data {
     uint64_t version;
     uint64_t bytes_used;
+    uint64_t obj_count;
     unsigned int bucket;
+    bool active; /* still being written to */
 };
 
 /* Pages can have objects deleted from them at any time. This creates holes
@@ -47,6 +50,7 @@ struct extstore_conf {
     unsigned int wbuf_count; // this might get locked to "2 per active page"
     unsigned int io_threadcount;
     unsigned int io_depth; // with normal I/O, hits locks less. req'd for AIO
+    bool io_uring; // submit IO through io_uring, if built with liburing
 };
 
 enum obj_io_mode {
@@ -90,6 +94,13 @@ const char *extstore_err(enum extstore_res res);
 void *extstore_init(char *fn, struct extstore_conf *cf, enum extstore_res *res);
 int extstore_write_request(void *ptr, unsigned int bucket, obj_io *io);
 void extstore_write(void *ptr, obj_io *io);
+/* Batched writes: io->len is the minimum space needed. On success io->len is
+ * raised to all of the free space in the write buffer, so several objects can
+ * be copied in back to back. extstore_write_batch() must follow, with io->len
+ * lowered to the bytes actually used and count the number of objects.
+ */
+int extstore_write_request_batch(void *ptr, unsigned int bucket, obj_io *io);
+void extstore_write_batch(void *ptr, obj_io *io, unsigned int count);
 int extstore_submit(void *ptr, obj_io *io);
 /* count are the number of objects being removed, bytes are the original
  * length of those objects. Bytes is optional but you can't track
@@ -102,6 +113,15 @@ void extstore_get_stats(void *ptr, struct extstore_stats *st);
  * caller must allocate its stats.page_data memory first.
  */
 void extstore_get_page_data(void *ptr, struct extstore_stats *st);
+/* Picks the page to compact from st->page_data: of the full pages with less
+ * than max_used bytes live, the one that frees the most space per byte of
+ * compaction IO (reading the page and rewriting what's live), weighted
+ * towards older pages whose remaining objects have outlived their peers.
+ * skip_buckets is a bitmask of buckets to leave alone.
+ * Returns the page id, or -1 if none qualify.
+ */
+int extstore_compact_pick(struct extstore_stats *st, uint64_t max_used,
+        unsigned int skip_buckets);
 void extstore_run_maint(void *ptr);
 void extstore_close_page(void *ptr, unsigned int page_id, uint64_t page_version);
 
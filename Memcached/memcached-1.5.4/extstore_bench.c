@@ -0,0 +1,256 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Read benchmark for extstore against a file-backed store.
+ *
+ * Fills a store file with fixed size objects, drops the file from the page
+ * cache and then issues random reads in batches of io_depth, the same way
+ * storage reads are handed to extstore_submit(). Prints reads/sec and read
+ * latency percentiles for the pread/pwrite IO threads and, when built with
+ * liburing, for the io_uring IO threads.
+ *
+ *   ./extstore_bench [-f file] [-t io_threads] [-d io_depth] [-s obj_size]
+ *                    [-p pages] [-n reads]
+ */
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "extstore.h"
+
+#define PAGE_SIZE_MB 64
+#define WBUF_SIZE_MB 8
+
+struct obj_loc {
+    unsigned int page_id;
+    unsigned int page_version;
+    unsigned int offset;
+};
+
+struct bench_io {
+    obj_io io;
+    uint64_t start;
+    struct bench_batch *batch;
+};
+
+struct bench_batch {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int pending;
+    unsigned int errors;
+    uint64_t *lat;
+    unsigned int lat_count;
+};
+
+static char *fn = "/tmp/extstore_bench.data";
+static unsigned int io_threads = 1;
+static unsigned int io_depth = 64;
+static unsigned int obj_size = 4096;
+static unsigned int page_count = 16;
+static unsigned int read_count = 200000;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void read_cb(void *e, obj_io *io, int ret) {
+    struct bench_io *bio = (struct bench_io *)io;
+    struct bench_batch *b = bio->batch;
+    uint64_t lat = now_ns() - bio->start;
+
+    pthread_mutex_lock(&b->mutex);
+    if (ret != (int)io->len)
+        b->errors++;
+    b->lat[b->lat_count++] = lat;
+    if (--b->pending == 0)
+        pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+/* Writes max objects into bucket 0, recording where each one landed. */
+static unsigned int fill(void *e, struct obj_loc *locs, unsigned int max) {
+    char *data = malloc(obj_size);
+    unsigned int count = 0;
+    memset(data, 'x', obj_size);
+
+    while (count < max) {
+        obj_io io;
+        memset(&io, 0, sizeof(io));
+        io.len = obj_size;
+        io.mode = OBJ_IO_WRITE;
+        if (extstore_write_request(e, 0, &io) != 0) {
+            // page rolled over or wbufs are flushing; try again.
+            usleep(100);
+            continue;
+        }
+        memcpy(io.buf, data, obj_size);
+        extstore_write(e, &io);
+        locs[count].page_id = io.page_id;
+        locs[count].page_version = io.page_version;
+        locs[count].offset = io.offset;
+        count++;
+    }
+    free(data);
+    return count;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(char *file, bool use_uring) {
+    struct extstore_conf cf;
+    enum extstore_res eres;
+    struct bench_batch batch;
+    struct bench_io *ios;
+    struct obj_loc *locs;
+    unsigned int objs, i, done = 0;
+    uint64_t start, elapsed;
+    char *bufs;
+    void *e;
+    int fd;
+
+    memset(&cf, 0, sizeof(cf));
+    cf.page_size = PAGE_SIZE_MB * 1024 * 1024;
+    cf.page_count = page_count;
+    cf.page_buckets = 1;
+    cf.wbuf_size = WBUF_SIZE_MB * 1024 * 1024;
+    cf.wbuf_count = 2;
+    cf.io_threadcount = io_threads;
+    cf.io_depth = io_depth;
+    cf.io_uring = use_uring;
+
+    e = extstore_init(file, &cf, &eres);
+    if (e == NULL) {
+        fprintf(stderr, "extstore_init failed: %s\n", extstore_err(eres));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Page 0 is never used and a free page must remain, or the maint
+     * thread starts evicting. Of the pages written, the last one may still
+     * sit in a wbuf, so it isn't read from.
+     */
+    objs = (cf.page_size / obj_size) * (page_count - 3);
+    locs = calloc(objs + cf.page_size / obj_size, sizeof(struct obj_loc));
+    fill(e, locs, objs + cf.page_size / obj_size);
+
+    // make reads hit the device rather than the page cache
+    fd = open(file, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    ios = calloc(io_depth, sizeof(struct bench_io));
+    bufs = malloc((size_t)io_depth * obj_size);
+    memset(&batch, 0, sizeof(batch));
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+    batch.lat = malloc(sizeof(uint64_t) * read_count);
+
+    srandom(1);
+    start = now_ns();
+    while (done < read_count) {
+        unsigned int n = read_count - done < io_depth ? read_count - done : io_depth;
+        obj_io *stack = NULL;
+
+        batch.pending = n;
+        for (i = 0; i < n; i++) {
+            struct bench_io *bio = &ios[i];
+            struct obj_loc *loc = &locs[random() % objs];
+            memset(bio, 0, sizeof(*bio));
+            bio->io.buf = bufs + (size_t)i * obj_size;
+            bio->io.len = obj_size;
+            bio->io.offset = loc->offset;
+            bio->io.page_id = loc->page_id;
+            bio->io.page_version = loc->page_version;
+            bio->io.mode = OBJ_IO_READ;
+            bio->io.cb = read_cb;
+            bio->io.next = stack;
+            bio->batch = &batch;
+            bio->start = now_ns();
+            stack = &bio->io;
+        }
+        extstore_submit(e, stack);
+
+        pthread_mutex_lock(&batch.mutex);
+        while (batch.pending > 0)
+            pthread_cond_wait(&batch.cond, &batch.mutex);
+        pthread_mutex_unlock(&batch.mutex);
+        done += n;
+    }
+    elapsed = now_ns() - start;
+
+    qsort(batch.lat, batch.lat_count, sizeof(uint64_t), cmp_u64);
+    printf("%-8s threads: %u depth: %u reads/s: %.0f p50: %.1fus p99: %.1fus errors: %u\n",
+            use_uring ? "io_uring" : "pread", io_threads, io_depth,
+            (double)done * 1e9 / elapsed,
+            batch.lat[batch.lat_count / 2] / 1000.0,
+            batch.lat[(uint64_t)batch.lat_count * 99 / 100] / 1000.0,
+            batch.errors);
+
+    /* IO threads run forever; the engine is leaked on purpose, and idles
+     * while the next run uses a file of its own. */
+    free(batch.lat);
+    free(bufs);
+    free(ios);
+    free(locs);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    while ((c = getopt(argc, argv, "f:t:d:s:p:n:")) != -1) {
+        switch (c) {
+        case 'f':
+            fn = optarg;
+            break;
+        case 't':
+            io_threads = atoi(optarg);
+            break;
+        case 'd':
+            io_depth = atoi(optarg);
+            break;
+        case 's':
+            obj_size = atoi(optarg);
+            break;
+        case 'p':
+            page_count = atoi(optarg);
+            break;
+        case 'n':
+            read_count = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-f file] [-t io_threads] [-d io_depth] "
+                    "[-s obj_size] [-p pages] [-n reads]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (page_count < 4 || io_depth < 1 || io_threads < 1 || obj_size < 1 ||
+            read_count < 1) {
+        fprintf(stderr, "need at least 4 pages and nonzero sizes\n");
+        return 1;
+    }
+
+    run(fn, false);
+    unlink(fn);
+#ifdef HAVE_LIBURING
+    {
+        char ufn[PATH_MAX];
+        snprintf(ufn, sizeof(ufn), "%s.uring", fn);
+        run(ufn, true);
+        unlink(ufn);
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,343 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Compaction simulator for extstore.
+ *
+ * Replays a churning workload against a model of extstore's pages, without
+ * touching a disk: objects are written into the open page of a bucket,
+ * overwrites and deletes leave holes behind, and once free pages run low a
+ * page is compacted by rewriting its live objects into the compaction bucket.
+ * When no page is free the oldest one is evicted, as the maint thread does.
+ *
+ * The same workload is run with the old victim choice of storage.c (the
+ * oldest page under the fragmentation limit), with the emptiest page, and
+ * with extstore_compact_pick(). For each it prints write amplification
+ * (bytes written to flash per byte stored by clients), bytes read back by
+ * compaction per byte stored, and objects lost to evictions.
+ *
+ *   ./extstore_compact_sim [-p pages] [-P page_kb] [-k keys] [-n writes]
+ *                          [-h hot_pct] [-d delete_pct] [-s seed]
+ */
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "extstore.h"
+
+#define BUCKET_DEFAULT 0
+#define BUCKET_COMPACT 1
+#define MAX_FRAG 0.8
+
+enum policy {
+    POLICY_OLDEST = 0,
+    POLICY_EMPTIEST,
+    POLICY_PICK,
+    POLICY_COUNT
+};
+
+static const char *policy_names[POLICY_COUNT] = {
+    "oldest", "emptiest", "pick"
+};
+
+struct sim_obj {
+    unsigned int page; /* 0 if not stored */
+    unsigned int size;
+    uint64_t seq;
+};
+
+/* what was written into a page, in order. entries go stale on overwrite */
+struct sim_entry {
+    unsigned int key;
+    uint64_t seq;
+};
+
+struct sim_page {
+    struct sim_entry *entries;
+    unsigned int nentries;
+    unsigned int allocated;
+    bool used;
+};
+
+struct sim {
+    struct extstore_stats st;
+    struct sim_page *pages;
+    struct sim_obj *objs;
+    unsigned int open[2]; /* open page per bucket, 0 if none */
+    uint64_t seq;
+    uint64_t version;
+    uint64_t bytes_stored;
+    uint64_t bytes_written;
+    uint64_t bytes_compact_read;
+    uint64_t objects_evicted;
+    uint64_t pages_compacted;
+    enum policy policy;
+};
+
+static unsigned int page_count = 64;
+static unsigned int page_size = 1024 * 1024;
+static unsigned int key_count = 10000;
+static uint64_t write_count = 2000000;
+static unsigned int hot_pct = 90;
+static unsigned int delete_pct = 10;
+static unsigned int seed = 1;
+
+static void page_free(struct sim *s, unsigned int id) {
+    struct sim_page *p = &s->pages[id];
+    free(p->entries);
+    memset(p, 0, sizeof(*p));
+    memset(&s->st.page_data[id], 0, sizeof(struct extstore_page_data));
+    if (s->open[BUCKET_DEFAULT] == id)
+        s->open[BUCKET_DEFAULT] = 0;
+    if (s->open[BUCKET_COMPACT] == id)
+        s->open[BUCKET_COMPACT] = 0;
+    s->st.pages_free++;
+}
+
+static void obj_drop(struct sim *s, unsigned int key) {
+    struct sim_obj *o = &s->objs[key];
+    struct extstore_page_data *pd;
+    if (o->page == 0)
+        return;
+    pd = &s->st.page_data[o->page];
+    pd->bytes_used -= o->size;
+    pd->obj_count--;
+    o->page = 0;
+}
+
+/* Like the maint thread, evicts the oldest full page. */
+static void evict(struct sim *s) {
+    struct sim_page *p;
+    uint64_t low = ULLONG_MAX;
+    unsigned int i, id = 0;
+    for (i = 1; i < page_count; i++) {
+        struct extstore_page_data *pd = &s->st.page_data[i];
+        if (pd->version != 0 && !pd->active && pd->version < low) {
+            low = pd->version;
+            id = i;
+        }
+    }
+    if (id == 0)
+        return;
+    p = &s->pages[id];
+    for (i = 0; i < p->nentries; i++) {
+        struct sim_obj *o = &s->objs[p->entries[i].key];
+        if (o->page == id && o->seq == p->entries[i].seq) {
+            obj_drop(s, p->entries[i].key);
+            s->objects_evicted++;
+        }
+    }
+    page_free(s, id);
+}
+
+static unsigned int page_alloc(struct sim *s, unsigned int bucket) {
+    struct extstore_page_data *pd;
+    unsigned int i;
+    if (s->st.pages_free == 0)
+        evict(s);
+    // page 0 is never used, as in extstore
+    for (i = 1; i < page_count; i++) {
+        if (!s->pages[i].used)
+            break;
+    }
+    if (i == page_count)
+        abort();
+    s->st.pages_free--;
+    s->pages[i].used = true;
+    pd = &s->st.page_data[i];
+    pd->version = ++s->version;
+    pd->bucket = bucket;
+    pd->active = true;
+    s->open[bucket] = i;
+    return i;
+}
+
+static void obj_write(struct sim *s, unsigned int bucket, unsigned int key,
+        unsigned int size) {
+    struct sim_obj *o = &s->objs[key];
+    struct sim_page *p;
+    struct extstore_page_data *pd;
+    unsigned int id = s->open[bucket];
+
+    if (id == 0 || s->pages[id].allocated + size > page_size) {
+        if (id != 0)
+            s->st.page_data[id].active = false;
+        id = page_alloc(s, bucket);
+    }
+    p = &s->pages[id];
+    pd = &s->st.page_data[id];
+    if (p->nentries % 64 == 0) {
+        p->entries = realloc(p->entries,
+                sizeof(struct sim_entry) * (p->nentries + 64));
+    }
+    o->page = id;
+    o->size = size;
+    o->seq = ++s->seq;
+    p->entries[p->nentries].key = key;
+    p->entries[p->nentries].seq = o->seq;
+    p->nentries++;
+    p->allocated += size;
+    pd->bytes_used += size;
+    pd->obj_count++;
+    s->bytes_written += size;
+}
+
+static int pick_victim(struct sim *s) {
+    struct extstore_page_data *pd = s->st.page_data;
+    double rate = (1.0 - (double)s->st.pages_free / page_count) * MAX_FRAG;
+    uint64_t frag_limit = page_size * rate;
+    uint64_t best = ULLONG_MAX;
+    int x, pick = -1;
+
+    if (s->policy == POLICY_PICK)
+        return extstore_compact_pick(&s->st, frag_limit, 0);
+
+    for (x = 0; x < page_count; x++) {
+        uint64_t v;
+        if (pd[x].version == 0 || pd[x].active || pd[x].obj_count == 0 ||
+                pd[x].bytes_used >= frag_limit)
+            continue;
+        v = s->policy == POLICY_OLDEST ? pd[x].version : pd[x].bytes_used;
+        if (v < best) {
+            best = v;
+            pick = x;
+        }
+    }
+    return pick;
+}
+
+static void compact(struct sim *s, unsigned int id) {
+    struct sim_page *p = &s->pages[id];
+    struct sim_entry *entries = p->entries;
+    unsigned int n = p->nentries, i;
+
+    // the compactor reads back the whole page
+    s->bytes_compact_read += page_size;
+    s->pages_compacted++;
+    // take the page out of circulation before its survivors go elsewhere
+    p->entries = NULL;
+    p->nentries = 0;
+    s->st.page_data[id].version = 0;
+    for (i = 0; i < n; i++) {
+        struct sim_obj *o = &s->objs[entries[i].key];
+        if (o->page == id && o->seq == entries[i].seq) {
+            unsigned int size = o->size;
+            o->page = 0;
+            obj_write(s, BUCKET_COMPACT, entries[i].key, size);
+        }
+    }
+    free(entries);
+    page_free(s, id);
+}
+
+static unsigned int next_key(void) {
+    unsigned int hot = key_count / 10 ? key_count / 10 : 1;
+    if ((unsigned int)(random() % 100) < hot_pct)
+        return random() % hot;
+    return hot + random() % (key_count - hot);
+}
+
+/* Object sizes between 1 and 16KB, skewed small. */
+static unsigned int next_size(void) {
+    unsigned int r = random() % 100;
+    if (r < 60)
+        return 1024 + random() % 2048;
+    if (r < 90)
+        return 3072 + random() % 5120;
+    return 8192 + random() % 8192;
+}
+
+static void run(enum policy policy) {
+    struct sim s;
+    uint64_t i;
+    unsigned int compact_under = page_count / 4;
+    unsigned int x;
+
+    memset(&s, 0, sizeof(s));
+    s.policy = policy;
+    s.st.page_count = page_count;
+    s.st.page_size = page_size;
+    s.st.pages_free = page_count - 1;
+    s.st.page_data = calloc(page_count, sizeof(struct extstore_page_data));
+    s.pages = calloc(page_count, sizeof(struct sim_page));
+    s.objs = calloc(key_count, sizeof(struct sim_obj));
+
+    srandom(seed);
+    for (i = 0; i < write_count; i++) {
+        unsigned int key = next_key();
+        if ((unsigned int)(random() % 100) < delete_pct) {
+            obj_drop(&s, key);
+            continue;
+        }
+        unsigned int size = next_size();
+        obj_drop(&s, key);
+        obj_write(&s, BUCKET_DEFAULT, key, size);
+        s.bytes_stored += size;
+
+        if (s.st.pages_free <= compact_under) {
+            int victim = pick_victim(&s);
+            if (victim > 0)
+                compact(&s, victim);
+        }
+    }
+
+    printf("%-8s write amp: %.3f compact read/stored: %.3f "
+            "pages compacted: %llu evicted objects: %llu\n",
+            policy_names[policy],
+            (double)s.bytes_written / s.bytes_stored,
+            (double)s.bytes_compact_read / s.bytes_stored,
+            (unsigned long long)s.pages_compacted,
+            (unsigned long long)s.objects_evicted);
+
+    for (x = 0; x < page_count; x++)
+        free(s.pages[x].entries);
+    free(s.pages);
+    free(s.objs);
+    free(s.st.page_data);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    enum policy policy;
+    while ((c = getopt(argc, argv, "p:P:k:n:h:d:s:")) != -1) {
+        switch (c) {
+        case 'p':
+            page_count = atoi(optarg);
+            break;
+        case 'P':
+            page_size = atoi(optarg) * 1024;
+            break;
+        case 'k':
+            key_count = atoi(optarg);
+            break;
+        case 'n':
+            write_count = strtoull(optarg, NULL, 10);
+            break;
+        case 'h':
+            hot_pct = atoi(optarg);
+            break;
+        case 'd':
+            delete_pct = atoi(optarg);
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p pages] [-P page_kb] [-k keys] "
+                    "[-n writes] [-h hot_pct] [-d delete_pct] [-s seed]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (page_count < 8 || page_size < 64 * 1024 || key_count < 10 ||
+            hot_pct > 100 || delete_pct > 100) {
+        fprintf(stderr, "need at least 8 pages of 64KB and 10 keys\n");
+        return 1;
+    }
+
+    for (policy = 0; policy < POLICY_COUNT; policy++)
+        run(policy);
+    return 0;
+}
@@ -0,0 +1,272 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Hot key tracker ("stats hotkeys").
+ *
+ * Workers sample one in settings.hotkey_sample_rate gets and sets, picked
+ * at random intervals so regular request patterns can't hide a key. A
+ * sample bumps the key in the worker's count-min sketch, and if its
+ * estimate beats the smallest entry of the worker's top-K min-heap the key
+ * takes that place. The sketch and heap sit behind a per-worker mutex that
+ * only the logger thread ever contends for.
+ *
+ * Once per window the logger thread adds all worker sketches together,
+ * re-estimates every worker's candidates against the sum, keeps the K
+ * largest and starts the workers on a new window. Memory is fixed (about
+ * 20KB per worker) and unsampled requests only decrement a counter.
+ */
+#include "memcached.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define HOTKEYS_DEPTH 4
+#define HOTKEYS_WIDTH 1024 /* power of two */
+#define HOTKEYS_TOPK 16
+#define HOTKEYS_WINDOW_MS 1000
+
+struct hotkey {
+    uint32_t hv;
+    uint32_t count; /* sketch estimate, in samples */
+    uint8_t nkey;
+    char key[KEY_MAX_LENGTH];
+};
+
+struct hotkeys_local {
+    pthread_mutex_t lock;
+    uint32_t rnd; /* xorshift state for the sampling intervals */
+    uint64_t samples;
+    uint32_t sketch[HOTKEYS_DEPTH][HOTKEYS_WIDTH];
+    int ntop;
+    struct hotkey top[HOTKEYS_TOPK]; /* min-heap on count */
+};
+
+static pthread_mutex_t hotkeys_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hotkeys_local **hotkeys_list = NULL;
+static int hotkeys_count = 0;
+
+/* results of the last window, under hotkeys_result_lock */
+static pthread_mutex_t hotkeys_result_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hotkey hotkeys_result[HOTKEYS_TOPK];
+static int hotkeys_result_count = 0;
+static uint64_t hotkeys_result_samples = 0;
+static uint64_t hotkeys_result_ms = 0;
+
+/* Next gap between samples: uniform in [1, 2 * rate - 1], mean rate. */
+static unsigned int hotkeys_next_gap(struct hotkeys_local *hk) {
+    uint32_t x = hk->rnd;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    hk->rnd = x;
+    return 1 + x % (2 * settings.hotkey_sample_rate - 1);
+}
+
+void *hotkeys_create(void) {
+    struct hotkeys_local *hk;
+    struct hotkeys_local **list;
+    struct timeval tv;
+
+    if (settings.hotkey_sample_rate == 0)
+        return NULL;
+    hk = calloc(1, sizeof(struct hotkeys_local));
+    if (hk == NULL)
+        return NULL;
+    pthread_mutex_init(&hk->lock, NULL);
+    gettimeofday(&tv, NULL);
+    hk->rnd = (uint32_t)(tv.tv_usec ^ (uintptr_t)hk) | 1;
+
+    pthread_mutex_lock(&hotkeys_list_lock);
+    list = realloc(hotkeys_list, sizeof(struct hotkeys_local *) * (hotkeys_count + 1));
+    if (list == NULL) {
+        pthread_mutex_unlock(&hotkeys_list_lock);
+        free(hk);
+        return NULL;
+    }
+    hotkeys_list = list;
+    hotkeys_list[hotkeys_count++] = hk;
+    pthread_mutex_unlock(&hotkeys_list_lock);
+    return hk;
+}
+
+/* Bucket of hv in a sketch row: double hashing off one key hash. */
+static inline unsigned int sketch_index(uint32_t hv, int row) {
+    uint32_t h2 = hv * 0x85ebca6b;
+    h2 ^= h2 >> 13;
+    return (hv + row * (h2 | 1)) & (HOTKEYS_WIDTH - 1);
+}
+
+static uint32_t sketch_estimate(uint32_t sketch[HOTKEYS_DEPTH][HOTKEYS_WIDTH], uint32_t hv) {
+    uint32_t est = UINT32_MAX;
+    int row;
+    for (row = 0; row < HOTKEYS_DEPTH; row++) {
+        uint32_t v = sketch[row][sketch_index(hv, row)];
+        if (v < est)
+            est = v;
+    }
+    return est;
+}
+
+static void heap_swap(struct hotkey *heap, int a, int b) {
+    struct hotkey tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+}
+
+static void heap_down(struct hotkey *heap, int n, int i) {
+    for (;;) {
+        int l = i * 2 + 1, r = l + 1, min = i;
+        if (l < n && heap[l].count < heap[min].count)
+            min = l;
+        if (r < n && heap[r].count < heap[min].count)
+            min = r;
+        if (min == i)
+            return;
+        heap_swap(heap, i, min);
+        i = min;
+    }
+}
+
+static void heap_up(struct hotkey *heap, int i) {
+    while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+        heap_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/* Puts key into the top-K heap if it belongs there, or updates its count. */
+static void topk_offer(struct hotkey *heap, int *n, uint32_t hv,
+        const char *key, const size_t nkey, uint32_t count) {
+    int i;
+
+    for (i = 0; i < *n; i++) {
+        if (heap[i].hv == hv && heap[i].nkey == nkey
+                && memcmp(heap[i].key, key, nkey) == 0) {
+            if (count > heap[i].count) {
+                heap[i].count = count;
+                heap_down(heap, *n, i);
+            }
+            return;
+        }
+    }
+
+    if (*n < HOTKEYS_TOPK) {
+        i = (*n)++;
+    } else if (count > heap[0].count) {
+        i = 0;
+    } else {
+        return;
+    }
+    heap[i].hv = hv;
+    heap[i].count = count;
+    heap[i].nkey = nkey;
+    memcpy(heap[i].key, key, nkey);
+    if (i == 0)
+        heap_down(heap, *n, 0);
+    else
+        heap_up(heap, i);
+}
+
+void hotkeys_record(LIBEVENT_THREAD *t, const char *key, const size_t nkey) {
+    struct hotkeys_local *hk = t->hotkeys;
+    uint32_t hv = hash(key, nkey);
+    int row;
+
+    pthread_mutex_lock(&hk->lock);
+    t->hotkeys_countdown = hotkeys_next_gap(hk);
+    for (row = 0; row < HOTKEYS_DEPTH; row++) {
+        hk->sketch[row][sketch_index(hv, row)]++;
+    }
+    hk->samples++;
+    topk_offer(hk->top, &hk->ntop, hv, key, nkey, sketch_estimate(hk->sketch, hv));
+    pthread_mutex_unlock(&hk->lock);
+}
+
+static int hotkey_cmp(const void *a, const void *b) {
+    const struct hotkey *x = a, *y = b;
+    return x->count > y->count ? -1 : x->count < y->count;
+}
+
+void hotkeys_merge(void) {
+    static uint32_t sum[HOTKEYS_DEPTH][HOTKEYS_WIDTH];
+    static struct timeval last = {0, 0};
+    struct hotkey *cand = NULL;
+    struct hotkey top[HOTKEYS_TOPK];
+    int ncand = 0, ntop = 0;
+    uint64_t samples = 0, ms;
+    struct timeval now;
+    int i, row, col;
+
+    gettimeofday(&now, NULL);
+    if (last.tv_sec == 0) {
+        last = now;
+        return;
+    }
+    ms = (now.tv_sec - last.tv_sec) * 1000 + (now.tv_usec - last.tv_usec) / 1000;
+    if (ms < HOTKEYS_WINDOW_MS)
+        return;
+    last = now;
+
+    memset(sum, 0, sizeof(sum));
+    pthread_mutex_lock(&hotkeys_list_lock);
+    if (hotkeys_count > 0)
+        cand = malloc(sizeof(struct hotkey) * HOTKEYS_TOPK * hotkeys_count);
+    for (i = 0; cand != NULL && i < hotkeys_count; i++) {
+        struct hotkeys_local *hk = hotkeys_list[i];
+        pthread_mutex_lock(&hk->lock);
+        for (row = 0; row < HOTKEYS_DEPTH; row++) {
+            for (col = 0; col < HOTKEYS_WIDTH; col++) {
+                sum[row][col] += hk->sketch[row][col];
+            }
+        }
+        memcpy(cand + ncand, hk->top, sizeof(struct hotkey) * hk->ntop);
+        ncand += hk->ntop;
+        samples += hk->samples;
+
+        memset(hk->sketch, 0, sizeof(hk->sketch));
+        hk->ntop = 0;
+        hk->samples = 0;
+        pthread_mutex_unlock(&hk->lock);
+    }
+    pthread_mutex_unlock(&hotkeys_list_lock);
+
+    for (i = 0; i < ncand; i++) {
+        topk_offer(top, &ntop, cand[i].hv, cand[i].key, cand[i].nkey,
+                sketch_estimate(sum, cand[i].hv));
+    }
+    free(cand);
+    qsort(top, ntop, sizeof(struct hotkey), hotkey_cmp);
+
+    pthread_mutex_lock(&hotkeys_result_lock);
+    memcpy(hotkeys_result, top, sizeof(struct hotkey) * ntop);
+    hotkeys_result_count = ntop;
+    hotkeys_result_samples = samples;
+    hotkeys_result_ms = ms;
+    pthread_mutex_unlock(&hotkeys_result_lock);
+}
+
+void hotkeys_stats(ADD_STAT add_stats, conn *c) {
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    char kbuf[KEY_MAX_LENGTH + 1];
+    int klen = 0, vlen = 0;
+    uint64_t rate = settings.hotkey_sample_rate;
+    int i;
+
+    pthread_mutex_lock(&hotkeys_result_lock);
+    APPEND_STAT("sample_rate", "%llu", (unsigned long long)rate);
+    APPEND_STAT("window_ms", "%llu", (unsigned long long)hotkeys_result_ms);
+    APPEND_STAT("window_requests", "%llu",
+            (unsigned long long)(hotkeys_result_samples * rate));
+    for (i = 0; i < hotkeys_result_count; i++) {
+        struct hotkey *hk = &hotkeys_result[i];
+        /* keys can be longer than STAT_VAL_LEN */
+        memcpy(kbuf, hk->key, hk->nkey);
+        kbuf[hk->nkey] = '\0';
+        klen = snprintf(key_str, STAT_KEY_LEN, "%d:key", i + 1);
+        add_stats(key_str, klen, kbuf, hk->nkey, c);
+        APPEND_NUM_STAT(i + 1, "requests", "%llu",
+                (unsigned long long)hk->count * rate);
+    }
+    pthread_mutex_unlock(&hotkeys_result_lock);
+}
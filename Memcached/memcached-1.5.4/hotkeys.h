@@ -0,0 +1,18 @@
+/* hot key tracker, see hotkeys.c */
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+/** Allocates a worker's sketch and top-K list. Call from the worker. */
+void *hotkeys_create(void);
+
+/** Counts a sampled get or set of key in the calling worker's sketch. */
+void hotkeys_record(LIBEVENT_THREAD *t, const char *key, const size_t nkey);
+
+/** Called by the logger thread: once per window, folds every worker's
+    sketch and top-K into the result shown by "stats hotkeys". */
+void hotkeys_merge(void);
+
+/** "stats hotkeys" */
+void hotkeys_stats(ADD_STAT add_stats, conn *c);
+
+#endif
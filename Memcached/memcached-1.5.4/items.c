@@ -112,14 +112,21 @@ static uint64_t lru_total_bumps_dropped(void);
 /* Get the next CAS id for a new item. */
 /* TODO: refactor some atomics for this. */
 // cas id
+static uint64_t cas_id = 0; //全局静态变量
 uint64_t get_cas_id(void) {
-  static uint64_t cas_id = 0; //全局静态变量
   pthread_mutex_lock(&cas_id_lock);
   uint64_t next_id = ++cas_id;
   pthread_mutex_unlock(&cas_id_lock);
   return next_id;
 }
 
+/* Restartable cache: continue from the CAS ids of the previous run. */
+void set_cas_id(uint64_t new_cas) {
+  pthread_mutex_lock(&cas_id_lock);
+  cas_id = new_cas;
+  pthread_mutex_unlock(&cas_id_lock);
+}
+
 // 比较当前 item 的时间与 flush 清理缓存命令的时间
 int item_is_flushed(item *it) {
   rel_time_t oldest_live = settings.oldest_live;
@@ -506,6 +513,21 @@ int do_item_link(item *it, const uint32_t hv) {
   return 1;
 }
 
+/* Links an item found in a reused memory file (see restart.c) back into the
+ * hash table and its LRU. Unlike do_item_link() the item keeps its CAS and
+ * access time, and already holds the reference for being linked. Only
+ * called during startup, before connections are accepted. */
+void do_item_link_restored(item *it) {
+  STATS_LOCK();
+  stats_state.curr_bytes += ITEM_ntotal(it);
+  stats_state.curr_items += 1;
+  STATS_UNLOCK();
+
+  assoc_insert(it, hash(ITEM_key(it), it->nkey));
+  item_link_q(it);
+  item_stats_sizes_add(it);
+}
+
 // 将item 从哈希表和LRU 链表中删除
 void do_item_unlink(item *it, const uint32_t hv) {
   MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
@@ -1108,6 +1130,46 @@ item *do_item_get(const char *key, const size_t nkey, const uint32_t hv,
   return it;
 }
 
+#ifdef HAVE_LOCKFREE_READS
+/* Lock-free front end to do_item_get() for worker threads.
+ * Answers plain hits and misses straight from the optimistic hash lookup.
+ * Anything that would modify the item (lazy expiry, flush, fetch/active
+ * markers, LRU bumps) or print verbose output is left to do_item_get(): we
+ * return false and the caller repeats the lookup under the item lock. */
+bool item_get_lockfree(const char *key, const size_t nkey, const uint32_t hv,
+                       conn *c, const bool do_update, item **itp) {
+  item *it;
+  bool slow = false;
+
+  if (settings.verbose > 2 || !assoc_find_lockfree(key, nkey, hv, &it))
+    return false;
+
+  if (it != NULL) {
+    if (item_is_flushed(it) ||
+        (it->exptime != 0 && it->exptime <= current_time)) {
+      slow = true;
+    } else if (do_update) {
+      if (settings.lru_segmented) {
+        slow = (it->it_flags & ITEM_ACTIVE) == 0;
+      } else {
+        slow = (it->it_flags & ITEM_FETCHED) == 0 ||
+               it->time < current_time - ITEM_UPDATE_INTERVAL;
+      }
+    }
+    if (slow) {
+      item_remove(it);
+      return false;
+    }
+    DEBUG_REFCNT(it, '+');
+  }
+
+  LOGGER_LOG(c->thread->l, LOG_FETCHERS, LOGGER_ITEM_GET, NULL, it ? 1 : 0,
+             key, nkey, (it) ? ITEM_clsid(it) : 0);
+  *itp = it;
+  return true;
+}
+#endif
+
 // 将该item 重新更新
 item *do_item_touch(const char *key, size_t nkey, uint32_t exptime,
                     const uint32_t hv, conn *c) {
@@ -536,6 +536,7 @@ static void *logger_thread(void *arg) {
                 to_sleep = MIN_LOGGER_SLEEP;
         }
         logger_thread_sum_stats(&ls);
+        hotkeys_merge();
     }
 
     return NULL;
@@ -14,6 +14,7 @@
  *      Brad Fitzpatrick <brad@danga.com>
  */
 #include "memcached.h"
+#include "restart.h"
 #include <ctype.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -52,6 +53,16 @@
 #include <getopt.h>
 #endif
 
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define USE_ZEROCOPY 1
+#define ZEROCOPY_FLAG MSG_ZEROCOPY
+#else
+#define ZEROCOPY_FLAG 0
+#endif
+
 /* FreeBSD 4.x doesn't have IOV_MAX exposed. */
 #ifndef IOV_MAX
 #if defined(__FreeBSD__) || defined(__APPLE__) || defined(__GNU__)
@@ -104,6 +115,7 @@ static void write_and_free(conn* c, char* buf, int bytes);
 static int ensure_iov_space(conn* c);
 static int add_iov(conn* c, const void* buf, int len);
 static int add_chunked_item_iovs(conn* c, item* it, int len);
+static int add_item_value_iovs(conn* c, item* it, int len);
 static int add_msghdr(conn* c);
 static void write_bin_error(conn* c, protocol_binary_response_status err,
     const char* errstr, int swallow);
@@ -156,6 +168,39 @@ static void maxconns_handler(const int fd, const short which, void* arg)
     }
 }
 
+/* With -o reuseport the TCP listeners belong to the worker threads, so a
+ * worker that runs out of fds only stops its own listeners and polls on its
+ * own event base until a connection is closed somewhere.
+ */
+static void listen_retry_handler(const int fd, const short which, void* arg)
+{
+    LIBEVENT_THREAD* me = arg;
+    struct timeval t = { .tv_sec = 0, .tv_usec = 10000 };
+    conn* next;
+
+    if (fd == -42 || allow_new_conns == false) {
+        evtimer_set(&me->listen_retry_event, listen_retry_handler, me);
+        event_base_set(me->base, &me->listen_retry_event);
+        evtimer_add(&me->listen_retry_event, &t);
+    } else {
+        for (next = me->listen_conns; next; next = next->next)
+            update_event(next, EV_READ | EV_PERSIST);
+    }
+}
+
+static void thread_accept_pause(LIBEVENT_THREAD* me)
+{
+    conn* next;
+
+    for (next = me->listen_conns; next; next = next->next)
+        update_event(next, 0);
+    STATS_LOCK();
+    stats.listen_disabled_num++;
+    STATS_UNLOCK();
+    allow_new_conns = false;
+    listen_retry_handler(-42, 0, me);
+}
+
 #define REALTIME_MAXDELTA 60 * 60 * 24 * 30
 
 /*
@@ -221,6 +266,7 @@ static void settings_init(void)
     settings.udpport = 11211; // 监听udp端口
     /* By default this string should be NULL for getaddrinfo() */
     settings.inter = NULL; // 绑定的IP地址,如果该值为NULL，那么就是INADDR_ANY
+    settings.memory_file = NULL;
     settings.maxbytes = 64 * 1024 * 1024; /* default is 64MB */ // 最大使用的内存
     settings.maxconns = 1024; /* to limit connections-related memory to about 5MB */ // 最大允许客户端在线
     settings.verbose = 0; // 运行信息的输出级别，值越大，输出越详细
@@ -268,6 +314,12 @@ static void settings_init(void)
     settings.logger_watcher_buf_size = LOGGER_WATCHER_BUF_SIZE;
     settings.logger_buf_size = LOGGER_BUF_SIZE;
     settings.drop_privileges = true;
+    settings.lockfree_reads = false;
+    settings.slab_magazine_size = 0;
+    settings.reuseport = false;
+    settings.get_prefetch = true;
+    settings.zerocopy_threshold = 0;
+    settings.hotkey_sample_rate = 100;
 #ifdef MEMCACHED_DEBUG
     settings.relaxed_privileges = false;
 #endif
@@ -577,6 +629,16 @@ conn* conn_new(const int sfd, enum conn_states init_state,
         }
     }
 
+    c->zerocopy = false;
+#ifdef USE_ZEROCOPY
+    if (settings.zerocopy_threshold && transport == tcp_transport
+        && init_state == conn_new_cmd) {
+        int one = 1;
+        /* older kernels don't know the option; such sockets just copy */
+        c->zerocopy = setsockopt(sfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
+#endif
+
     if (settings.verbose > 1) {
         if (init_state == conn_listening) {
             fprintf(stderr, "<%d server listening (%s)\n", sfd,
@@ -600,6 +662,11 @@ conn* conn_new(const int sfd, enum conn_states init_state,
     c->state = init_state;
     c->rlbytes = 0;
     c->cmd = -1;
+    c->bin_prefetched = 0;
+    c->latency_cmd = LATENCY_NONE;
+    c->zc_used = false;
+    c->zc_done = 0;
+    c->zc_next = 0;
     c->rbytes = c->wbytes = 0;
     c->wcurr = c->wbuf;
     c->rcurr = c->rbuf;
@@ -669,10 +736,270 @@ static void conn_release_items(conn* c)
     c->suffixcurr = c->suffixlist;
 }
 
+#ifdef USE_ZEROCOPY
+/* Items of a response sent with MSG_ZEROCOPY. The kernel numbers the
+ * zerocopy sends on a socket from 0 and reports ranges of them complete on
+ * the socket's error queue, normally but not necessarily in order. */
+struct zc_batch {
+    struct zc_batch* next;
+    uint32_t first; /* ids of the response's zerocopy sends */
+    uint32_t last;
+    uint32_t done; /* how many of them are complete */
+    int nitems;
+    item* items[];
+};
+
+/* Called when a response is fully written: its items move to a batch that
+ * is released once the kernel no longer reads from them. */
+static void conn_zerocopy_hold(conn* c)
+{
+    struct zc_batch* b;
+    int n = c->ileft + (c->item ? 1 : 0);
+
+    assert(c->zc_used);
+    c->zc_used = false;
+    if (n == 0)
+        return;
+
+    b = malloc(sizeof(struct zc_batch) + sizeof(item*) * n);
+    if (b == NULL) {
+        /* conn_release_items() lets go of them early */
+        STATS_LOCK();
+        stats.malloc_fails++;
+        STATS_UNLOCK();
+        return;
+    }
+    b->next = NULL;
+    b->first = c->zc_first;
+    b->last = c->zc_next - 1;
+    b->done = c->zc_done;
+    b->nitems = 0;
+    if (c->item) {
+        b->items[b->nitems++] = c->item;
+        c->item = 0;
+    }
+    for (; c->ileft > 0; c->ileft--, c->icurr++) {
+        b->items[b->nitems++] = *(c->icurr);
+    }
+
+    if (c->zc_tail)
+        c->zc_tail->next = b;
+    else
+        c->zc_head = b;
+    c->zc_tail = b;
+}
+
+/* Counts the part of [lo, hi] that falls into [first, last]. */
+static uint32_t zerocopy_overlap(uint32_t first, uint32_t last, uint32_t lo, uint32_t hi)
+{
+    int32_t s = (int32_t)(lo - first);
+    int32_t e = (int32_t)(hi - first);
+    int32_t n = (int32_t)(last - first);
+
+    if (s < 0)
+        s = 0;
+    if (e > n)
+        e = n;
+    return e >= s ? e - s + 1 : 0;
+}
+
+static void zerocopy_batch_free(struct zc_batch* b)
+{
+    int i;
+    for (i = 0; i < b->nitems; i++) {
+        item_remove(b->items[i]);
+    }
+    free(b);
+}
+
+/* Reads the completion notifications off sfd's error queue into the
+ * batches from head on, and into the response c is writing if c isn't NULL.
+ * Returns how many of the sends the kernel copied anyway. */
+static uint64_t zerocopy_read_completions(int sfd, struct zc_batch* head, conn* c)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    struct cmsghdr* cm;
+    struct zc_batch* b;
+    uint64_t copied = 0;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sfd, &msg, MSG_ERRQUEUE) == -1)
+            break;
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err* serr;
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* [ee_info, ee_data] completed */
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                copied += serr->ee_data - serr->ee_info + 1;
+            for (b = head; b != NULL; b = b->next) {
+                b->done += zerocopy_overlap(b->first, b->last, serr->ee_info, serr->ee_data);
+            }
+            if (c != NULL && c->zc_used) {
+                c->zc_done += zerocopy_overlap(c->zc_first, c->zc_next - 1,
+                    serr->ee_info, serr->ee_data);
+            }
+        }
+    }
+    return copied;
+}
+
+/* Frees the complete batches at the front of the list. */
+static void zerocopy_free_done(struct zc_batch** head)
+{
+    struct zc_batch* b;
+
+    while ((b = *head) != NULL && b->done == b->last - b->first + 1) {
+        *head = b->next;
+        zerocopy_batch_free(b);
+    }
+}
+
+static void zerocopy_count_copied(LIBEVENT_THREAD* t, uint64_t copied)
+{
+    if (copied) {
+        pthread_mutex_lock(&t->stats.mutex);
+        t->stats.zerocopy_copied += copied;
+        pthread_mutex_unlock(&t->stats.mutex);
+    }
+}
+
+/* Drains the completion notifications from the socket's error queue. Run
+ * from event_handler(): pending notifications make the socket report an
+ * error (EV_READ|EV_WRITE) until read. */
+static void conn_zerocopy_reap(conn* c)
+{
+    uint64_t copied = zerocopy_read_completions(c->sfd, c->zc_head, c);
+
+    zerocopy_free_done(&c->zc_head);
+    if (c->zc_head == NULL)
+        c->zc_tail = NULL;
+    zerocopy_count_copied(c->thread, copied);
+}
+
+/* Gives up on the peer: a reset drops what is still queued on the socket,
+ * so the kernel stops sending from the items. */
+static void zerocopy_abort_close(int sfd)
+{
+    struct linger ling = { 1, 0 };
+
+    setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void*)&ling, sizeof(ling));
+    close(sfd);
+}
+
+/* A closed connection whose socket is kept open, with the items of its
+ * zerocopy sends, until the kernel is done with them. */
+struct zc_drain {
+    struct event timer;
+    int sfd;
+    int ticks;
+    LIBEVENT_THREAD* thread;
+    struct zc_batch* head;
+};
+
+#define ZEROCOPY_DRAIN_USEC 10000
+/* about 10s: after that the peer gets a reset */
+#define ZEROCOPY_DRAIN_TICKS 1000
+
+static void zerocopy_drain_handler(const int fd, const short which, void* arg)
+{
+    struct zc_drain* d = arg;
+    struct timeval t = { .tv_sec = 0, .tv_usec = ZEROCOPY_DRAIN_USEC };
+    struct zc_batch* b;
+
+    zerocopy_count_copied(d->thread, zerocopy_read_completions(d->sfd, d->head, NULL));
+    zerocopy_free_done(&d->head);
+    if (d->head != NULL && ++d->ticks < ZEROCOPY_DRAIN_TICKS) {
+        evtimer_set(&d->timer, zerocopy_drain_handler, d);
+        event_base_set(d->thread->base, &d->timer);
+        evtimer_add(&d->timer, &t);
+        return;
+    }
+
+    if (d->head != NULL)
+        zerocopy_abort_close(d->sfd);
+    else
+        close(d->sfd);
+    while ((b = d->head) != NULL) {
+        d->head = b->next;
+        zerocopy_batch_free(b);
+    }
+    free(d);
+}
+
+/* Closes the socket of a connection with zerocopy sends in flight. After
+ * close() the kernel goes on sending the queued data, retransmits too,
+ * from the items, but the completions can no longer be read: so the
+ * socket stays open, with the items, until they are in. The FIN goes out
+ * now, the socket is only kept for its error queue.
+ */
+static void conn_zerocopy_park(conn* c)
+{
+    struct zc_drain* d;
+
+    if (c->zc_used) {
+        conn_zerocopy_hold(c);
+        if (c->item != NULL || c->ileft > 0) {
+            /* no batch for them: conn_cleanup() lets go of the items */
+            zerocopy_abort_close(c->sfd);
+            return;
+        }
+    }
+    conn_zerocopy_reap(c);
+    if (c->zc_head == NULL) {
+        close(c->sfd);
+        return;
+    }
+
+    d = malloc(sizeof(struct zc_drain));
+    if (d == NULL) {
+        STATS_LOCK();
+        stats.malloc_fails++;
+        STATS_UNLOCK();
+        zerocopy_abort_close(c->sfd);
+        return;
+    }
+    shutdown(c->sfd, SHUT_WR);
+    d->sfd = c->sfd;
+    d->ticks = 0;
+    d->thread = c->thread;
+    d->head = c->zc_head;
+    c->zc_head = c->zc_tail = NULL;
+    zerocopy_drain_handler(-1, 0, d);
+}
+
+/* Lets go of the items of zerocopy sends right away: only for sockets that
+ * never made any, or that were reset. */
+static void conn_zerocopy_release(conn* c)
+{
+    struct zc_batch* b;
+
+    while ((b = c->zc_head) != NULL) {
+        c->zc_head = b->next;
+        zerocopy_batch_free(b);
+    }
+    c->zc_tail = NULL;
+    c->zc_used = false;
+}
+#endif
+
 static void conn_cleanup(conn* c)
 {
     assert(c != NULL);
 
+#ifdef USE_ZEROCOPY
+    conn_zerocopy_release(c);
+#endif
     conn_release_items(c);
 
     if (c->write_and_free) {
@@ -722,6 +1049,8 @@ void conn_free(conn* c)
 
 static void conn_close(conn* c)
 {
+    bool closed = false;
+
     assert(c != NULL);
 
     /* delete the event, the socket and the conn */
@@ -730,11 +1059,19 @@ static void conn_close(conn* c)
     if (settings.verbose > 1)
         fprintf(stderr, "<%d connection closed.\n", c->sfd);
 
+#ifdef USE_ZEROCOPY
+    /* before conn_cleanup() lets go of the items the kernel sends from */
+    if (c->zc_head != NULL || c->zc_used) {
+        conn_zerocopy_park(c);
+        closed = true;
+    }
+#endif
     conn_cleanup(c);
 
     MEMCACHED_CONN_RELEASE(c->sfd);
     conn_set_state(c, conn_closed);
-    close(c->sfd);
+    if (!closed)
+        close(c->sfd);
 
     pthread_mutex_lock(&conn_lock);
     allow_new_conns = true;
@@ -831,11 +1168,48 @@ static const char* state_text(enum conn_states state)
  * processing that needs to happen on certain state transitions can
  * happen here.
  */
+/* Times the current command for "stats latency". It is recorded when the
+ * connection is ready for the next command, see conn_set_state(). */
+static inline void conn_latency_start(conn* c, enum latency_cmd cmd)
+{
+    c->latency_cmd = cmd;
+    c->latency_start = latency_now();
+}
+
+static void conn_latency_record(conn* c)
+{
+    uint64_t ns = latency_now() - c->latency_start;
+    struct latency_hist* h = &c->thread->latency[c->latency_cmd];
+    unsigned int b = latency_bucket(ns);
+
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+    h->buckets[b]++;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+    c->latency_cmd = LATENCY_NONE;
+}
+
+/* Feeds about one in settings.hotkey_sample_rate gets and sets to the hot
+ * key tracker; everything else costs a decrement. */
+static inline void conn_hotkey_sample(conn* c, const char* key, const size_t nkey)
+{
+    if (c->thread->hotkeys != NULL && --c->thread->hotkeys_countdown == 0) {
+        hotkeys_record(c->thread, key, nkey);
+    }
+}
+
 static void conn_set_state(conn* c, enum conn_states state)
 {
     assert(c != NULL);
     assert(state >= conn_listening && state < conn_max_state);
 
+    if (state == conn_new_cmd && c->latency_cmd != LATENCY_NONE) {
+        conn_latency_record(c);
+    }
+
     if (state != c->state) {
         if (settings.verbose > 2) {
             fprintf(stderr, "%d: going from %s to %s\n",
@@ -972,6 +1346,44 @@ static int add_chunked_item_iovs(conn* c, item* it, int len)
     return 0;
 }
 
+/* Values too small for MSG_ZEROCOPY to pay off are copied with the rest
+ * of the response. */
+static inline bool zerocopy_value(conn* c, int len)
+{
+    return c->zerocopy && len >= (int)settings.zerocopy_threshold;
+}
+
+/* Adds len bytes of an item's value. A value sent zerocopy gets a msghdr
+ * of its own, so that only item memory is pinned by the kernel: headers
+ * built in connection buffers are reused before the send completes.
+ */
+static int add_item_value_iovs(conn* c, item* it, int len)
+{
+    bool zc = zerocopy_value(c, len);
+    int first;
+
+    if (zc && c->msglist[c->msgused - 1].msg_iovlen > 0 && add_msghdr(c) != 0)
+        return -1;
+    first = c->msgused - 1;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0) {
+        if (add_iov(c, ITEM_data(it), len) != 0)
+            return -1;
+    } else if (add_chunked_item_iovs(c, it, len) != 0) {
+        return -1;
+    }
+
+    if (zc) {
+        /* msg_flags is ignored by sendmsg(); transmit() reads it back. A
+         * long chunked value may have spilled into more msghdrs. */
+        for (; first < c->msgused; first++) {
+            c->msglist[first].msg_flags = ZEROCOPY_FLAG;
+        }
+        return add_msghdr(c);
+    }
+    return 0;
+}
+
 /*
  * Constructs a set of UDP headers and attaches them to the outgoing messages.
  */
@@ -1086,6 +1498,8 @@ static void complete_nread_ascii(conn* c)
 {
     assert(c != NULL);
 
+    conn_latency_start(c, LATENCY_SET);
+
     item* it = c->item;
     int comm = c->cmd;
     enum store_item_type ret;
@@ -1334,6 +1748,8 @@ static void complete_incr_bin(conn* c)
     char tmpbuf[INCR_MAX_STORAGE_LEN];
     uint64_t cas = 0;
 
+    conn_latency_start(c, LATENCY_INCR);
+
     protocol_binary_response_incr* rsp = (protocol_binary_response_incr*)c->wbuf;
     protocol_binary_request_incr* req = binary_get_request(c);
 
@@ -1431,6 +1847,7 @@ static void complete_update_bin(conn* c)
     enum store_item_type ret = NOT_STORED;
     assert(c != NULL);
 
+    conn_latency_start(c, LATENCY_SET);
     item* it = c->item;
 
     pthread_mutex_lock(&c->thread->stats.mutex);
@@ -1509,6 +1926,56 @@ static void complete_update_bin(conn* c)
     c->item = 0;
 }
 
+/* Keys per multiget batch. ASCII gets tokenize the rest of the line this many
+ * keys at a time after the first few keys from process_command(); binary
+ * GETQ runs look this many requests ahead. Each batch is hashed and
+ * prefetched before any of its keys is looked up. */
+#define GET_BATCH_KEYS 64
+
+/*
+ * Binary multigets arrive as a run of GETQ/GETKQ requests, usually many of
+ * them in one read. When starting on such a run, look ahead in the input
+ * buffer and prefetch the buckets of the next GET_BATCH_KEYS keys, so they
+ * are warm by the time each request is dispatched.
+ */
+static void process_bin_getq_prefetch(conn* c)
+{
+    protocol_binary_request_header req;
+    uint32_t hvs[GET_BATCH_KEYS];
+    char* p = c->rcurr;
+    int left = c->rbytes;
+    int n = 0;
+
+    if (c->bin_prefetched > 0) {
+        c->bin_prefetched--;
+        return;
+    }
+
+    while (n < GET_BATCH_KEYS && left >= (int)sizeof(req)) {
+        uint32_t bodylen;
+        uint16_t keylen;
+
+        /* the buffer isn't aligned for the next header */
+        memcpy(&req, p, sizeof(req));
+        if (req.request.magic != PROTOCOL_BINARY_REQ || (req.request.opcode != PROTOCOL_BINARY_CMD_GETQ && req.request.opcode != PROTOCOL_BINARY_CMD_GETKQ)) {
+            break;
+        }
+        bodylen = ntohl(req.request.bodylen);
+        keylen = ntohs(req.request.keylen);
+        if (bodylen > (uint32_t)(left - sizeof(req)) || req.request.extlen + keylen > bodylen) {
+            break;
+        }
+        hvs[n++] = hash(p + sizeof(req) + req.request.extlen, keylen);
+        p += sizeof(req) + bodylen;
+        left -= sizeof(req) + bodylen;
+    }
+
+    if (n > 0) {
+        item_prefetch(hvs, n, c);
+    }
+    c->bin_prefetched = n;
+}
+
 static void process_bin_get_or_touch(conn* c)
 {
     item* it;
@@ -1520,6 +1987,8 @@ static void process_bin_get_or_touch(conn* c)
     int should_return_key = (c->cmd == PROTOCOL_BINARY_CMD_GETK || c->cmd == PROTOCOL_BINARY_CMD_GATK);
     int should_return_value = (c->cmd != PROTOCOL_BINARY_CMD_TOUCH);
 
+    conn_latency_start(c, LATENCY_GET);
+
     if (settings.verbose > 1) {
         fprintf(stderr, "<%d %s ", c->sfd, should_touch ? "TOUCH" : "GET");
         if (fwrite(key, 1, nkey, stderr)) {
@@ -1533,6 +2002,9 @@ static void process_bin_get_or_touch(conn* c)
 
         it = item_touch(key, nkey, realtime(exptime), c);
     } else {
+        if (settings.get_prefetch && (c->cmd == PROTOCOL_BINARY_CMD_GETQ || c->cmd == PROTOCOL_BINARY_CMD_GETKQ)) {
+            process_bin_getq_prefetch(c);
+        }
         it = item_get(key, nkey, c, DO_UPDATE);
     }
 
@@ -1585,11 +2057,7 @@ static void process_bin_get_or_touch(conn* c)
 
         if (should_return_value) {
             /* Add the data minus the CRLF */
-            if ((it->it_flags & ITEM_CHUNKED) == 0) {
-                add_iov(c, ITEM_data(it), it->nbytes - 2);
-            } else {
-                add_chunked_item_iovs(c, it, it->nbytes - 2);
-            }
+            add_item_value_iovs(c, it, it->nbytes - 2);
         }
 
         conn_set_state(c, conn_mwrite);
@@ -1634,6 +2102,7 @@ static void process_bin_get_or_touch(conn* c)
     if (settings.detail_enabled) {
         stats_prefix_record_get(key, nkey, NULL != it);
     }
+    conn_hotkey_sample(c, key, nkey);
 }
 
 static void append_bin_stats(const char* key, const uint16_t klen,
@@ -2097,6 +2566,11 @@ static void dispatch_bin_command(conn* c)
     uint16_t keylen = c->binary_header.request.keylen;
     uint32_t bodylen = c->binary_header.request.bodylen;
 
+    if (c->cmd != PROTOCOL_BINARY_CMD_GETQ && c->cmd != PROTOCOL_BINARY_CMD_GETKQ) {
+        /* a GETQ run ended, see process_bin_getq_prefetch() */
+        c->bin_prefetched = 0;
+    }
+
     if (keylen > bodylen || keylen + extlen > bodylen) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND, NULL, 0);
         c->write_and_go = conn_closing;
@@ -2321,6 +2795,7 @@ static void process_bin_update(conn* c)
     if (settings.detail_enabled) {
         stats_prefix_record_set(key, nkey);
     }
+    conn_hotkey_sample(c, key, nkey);
 
     it = item_alloc(key, nkey, req->message.body.flags,
         realtime(req->message.body.expiration), vlen + 2);
@@ -2403,6 +2878,7 @@ static void process_bin_append_prepend(conn* c)
     if (settings.detail_enabled) {
         stats_prefix_record_set(key, nkey);
     }
+    conn_hotkey_sample(c, key, nkey);
 
     it = item_alloc(key, nkey, 0, 0, vlen + 2);
 
@@ -2479,6 +2955,8 @@ static void process_bin_delete(conn* c)
 {
     item* it;
 
+    conn_latency_start(c, LATENCY_DELETE);
+
     protocol_binary_request_delete* req = binary_get_request(c);
 
     char* key = binary_get_key(c);
@@ -3024,6 +3502,10 @@ static void server_stats(ADD_STAT add_stats, conn* c)
     }
     APPEND_STAT("bytes_read", "%llu", (unsigned long long)thread_stats.bytes_read);
     APPEND_STAT("bytes_written", "%llu", (unsigned long long)thread_stats.bytes_written);
+    if (settings.zerocopy_threshold) {
+        APPEND_STAT("zerocopy_sends", "%llu", (unsigned long long)thread_stats.zerocopy_sends);
+        APPEND_STAT("zerocopy_copied", "%llu", (unsigned long long)thread_stats.zerocopy_copied);
+    }
     APPEND_STAT("limit_maxbytes", "%llu", (unsigned long long)settings.maxbytes);
     APPEND_STAT("accepting_conns", "%u", stats_state.accepting_conns);
     APPEND_STAT("listen_disabled_num", "%llu", (unsigned long long)stats.listen_disabled_num);
@@ -3100,6 +3582,7 @@ static void process_stat_settings(ADD_STAT add_stats, void* c)
     APPEND_STAT("tail_repair_time", "%d", settings.tail_repair_time);
     APPEND_STAT("flush_enabled", "%s", settings.flush_enabled ? "yes" : "no");
     APPEND_STAT("dump_enabled", "%s", settings.dump_enabled ? "yes" : "no");
+    APPEND_STAT("memory_file", "%s", settings.memory_file ? settings.memory_file : "");
     APPEND_STAT("hash_algorithm", "%s", settings.hash_algorithm);
     APPEND_STAT("lru_maintainer_thread", "%s", settings.lru_maintainer_thread ? "yes" : "no");
     APPEND_STAT("lru_segmented", "%s", settings.lru_segmented ? "yes" : "no");
@@ -3113,6 +3596,12 @@ static void process_stat_settings(ADD_STAT add_stats, void* c)
     APPEND_STAT("watcher_logbuf_size", "%u", settings.logger_watcher_buf_size);
     APPEND_STAT("worker_logbuf_size", "%u", settings.logger_buf_size);
     APPEND_STAT("track_sizes", "%s", item_stats_sizes_status() ? "yes" : "no");
+    APPEND_STAT("lockfree_reads", "%s", settings.lockfree_reads ? "yes" : "no");
+    APPEND_STAT("slab_magazine_size", "%u", settings.slab_magazine_size);
+    APPEND_STAT("reuseport", "%s", settings.reuseport ? "yes" : "no");
+    APPEND_STAT("get_prefetch", "%s", settings.get_prefetch ? "yes" : "no");
+    APPEND_STAT("zerocopy_threshold", "%u", settings.zerocopy_threshold);
+    APPEND_STAT("hotkey_sample_rate", "%u", settings.hotkey_sample_rate);
     APPEND_STAT("inline_ascii_response", "%s", settings.inline_ascii_response ? "yes" : "no");
 }
 
@@ -3280,6 +3769,16 @@ static void process_stat(conn* c, token_t* tokens, const size_t ntokens)
         return;
     } else if (strcmp(subcommand, "conns") == 0) {
         process_stats_conns(&append_stats, c);
+    } else if (strcmp(subcommand, "threads") == 0) {
+        threadlocal_stats_threads(&append_stats, c);
+    } else if (strcmp(subcommand, "latency") == 0) {
+        latency_stats(&append_stats, c);
+    } else if (strcmp(subcommand, "hotkeys") == 0) {
+        if (settings.hotkey_sample_rate == 0) {
+            out_string(c, "CLIENT_ERROR hot key tracking disabled");
+            return;
+        }
+        hotkeys_stats(&append_stats, c);
     } else {
         /* getting here means that the subcommand is either engine specific or
            is invalid. query the engine and see. */
@@ -3336,13 +3835,13 @@ static inline int make_ascii_get_suffix(char* suffix, item* it, bool return_cas,
 }
 
 #define IT_REFCOUNT_LIMIT 60000
-static inline item* limited_get(char* key, size_t nkey, conn* c, uint32_t exptime, bool should_touch)
+static inline item* limited_get(char* key, size_t nkey, uint32_t hv, conn* c, uint32_t exptime, bool should_touch)
 {
     item* it;
     if (should_touch) {
-        it = item_touch(key, nkey, exptime, c);
+        it = item_touch_hv(key, nkey, hv, exptime, c);
     } else {
-        it = item_get(key, nkey, c, DO_UPDATE);
+        it = item_get_hv(key, nkey, hv, c, DO_UPDATE);
     }
     if (it && it->refcount > IT_REFCOUNT_LIMIT) {
         item_remove(it);
@@ -3406,13 +3905,18 @@ static inline void process_get_command(conn* c, token_t* tokens, size_t ntokens,
     size_t nkey;
     int i = 0;
     int si = 0;
+    int k, nbatch;
     item* it;
     token_t* key_token = &tokens[KEY_TOKEN];
+    token_t batch_tokens[GET_BATCH_KEYS + 1];
+    uint32_t hvs[GET_BATCH_KEYS];
     char* suffix;
     int32_t exptime_int = 0;
     rel_time_t exptime = 0;
     assert(c != NULL);
 
+    conn_latency_start(c, LATENCY_GET);
+
     if (should_touch) {
         // For get and touch commands, use first token as exptime
         if (!safe_strtol(tokens[1].value, &exptime_int)) {
@@ -3424,6 +3928,14 @@ static inline void process_get_command(conn* c, token_t* tokens, size_t ntokens,
     }
 
     do {
+        for (nbatch = 0; key_token[nbatch].length != 0; nbatch++) {
+            hvs[nbatch] = hash(key_token[nbatch].value, key_token[nbatch].length);
+        }
+        if (settings.get_prefetch && nbatch > 1) {
+            item_prefetch(hvs, nbatch, c);
+        }
+        k = 0;
+
         while (key_token->length != 0) {
 
             key = key_token->value;
@@ -3440,10 +3952,11 @@ static inline void process_get_command(conn* c, token_t* tokens, size_t ntokens,
                 return;
             }
 
-            it = limited_get(key, nkey, c, exptime, should_touch);
+            it = limited_get(key, nkey, hvs[k++], c, exptime, should_touch);
             if (settings.detail_enabled) {
                 stats_prefix_record_get(key, nkey, NULL != it);
             }
+            conn_hotkey_sample(c, key, nkey);
             if (it) {
                 if (_ascii_get_expand_ilist(c, i) != 0) {
                     item_remove(it);
@@ -3474,9 +3987,7 @@ static inline void process_get_command(conn* c, token_t* tokens, size_t ntokens,
                         item_remove(it);
                         break;
                     }
-                    if ((it->it_flags & ITEM_CHUNKED) == 0) {
-                        add_iov(c, ITEM_data(it), it->nbytes);
-                    } else if (add_chunked_item_iovs(c, it, it->nbytes) != 0) {
+                    if (add_item_value_iovs(c, it, it->nbytes) != 0) {
                         item_remove(it);
                         break;
                     }
@@ -3487,12 +3998,12 @@ static inline void process_get_command(conn* c, token_t* tokens, size_t ntokens,
                         item_remove(it);
                         break;
                     }
-                    if ((it->it_flags & ITEM_CHUNKED) == 0) {
+                    if ((it->it_flags & ITEM_CHUNKED) == 0 && !zerocopy_value(c, it->nbytes)) {
                         if (add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) != 0) {
                             item_remove(it);
                             break;
                         }
-                    } else if (add_iov(c, ITEM_suffix(it), it->nsuffix) != 0 || add_chunked_item_iovs(c, it, it->nbytes) != 0) {
+                    } else if (add_iov(c, ITEM_suffix(it), it->nsuffix) != 0 || add_item_value_iovs(c, it, it->nbytes) != 0) {
                         item_remove(it);
                         break;
                     }
@@ -3540,8 +4051,8 @@ static inline void process_get_command(conn* c, token_t* tokens, size_t ntokens,
          * of tokens.
          */
         if (key_token->value != NULL) {
-            ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
-            key_token = tokens;
+            ntokens = tokenize_command(key_token->value, batch_tokens, GET_BATCH_KEYS + 1);
+            key_token = batch_tokens;
         }
 
     } while (key_token->value != NULL);
@@ -3623,6 +4134,7 @@ static void process_update_command(conn* c, token_t* tokens, const size_t ntoken
     if (settings.detail_enabled) {
         stats_prefix_record_set(key, nkey);
     }
+    conn_hotkey_sample(c, key, nkey);
 
     it = item_alloc(key, nkey, flags, realtime(exptime), vlen);
 
@@ -3714,6 +4226,8 @@ static void process_arithmetic_command(conn* c, token_t* tokens, const size_t nt
 
     assert(c != NULL);
 
+    conn_latency_start(c, LATENCY_INCR);
+
     set_noreply_maybe(c, tokens, ntokens);
 
     if (tokens[KEY_TOKEN].length > KEY_MAX_LENGTH) {
@@ -3884,6 +4398,8 @@ static void process_delete_command(conn* c, token_t* tokens, const size_t ntoken
 
     assert(c != NULL);
 
+    conn_latency_start(c, LATENCY_DELETE);
+
     if (ntokens > 3) {
         bool hold_is_zero = strcmp(tokens[KEY_TOKEN + 1].value, "0") == 0;
         bool sets_noreply = set_noreply_maybe(c, tokens, ntokens);
@@ -4728,20 +5244,43 @@ static enum transmit_result transmit(conn* c)
 {
     assert(c != NULL);
 
-    if (c->msgcurr < c->msgused && c->msglist[c->msgcurr].msg_iovlen == 0) {
+    /* zerocopy values can leave an empty msghdr at the end */
+    while (c->msgcurr < c->msgused && c->msglist[c->msgcurr].msg_iovlen == 0) {
         /* Finished writing the current msg; advance to the next. */
         c->msgcurr++;
     }
     if (c->msgcurr < c->msgused) {
         ssize_t res;
         struct msghdr* m = &c->msglist[c->msgcurr];
+        int flags = m->msg_flags & ZEROCOPY_FLAG;
 
-        res = sendmsg(c->sfd, m, 0);
+        res = sendmsg(c->sfd, m, flags);
+        if (res == -1 && flags && errno == ENOBUFS) {
+            /* out of socket option memory for pinning pages: copy it */
+            m->msg_flags = 0;
+            flags = 0;
+            pthread_mutex_lock(&c->thread->stats.mutex);
+            c->thread->stats.zerocopy_copied++;
+            pthread_mutex_unlock(&c->thread->stats.mutex);
+            res = sendmsg(c->sfd, m, 0);
+        }
         if (res > 0) {
             pthread_mutex_lock(&c->thread->stats.mutex);
             c->thread->stats.bytes_written += res;
+            if (flags)
+                c->thread->stats.zerocopy_sends++;
             pthread_mutex_unlock(&c->thread->stats.mutex);
 
+            if (flags) {
+                /* the kernel gives every zerocopy send that took data an id */
+                if (!c->zc_used) {
+                    c->zc_used = true;
+                    c->zc_first = c->zc_next;
+                    c->zc_done = 0;
+                }
+                c->zc_next++;
+            }
+
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
             while (m->msg_iovlen > 0 && res >= m->msg_iov->iov_len) {
@@ -4916,7 +5455,11 @@ static void drive_machine(conn* c)
                 } else if (errno == EMFILE) {
                     if (settings.verbose > 0)
                         fprintf(stderr, "Too many open connections\n");
-                    accept_new_conns(false);
+                    if (settings.reuseport && IS_TCP(c->transport)) {
+                        thread_accept_pause(c->thread);
+                    } else {
+                        accept_new_conns(false);
+                    }
                     stop = true;
                 } else {
                     perror("accept()");
@@ -4939,6 +5482,20 @@ static void drive_machine(conn* c)
                 STATS_LOCK();
                 stats.rejected_conns++;
                 STATS_UNLOCK();
+            } else if (settings.reuseport && IS_TCP(c->transport)) {
+                /* the kernel already picked this worker; keep it here */
+                conn* nc = conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                    DATA_BUFFER_SIZE, c->transport, c->thread->base);
+                if (nc == NULL) {
+                    if (settings.verbose > 0)
+                        fprintf(stderr, "Can't listen for events on fd %d\n", sfd);
+                    close(sfd);
+                } else {
+                    nc->thread = c->thread;
+                    pthread_mutex_lock(&c->thread->stats.mutex);
+                    c->thread->stats.conn_accepts++;
+                    pthread_mutex_unlock(&c->thread->stats.mutex);
+                }
             } else {
                 // 当客户端用socket 连接上，则会调用分发逻辑函数
                 dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
@@ -5176,6 +5733,10 @@ static void drive_machine(conn* c)
             switch (transmit(c)) {
             case TRANSMIT_COMPLETE:
                 if (c->state == conn_mwrite) {
+#ifdef USE_ZEROCOPY
+                    if (c->zc_used)
+                        conn_zerocopy_hold(c);
+#endif
                     conn_release_items(c);
                     /* XXX:  I don't know why this wasn't the general case */
                     if (c->protocol == binary_prot) {
@@ -5252,6 +5813,11 @@ void event_handler(const int fd, const short which, void* arg)
         return;
     }
 
+#ifdef USE_ZEROCOPY
+    if (c->zc_head != NULL || c->zc_used)
+        conn_zerocopy_reap(c);
+#endif
+
     // 状态机
     drive_machine(c);
 
@@ -5314,6 +5880,77 @@ static void maximize_sndbuf(const int sfd)
         fprintf(stderr, "<%d send buffer was %d, now %d\n", sfd, old_size, last_good);
 }
 
+static void server_socket_tcp_opts(int sfd)
+{
+    struct linger ling = { 0, 0 };
+    int flags = 1;
+    int error;
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void*)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void*)&ling, sizeof(ling));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void*)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+}
+
+#ifdef SO_REUSEPORT
+/*
+ * -o reuseport: sfd is bound and listening with SO_REUSEPORT set. Open one
+ * more listener per remaining worker on the same address and give each
+ * worker its own, so the kernel spreads new connections over the workers
+ * and the main thread never accepts. The address is read back from sfd so
+ * that port 0 (-p -1) ends up on one port for all of them.
+ */
+static int server_socket_reuseport(int sfd, struct addrinfo* ai)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int flags = 1;
+    int tid;
+
+    if (getsockname(sfd, (struct sockaddr*)&addr, &addrlen) != 0) {
+        perror("getsockname()");
+        close(sfd);
+        return 1;
+    }
+    dispatch_conn_new_thread(0, sfd, conn_listening, EV_READ | EV_PERSIST, 1,
+        tcp_transport);
+
+    for (tid = 1; tid < settings.num_threads; tid++) {
+        int fd = new_socket(ai);
+        if (fd == -1) {
+            perror("socket()");
+            return 1;
+        }
+#ifdef IPV6_V6ONLY
+        if (ai->ai_family == AF_INET6)
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&flags, sizeof(flags));
+#endif
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void*)&flags, sizeof(flags));
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void*)&flags, sizeof(flags)) != 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            close(fd);
+            return 1;
+        }
+        server_socket_tcp_opts(fd);
+        if (bind(fd, (struct sockaddr*)&addr, addrlen) == -1 || listen(fd, settings.backlog) == -1) {
+            perror("bind()/listen() for reuseport listener");
+            close(fd);
+            return 1;
+        }
+        dispatch_conn_new_thread(tid, fd, conn_listening, EV_READ | EV_PERSIST, 1,
+            tcp_transport);
+    }
+    return 0;
+}
+#endif
+
 /******************************************************************
   * 函数功能:  创建一个socket，并绑定特定的端口号
   ******************************************************************/
@@ -5332,7 +5969,6 @@ static int server_socket(const char* interface,
     FILE* portnumber_file)
 {
     int sfd;
-    struct linger ling = { 0, 0 };
     struct addrinfo* ai;
     struct addrinfo* next;
     struct addrinfo hints = { .ai_flags = AI_PASSIVE,
@@ -5383,20 +6019,20 @@ static int server_socket(const char* interface,
 #endif
 
         setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void*)&flags, sizeof(flags));
+#ifdef SO_REUSEPORT
+        if (settings.reuseport && !IS_UDP(transport)) {
+            error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void*)&flags, sizeof(flags));
+            if (error != 0) {
+                perror("setsockopt(SO_REUSEPORT)");
+                close(sfd);
+                continue;
+            }
+        }
+#endif
         if (IS_UDP(transport)) {
             maximize_sndbuf(sfd);
         } else {
-            error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void*)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void*)&ling, sizeof(ling));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void*)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
+            server_socket_tcp_opts(sfd);
         }
 
         if (bind(sfd, next->ai_addr, next->ai_addrlen) == -1) {
@@ -5453,6 +6089,13 @@ static int server_socket(const char* interface,
                     EV_READ | EV_PERSIST,
                     UDP_READ_BUFFER_SIZE, transport);
             }
+#ifdef SO_REUSEPORT
+        } else if (settings.reuseport) {
+            if (server_socket_reuseport(sfd, next) != 0) {
+                freeaddrinfo(ai);
+                return 1;
+            }
+#endif
         } else {
             if (!(listen_conn_add = conn_new(sfd, conn_listening,
                       EV_READ | EV_PERSIST, 1,
@@ -5626,6 +6269,8 @@ static int server_socket_unix(const char* path, int access_mask)
  */
 volatile rel_time_t current_time;
 static struct event clockevent;
+/* set by sig_handler when the cache must be saved before exiting */
+static volatile sig_atomic_t stop_main_loop = 0;
 
 /* libevent uses a monotonic clock when available for event scheduling. Aside
  * from jitter, simply ticking our internal timer here is accurate enough.
@@ -5640,6 +6285,11 @@ static void clock_handler(const int fd, const short which, void* arg)
     static time_t monotonic_start;
 #endif
 
+    if (stop_main_loop) {
+        event_base_loopexit(main_base, NULL);
+        return;
+    }
+
     if (initialized) {
         /* only delete the event if it's actually there. */
         evtimer_del(&clockevent);
@@ -5721,6 +6371,8 @@ static void usage(void)
 #endif
     printf("-F, --disable-flush-all   disable flush_all command\n");
     printf("-X, --disable-dumping     disable stats cachedump and lru_crawler metadump\n");
+    printf("-e, --memory-file=<file>  keep item memory in a mmap'd file, reused across\n"
+           "                          graceful restarts (SIGTERM/SIGINT)\n");
     printf("-o, --extended            comma separated list of extended options\n"
            "                          most options have a 'no_' prefix to disable\n"
            "   - maxconns_fast:       immediately close new connections after limit\n"
@@ -5748,6 +6400,8 @@ static void usage(void)
            "                          (requires lru_maintainer)\n"
            "   - idle_timeout:        timeout for idle connections\n"
            "   - slab_chunk_max:      (EXPERIMENTAL) maximum slab size. use extreme care.\n"
+           "   - slab_magazine_size:  free chunks each worker caches per slab class,\n"
+           "                          so most sets skip the global slabs lock. (default: 0)\n"
            "   - watcher_logbuf_size: size in kilobytes of per-watcher write buffer.\n"
            "   - worker_logbuf_size:  size in kilobytes of per-worker-thread buffer\n"
            "                          read by background thread, then written to watchers.\n"
@@ -5756,6 +6410,21 @@ static void usage(void)
            "                           small perf hit in ASCII, no perf difference in\n"
            "                           binary protocol. speeds up all sets.\n"
            "   - no_hashexpand:       disables hash table expansion (dangerous)\n"
+#ifdef HAVE_LOCKFREE_READS
+           "   - lockfree_reads:      GETs read the hash table without taking item locks\n"
+#endif
+#ifdef SO_REUSEPORT
+           "   - reuseport:           each worker thread gets its own SO_REUSEPORT TCP\n"
+           "                          listener and accepts its own connections\n"
+#endif
+           "   - no_get_prefetch:     look up multiget keys one at a time instead of\n"
+           "                          prefetching their hash buckets in batches\n"
+#ifdef USE_ZEROCOPY
+           "   - zerocopy_threshold:  send values of at least this many bytes with\n"
+           "                          MSG_ZEROCOPY. (default: 0, disabled)\n"
+#endif
+           "   - hotkey_sample_rate:  sample 1 in this many gets and sets for\n"
+           "                          'stats hotkeys'. 0 disables. (default: 100)\n"
            "   - modern:              enables options which will be default in future.\n"
            "             currently: nothing\n"
            "   - no_modern:           uses defaults of previous major version (1.4.x)\n"
@@ -5894,6 +6563,12 @@ static void remove_pidfile(const char* pid_file)
 static void sig_handler(const int sig)
 {
     printf("Signal handled: %s.\n", strsignal(sig));
+    /* with a memory file, leave the main loop at the next clock tick so the
+     * slab arena can be saved. */
+    if (settings.memory_file != NULL && !stop_main_loop) {
+        stop_main_loop = 1;
+        return;
+    }
     exit(EXIT_SUCCESS);
 }
 
@@ -6088,6 +6763,12 @@ int main(int argc, char** argv)
         NO_LRU_CRAWLER,
         NO_LRU_MAINTAINER,
         NO_DROP_PRIVILEGES,
+        LOCKFREE_READS,
+        SLAB_MAGAZINE_SIZE,
+        REUSEPORT,
+        NO_GET_PREFETCH,
+        ZEROCOPY_THRESHOLD,
+        HOTKEY_SAMPLE_RATE,
 #ifdef MEMCACHED_DEBUG
         RELAXED_PRIVILEGES,
 #endif
@@ -6129,6 +6810,12 @@ int main(int argc, char** argv)
         [NO_LRU_CRAWLER] = "no_lru_crawler",
         [NO_LRU_MAINTAINER] = "no_lru_maintainer",
         [NO_DROP_PRIVILEGES] = "no_drop_privileges",
+        [LOCKFREE_READS] = "lockfree_reads",
+        [SLAB_MAGAZINE_SIZE] = "slab_magazine_size",
+        [REUSEPORT] = "reuseport",
+        [NO_GET_PREFETCH] = "no_get_prefetch",
+        [ZEROCOPY_THRESHOLD] = "zerocopy_threshold",
+        [HOTKEY_SAMPLE_RATE] = "hotkey_sample_rate",
 #ifdef MEMCACHED_DEBUG
         [RELAXED_PRIVILEGES] = "relaxed_privileges",
 #endif
@@ -6186,6 +6873,7 @@ int main(int argc, char** argv)
                       "S" /* Sasl ON */
                       "F" /* Disable flush_all */
                       "X" /* Disable dump commands */
+                      "e:" /* mmap'd memory file for a restartable cache */
                       "o:" /* Extended generic options */
         ;
 
@@ -6222,6 +6910,7 @@ int main(int argc, char** argv)
         { "enable-sasl", no_argument, 0, 'S' },
         { "disable-flush-all", no_argument, 0, 'F' },
         { "disable-dumping", no_argument, 0, 'X' },
+        { "memory-file", required_argument, 0, 'e' },
         { "extended", required_argument, 0, 'o' },
         { 0, 0, 0, 0 }
     };
@@ -6434,6 +7123,9 @@ int main(int argc, char** argv)
         case 'X':
             settings.dump_enabled = false;
             break;
+        case 'e':
+            settings.memory_file = strdup(optarg);
+            break;
         case 'o': /* It's sub-opts time! */
             subopts_orig = subopts = strdup(optarg); /* getsubopt() changes the original args */
 
@@ -6692,6 +7384,60 @@ int main(int argc, char** argv)
                 case NO_DROP_PRIVILEGES:
                     settings.drop_privileges = false;
                     break;
+                case LOCKFREE_READS:
+#ifdef HAVE_LOCKFREE_READS
+                    settings.lockfree_reads = true;
+#else
+                    fprintf(stderr, "lockfree_reads requires compiler atomics support\n");
+                    return 1;
+#endif
+                    break;
+                case SLAB_MAGAZINE_SIZE:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing slab_magazine_size argument\n");
+                        return 1;
+                    }
+                    if (!safe_strtoul(subopts_value, &settings.slab_magazine_size)) {
+                        fprintf(stderr, "slab_magazine_size must be a number\n");
+                        return 1;
+                    }
+                    break;
+                case REUSEPORT:
+#ifdef SO_REUSEPORT
+                    settings.reuseport = true;
+#else
+                    fprintf(stderr, "reuseport requires SO_REUSEPORT support\n");
+                    return 1;
+#endif
+                    break;
+                case NO_GET_PREFETCH:
+                    settings.get_prefetch = false;
+                    break;
+                case ZEROCOPY_THRESHOLD:
+#ifdef USE_ZEROCOPY
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing zerocopy_threshold argument\n");
+                        return 1;
+                    }
+                    if (!safe_strtoul(subopts_value, &settings.zerocopy_threshold)) {
+                        fprintf(stderr, "zerocopy_threshold must be a number\n");
+                        return 1;
+                    }
+#else
+                    fprintf(stderr, "zerocopy_threshold requires MSG_ZEROCOPY support\n");
+                    return 1;
+#endif
+                    break;
+                case HOTKEY_SAMPLE_RATE:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing hotkey_sample_rate argument\n");
+                        return 1;
+                    }
+                    if (!safe_strtoul(subopts_value, &settings.hotkey_sample_rate)) {
+                        fprintf(stderr, "hotkey_sample_rate must be a number\n");
+                        return 1;
+                    }
+                    break;
 #ifdef MEMCACHED_DEBUG
                 case RELAXED_PRIVILEGES:
                     settings.relaxed_privileges = true;
@@ -6876,14 +7622,23 @@ int main(int argc, char** argv)
     /* initialize main thread libevent instance */
     main_base = event_init(); // 初始化主线程libevent 实例
 
+    /* with a memory file the slab arena lives in it, and is reused if the
+     * last run shut down gracefully. */
+    void *mem_base = NULL;
+    bool restart_warm = false;
+    if (settings.memory_file != NULL) {
+        mem_base = restart_mmap(settings.memory_file, settings.maxbytes);
+        restart_warm = restart_meta_read(settings.memory_file);
+    }
+
     /* initialize other stuff */
     logger_init(); // 日志初始化
     stats_init(); // 统计初始化
     assoc_init(settings.hashpower_init); // 初始化哈希表，默认幂为0
     conn_init(); // 连接初始化
     // slab 初始化(内存分配)
-    slabs_init(settings.maxbytes, settings.factor, preallocate,
-        use_slab_sizes ? slab_sizes : NULL);
+    slabs_init(settings.maxbytes, settings.factor, preallocate && !restart_warm,
+        use_slab_sizes ? slab_sizes : NULL, mem_base);
 
     /*
      * ignore SIGPIPE signals; we can use errno == EPIPE if we
@@ -6898,6 +7653,11 @@ int main(int argc, char** argv)
     // 创建工作线程，默认创建4 个工作线程
     memcached_thread_init(settings.num_threads, NULL);
 
+    /* needs the LRU locks from memcached_thread_init() */
+    if (restart_warm && !restart_restore()) {
+        fprintf(stderr, "Slab classes changed; not reusing the memory file\n");
+    }
+
     // 创建哈希表的维护线程
     if (start_assoc_maint && start_assoc_maintenance_thread() == -1) {
         exit(EXIT_FAILURE);
@@ -7018,6 +7778,10 @@ int main(int argc, char** argv)
 
     stop_assoc_maintenance_thread();
 
+    if (settings.memory_file != NULL) {
+        restart_save();
+    }
+
     /* remove the PID file if we're a daemon */
     if (do_daemonize)
         remove_pidfile(pid_file);
@@ -74,6 +74,12 @@
  */
 #define ITEM_UPDATE_INTERVAL 60
 
+/* Optimistic lock-free GETs (-o lockfree_reads) need compiler atomics for the
+ * hash bucket version counters and for atomic item refcounts. */
+#if defined(HAVE_GCC_ATOMICS) && defined(__ATOMIC_ACQUIRE)
+#define HAVE_LOCKFREE_READS 1
+#endif
+
 /* unistd.h is here */
 #if HAVE_UNISTD_H
 #include <unistd.h>
@@ -275,7 +281,10 @@ struct slab_stats {
     X(conn_yields) /* # of yields for connections (-R option)*/ \
     X(auth_cmds)                                                \
     X(auth_errors)                                              \
-    X(idle_kicks) /* idle connections killed */
+    X(idle_kicks) /* idle connections killed */               \
+    X(conn_accepts) /* connections this thread took on */       \
+    X(zerocopy_sends) /* sendmsg calls made with MSG_ZEROCOPY */ \
+    X(zerocopy_copied) /* zerocopy sends the kernel copied anyway */
 
 /**
  * Stats stored per-thread.
@@ -289,6 +298,30 @@ struct thread_stats {
     uint64_t lru_hits[POWER_LARGEST];
 };
 
+/**
+ * Per-thread command latency histograms, see stats.c. Latencies are in
+ * nanoseconds; each power of two is split into 2^LATENCY_SUB_BITS buckets.
+ */
+#define LATENCY_SUB_BITS 3
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+enum latency_cmd {
+    LATENCY_GET,
+    LATENCY_SET,
+    LATENCY_DELETE,
+    LATENCY_INCR,
+    LATENCY_CMD_COUNT
+};
+/* the current command isn't timed */
+#define LATENCY_NONE LATENCY_CMD_COUNT
+
+struct latency_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+
 /**
  * Global stats. Only resettable stats should go into this structure.
  */
@@ -385,6 +418,7 @@ struct settings {
     int tail_repair_time; /* LRU tail refcount leak repair time */
     bool flush_enabled; /* flush_all enabled */
     bool dump_enabled; /* whether cachedump/metadump commands work */
+    char *memory_file; /* mmap'd slab arena, reused across restarts (-e) */
     char* hash_algorithm; /* Hash algorithm in use */
     int lru_crawler_sleep; /* Microsecond sleep between items */
     uint32_t lru_crawler_tocrawl; /* Number of items to crawl per run */
@@ -405,6 +439,12 @@ struct settings {
         drop_privileges; /* Whether or not to drop unnecessary process privileges
                         */
     bool relaxed_privileges; /* Relax process restrictions when running testapp */
+    bool lockfree_reads; /* GETs look up the hash table without item locks */
+    unsigned int slab_magazine_size; /* per-worker cached free chunks per class, 0 disables */
+    bool reuseport; /* one SO_REUSEPORT TCP listener per worker thread */
+    bool get_prefetch; /* multigets prefetch hash buckets a batch at a time */
+    unsigned int zerocopy_threshold; /* values this large are sent with MSG_ZEROCOPY, 0 disables */
+    unsigned int hotkey_sample_rate; /* 1 in N gets/sets feed stats hotkeys, 0 disables */
 };
 
 // 在 .h 文件中extern，在 .c 文件中包含这个.h 文件
@@ -516,6 +556,13 @@ typedef struct
     cache_t* suffix_cache; /* suffix cache */
     logger* l; /* logger buffer */
     void* lru_bump_buf; /* async LRU bump buffer */
+    uint64_t lockfree_epoch; /* nonzero while inside a lock-free lookup */
+    void* slab_magazine; /* per-worker slab chunk cache, see slabs.c */
+    struct conn* listen_conns; /* SO_REUSEPORT listeners owned by this thread */
+    struct event listen_retry_event; /* re-enables listen_conns after EMFILE */
+    struct latency_hist latency[LATENCY_CMD_COUNT]; /* under stats.mutex */
+    void* hotkeys; /* sampled hot key sketch, see hotkeys.c */
+    unsigned int hotkeys_countdown; /* requests until the next sample */
 } LIBEVENT_THREAD;
 // http://blog.chinaunix.net/uid-23381466-id-1630441.html
 /**
@@ -611,6 +658,19 @@ struct conn {
     short cmd; /* current command being processed */
     int opaque;
     int keylen;
+    int bin_prefetched; /* pipelined GETQs whose buckets were prefetched */
+    enum latency_cmd latency_cmd; /* histogram the current command goes to */
+    uint64_t latency_start; /* when it started, in ns */
+
+    /* MSG_ZEROCOPY: items sent this way stay referenced until the kernel
+     * reports the sends that carried them complete. */
+    bool zerocopy; /* SO_ZEROCOPY is on for this socket */
+    bool zc_used; /* the response being written made zerocopy sends */
+    uint32_t zc_first; /* kernel id of its first zerocopy send */
+    uint32_t zc_done; /* of its sends, how many the kernel already reported */
+    uint32_t zc_next; /* kernel id of the next zerocopy send */
+    struct zc_batch* zc_head; /* finished responses awaiting completion, oldest first */
+    struct zc_batch* zc_tail;
     conn* next; /* Used for generating a list of conn structures */
     LIBEVENT_THREAD
     *thread; /* Pointer to the thread object serving this connection */
@@ -665,6 +725,7 @@ extern int daemonize(int nochdir, int noclose);
 #include "assoc.h"
 #include "crawler.h"
 #include "hash.h"
+#include "hotkeys.h"
 #include "items.h"
 #include "slabs.h"
 #include "stats.h"
@@ -681,6 +742,8 @@ void memcached_thread_init(int nthreads, void* arg);
 void redispatch_conn(conn* c);
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
     int read_buffer_size, enum network_transport transport);
+void dispatch_conn_new_thread(int tid, int sfd, enum conn_states init_state,
+    int event_flags, int read_buffer_size, enum network_transport transport);
 void sidethread_conn_close(conn* c);
 
 /* Lock wrappers for cache functions that are called from main loop. */
@@ -697,7 +760,12 @@ item* item_alloc(char* key, size_t nkey, int flags, rel_time_t exptime,
 #define DONT_UPDATE false
 item* item_get(const char* key, const size_t nkey, conn* c,
     const bool do_update);
+item* item_get_hv(const char* key, const size_t nkey, const uint32_t hv,
+    conn* c, const bool do_update);
+void item_prefetch(const uint32_t* hvs, const int count, conn* c);
 item* item_touch(const char* key, const size_t nkey, uint32_t exptime, conn* c);
+item* item_touch_hv(const char* key, const size_t nkey, const uint32_t hv,
+    uint32_t exptime, conn* c);
 int item_link(item* it);
 void item_remove(item* it);
 int item_replace(item* it, item* new_it, const uint32_t hv);
@@ -708,12 +776,24 @@ void* item_trylock(uint32_t hv);
 void item_trylock_unlock(void* arg);
 void item_unlock(uint32_t hv);
 void pause_threads(enum pause_thread_types type);
+#ifdef HAVE_LOCKFREE_READS
+/* With lockfree_reads, worker threads take item references without holding
+ * the item lock, so every refcount update has to be atomic. */
+#define refcount_incr(it) (settings.lockfree_reads ? \
+    __sync_add_and_fetch(&(it)->refcount, 1) : ++(it->refcount))
+#define refcount_decr(it) (settings.lockfree_reads ? \
+    __sync_sub_and_fetch(&(it)->refcount, 1) : --(it->refcount))
+void lockfree_read_sync(void);
+#else
 #define refcount_incr(it) ++(it->refcount)
 #define refcount_decr(it) --(it->refcount)
+#endif
 void STATS_LOCK(void);
 void STATS_UNLOCK(void);
 void threadlocal_stats_reset(void);
 void threadlocal_stats_aggregate(struct thread_stats* stats);
+void threadlocal_stats_threads(ADD_STAT add_stats, void* c);
+void threadlocal_latency_aggregate(struct latency_hist* out);
 void slab_stats_aggregate(struct thread_stats* stats, struct slab_stats* out);
 
 /* Stat processing functions */
@@ -0,0 +1,357 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Restartable cache (-e <file>).
+ *
+ * The slab arena lives in a shared mapping of a file, normally on /dev/shm,
+ * instead of on the heap. A graceful shutdown (SIGINT, SIGTERM or the
+ * "shutdown" command) pauses every thread and writes <file>.meta: where the
+ * arena was mapped, the slab class layout, which class owned each page, the
+ * hash power and the clock, CAS and flush_all state.
+ *
+ * When started again with the same memory settings the file is mapped again
+ * and every page walked: pointers are moved to the new mapping, items that
+ * were linked go back into the hash table and into their LRU in last access
+ * order, and everything else goes on the slab freelists. Item times are
+ * shifted onto the new process clock, so downtime counts against exptimes.
+ *
+ * The .meta file is removed as soon as it has been read: after a crash the
+ * arena is never trusted and the cache starts empty.
+ */
+#include "memcached.h"
+#include "restart.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RESTART_META_VERSION 1
+#define RESTART_LAYOUT_LEN 4096
+
+static char *meta_file = NULL;
+static void *arena = NULL;
+static size_t arena_size = 0;
+
+/* What the last run left behind, see restart_save(). */
+static struct {
+    uintptr_t base;
+    char layout[RESTART_LAYOUT_LEN];
+    unsigned int npages;
+    uint8_t *page_map;
+    unsigned int hashpower;
+    rel_time_t current_time;
+    time_t wall_time;
+    rel_time_t oldest_live;
+    uint64_t oldest_cas;
+    uint64_t cas_id;
+} meta;
+
+/* restore state */
+static int64_t time_shift = 0; /* old relative time - new relative time */
+static rel_time_t restore_now = 0;
+static item **restored = NULL;
+static size_t restored_count = 0;
+static size_t restored_size = 0;
+static uint64_t restored_max_cas = 0;
+static uint64_t restored_dropped = 0;
+
+void *restart_mmap(const char *file, const size_t limit) {
+    struct stat st;
+    int fd;
+
+    meta_file = malloc(strlen(file) + sizeof(".meta"));
+    if (meta_file == NULL) {
+        fprintf(stderr, "Failed to allocate memory file name\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(meta_file, "%s.meta", file);
+
+    fd = open(file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open memory file %s: %s\n", file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size != limit && ftruncate(fd, limit) != 0)) {
+        fprintf(stderr, "Failed to size memory file %s: %s\n", file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    arena = mmap(NULL, limit, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (arena == MAP_FAILED) {
+        fprintf(stderr, "Failed to mmap memory file %s: %s\n", file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    arena_size = limit;
+    return arena;
+}
+
+static int hexval(const char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static bool meta_page_map(const char *hex) {
+    unsigned int i;
+    if (strlen(hex) != meta.npages * 2)
+        return false;
+    meta.page_map = malloc(meta.npages);
+    if (meta.page_map == NULL)
+        return false;
+    for (i = 0; i < meta.npages; i++) {
+        int hi = hexval(hex[i * 2]);
+        int lo = hexval(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        meta.page_map[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+bool restart_meta_read(const char *file) {
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    unsigned int version = 0;
+    uint64_t v;
+    bool ok = true;
+    bool got_layout = false, got_map = false;
+    FILE *f;
+    char fn[PATH_MAX];
+
+    snprintf(fn, sizeof(fn), "%s.meta", file);
+    f = fopen(fn, "r");
+    if (f == NULL)
+        return false;
+    /* One chance: whatever happens from here, the next start is cold unless
+     * this run shuts down cleanly again. */
+    unlink(fn);
+
+    while (ok && (read = getline(&line, &len, f)) != -1) {
+        char *val;
+        if (read > 0 && line[read - 1] == '\n')
+            line[read - 1] = '\0';
+        val = strchr(line, ' ');
+        if (val == NULL) {
+            ok = false;
+            break;
+        }
+        *val++ = '\0';
+
+        if (strcmp(line, "page_map") == 0) {
+            ok = meta_page_map(val);
+            got_map = true;
+            continue;
+        } else if (strcmp(line, "slab_layout") == 0) {
+            /* checked against the slab classes in restart_restore() */
+            ok = strlen(val) < sizeof(meta.layout);
+            if (ok)
+                strcpy(meta.layout, val);
+            got_layout = true;
+            continue;
+        }
+
+        if (!safe_strtoull(val, &v)) {
+            ok = false;
+        } else if (strcmp(line, "version") == 0) {
+            version = v;
+        } else if (strcmp(line, "mmap_base") == 0) {
+            meta.base = v;
+        } else if (strcmp(line, "mem_limit") == 0) {
+            ok = v == arena_size;
+        } else if (strcmp(line, "slab_page_size") == 0) {
+            ok = v == settings.slab_page_size;
+        } else if (strcmp(line, "pages") == 0) {
+            meta.npages = v;
+            ok = (size_t)meta.npages * settings.slab_page_size <= arena_size;
+        } else if (strcmp(line, "hashpower") == 0) {
+            meta.hashpower = v;
+        } else if (strcmp(line, "current_time") == 0) {
+            meta.current_time = v;
+        } else if (strcmp(line, "wall_time") == 0) {
+            meta.wall_time = v;
+        } else if (strcmp(line, "oldest_live") == 0) {
+            meta.oldest_live = v;
+        } else if (strcmp(line, "oldest_cas") == 0) {
+            meta.oldest_cas = v;
+        } else if (strcmp(line, "cas_id") == 0) {
+            meta.cas_id = v;
+        } else {
+            ok = false;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    if (!ok || version != RESTART_META_VERSION || !got_layout || !got_map
+            || meta.base == 0) {
+        fprintf(stderr, "memory file metadata doesn't match the current "
+                "settings; starting with an empty cache\n");
+        free(meta.page_map);
+        meta.page_map = NULL;
+        return false;
+    }
+
+    if (meta.hashpower > (unsigned int)settings.hashpower_init)
+        settings.hashpower_init = meta.hashpower;
+    return true;
+}
+
+/* Called by slabs_restore() for every item that was linked. Moves its times
+ * onto the new clock and drops it if it expired or was flushed meanwhile. */
+static bool restart_keep_item(item *it) {
+    int64_t t;
+
+    if (meta.oldest_live != 0 && meta.oldest_live <= meta.current_time &&
+            (it->time <= meta.oldest_live ||
+             (meta.oldest_cas != 0 && ITEM_get_cas(it) != 0 &&
+              ITEM_get_cas(it) < meta.oldest_cas))) {
+        restored_dropped++;
+        return false;
+    }
+    if (it->exptime != 0) {
+        t = (int64_t)it->exptime - time_shift;
+        if (t <= restore_now) {
+            restored_dropped++;
+            return false;
+        }
+        it->exptime = t;
+    }
+    t = (int64_t)it->time - time_shift;
+    it->time = t < 0 ? 0 : (t > restore_now ? restore_now : t);
+
+    if (restored_count == restored_size) {
+        size_t nsize = restored_size ? restored_size * 2 : 65536;
+        item **n = realloc(restored, nsize * sizeof(item *));
+        if (n == NULL) {
+            restored_dropped++;
+            return false;
+        }
+        restored = n;
+        restored_size = nsize;
+    }
+    restored[restored_count++] = it;
+    if (ITEM_get_cas(it) > restored_max_cas)
+        restored_max_cas = ITEM_get_cas(it);
+    return true;
+}
+
+static int cmp_item_time(const void *a, const void *b) {
+    rel_time_t x = (*(item * const *)a)->time;
+    rel_time_t y = (*(item * const *)b)->time;
+    return x < y ? -1 : x > y;
+}
+
+bool restart_restore(void) {
+    char layout[RESTART_LAYOUT_LEN];
+    time_t now = time(0);
+    size_t i;
+
+    slabs_layout(layout, sizeof(layout));
+    if (strcmp(layout, meta.layout) != 0) {
+        fprintf(stderr, "slab classes differ from the memory file's; "
+                "starting with an empty cache\n");
+        free(meta.page_map);
+        meta.page_map = NULL;
+        return false;
+    }
+
+    /* The relative clock restarts at the same offset from process_started as
+     * clock_handler() will give it. */
+    restore_now = (rel_time_t)(now - process_started);
+    time_shift = (int64_t)meta.current_time + (now - meta.wall_time) - restore_now;
+
+    slabs_restore(meta.page_map, meta.npages,
+            (intptr_t)arena - (intptr_t)meta.base, restart_keep_item);
+
+    /* Oldest first: every link becomes the new LRU head. */
+    qsort(restored, restored_count, sizeof(item *), cmp_item_time);
+    for (i = 0; i < restored_count; i++)
+        do_item_link_restored(restored[i]);
+
+    if (settings.use_cas)
+        set_cas_id(meta.cas_id > restored_max_cas ? meta.cas_id : restored_max_cas);
+
+    if (settings.verbose > 0) {
+        fprintf(stderr, "restored %llu items from memory file, dropped %llu\n",
+                (unsigned long long)restored_count,
+                (unsigned long long)restored_dropped);
+    }
+    free(restored);
+    restored = NULL;
+    free(meta.page_map);
+    meta.page_map = NULL;
+    return true;
+}
+
+void restart_save(void) {
+    char layout[RESTART_LAYOUT_LEN];
+    char tmp[PATH_MAX];
+    unsigned int npages = arena_size / settings.slab_page_size;
+    uint8_t *map = malloc(npages);
+    unsigned int i;
+    FILE *f;
+
+    if (map == NULL) {
+        fprintf(stderr, "Failed to allocate page map; memory file not saved\n");
+        return;
+    }
+
+    /* Workers, LRU maintainer, crawler and slab mover stop between requests
+     * or moves, so nothing is half linked while the arena is described. */
+    pause_threads(PAUSE_ALL_THREADS);
+
+    slabs_layout(layout, sizeof(layout));
+    slabs_page_map(map, npages);
+    /* trailing unused pages don't need to be described */
+    while (npages > 0 && map[npages - 1] == SLABS_PAGE_UNUSED)
+        npages--;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", meta_file);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to write %s: %s\n", tmp, strerror(errno));
+        free(map);
+        return;
+    }
+    fprintf(f, "version %d\n", RESTART_META_VERSION);
+    fprintf(f, "mmap_base %llu\n", (unsigned long long)(uintptr_t)arena);
+    fprintf(f, "mem_limit %llu\n", (unsigned long long)arena_size);
+    fprintf(f, "slab_page_size %d\n", settings.slab_page_size);
+    fprintf(f, "slab_layout %s\n", layout);
+    fprintf(f, "hashpower %u\n", hashpower);
+    fprintf(f, "current_time %u\n", current_time);
+    fprintf(f, "wall_time %llu\n", (unsigned long long)time(0));
+    fprintf(f, "oldest_live %u\n", settings.oldest_live);
+    fprintf(f, "oldest_cas %llu\n", (unsigned long long)settings.oldest_cas);
+    fprintf(f, "cas_id %llu\n", (unsigned long long)(settings.use_cas ? get_cas_id() : 0));
+    fprintf(f, "pages %u\n", npages);
+    fprintf(f, "page_map ");
+    for (i = 0; i < npages; i++)
+        fprintf(f, "%02x", map[i]);
+    fprintf(f, "\n");
+    free(map);
+
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", tmp, strerror(errno));
+        unlink(tmp);
+        return;
+    }
+    if (msync(arena, arena_size, MS_SYNC) != 0) {
+        perror("msync");
+        unlink(tmp);
+        return;
+    }
+    /* only a complete description may be found next time */
+    if (rename(tmp, meta_file) != 0) {
+        perror("rename");
+        unlink(tmp);
+    }
+}
@@ -0,0 +1,23 @@
+/* restartable cache: slab arena in a mmap'd file (-e) */
+#ifndef RESTART_H
+#define RESTART_H
+
+/** Maps (creating or resizing if needed) the memory file as the slab arena.
+    Exits on failure. */
+void *restart_mmap(const char *file, const size_t limit);
+
+/** Reads and removes <file>.meta left by the last graceful shutdown. Returns
+    true if it matches the current memory settings, so the arena can be
+    reused. Call after restart_mmap() and before assoc_init(); it may raise
+    settings.hashpower_init. */
+bool restart_meta_read(const char *file);
+
+/** After slabs_init(): puts the items of the reused arena back into the hash
+    table and the LRUs. Returns false, leaving the arena empty, if the slab
+    classes changed since the file was saved. */
+bool restart_restore(void);
+
+/** On graceful shutdown: pauses all threads and writes <file>.meta. */
+void restart_save(void);
+
+#endif
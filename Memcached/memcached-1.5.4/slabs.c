@@ -74,6 +74,51 @@ static size_t mem_avail = 0;
 static pthread_mutex_t slabs_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t slabs_rebalance_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* slabs_lock traffic from slabs_alloc()/slabs_free() and magazine refills and
+ * drains. Updated while holding slabs_lock. */
+static uint64_t slabs_lock_acquires = 0;
+static uint64_t slabs_lock_contended = 0;
+static uint64_t slabs_lock_wait_us = 0;
+
+/*
+ * Per-worker slab magazines (-o slab_magazine_size=N).
+ *
+ * Each worker thread keeps up to N free chunks per slab class. Allocations
+ * and frees hit the magazine under its own (normally uncontended) mutex and
+ * only take slabs_lock to refill or drain half a magazine at a time.
+ *
+ * Chunks sitting in a magazine have refcount 0 and neither ITEM_SLABBED nor
+ * ITEM_LINKED set, so the slab mover treats them as busy. When a page move
+ * starts, the source class is drained from every magazine and bypassed until
+ * the move finishes.
+ *
+ * mem_requested changes are kept per magazine and folded into the class on
+ * every refill or drain; stats add in the unfolded part.
+ *
+ * Lock order is magazine mutex -> slabs_lock.
+ */
+typedef struct {
+    void *slots;            /* free chunks, linked through ->next */
+    unsigned int count;
+    int64_t requested;      /* requested bytes not yet folded into the class */
+    uint64_t hits;          /* allocations served from the magazine */
+    uint64_t frees;         /* frees kept in the magazine */
+    uint64_t refills;
+    uint64_t drains;
+} slab_magazine_class;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    slab_magazine_class cls[MAX_NUMBER_OF_SLAB_CLASSES];
+} slab_magazine;
+
+static pthread_key_t slab_magazine_key;
+/* All magazines, for flushing and stats. Protected by slabs_lock. */
+static slab_magazine **magazines = NULL;
+static unsigned int magazine_count = 0;
+/* Source class of a running page move; magazines won't cache it. */
+static volatile unsigned int magazine_bypass_clsid = 0;
+
 /*
  * Forward Declarations 前置声明,静态函数限定本文件使用
  */
@@ -115,16 +160,21 @@ unsigned int slabs_clsid(const size_t size) {
 /******************************************************************
   * 函数功能:  slabs 初始化
   ******************************************************************/
-void slabs_init(const size_t limit, const double factor, const bool prealloc, const uint32_t *slab_sizes) {
+void slabs_init(const size_t limit, const double factor, const bool prealloc, const uint32_t *slab_sizes, void *mem_base_external) {
     int i = POWER_SMALLEST - 1;  // POWER_SMALLEST = 1
     
     //size 由两部分组成: item 结构体本身 和 这个item 对应的数据
     unsigned int size = sizeof(item) + settings.chunk_size; // chunk_size 默认为48
 
     mem_limit = limit;
-
-    // prealloc 默认为0，不为0 表示预分配一大块的内存
-    if (prealloc) {
+    pthread_key_create(&slab_magazine_key, NULL);
+
+    if (mem_base_external != NULL) {
+        /* -e: pages come from the memory file, see restart.c */
+        mem_base = mem_base_external;
+        mem_current = mem_base;
+        mem_avail = mem_limit;
+    } else if (prealloc) {  // prealloc 默认为0，不为0 表示预分配一大块的内存
         /* Allocate everything in a big chunk with malloc */
         mem_base = malloc(mem_limit);
         if (mem_base != NULL) {
@@ -258,7 +308,9 @@ static int do_slabs_newslab(const unsigned int id) {
     slabclass_t *g = &slabclass[SLAB_GLOBAL_PAGE_POOL];
 	
     // 求出slab class 里的slab size
-    int len = (settings.slab_reassign || settings.slab_chunk_size_max != settings.slab_page_size)
+    // (a memory file is described page by page, so it always uses full pages)
+    int len = (settings.slab_reassign || settings.slab_chunk_size_max != settings.slab_page_size
+            || settings.memory_file != NULL)
         ? settings.slab_page_size
         : p->size * p->perslab;
     char *ptr;
@@ -427,6 +479,187 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     return;
 }
 
+/* slabs_lock for the alloc/free paths; counts acquisitions and time spent
+ * waiting when the lock was already held. */
+static void slabs_lock_counted(void) {
+    if (pthread_mutex_trylock(&slabs_lock) != 0) {
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        pthread_mutex_lock(&slabs_lock);
+        gettimeofday(&end, NULL);
+        slabs_lock_contended++;
+        slabs_lock_wait_us += (end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_usec - start.tv_usec);
+    }
+    slabs_lock_acquires++;
+}
+
+void *slabs_magazine_create(void) {
+    slab_magazine *m;
+    slab_magazine **list;
+
+    if (settings.slab_magazine_size == 0)
+        return NULL;
+    m = calloc(1, sizeof(slab_magazine));
+    if (m == NULL)
+        return NULL;
+    pthread_mutex_init(&m->mutex, NULL);
+
+    pthread_mutex_lock(&slabs_lock);
+    list = realloc(magazines, sizeof(slab_magazine *) * (magazine_count + 1));
+    if (list == NULL) {
+        pthread_mutex_unlock(&slabs_lock);
+        free(m);
+        return NULL;
+    }
+    magazines = list;
+    magazines[magazine_count++] = m;
+    pthread_mutex_unlock(&slabs_lock);
+
+    pthread_setspecific(slab_magazine_key, m);
+    return m;
+}
+
+/* Returns up to count chunks from the magazine to the class freelist and
+ * folds in its mem_requested delta.
+ * Called with m->mutex and slabs_lock held. */
+static void magazine_drain(slab_magazine *m, unsigned int id, unsigned int count) {
+    slab_magazine_class *mc = &m->cls[id];
+
+    while (count-- > 0 && mc->slots != NULL) {
+        item *it = (item *)mc->slots;
+        mc->slots = it->next;
+        mc->count--;
+        do_slabs_free(it, 0, id);
+    }
+    slabclass[id].requested += mc->requested;
+    mc->requested = 0;
+    mc->drains++;
+}
+
+/* Moves up to half a magazine of chunks off the class freelist. Only grabs a
+ * new page if the magazine would otherwise stay empty.
+ * Called with m->mutex and slabs_lock held. */
+static void magazine_refill(slab_magazine *m, unsigned int id, unsigned int flags) {
+    slab_magazine_class *mc = &m->cls[id];
+    slabclass_t *p = &slabclass[id];
+    unsigned int want = (settings.slab_magazine_size + 1) / 2;
+
+    p->requested += mc->requested;
+    mc->requested = 0;
+    if (p->sl_curr == 0 && flags != SLABS_ALLOC_NO_NEWPAGE) {
+        do_slabs_newslab(id);
+    }
+    while (want-- > 0 && p->sl_curr != 0) {
+        item *it = (item *)p->slots;
+        p->slots = it->next;
+        if (it->next) it->next->prev = 0;
+        p->sl_curr--;
+        /* Off the freelist, but refcount stays 0 until it's handed out. */
+        it->it_flags &= ~ITEM_SLABBED;
+        it->next = mc->slots;
+        mc->slots = it;
+        mc->count++;
+    }
+    mc->refills++;
+}
+
+static void *magazine_alloc(slab_magazine *m, const size_t size, unsigned int id,
+        uint64_t *total_bytes, unsigned int flags) {
+    slab_magazine_class *mc = &m->cls[id];
+    item *it = NULL;
+
+    pthread_mutex_lock(&m->mutex);
+    if (mc->count == 0 && id != magazine_bypass_clsid) {
+        slabs_lock_counted();
+        magazine_refill(m, id, flags);
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    if (mc->count != 0) {
+        it = (item *)mc->slots;
+        mc->slots = it->next;
+        mc->count--;
+        /* Same state do_slabs_alloc() hands out. */
+        it->refcount = 1;
+        mc->requested += size;
+        mc->hits++;
+        if (total_bytes != NULL) {
+            /* Unlocked read; only used as an LRU sizing hint. */
+            *total_bytes = slabclass[id].requested + mc->requested;
+        }
+        MEMCACHED_SLABS_ALLOCATE(size, id, slabclass[id].size, it);
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return it;
+}
+
+/* Returns false if the chunk has to go through the global freelist. */
+static bool magazine_free(slab_magazine *m, void *ptr, const size_t size, unsigned int id) {
+    slab_magazine_class *mc = &m->cls[id];
+    item *it = (item *)ptr;
+
+    pthread_mutex_lock(&m->mutex);
+    if (id == magazine_bypass_clsid) {
+        pthread_mutex_unlock(&m->mutex);
+        return false;
+    }
+    MEMCACHED_SLABS_FREE(size, id, ptr);
+    it->it_flags = 0;
+    it->slabs_clsid = 0;
+    it->prev = 0;
+    it->next = mc->slots;
+    mc->slots = it;
+    mc->count++;
+    mc->requested -= size;
+    mc->frees++;
+    if (mc->count > settings.slab_magazine_size) {
+        slabs_lock_counted();
+        magazine_drain(m, id, mc->count / 2);
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return true;
+}
+
+/* Empties class id out of every magazine. Called by the slab mover with no
+ * locks held, after magazine_bypass_clsid has been set. */
+static void magazines_flush_class(unsigned int id) {
+    unsigned int i;
+    for (i = 0; ; i++) {
+        slab_magazine *m;
+        pthread_mutex_lock(&slabs_lock);
+        if (i >= magazine_count) {
+            pthread_mutex_unlock(&slabs_lock);
+            break;
+        }
+        m = magazines[i];
+        pthread_mutex_unlock(&slabs_lock);
+
+        pthread_mutex_lock(&m->mutex);
+        pthread_mutex_lock(&slabs_lock);
+        magazine_drain(m, id, m->cls[id].count);
+        pthread_mutex_unlock(&slabs_lock);
+        pthread_mutex_unlock(&m->mutex);
+    }
+}
+
+/* Sums magazine state for one class. Called with slabs_lock held; the
+ * magazines themselves are read without their locks, which is fine for
+ * stats. */
+static void magazines_class_totals(unsigned int id, slab_magazine_class *total) {
+    unsigned int i;
+    memset(total, 0, sizeof(*total));
+    for (i = 0; i < magazine_count; i++) {
+        slab_magazine_class *mc = &magazines[i]->cls[id];
+        total->count += mc->count;
+        total->requested += mc->requested;
+        total->hits += mc->hits;
+        total->frees += mc->frees;
+        total->refills += mc->refills;
+        total->drains += mc->drains;
+    }
+}
+
 /* With refactoring of the various stats code the automover won't need a
  * custom function here.
  */
@@ -436,8 +669,10 @@ void fill_slab_stats_automove(slab_stats_automove *am) {
     for (n = 0; n < MAX_NUMBER_OF_SLAB_CLASSES; n++) {
         slabclass_t *p = &slabclass[n];
         slab_stats_automove *cur = &am[n];
+        slab_magazine_class mag;
+        magazines_class_totals(n, &mag);
         cur->chunks_per_page = p->perslab;
-        cur->free_chunks = p->sl_curr;
+        cur->free_chunks = p->sl_curr + mag.count;
         cur->total_pages = p->slabs;
     }
     pthread_mutex_unlock(&slabs_lock);
@@ -500,8 +735,10 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
         slabclass_t *p = &slabclass[i];
         if (p->slabs != 0) {
             uint32_t perslab, slabs;
+            slab_magazine_class mag;
             slabs = p->slabs;
             perslab = p->perslab;
+            magazines_class_totals(i, &mag);
 
 	    // 长度128
             char key_str[STAT_KEY_LEN];
@@ -513,12 +750,23 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
             APPEND_NUM_STAT(i, "total_pages", "%u", slabs);
             APPEND_NUM_STAT(i, "total_chunks", "%u", slabs * perslab);
             APPEND_NUM_STAT(i, "used_chunks", "%u",
-                            slabs*perslab - p->sl_curr);
+                            slabs*perslab - p->sl_curr - mag.count);
             APPEND_NUM_STAT(i, "free_chunks", "%u", p->sl_curr);
             /* Stat is dead, but displaying zero instead of removing it. */
             APPEND_NUM_STAT(i, "free_chunks_end", "%u", 0);
             APPEND_NUM_STAT(i, "mem_requested", "%llu",
-                            (unsigned long long)p->requested);
+                            (unsigned long long)(p->requested + mag.requested));
+            if (settings.slab_magazine_size > 0) {
+                APPEND_NUM_STAT(i, "magazine_chunks", "%u", mag.count);
+                APPEND_NUM_STAT(i, "magazine_hits", "%llu",
+                        (unsigned long long)mag.hits);
+                APPEND_NUM_STAT(i, "magazine_frees", "%llu",
+                        (unsigned long long)mag.frees);
+                APPEND_NUM_STAT(i, "magazine_refills", "%llu",
+                        (unsigned long long)mag.refills);
+                APPEND_NUM_STAT(i, "magazine_drains", "%llu",
+                        (unsigned long long)mag.drains);
+            }
             APPEND_NUM_STAT(i, "get_hits", "%llu",
                     (unsigned long long)thread_stats.slab_stats[i].get_hits);
             APPEND_NUM_STAT(i, "cmd_set", "%llu",
@@ -543,6 +791,9 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
 
     APPEND_STAT("active_slabs", "%d", total);
     APPEND_STAT("total_malloced", "%llu", (unsigned long long)mem_malloced);
+    APPEND_STAT("slabs_lock_acquires", "%llu", (unsigned long long)slabs_lock_acquires);
+    APPEND_STAT("slabs_lock_contended", "%llu", (unsigned long long)slabs_lock_contended);
+    APPEND_STAT("slabs_lock_wait_us", "%llu", (unsigned long long)slabs_lock_wait_us);
     add_stats(NULL, 0, NULL, 0, c);
 }
 
@@ -600,15 +851,36 @@ static void memory_release() {
 void *slabs_alloc(size_t size, unsigned int id, uint64_t *total_bytes,
         unsigned int flags) {
     void *ret;
+    slab_magazine *m;
+
+    if (settings.slab_magazine_size > 0 &&
+        id >= POWER_SMALLEST && id <= power_largest &&
+        (m = pthread_getspecific(slab_magazine_key)) != NULL) {
+        ret = magazine_alloc(m, size, id, total_bytes, flags);
+        if (ret != NULL)
+            return ret;
+    }
 
-    pthread_mutex_lock(&slabs_lock);
+    slabs_lock_counted();
     ret = do_slabs_alloc(size, id, total_bytes, flags);
     pthread_mutex_unlock(&slabs_lock);
     return ret;
 }
 
 void slabs_free(void *ptr, size_t size, unsigned int id) {
-    pthread_mutex_lock(&slabs_lock);
+    slab_magazine *m;
+
+    /* Chunked items scatter over several classes; leave them to
+     * do_slabs_free_chunked(). */
+    if (settings.slab_magazine_size > 0 &&
+        id >= POWER_SMALLEST && id <= power_largest &&
+        (((item *)ptr)->it_flags & ITEM_CHUNKED) == 0 &&
+        (m = pthread_getspecific(slab_magazine_key)) != NULL &&
+        magazine_free(m, ptr, size, id)) {
+        return;
+    }
+
+    slabs_lock_counted();
     do_slabs_free(ptr, size, id);
     pthread_mutex_unlock(&slabs_lock);
 }
@@ -684,6 +956,141 @@ void slabs_munlock(void) {
     pthread_mutex_unlock(&slabs_lock);
 }
 
+void slabs_layout(char *buf, const size_t len) {
+    size_t off = 0;
+    int i;
+
+    buf[0] = '\0';
+    for (i = POWER_SMALLEST; i <= power_largest && off < len; i++) {
+        off += snprintf(buf + off, len - off, "%s%u", i == POWER_SMALLEST ? "" : ",",
+                slabclass[i].size);
+    }
+}
+
+void slabs_page_map(uint8_t *map, const unsigned int npages) {
+    unsigned int i, id;
+
+    memset(map, SLABS_PAGE_UNUSED, npages);
+    pthread_mutex_lock(&slabs_lock);
+    for (id = 0; id <= power_largest; id++) {
+        slabclass_t *p = &slabclass[id];
+        for (i = 0; i < p->slabs; i++) {
+            size_t page = ((char *)p->slab_list[i] - (char *)mem_base) / settings.slab_page_size;
+            if (page < npages)
+                map[page] = id;
+        }
+    }
+    pthread_mutex_unlock(&slabs_lock);
+}
+
+#define REBASE(ptr, delta) \
+    do { if ((ptr) != NULL) (ptr) = (void *)((char *)(ptr) + (delta)); } while (0)
+
+static bool slabs_in_arena(const void *ptr) {
+    return (char *)ptr >= (char *)mem_base && (char *)ptr < (char *)mem_current;
+}
+
+/* Frees a chunk found in a reused arena onto its class' freelist. */
+static void slabs_restore_free(item *it, const unsigned int id) {
+    it->it_flags = 0;
+    do_slabs_free(it, 0, id);
+}
+
+/* The class of the page an item header sits in. A chunked item's header
+ * claims the class its chunks come from, the real one is in its first
+ * chunk. */
+static unsigned int slabs_restore_clsid(item *it) {
+    if (it->it_flags & ITEM_CHUNKED)
+        return ((item_chunk *)ITEM_data(it))->orig_clsid;
+    return ITEM_clsid(it);
+}
+
+void slabs_restore(const uint8_t *map, const unsigned int npages,
+        const intptr_t delta, bool (*keep)(item *it)) {
+    unsigned int i, x, used = 0;
+
+    for (i = 0; i < npages; i++) {
+        if (map[i] != SLABS_PAGE_UNUSED)
+            used = i + 1;
+    }
+    mem_current = (char *)mem_base + (size_t)used * settings.slab_page_size;
+    mem_avail = mem_limit - (size_t)used * settings.slab_page_size;
+    mem_malloced = (size_t)used * settings.slab_page_size;
+
+    /* Item headers first, so that a data chunk can tell whether the item it
+     * belongs to was kept. */
+    for (i = 0; i < used; i++) {
+        unsigned int id = map[i];
+        char *page = (char *)mem_base + (size_t)i * settings.slab_page_size;
+        slabclass_t *p;
+
+        if (id == SLABS_PAGE_UNUSED || id > power_largest) {
+            /* a hole can't happen, pages are handed out in order; keep the
+             * page out of use rather than guess */
+            continue;
+        }
+        p = &slabclass[id];
+        if (grow_slab_list(id) == 0) {
+            fprintf(stderr, "Out of memory restoring slab pages\n");
+            exit(EXIT_FAILURE);
+        }
+        p->slab_list[p->slabs++] = page;
+        if (id == SLAB_GLOBAL_PAGE_POOL)
+            continue;
+
+        for (x = 0; x < p->perslab; x++) {
+            item *it = (item *)(page + (size_t)x * p->size);
+            if (it->it_flags & ITEM_CHUNK)
+                continue;
+            if ((it->it_flags & (ITEM_LINKED | ITEM_SLABBED)) == ITEM_LINKED
+                    && slabs_restore_clsid(it) == id) {
+                it->next = it->prev = it->h_next = NULL;
+                if (it->it_flags & ITEM_CHUNKED) {
+                    item_chunk *ch = (item_chunk *)ITEM_data(it);
+                    REBASE(ch->next, delta);
+                    ch->head = it;
+                }
+                it->refcount = 1;
+                if (keep(it)) {
+                    if (it->it_flags & ITEM_CHUNKED) {
+                        p->requested += it->nkey + 1 + it->nsuffix + sizeof(item)
+                            + sizeof(item_chunk)
+                            + ((it->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0);
+                    } else {
+                        p->requested += ITEM_ntotal(it);
+                    }
+                    continue;
+                }
+            }
+            slabs_restore_free(it, id);
+        }
+    }
+
+    /* Then the chunks of chunked items. */
+    for (i = 0; i < used; i++) {
+        unsigned int id = map[i];
+        char *page = (char *)mem_base + (size_t)i * settings.slab_page_size;
+        slabclass_t *p;
+
+        if (id == SLABS_PAGE_UNUSED || id == SLAB_GLOBAL_PAGE_POOL || id > power_largest)
+            continue;
+        p = &slabclass[id];
+        for (x = 0; x < p->perslab; x++) {
+            item_chunk *ch = (item_chunk *)(page + (size_t)x * p->size);
+            if ((ch->it_flags & ITEM_CHUNK) == 0)
+                continue;
+            REBASE(ch->head, delta);
+            REBASE(ch->next, delta);
+            REBASE(ch->prev, delta);
+            if (slabs_in_arena(ch->head) && (ch->head->it_flags & ITEM_LINKED)) {
+                p->requested += ch->size + sizeof(item_chunk);
+            } else {
+                slabs_restore_free((item *)ch, id);
+            }
+        }
+    }
+}
+
 static pthread_cond_t slab_rebalance_cond = PTHREAD_COND_INITIALIZER;
 static volatile int do_run_slab_thread = 1;
 static volatile int do_run_slab_rebalance_thread = 1;
@@ -729,6 +1136,7 @@ static int slab_rebalance_start(void) {
 
     /* Also tells do_item_get to search for items in this slab */
     slab_rebalance_signal = 2;
+    magazine_bypass_clsid = slab_rebal.s_clsid;
 
     if (settings.verbose > 1) {
         fprintf(stderr, "Started a slab rebalance\n");
@@ -736,6 +1144,11 @@ static int slab_rebalance_start(void) {
 
     pthread_mutex_unlock(&slabs_lock);
 
+    /* Chunks cached in worker magazines would look busy to the mover
+     * forever; hand them back to the freelist it scans. */
+    if (settings.slab_magazine_size > 0)
+        magazines_flush_class(slab_rebal.s_clsid);
+
     STATS_LOCK();
     stats_state.slab_reassign_running = true;
     STATS_UNLOCK();
@@ -963,13 +1376,26 @@ static int slab_rebalance_move(void) {
                                 fch = fch->next;
                             }
                         }
-                        it->refcount = 0;
-                        it->it_flags = ITEM_SLABBED|ITEM_FETCHED;
+#ifdef HAVE_LOCKFREE_READS
+                        /* A lock-free GET can grab a reference between our
+                         * refcount check and the replace above. If so, the
+                         * reader frees the old item back onto the freelist
+                         * and we pick the chunk up on a later pass. */
+                        if (settings.lockfree_reads && refcount_decr(it) != 0) {
+                            slab_rebal.busy_items++;
+                            was_busy++;
+                            slab_rebal.rescues++;
+                        } else
+#endif
+                        {
+                            it->refcount = 0;
+                            it->it_flags = ITEM_SLABBED|ITEM_FETCHED;
 #ifdef DEBUG_SLAB_MOVER
-                        memcpy(ITEM_key(it), "deadbeef", 8);
+                            memcpy(ITEM_key(it), "deadbeef", 8);
 #endif
-                        slab_rebal.rescues++;
-                        requested_adjust = ntotal;
+                            slab_rebal.rescues++;
+                            requested_adjust = ntotal;
+                        }
                     } else {
                         item_chunk *nch = (item_chunk *) new_it;
                         /* Chunks always have head chunk (the main it) */
@@ -1052,6 +1478,14 @@ static void slab_rebalance_finish(void) {
     uint32_t chunk_rescues;
     uint32_t busy_deletes;
 
+#ifdef HAVE_LOCKFREE_READS
+    /* A lock-free reader may still hold a stale pointer into this page from
+     * before its items were unlinked. Let those lookups finish before the
+     * page is re-split for another class or released. */
+    if (settings.lockfree_reads)
+        lockfree_read_sync();
+#endif
+
     pthread_mutex_lock(&slabs_lock);
 
     s_cls = &slabclass[slab_rebal.s_clsid];
@@ -1110,6 +1544,7 @@ static void slab_rebalance_finish(void) {
     slab_rebal.busy_deletes = 0;
 
     slab_rebalance_signal = 0;
+    magazine_bypass_clsid = 0;
 
     pthread_mutex_unlock(&slabs_lock);
 
@@ -7,8 +7,10 @@
     size equal to the previous slab's chunk size times this factor.
     3rd argument specifies if the slab allocator should allocate all memory
     up front (if true), or allocate memory in chunks as it is needed (if false)
+    mem_base_external, if not NULL, is the arena to carve pages from instead
+    of the heap (the memory file of -e, see restart.c).
 */
-void slabs_init(const size_t limit, const double factor, const bool prealloc, const uint32_t *slab_sizes);
+void slabs_init(const size_t limit, const double factor, const bool prealloc, const uint32_t *slab_sizes, void *mem_base_external);
 
 /** Call only during init. Pre-allocates all available memory */
 void slabs_prefill_global(void);
@@ -27,6 +29,10 @@ void *slabs_alloc(const size_t size, unsigned int id, uint64_t *total_bytes, uns
 /** Free previously allocated object */
 void slabs_free(void *ptr, size_t size, unsigned int id);
 
+/** Create the calling worker thread's slab magazine. Returns NULL if
+    magazines are disabled (-o slab_magazine_size=0) or on OOM. */
+void *slabs_magazine_create(void);
+
 /** Adjust the stats for memory requested */
 void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal);
 
@@ -54,6 +60,20 @@ unsigned int slabs_available_chunks(unsigned int id, bool *mem_flag, uint64_t *t
 void slabs_mlock(void);
 void slabs_munlock(void);
 
+/* Restartable cache, see restart.c. */
+#define SLABS_PAGE_UNUSED 0xff
+/** Writes the chunk sizes of all classes as "size,size,..." to buf. */
+void slabs_layout(char *buf, const size_t len);
+/** For each page of the external arena, the class owning it (0 for the
+    global page pool) or SLABS_PAGE_UNUSED. */
+void slabs_page_map(uint8_t *map, const unsigned int npages);
+/** Rebuilds the slab classes from a reused arena. map is what
+    slabs_page_map() returned when it was saved, delta how far the arena
+    moved since. Linked items are rebased and offered to keep(); accepted
+    ones stay allocated along with their chunks, the rest is freed. */
+void slabs_restore(const uint8_t *map, const unsigned int npages,
+        const intptr_t delta, bool (*keep)(item *it));
+
 int start_slab_maintenance_thread(void);
 void stop_slab_maintenance_thread(void);
 
@@ -12,6 +12,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/time.h>
 
 /*
  * Stats are tracked on the basis of key prefixes. This is a simple
@@ -218,6 +220,107 @@ char *stats_prefix_dump(int *length) {
     return buf;
 }
 
+/*
+ * Command latency histograms. Every worker keeps one per timed command in
+ * its LIBEVENT_THREAD; a command is timed from when it is dispatched (for
+ * sets: from when their data has been read) until the connection is ready
+ * for the next one, so writing the response is included. The buckets are
+ * log-linear, as in HdrHistogram: values below 2^LATENCY_SUB_BITS get a
+ * bucket each, above that every power of two is split into
+ * 2^LATENCY_SUB_BITS buckets, so a bucket is at most 1/8 of its values wide.
+ */
+static const char *latency_names[LATENCY_CMD_COUNT] = {
+    [LATENCY_GET] = "get",
+    [LATENCY_SET] = "set",
+    [LATENCY_DELETE] = "delete",
+    [LATENCY_INCR] = "incr",
+};
+
+uint64_t latency_now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+unsigned int latency_bucket(uint64_t ns) {
+    unsigned int msb;
+
+    if (ns < (1 << LATENCY_SUB_BITS))
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+        + ((ns >> (msb - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+/* Smallest value that falls into bucket b. */
+static uint64_t latency_bucket_min(unsigned int b) {
+    unsigned int group = b >> LATENCY_SUB_BITS;
+
+    if (group == 0)
+        return b;
+    return (uint64_t)((1 << LATENCY_SUB_BITS) + (b & ((1 << LATENCY_SUB_BITS) - 1)))
+        << (group - 1);
+}
+
+/* The value below which permille/1000 of the samples fall, rounded up to
+ * the end of its bucket. */
+static uint64_t latency_percentile(const struct latency_hist *h, unsigned int permille) {
+    uint64_t rank = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank && seen > 0) {
+            uint64_t top = b + 1 < LATENCY_BUCKETS ? latency_bucket_min(b + 1) - 1 : h->max;
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+/* "stats latency": the merged histograms, summarized in microseconds. */
+void latency_stats(ADD_STAT add_stats, conn *c) {
+    static const struct {
+        const char *name;
+        unsigned int permille;
+    } pcts[] = { { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 } };
+    struct latency_hist *hists = malloc(sizeof(struct latency_hist) * LATENCY_CMD_COUNT);
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+    int cmd;
+    unsigned int i;
+
+    if (hists == NULL)
+        return;
+    threadlocal_latency_aggregate(hists);
+
+    for (cmd = 0; cmd < LATENCY_CMD_COUNT; cmd++) {
+        const struct latency_hist *h = &hists[cmd];
+        const char *name = latency_names[cmd];
+
+        APPEND_NUM_FMT_STAT("%s:%s", name, "count", "%llu", (unsigned long long)h->count);
+        if (h->count == 0)
+            continue;
+        APPEND_NUM_FMT_STAT("%s:%s", name, "mean_us", "%.3f", h->sum / 1000.0 / h->count);
+        for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+            char pname[16];
+            snprintf(pname, sizeof(pname), "%s_us", pcts[i].name);
+            APPEND_NUM_FMT_STAT("%s:%s", name, pname, "%.3f",
+                    latency_percentile(h, pcts[i].permille) / 1000.0);
+        }
+        APPEND_NUM_FMT_STAT("%s:%s", name, "max_us", "%.3f", h->max / 1000.0);
+    }
+    free(hists);
+}
+
 
 #ifdef UNIT_TEST
 
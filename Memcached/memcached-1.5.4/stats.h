@@ -6,3 +6,8 @@ void stats_prefix_record_delete(const char *key, const size_t nkey);
 void stats_prefix_record_set(const char *key, const size_t nkey);
 /*@null@*/
 char *stats_prefix_dump(int *length);
+
+/* latency histograms */
+uint64_t latency_now(void);
+unsigned int latency_bucket(uint64_t ns);
+void latency_stats(ADD_STAT add_stats, conn *c);
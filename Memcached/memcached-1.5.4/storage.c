@@ -128,6 +128,8 @@ int lru_maintainer_store(void *storage, const int clsid) {
 /* Fetch stats from the external storage system and decide to compact.
  * If we're more than half full, start skewing how aggressively to run
  * compaction, up to a desired target when all pages are full.
+ * Of the pages under the limit, extstore_compact_pick() chooses the one
+ * reclaiming the most space for the least IO.
  */
 static int storage_compact_check(void *storage, logger *l,
         uint32_t *page_id, uint64_t *page_version,
@@ -136,10 +138,9 @@ static int storage_compact_check(void *storage, logger *l,
     int x;
     double rate;
     uint64_t frag_limit;
-    uint64_t low_version = ULLONG_MAX;
     uint64_t lowest_version = ULLONG_MAX;
-    unsigned int low_page = 0;
     unsigned int lowest_page = 0;
+    int pick;
     extstore_get_stats(storage, &st);
     if (st.pages_used == 0)
         return 0;
@@ -159,31 +160,30 @@ static int storage_compact_check(void *storage, logger *l,
     st.page_data = calloc(st.page_count, sizeof(struct extstore_page_data));
     extstore_get_page_data(storage, &st);
 
-    // find oldest page by version that violates the constraint
+    // low TTL pages empty out by themselves.
+    pick = extstore_compact_pick(&st, frag_limit, 1 << PAGE_BUCKET_LOWTTL);
+    if (pick >= 0) {
+        *page_id = pick;
+        *page_version = st.page_data[pick].version;
+        *page_size = st.page_size;
+        free(st.page_data);
+        return 1;
+    }
+
+    // find oldest page by version in case we have to drop items
     for (x = 0; x < st.page_count; x++) {
-        if (st.page_data[x].version == 0 ||
+        if (st.page_data[x].version == 0 || st.page_data[x].active ||
             st.page_data[x].bucket == PAGE_BUCKET_LOWTTL)
             continue;
         if (st.page_data[x].version < lowest_version) {
             lowest_page = x;
             lowest_version = st.page_data[x].version;
         }
-        if (st.page_data[x].bytes_used < frag_limit) {
-            if (st.page_data[x].version < low_version) {
-                low_page = x;
-                low_version = st.page_data[x].version;
-            }
-        }
     }
     *page_size = st.page_size;
     free(st.page_data);
 
-    // we have a page + version to attempt to reclaim.
-    if (low_version != ULLONG_MAX) {
-        *page_id = low_page;
-        *page_version = low_version;
-        return 1;
-    } else if (lowest_version != ULLONG_MAX && settings.ext_drop_unread
+    if (lowest_version != ULLONG_MAX && settings.ext_drop_unread
             && st.pages_free <= settings.ext_drop_under) {
         // nothing matched the frag rate barrier, so pick the absolute oldest
         // version if we're configured to drop items.
@@ -209,13 +209,36 @@ struct storage_compact_wrap {
     bool miss; // version flipped out from under us
 };
 
+/* A live item found in the chunk being compacted. */
+struct storage_compact_move {
+    item *it; /* in the readback buffer */
+    uint32_t hv;
+    unsigned int offset; /* where it was in the page being compacted */
+    unsigned int new_offset;
+    unsigned int new_page_id;
+    uint64_t new_page_version;
+};
+
+/* Moves the live items of one chunk read back from a page being compacted.
+ * Survivors are found first, then copied in runs filling as much of a write
+ * buffer as possible, and only then are their headers pointed at the new
+ * location. Item locks aren't held while waiting on extstore, so client
+ * requests hashing to them don't stall behind the compaction.
+ * An item leaves the old page's counts when its header is relinked. Skipped
+ * and lost items still point at the old page, so a delete or overwrite can
+ * take them off; if none comes, closing the page drops them.
+ */
 static void storage_compact_readback(void *storage, logger *l,
-        bool drop_unread, char *readback_buf,
-        uint32_t page_id, uint64_t page_version, uint64_t read_size) {
+        bool drop_unread, char *readback_buf, struct storage_compact_move *moves,
+        uint32_t page_id, uint64_t page_version, uint64_t page_offset,
+        uint64_t read_size) {
     uint64_t offset = 0;
     unsigned int rescues = 0;
     unsigned int lost = 0;
     unsigned int skipped = 0;
+    unsigned int nmoves = 0;
+    unsigned int moved = 0;
+    unsigned int i;
 
     while (offset < read_size) {
         item *hdr_it = NULL;
@@ -233,55 +256,24 @@ static void storage_compact_readback(void *storage, logger *l,
         // We don't have a conn and don't need to do most of do_item_get
         hdr_it = assoc_find(ITEM_key(it), it->nkey, hv);
         if (hdr_it != NULL) {
-            bool do_write = false;
             refcount_incr(hdr_it);
 
             // Check validity but don't bother removing it.
             if ((hdr_it->it_flags & ITEM_HDR) && !item_is_flushed(hdr_it) &&
                    (hdr_it->exptime == 0 || hdr_it->exptime > current_time)) {
                 hdr = (item_hdr *)ITEM_data(hdr_it);
-                if (hdr->page_id == page_id && hdr->page_version == page_version) {
+                if (hdr->page_id == page_id && hdr->page_version == page_version &&
+                        hdr->offset == page_offset + offset) {
                     // Item header is still completely valid.
-                    extstore_delete(storage, page_id, page_version, 1, ntotal);
                     // drop inactive items.
                     if (drop_unread && GET_LRU(hdr_it->slabs_clsid) == COLD_LRU) {
-                        do_write = false;
                         skipped++;
                     } else {
-                        do_write = true;
-                    }
-                }
-            }
-
-            if (do_write) {
-                bool do_update = false;
-                int tries;
-                obj_io io;
-                io.len = ntotal;
-                io.mode = OBJ_IO_WRITE;
-                for (tries = 10; tries > 0; tries--) {
-                    if (extstore_write_request(storage, PAGE_BUCKET_COMPACT, &io) == 0) {
-                        memcpy(io.buf, it, io.len);
-                        extstore_write(storage, &io);
-                        do_update = true;
-                        break;
-                    } else {
-                        usleep(1000);
-                    }
-                }
-
-                if (do_update) {
-                    if (it->refcount == 2) {
-                        hdr->page_version = io.page_version;
-                        hdr->page_id = io.page_id;
-                        hdr->offset = io.offset;
-                        rescues++;
-                    } else {
-                        lost++;
-                        // TODO: re-alloc and replace header.
+                        moves[nmoves].it = it;
+                        moves[nmoves].hv = hv;
+                        moves[nmoves].offset = page_offset + offset;
+                        nmoves++;
                     }
-                } else {
-                    lost++;
                 }
             }
 
@@ -294,6 +286,79 @@ static void storage_compact_readback(void *storage, logger *l,
             break;
     }
 
+    while (moved < nmoves) {
+        unsigned int used = 0;
+        unsigned int first = moved;
+        int tries;
+        obj_io io;
+        io.len = ITEM_ntotal(moves[moved].it);
+        io.mode = OBJ_IO_WRITE;
+        for (tries = 10; tries > 0; tries--) {
+            if (extstore_write_request_batch(storage, PAGE_BUCKET_COMPACT, &io) == 0)
+                break;
+            usleep(1000);
+        }
+        if (tries == 0)
+            break;
+
+        while (moved < nmoves) {
+            unsigned int ntotal = ITEM_ntotal(moves[moved].it);
+            if (used + ntotal > io.len)
+                break;
+            memcpy(io.buf + used, moves[moved].it, ntotal);
+            moves[moved].new_offset = used;
+            used += ntotal;
+            moved++;
+        }
+        io.len = used;
+        extstore_write_batch(storage, &io, moved - first);
+        for (i = first; i < moved; i++) {
+            moves[i].new_offset += io.offset;
+            moves[i].new_page_id = io.page_id;
+            moves[i].new_page_version = io.page_version;
+        }
+    }
+    lost += nmoves - moved;
+
+    for (i = 0; i < moved; i++) {
+        struct storage_compact_move *m = &moves[i];
+        item *it = m->it;
+        item *hdr_it;
+        bool relinked = false;
+        item_lock(m->hv);
+        hdr_it = assoc_find(ITEM_key(it), it->nkey, m->hv);
+        if (hdr_it != NULL) {
+            item_hdr *hdr = (item_hdr *)ITEM_data(hdr_it);
+            refcount_incr(hdr_it);
+            if ((hdr_it->it_flags & ITEM_HDR) && hdr->page_id == page_id &&
+                    hdr->page_version == page_version &&
+                    hdr->offset == m->offset) {
+                // a reader in flight still expects the old location.
+                if (hdr_it->refcount == 2) {
+                    // gone from the old page only once nothing points there:
+                    // a delete from now on hits the new one.
+                    extstore_delete(storage, page_id, page_version,
+                            1, ITEM_ntotal(it));
+                    hdr->page_version = m->new_page_version;
+                    hdr->page_id = m->new_page_id;
+                    hdr->offset = m->new_offset;
+                    relinked = true;
+                    rescues++;
+                } else {
+                    lost++;
+                    // TODO: re-alloc and replace header.
+                }
+            }
+            do_item_remove(hdr_it);
+        }
+        item_unlock(m->hv);
+        // changed or deleted while we were writing; drop the copy.
+        if (!relinked) {
+            extstore_delete(storage, m->new_page_id, m->new_page_version,
+                    1, ITEM_ntotal(it));
+        }
+    }
+
     STATS_LOCK();
     stats.extstore_compact_lost += lost;
     stats.extstore_compact_rescues += rescues;
@@ -330,6 +395,7 @@ static void *storage_compact_thread(void *arg) {
     uint32_t page_id = 0;
     bool drop_unread = false;
     char *readback_buf = NULL;
+    struct storage_compact_move *moves = NULL;
     struct storage_compact_wrap wrap;
 
     logger *l = logger_create();
@@ -344,6 +410,14 @@ static void *storage_compact_thread(void *arg) {
         abort();
     }
 
+    // one entry per item that can fit in a readback
+    moves = calloc(settings.ext_wbuf_size / sizeof(item) + 1,
+            sizeof(struct storage_compact_move));
+    if (moves == NULL) {
+        fprintf(stderr, "Failed to allocate move list for storage compaction thread\n");
+        abort();
+    }
+
     pthread_mutex_init(&wrap.lock, NULL);
     wrap.done = false;
     wrap.submitted = false;
@@ -393,7 +467,8 @@ static void *storage_compact_thread(void *arg) {
                 LOGGER_LOG(l, LOG_SYSEVENTS, LOGGER_COMPACT_READ_START,
                         NULL, page_id, page_offset);
                 storage_compact_readback(storage, l, drop_unread,
-                        readback_buf, page_id, page_version, settings.ext_wbuf_size);
+                        readback_buf, moves, page_id, page_version,
+                        page_offset, settings.ext_wbuf_size);
                 page_offset += settings.ext_wbuf_size;
                 wrap.done = false;
                 wrap.submitted = false;
@@ -415,6 +490,7 @@ static void *storage_compact_thread(void *arg) {
         }
     }
     free(readback_buf);
+    free(moves);
 
     return NULL;
 }
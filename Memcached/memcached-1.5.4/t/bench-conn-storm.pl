@@ -0,0 +1,76 @@
+#!/usr/bin/perl
+#
+# Connection storm benchmark: many clients that connect, send one request and
+# disconnect, against the main-thread listener and against -o reuseport.
+# Run from the build directory:
+#
+#   perl t/bench-conn-storm.pl [seconds] [clients] [threads]
+#
+# Prints connections/sec and p99 connect+request latency for each mode, and
+# the per worker accept counts from "stats threads".
+
+use strict;
+use warnings;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use IO::Socket::INET;
+use Time::HiRes qw(time);
+
+my $duration = shift || 5;
+my $clients = shift || 64;
+my $nthreads = shift || 4;
+
+sub run {
+    my ($reuseport) = @_;
+    my $opts = "-m 64 -c 65536 -t $nthreads -l 127.0.0.1";
+    $opts .= " -o reuseport" if $reuseport;
+    my $server = new_memcached($opts);
+
+    my @pids;
+    pipe(my $rd, my $wr) or die "pipe: $!";
+    for my $c (1 .. $clients) {
+        my $pid = fork();
+        die "fork: $!" unless defined $pid;
+        if ($pid == 0) {
+            close $rd;
+            my @lat;
+            my $end = time() + $duration;
+            while (time() < $end) {
+                my $start = time();
+                my $conn = $server->new_sock or next;
+                print $conn "version\r\n";
+                my $line = <$conn>;
+                close $conn;
+                push @lat, time() - $start if defined $line;
+            }
+            # one line per client: count and its own p99
+            @lat = sort { $a <=> $b } @lat;
+            my $p99 = @lat ? $lat[int(@lat * 0.99)] : 0;
+            printf $wr "%d %f\n", scalar @lat, $p99;
+            close $wr;
+            exit 0;
+        }
+        push @pids, $pid;
+    }
+    close $wr;
+    my ($total, $p99) = (0, 0);
+    while (my $line = <$rd>) {
+        my ($n, $p) = split ' ', $line;
+        $total += $n;
+        $p99 = $p if $p > $p99;
+    }
+    waitpid($_, 0) for @pids;
+
+    my $threads = mem_stats($server->sock, 'threads');
+    my @accepts = map { $threads->{"$_:conn_accepts"} } 0 .. $nthreads - 1;
+    $server->stop;
+    return ($total / $duration, $p99 * 1e6, @accepts);
+}
+
+printf "%-10s %12s %12s  %s\n", "listener", "conns/s", "p99 us", "accepts per worker";
+for my $reuseport (0, 1) {
+    my ($rate, $p99, @accepts) = run($reuseport);
+    printf "%-10s %12.0f %12.0f  %s\n", $reuseport ? "reuseport" : "main",
+        $rate, $p99, join(" ", @accepts);
+}
@@ -0,0 +1,85 @@
+#!/usr/bin/perl
+#
+# Multiget microbenchmark: ASCII gets of 1, 10, 50, 100 and 200 keys against
+# a key set larger than the CPU caches, with batched bucket prefetching and
+# with -o no_get_prefetch. Run from the build directory:
+#
+#   perl t/bench-multiget.pl [seconds] [keys] [clients]
+#
+# Prints lookups/sec and p50/p99 request latency for each mode and size.
+
+use strict;
+use warnings;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use IO::Socket::INET;
+use Time::HiRes qw(time);
+
+my $duration = shift || 5;
+my $keys = shift || 1000000;
+my $clients = shift || 4;
+my @sizes = (1, 10, 50, 100, 200);
+
+sub run {
+    my ($server, $batch) = @_;
+    my @pids;
+    pipe(my $rd, my $wr) or die "pipe: $!";
+    for my $c (1 .. $clients) {
+        my $pid = fork();
+        die "fork: $!" unless defined $pid;
+        if ($pid == 0) {
+            close $rd;
+            my $conn = $server->new_sock;
+            my @lat;
+            my $end = time() + $duration;
+            while (time() < $end) {
+                my $req = "get";
+                $req .= " key" . (1 + int(rand($keys))) for 1 .. $batch;
+                my $start = time();
+                print $conn "$req\r\n";
+                while (my $line = <$conn>) {
+                    last if $line eq "END\r\n";
+                }
+                push @lat, time() - $start;
+            }
+            @lat = sort { $a <=> $b } @lat;
+            printf $wr "%d %f %f\n", scalar @lat, $lat[int(@lat / 2)],
+                $lat[int(@lat * 0.99)];
+            close $wr;
+            exit 0;
+        }
+        push @pids, $pid;
+    }
+    close $wr;
+    my ($reqs, $p50, $p99) = (0, 0, 0);
+    while (my $line = <$rd>) {
+        my ($n, $a, $b) = split ' ', $line;
+        $reqs += $n;
+        $p50 = $a if $a > $p50;
+        $p99 = $b if $b > $p99;
+    }
+    waitpid($_, 0) for @pids;
+    return ($reqs * $batch / $duration, $p50 * 1e6, $p99 * 1e6);
+}
+
+printf "%-9s %6s %14s %10s %10s\n", "mode", "keys", "lookups/s", "p50 us", "p99 us";
+for my $prefetch (1, 0) {
+    my $opts = "-m 1024 -t $clients -l 127.0.0.1";
+    $opts .= " -o no_get_prefetch" unless $prefetch;
+    my $server = new_memcached($opts);
+    my $sock = $server->sock;
+
+    for my $k (1 .. $keys) {
+        print $sock "set key$k 0 0 8 noreply\r\nabcdefgh\r\n";
+    }
+    print $sock "version\r\n";
+    scalar <$sock>;
+
+    for my $batch (@sizes) {
+        my ($rate, $p50, $p99) = run($server, $batch);
+        printf "%-9s %6d %14.0f %10.0f %10.0f\n",
+            $prefetch ? "prefetch" : "serial", $batch, $rate, $p50, $p99;
+    }
+    $server->stop;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+#
+# Read scaling benchmark: GET throughput against 1..64 worker threads, with
+# and without -o lockfree_reads.  Run from the build directory:
+#
+#   perl t/bench-read-scaling.pl [seconds] [keys]
+#
+# Each run starts a fresh memcached-debug with -t N, preloads the key set and
+# forks N clients that issue multi-key GETs for the given time.
+
+use strict;
+use warnings;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use IO::Socket::INET;
+use Time::HiRes qw(time);
+
+my $duration = shift || 5;
+my $keys = shift || 100000;
+my @threads = (1, 2, 4, 8, 16, 32, 64);
+my $batch = 10;
+
+sub run {
+    my ($nthreads, $lockfree) = @_;
+    my $opts = "-m 256 -c 4096 -t $nthreads -l 127.0.0.1";
+    $opts .= " -o lockfree_reads" if $lockfree;
+    my $server = new_memcached($opts);
+    my $sock = $server->sock;
+
+    for my $k (1 .. $keys) {
+        print $sock "set key$k 0 0 8 noreply\r\nabcdefgh\r\n";
+    }
+    print $sock "version\r\n";
+    scalar <$sock>;
+
+    my @pids;
+    pipe(my $rd, my $wr) or die "pipe: $!";
+    for my $c (1 .. $nthreads) {
+        my $pid = fork();
+        die "fork: $!" unless defined $pid;
+        if ($pid == 0) {
+            close $rd;
+            my $conn = $server->new_sock;
+            my $ops = 0;
+            my $end = time() + $duration;
+            while (time() < $end) {
+                my $req = "get";
+                $req .= " key" . (1 + int(rand($keys))) for 1 .. $batch;
+                print $conn "$req\r\n";
+                while (my $line = <$conn>) {
+                    last if $line eq "END\r\n";
+                }
+                $ops += $batch;
+            }
+            print $wr "$ops\n";
+            close $wr;
+            exit 0;
+        }
+        push @pids, $pid;
+    }
+    close $wr;
+    my $total = 0;
+    while (my $line = <$rd>) {
+        $total += $line;
+    }
+    waitpid($_, 0) for @pids;
+    $server->stop;
+    return $total / $duration;
+}
+
+printf "%8s %14s %14s %8s\n", "threads", "locked get/s", "lockfree get/s", "ratio";
+for my $n (@threads) {
+    my $locked = run($n, 0);
+    my $lockfree = run($n, 1);
+    printf "%8d %14.0f %14.0f %8.2f\n", $n, $locked, $lockfree,
+        $locked ? $lockfree / $locked : 0;
+}
@@ -0,0 +1,67 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $settings = mem_stats($sock, ' settings');
+is($settings->{hotkey_sample_rate}, 100, "sampling on by default");
+
+$server = new_memcached('-o hotkey_sample_rate=0');
+$sock = $server->sock;
+print $sock "stats hotkeys\r\n";
+is(scalar <$sock>, "CLIENT_ERROR hot key tracking disabled\r\n",
+   "stats hotkeys when disabled");
+
+# sample every request so the counts are exact enough to check
+$server = new_memcached('-o hotkey_sample_rate=1');
+$sock = $server->sock;
+
+print $sock "set hot 0 0 1\r\nh\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored hot key");
+
+# The hot key leads and is interleaved with the others, and the traffic
+# goes on until the logger thread has merged a window (about once a
+# second). Whatever stretch of it that window holds, the hot key has more
+# requests than any other key in it.
+for my $i (1 .. 40) {
+    print $sock "set cold$i 0 0 1\r\nc\r\nset hot 0 0 1\r\nh\r\n";
+    die unless <$sock> eq "STORED\r\n" && <$sock> eq "STORED\r\n";
+}
+
+my $stats;
+my $round = 0;
+my $deadline = time + 10;
+while (time < $deadline) {
+    print $sock "get hot\r\n" x 50;
+    <$sock> for 1 .. 150;
+    my $cold = "cold" . (1 + $round++ % 40);
+    print $sock "get $cold\r\n" x 5;
+    <$sock> for 1 .. 15;
+
+    $stats = mem_stats($sock, ' hotkeys');
+    last if $stats->{window_requests} > 0 && exists $stats->{'1:key'};
+}
+
+is($stats->{sample_rate}, 1, "sample rate reported");
+ok($stats->{window_ms} >= 1000, "window length reported");
+cmp_ok($stats->{window_requests}, '>', 0, "requests counted");
+is($stats->{'1:key'}, "hot", "hottest key found");
+cmp_ok($stats->{'1:requests'}, '>', $stats->{'2:requests'} || 0,
+       "hot key ahead of the rest");
+cmp_ok($stats->{'1:requests'}, '<=', $stats->{window_requests},
+       "estimate within the window's requests");
+ok(!exists $stats->{'17:key'}, "at most 16 keys listed");
+
+# a quiet window empties the list
+for (1 .. 50) {
+    $stats = mem_stats($sock, ' hotkeys');
+    last if $stats->{window_requests} == 0;
+    select(undef, undef, undef, 0.1);
+}
+ok(!exists $stats->{'1:key'}, "idle window has no hot keys");
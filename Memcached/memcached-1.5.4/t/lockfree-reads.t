@@ -0,0 +1,58 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-t 2 -o hashpower=12,lockfree_reads');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, 'settings');
+is($stats->{lockfree_reads}, 'yes', "lockfree_reads enabled");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "fooval");
+
+print $sock "delete foo\r\n";
+is(scalar <$sock>, "DELETED\r\n", "deleted foo");
+mem_get_is($sock, "foo", undef);
+
+# Items that expired must not be served from the lock-free path.
+print $sock "set bar 0 1 6\r\nbarval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored bar");
+sleep(2.2);
+mem_get_is($sock, "bar", undef);
+
+# Push the table past 1.5 * 2^12 items so it grows while we keep reading.
+my $keycount = 12000;
+for my $k (1 .. $keycount) {
+    my $val = "v$k";
+    print $sock "set key$k 0 0 " . length($val) . " noreply\r\n$val\r\n";
+}
+
+my $misses = 0;
+for my $try (1 .. 50) {
+    $misses = 0;
+    for my $k (1 .. $keycount) {
+        print $sock "get key$k\r\n";
+        my $line = scalar <$sock>;
+        if ($line =~ /^VALUE/) {
+            my $val = scalar <$sock>;
+            $misses++ unless $val eq "v$k\r\n";
+            $line = scalar <$sock>;
+        } else {
+            $misses++;
+        }
+    }
+    $stats = mem_stats($sock);
+    last if $stats->{hash_is_expanding} == 0;
+}
+is($misses, 0, "all keys readable across hash expansion");
+cmp_ok($stats->{hash_power_level}, '>', 12, "hash table expanded");
+is($stats->{hash_is_expanding}, 0, "expansion finished");
+
+mem_get_is($sock, "key$keycount", "v$keycount");
@@ -0,0 +1,86 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 14;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Multigets are hashed and prefetched GET_BATCH_KEYS (64) keys at a time;
+# use key counts that straddle batch boundaries, with misses mixed in.
+my @keys = map { "mgb$_" } 1 .. 200;
+my %stored = map { $_ => "val-$_" } grep { /(\d+)$/ && $1 % 3 != 0 } @keys;
+
+sub ascii_multiget {
+    my ($sock, $cmd, @k) = @_;
+    print $sock "$cmd @k\r\n";
+    my @got;
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        if ($line =~ /^VALUE (\S+) \d+ (\d+)/) {
+            my ($key, $len) = ($1, $2);
+            read($sock, my $data, $len + 2);
+            push @got, $key . "=" . substr($data, 0, $len);
+        }
+    }
+    return @got;
+}
+
+# Pipelined GETKQ for every key, closed by a NOOP.
+sub binary_multiget {
+    my ($sock, @k) = @_;
+    my $req = '';
+    my $opaque = 0;
+    for my $key (@k) {
+        $req .= pack("CCnCCnNNNN", 0x80, 0x0D, length($key), 0, 0, 0,
+                     length($key), $opaque++, 0, 0) . $key;
+    }
+    $req .= pack("CCnCCnNNNN", 0x80, 0x0A, 0, 0, 0, 0, 0, $opaque, 0, 0);
+    print $sock $req;
+
+    my @got;
+    while (1) {
+        read($sock, my $hdr, 24) == 24 or last;
+        my ($magic, $cmd, $keylen, $extlen, undef, $status, $bodylen)
+            = unpack("CCnCCnN", $hdr);
+        my $body = '';
+        read($sock, $body, $bodylen) if $bodylen;
+        last if $cmd == 0x0A;
+        my $key = substr($body, $extlen, $keylen);
+        push @got, $key . "=" . substr($body, $extlen + $keylen);
+    }
+    return @got;
+}
+
+for my $opts ('', '-o no_get_prefetch') {
+    my $server = new_memcached($opts);
+    my $sock = $server->sock;
+    my $want = $opts ? "no" : "yes";
+
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{get_prefetch}, $want, "get_prefetch is $want");
+
+    for my $key (sort keys %stored) {
+        print $sock "set $key 0 0 " . length($stored{$key}) . " noreply\r\n$stored{$key}\r\n";
+    }
+    mem_get_is($sock, "mgb1", "val-mgb1");
+
+    my @expect = map { "$_=$stored{$_}" } grep { exists $stored{$_} } @keys;
+    is_deeply([ascii_multiget($sock, "get", @keys)], \@expect,
+        "ascii get of 200 keys");
+    is_deeply([ascii_multiget($sock, "gets", @keys[60 .. 70])],
+        [ grep { /^mgb(\d+)=/ && $1 >= 61 && $1 <= 71 } @expect ],
+        "ascii gets across a batch boundary");
+    is_deeply([ascii_multiget($sock, "get", ("mgb1") x 130)],
+        [ ("mgb1=val-mgb1") x 130 ], "repeated key");
+
+    my $bsock = $server->new_sock;
+    is_deeply([binary_multiget($bsock, @keys)], \@expect,
+        "binary GETKQ run of 200 keys");
+
+    $stats = mem_stats($sock);
+    is($stats->{get_hits}, 1 + 2 * scalar(@expect) + 130
+        + scalar(grep { /^mgb(\d+)=/ && $1 >= 61 && $1 <= 71 } @expect),
+        "hits counted once per key");
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 19;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $file = "/tmp/memcachedtest-restart.$$";
+my $args = "-m 32 -e $file";
+
+# Stops gracefully, which saves the memory file's metadata.
+sub stop_and_wait {
+    my $server = shift;
+    $server->stop;
+    waitpid($server->{pid}, 0);
+}
+
+my $server = new_memcached($args);
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{memory_file}, $file, "memory_file setting");
+
+print $sock "set flushed 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored flushed");
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "flushed");
+
+print $sock "set foo 5 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+print $sock "gets foo\r\n";
+my $line = <$sock>;
+my ($cas) = $line =~ /^VALUE foo 5 3 (\d+)/;
+ok(defined $cas, "got foo's cas");
+<$sock>; <$sock>;
+
+# larger than slab_chunk_max, so stored as a chunked item
+my $big = join('', map { chr(65 + $_ % 26) } 1 .. 700 * 1024);
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored chunked item");
+
+print $sock "set short 0 2 2\r\nhi\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored expiring item");
+print $sock "set deleted 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored deleted");
+print $sock "delete deleted\r\n";
+is(scalar <$sock>, "DELETED\r\n", "deleted");
+
+for my $i (1 .. 100) {
+    print $sock "set k$i 0 0 " . length("v$i") . "\r\nv$i\r\n";
+    die "failed to store k$i" unless scalar <$sock> eq "STORED\r\n";
+}
+
+stop_and_wait($server);
+ok(-f "$file.meta", "metadata written on shutdown");
+
+# the expiring item runs out while the server is down
+sleep 3;
+
+$server = new_memcached($args);
+$sock = $server->sock;
+ok(! -f "$file.meta", "metadata consumed on start");
+
+print $sock "gets foo\r\n";
+is(scalar <$sock>, "VALUE foo 5 3 $cas\r\n", "foo kept its flags and cas");
+is(scalar <$sock>, "bar\r\n", "foo kept its value");
+is(scalar <$sock>, "END\r\n", "end of gets");
+mem_get_is($sock, "big", $big, "chunked item restored");
+mem_get_is($sock, "short", undef, "expired during downtime");
+mem_get_is($sock, "flushed", undef, "flushed item not restored");
+mem_get_is($sock, "deleted", undef, "deleted item not restored");
+
+my $stats = mem_stats($sock);
+is($stats->{curr_items}, 102, "restored item count");
+
+stop_and_wait($server);
+unlink($file, "$file.meta");
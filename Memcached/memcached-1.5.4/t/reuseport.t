@@ -0,0 +1,55 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-t 4 -l 127.0.0.1 -o reuseport');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{reuseport}, "yes", "reuseport enabled");
+
+# Every worker owns exactly one listener on the one port.
+my $threads = mem_stats($sock, 'threads');
+my $listeners = 0;
+$listeners += $threads->{"$_:listeners"} for 0 .. 3;
+is($listeners, 4, "one listener per worker");
+
+my $conns = mem_stats($sock, 'conns');
+my @listening = grep { /:state$/ && $conns->{$_} eq 'conn_listening' } keys %$conns;
+ok(@listening >= 4, "listeners show up in stats conns");
+
+# A burst of short connections, each doing a set/get round trip.
+my $ok = 0;
+for my $i (1 .. 100) {
+    my $c = $server->new_sock;
+    next unless $c;
+    print $c "set rp$i 0 0 2\r\nhi\r\n";
+    my $line = <$c>;
+    $ok++ if defined $line && $line eq "STORED\r\n";
+    close $c;
+}
+is($ok, 100, "all short connections served");
+mem_get_is($sock, "rp1", "hi");
+mem_get_is($sock, "rp100", "hi");
+
+$threads = mem_stats($sock, 'threads');
+my $accepts = 0;
+my $busy = 0;
+for my $t (0 .. 3) {
+    $accepts += $threads->{"$t:conn_accepts"};
+    $busy++ if $threads->{"$t:conn_accepts"} > 0;
+}
+cmp_ok($accepts, '>=', 101, "accepts counted per worker");
+cmp_ok($busy, '>', 1, "connections spread over workers");
+
+# Without reuseport the main thread keeps the listener.
+my $plain = new_memcached('-t 4 -l 127.0.0.1');
+$threads = mem_stats($plain->sock, 'threads');
+is($threads->{"0:listeners"} + $threads->{"1:listeners"}
+    + $threads->{"2:listeners"} + $threads->{"3:listeners"}, 0,
+    "workers own no listeners by default");
@@ -0,0 +1,63 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 12;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-t 2 -m 6 -o slab_reassign,slab_magazine_size=16');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{slab_magazine_size}, 16, "magazines enabled");
+
+# Overwrites free the old item back into the worker's magazine, which the
+# next set then reuses.
+for my $round (1 .. 5) {
+    for my $k (1 .. 200) {
+        my $val = "v$round$k";
+        print $sock "set mfoo$k 0 0 " . length($val) . " noreply\r\n$val\r\n";
+    }
+}
+mem_get_is($sock, "mfoo1", "v51");
+mem_get_is($sock, "mfoo200", "v5200");
+
+my $slabs = mem_stats($sock, "slabs");
+my $cls = 1;
+$cls++ until exists $slabs->{"$cls:magazine_hits"} || $cls > 63;
+cmp_ok($slabs->{"$cls:magazine_hits"}, '>', 0, "allocations served from magazine");
+cmp_ok($slabs->{"$cls:magazine_frees"}, '>', 0, "frees kept in magazine");
+cmp_ok($slabs->{"$cls:magazine_chunks"}, '<=', 16 * 2, "magazines stay bounded");
+cmp_ok($slabs->{slabs_lock_acquires}, '>', 0, "slabs lock acquisitions counted");
+ok(exists $slabs->{slabs_lock_wait_us}, "slabs lock wait time reported");
+
+# Magazine chunks count as neither used nor free.
+is($slabs->{"$cls:used_chunks"} + $slabs->{"$cls:free_chunks"}
+    + $slabs->{"$cls:magazine_chunks"}, $slabs->{"$cls:total_chunks"},
+    "chunk accounting adds up");
+
+# A page move out of a class with cached chunks must still complete.
+my $bigdata = 'x' x 70000;
+for (1 .. 60) {
+    print $sock "set bfoo$_ 0 0 70000 noreply\r\n", $bigdata, "\r\n";
+}
+my $smalldata = 'y' x 20000;
+for (1 .. 60) {
+    print $sock "set sfoo$_ 0 0 20000 noreply\r\n", $smalldata, "\r\n";
+}
+$slabs = mem_stats($sock, "slabs");
+my ($big) = sort { $a <=> $b } map { /^(\d+):chunk_size$/ ? $1 : () }
+    grep { /:chunk_size$/ && $slabs->{$_} >= 70000 } keys %$slabs;
+my $before = $slabs->{"$big:total_pages"};
+print $sock "slabs reassign $big 0\r\n";
+is(scalar <$sock>, "OK\r\n", "slab rebalancer started");
+for (1 .. 20) {
+    sleep 0.5;
+    $stats = mem_stats($sock);
+    last if $stats->{slabs_moved} > 0;
+}
+cmp_ok($stats->{slabs_moved}, '>', 0, "page moved despite magazines");
+$slabs = mem_stats($sock, "slabs");
+is($slabs->{"$big:total_pages"}, $before - 1, "source class lost a page");
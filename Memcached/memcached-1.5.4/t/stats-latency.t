@@ -0,0 +1,62 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 118;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' latency');
+is($stats->{'get:count'}, 0, "no gets timed yet");
+ok(!exists $stats->{'get:p50_us'}, "no percentiles without samples");
+
+for my $i (1 .. 50) {
+    print $sock "set k$i 0 0 " . length($i) . "\r\n$i\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored k$i");
+}
+mem_get_is($sock, "k$_", $_) for 1 .. 50;
+print $sock "get missing\r\n";
+is(scalar <$sock>, "END\r\n", "miss");
+print $sock "incr k1 1\r\n";
+is(scalar <$sock>, "2\r\n", "incr");
+print $sock "decr k1 1\r\n";
+is(scalar <$sock>, "1\r\n", "decr");
+print $sock "delete k2\r\n";
+is(scalar <$sock>, "DELETED\r\n", "delete");
+# noreply commands are timed too
+print $sock "set k3 0 0 1 noreply\r\nx\r\n";
+
+$stats = mem_stats($sock, ' latency');
+is($stats->{'get:count'}, 51, "gets and misses timed");
+is($stats->{'set:count'}, 51, "sets timed");
+is($stats->{'incr:count'}, 2, "incr and decr timed");
+is($stats->{'delete:count'}, 1, "delete timed");
+
+my $get = { map { $_ => $stats->{"get:$_"} } qw(p50_us p90_us p99_us p999_us max_us mean_us) };
+ok($get->{p50_us} > 0, "p50 measured");
+ok($get->{p50_us} <= $get->{p90_us} && $get->{p90_us} <= $get->{p99_us}
+   && $get->{p99_us} <= $get->{p999_us}, "percentiles ordered");
+ok($get->{p999_us} <= $get->{max_us}, "percentiles bounded by max");
+ok($get->{mean_us} <= $get->{max_us}, "mean bounded by max");
+
+# binary protocol commands land in the same histograms
+my $bsock = $server->new_sock;
+print $bsock pack("CCnCCnNNNN", 0x80, 0x00, 2, 0, 0, 0, 2, 0, 0, 0) . "k4";
+read($bsock, my $hdr, 24);
+my ($magic, $op, $keylen, $extlen, $dt, $status, $bodylen) = unpack("CCnCCnN", $hdr);
+read($bsock, my $body, $bodylen);
+is($status, 0, "binary get hit");
+# the get is recorded once its response is written; a NOOP orders after it
+print $bsock pack("CCnCCnNNNN", 0x80, 0x0A, 0, 0, 0, 0, 0, 0, 0, 0);
+read($bsock, $hdr, 24);
+$stats = mem_stats($sock, ' latency');
+is($stats->{'get:count'}, 52, "binary get timed");
+
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "stats reset");
+$stats = mem_stats($sock, ' latency');
+is($stats->{'set:count'}, 0, "histograms reset");
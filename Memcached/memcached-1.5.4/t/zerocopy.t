@@ -0,0 +1,87 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if ($^O ne 'linux') {
+    plan skip_all => 'MSG_ZEROCOPY is Linux only';
+}
+plan tests => 17;
+
+# MSG_ZEROCOPY needs TCP, the tests default to a unix socket
+my $server = new_memcached('-o zerocopy_threshold=65536 -l 127.0.0.1');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{zerocopy_threshold}, 65536, "zerocopy_threshold setting");
+
+sub value {
+    my ($len, $seed) = @_;
+    return join('', map { chr(65 + ($_ + $seed) % 26) } 1 .. $len);
+}
+
+my $big = value(300 * 1024, 0);
+my $chunked = value(700 * 1024, 7);
+
+print $sock "set small 0 0 5\r\nhello\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored small value");
+my $before = mem_stats($sock);
+mem_get_is($sock, "small", "hello", "small value");
+is(mem_stats($sock)->{zerocopy_sends}, $before->{zerocopy_sends},
+   "small values are copied");
+
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big value");
+print $sock "set chunked 0 0 " . length($chunked) . "\r\n$chunked\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored chunked value");
+
+mem_get_is($sock, "big", $big, "big value");
+mem_get_is($sock, "chunked", $chunked, "chunked value");
+
+# value headers are still copied: mixing keys keeps the framing intact
+print $sock "get big small chunked\r\n";
+my @got;
+while (my $line = <$sock>) {
+    last if $line eq "END\r\n";
+    my ($key, $len) = $line =~ /^VALUE (\S+) 0 (\d+)\r\n/;
+    read($sock, my $data, $len + 2);
+    push @got, $key, substr($data, 0, $len);
+}
+is_deeply(\@got, ["big", $big, "small", "hello", "chunked", $chunked],
+          "multiget with big and small values");
+
+# replaced right after being sent, likely before the kernel is done with
+# it; the held copy must not be overwritten
+my $big2 = value(300 * 1024, 3);
+print $sock "get big\r\n";
+my $line = <$sock>;
+read($sock, my $data, length($big) + 2);
+is(substr($data, 0, length($big)), $big, "value sent before replace");
+is(scalar <$sock>, "END\r\n", "end of get");
+print $sock "set big 0 0 " . length($big2) . "\r\n$big2\r\n";
+is(scalar <$sock>, "STORED\r\n", "replaced big value");
+mem_get_is($sock, "big", $big2, "replaced value");
+
+my $stats = mem_stats($sock);
+cmp_ok($stats->{zerocopy_sends}, '>', 0, "big values sent with MSG_ZEROCOPY");
+
+# clients that go away with the value unread: the closed connections keep
+# the items until the kernel is done sending them, so the memory is not
+# handed out again with the old bytes still queued
+for my $i (1 .. 20) {
+    my $gone = $server->new_sock;
+    print $gone "get big chunked\r\n";
+    close($gone);
+    print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+    <$sock>;
+    print $sock "set big 0 0 " . length($big2) . "\r\n$big2\r\n";
+    <$sock>;
+}
+mem_get_is($sock, "big", $big2, "big value after unread sends");
+mem_get_is($sock, "chunked", $chunked, "chunked value after unread sends");
+my $fresh = $server->new_sock;
+mem_get_is($fresh, "big", $big2, "new connection after unread sends");
@@ -124,6 +124,48 @@ void item_unlock(uint32_t hv)
     mutex_unlock(&item_locks[hv & hashmask(item_lock_hashpower)]);
 }
 
+#ifdef HAVE_LOCKFREE_READS
+/* Bumped by lockfree_read_sync(); readers publish the value they saw. */
+static uint64_t lockfree_epoch = 1;
+
+/* Marks the start of a lock-free hash lookup by a worker thread. The full
+ * barrier orders our epoch store before any load of the hash table, pairing
+ * with the one in lockfree_read_sync(). */
+static inline void lockfree_read_begin(LIBEVENT_THREAD *me)
+{
+    __atomic_store_n(&me->lockfree_epoch,
+                     __atomic_load_n(&lockfree_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void lockfree_read_end(LIBEVENT_THREAD *me)
+{
+    __atomic_store_n(&me->lockfree_epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Waits until every worker thread has finished any lock-free lookup that
+ * started before this call. Anything unpublished beforehand (an old hash
+ * table, a slab page that is about to change class) can't be reached by
+ * readers afterwards. Must not be called with item locks held. */
+void lockfree_read_sync(void)
+{
+    uint64_t epoch = __sync_add_and_fetch(&lockfree_epoch, 1);
+    int i;
+
+    for (i = 0; i < settings.num_threads; i++)
+    {
+        uint64_t seen;
+        while ((seen = __atomic_load_n(&threads[i].lockfree_epoch,
+                                       __ATOMIC_ACQUIRE)) != 0 &&
+               seen < epoch)
+        {
+            usleep(10);
+        }
+    }
+}
+#endif
+
 static void wait_for_thread_registration(int nthreads)
 {
     while (init_count < nthreads)
@@ -419,6 +461,23 @@ static void *worker_libevent(void *arg)
     {
         abort();
     }
+    if (settings.slab_magazine_size > 0)
+    {
+        me->slab_magazine = slabs_magazine_create();
+        if (me->slab_magazine == NULL)
+        {
+            abort();
+        }
+    }
+    if (settings.hotkey_sample_rate > 0)
+    {
+        me->hotkeys = hotkeys_create();
+        if (me->hotkeys == NULL)
+        {
+            abort();
+        }
+        me->hotkeys_countdown = settings.hotkey_sample_rate;
+    }
 
     if (settings.drop_privileges)
     {
@@ -493,6 +552,18 @@ static void thread_libevent_process(int fd, short which, void *arg)
             else
             {
                 c->thread = me;
+                if (item->init_state == conn_listening)
+                {
+                    /* -o reuseport: this thread owns the listener */
+                    c->next = me->listen_conns;
+                    me->listen_conns = c;
+                }
+                else if (item->init_state == conn_new_cmd)
+                {
+                    pthread_mutex_lock(&me->stats.mutex);
+                    me->stats.conn_accepts++;
+                    pthread_mutex_unlock(&me->stats.mutex);
+                }
             }
             break;
 
@@ -532,6 +603,23 @@ static int last_thread = -1;
  */
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
                        int read_buffer_size, enum network_transport transport)
+{
+    // 求余法
+    int tid = (last_thread + 1) % settings.num_threads;
+
+    last_thread = tid;
+
+    dispatch_conn_new_thread(tid, sfd, init_state, event_flags,
+                             read_buffer_size, transport);
+}
+
+/*
+ * Hands a connection to a specific worker thread. Used directly for the
+ * per-worker listening sockets of -o reuseport.
+ */
+void dispatch_conn_new_thread(int tid, int sfd, enum conn_states init_state,
+                              int event_flags, int read_buffer_size,
+                              enum network_transport transport)
 {
     CQ_ITEM *item = cqi_new();
     char buf[1];
@@ -543,13 +631,8 @@ void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
         return;
     }
 
-    // 求余法
-    int tid = (last_thread + 1) % settings.num_threads;
-
     LIBEVENT_THREAD *thread = threads + tid;
 
-    last_thread = tid;
-
     item->sfd = sfd;
     item->init_state = init_state;
     item->event_flags = event_flags;
@@ -632,21 +715,64 @@ item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbyt
  */
 ////根据key信息和key的长度信息读取数据
 item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
+    return item_get_hv(key, nkey, hash(key, nkey), c, do_update);
+}
+
+/* Same as item_get(), for callers that already hashed the key (multiget
+ * batches hash and prefetch all of their keys first). */
+item *item_get_hv(const char *key, const size_t nkey, const uint32_t hv,
+                  conn *c, const bool do_update)
 {
     item *it;
-    uint32_t hv;
-    hv = hash(key, nkey);
+#ifdef HAVE_LOCKFREE_READS
+    if (settings.lockfree_reads)
+    {
+        bool done;
+        lockfree_read_begin(c->thread);
+        done = item_get_lockfree(key, nkey, hv, c, do_update, &it);
+        lockfree_read_end(c->thread);
+        if (done)
+            return it;
+    }
+#endif
     item_lock(hv);////获得分段锁信息，如果未进行扩容，则item的hash表是多个hash桶共用同一个锁，即是分段的锁
     it = do_item_get(key, nkey, hv, c, do_update); ////执行get操作
     item_unlock(hv);
     return it;
 }
 
+/*
+ * Prefetches the hash buckets of a batch of keys ahead of looking them up
+ * with item_get_hv(), so the cache misses of the whole batch overlap instead
+ * of being taken one key at a time.
+ */
+void item_prefetch(const uint32_t *hvs, const int count, conn *c)
+{
+    int i;
+#ifdef HAVE_LOCKFREE_READS
+    if (settings.lockfree_reads)
+        lockfree_read_begin(c->thread);
+#endif
+    for (i = 0; i < count; i++)
+        assoc_prefetch_bucket(hvs[i]);
+    for (i = 0; i < count; i++)
+        assoc_prefetch_item(hvs[i]);
+#ifdef HAVE_LOCKFREE_READS
+    if (settings.lockfree_reads)
+        lockfree_read_end(c->thread);
+#endif
+}
+
 item *item_touch(const char *key, size_t nkey, uint32_t exptime, conn *c)
+{
+    return item_touch_hv(key, nkey, hash(key, nkey), exptime, c);
+}
+
+item *item_touch_hv(const char *key, size_t nkey, const uint32_t hv,
+                    uint32_t exptime, conn *c)
 {
     item *it;
-    uint32_t hv;
-    hv = hash(key, nkey);
     item_lock(hv);
     it = do_item_touch(key, nkey, exptime, hv, c);
     item_unlock(hv);
@@ -763,6 +889,7 @@ void threadlocal_stats_reset(void)
                sizeof(threads[ii].stats.slab_stats));
         memset(&threads[ii].stats.lru_hits, 0,
                sizeof(uint64_t) * POWER_LARGEST);
+        memset(&threads[ii].latency, 0, sizeof(threads[ii].latency));
 
         pthread_mutex_unlock(&threads[ii].stats.mutex);
     }
@@ -803,6 +930,58 @@ void threadlocal_stats_aggregate(struct thread_stats *stats)
     }
 }
 
+/* "stats threads": per worker counters, to see how evenly connections are
+ * spread over the workers (e.g. with -o reuseport). */
+void threadlocal_stats_threads(ADD_STAT add_stats, void *c)
+{
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+    int ii;
+
+    for (ii = 0; ii < settings.num_threads; ++ii)
+    {
+        uint64_t accepts;
+        int listeners = 0;
+        conn *l;
+
+        pthread_mutex_lock(&threads[ii].stats.mutex);
+        accepts = threads[ii].stats.conn_accepts;
+        pthread_mutex_unlock(&threads[ii].stats.mutex);
+        /* only written by the owning thread while it starts up */
+        for (l = threads[ii].listen_conns; l != NULL; l = l->next)
+            listeners++;
+
+        APPEND_NUM_STAT(ii, "conn_accepts", "%llu", (unsigned long long)accepts);
+        APPEND_NUM_STAT(ii, "listeners", "%d", listeners);
+    }
+}
+
+/* Merges the latency histograms of all workers, for "stats latency". Kept
+ * out of threadlocal_stats_aggregate() so that plain "stats" doesn't pay
+ * for copying them. */
+void threadlocal_latency_aggregate(struct latency_hist *out)
+{
+    int ii, cmd, b;
+
+    memset(out, 0, sizeof(struct latency_hist) * LATENCY_CMD_COUNT);
+    for (ii = 0; ii < settings.num_threads; ++ii)
+    {
+        pthread_mutex_lock(&threads[ii].stats.mutex);
+        for (cmd = 0; cmd < LATENCY_CMD_COUNT; cmd++)
+        {
+            struct latency_hist *h = &threads[ii].latency[cmd];
+            out[cmd].count += h->count;
+            out[cmd].sum += h->sum;
+            if (h->max > out[cmd].max)
+                out[cmd].max = h->max;
+            for (b = 0; b < LATENCY_BUCKETS; b++)
+                out[cmd].buckets[b] += h->buckets[b];
+        }
+        pthread_mutex_unlock(&threads[ii].stats.mutex);
+    }
+}
+
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out)
 {
     int sid;
@@ -95,6 +95,7 @@
 #include "evthread-internal.h"
 #include "evbuffer-internal.h"
 #include "bufferevent-internal.h"
+#include "event-internal.h"
 
 /* some systems do not have MAP_FAILED */
 #ifndef MAP_FAILED
@@ -191,6 +192,156 @@ evbuffer_chain_new(size_t size)
 	return (chain);
 }
 
+/* The size class of a pooled chain of to_alloc bytes, or -1. */
+static inline int
+evbuffer_pool_class(size_t to_alloc)
+{
+	int cls = 0;
+	size_t sz = MIN_BUFFER_SIZE;
+
+	while (sz < to_alloc) {
+		if (++cls == EVBUFFER_POOL_CLASSES)
+			return -1;
+		sz <<= 1;
+	}
+	return cls;
+}
+
+/* Like evbuffer_chain_new(), but for chains that hold buf's own data: if
+ * buf has a pool and we are in its thread, the memory comes from there. */
+static struct evbuffer_chain *
+evbuffer_chain_new_membuf(struct evbuffer *buf, size_t size)
+{
+	struct evbuffer_chain_pool *pool = buf->pool;
+	struct evbuffer_chain *chain;
+	size_t to_alloc;
+	int cls;
+
+	if (pool == NULL || pool->dead || pool->owner != EVTHREAD_GET_ID() ||
+	    size > EVBUFFER_CHAIN_MAX - EVBUFFER_CHAIN_SIZE)
+		return evbuffer_chain_new(size);
+	cls = evbuffer_pool_class(size + EVBUFFER_CHAIN_SIZE);
+	if (cls < 0)
+		return evbuffer_chain_new(size);
+	to_alloc = (size_t)MIN_BUFFER_SIZE << cls;
+
+	if ((chain = pool->free[cls]) != NULL) {
+		pool->free[cls] = chain->next;
+		--pool->n_free[cls];
+		++pool->hits;
+	} else {
+		if ((chain = mm_malloc(to_alloc)) == NULL)
+			return (NULL);
+		++pool->misses;
+	}
+	++pool->allocated;
+
+	memset(chain, 0, EVBUFFER_CHAIN_SIZE);
+	chain->buffer_len = to_alloc - EVBUFFER_CHAIN_SIZE;
+	chain->buffer = EVBUFFER_CHAIN_EXTRA(unsigned char, chain);
+	chain->refcnt = 1;
+	chain->pool = pool;
+
+	return (chain);
+}
+
+/* Give a chain back to the pool it came from. */
+static void
+evbuffer_chain_pool_put(struct evbuffer_chain *chain)
+{
+	struct evbuffer_chain_pool *pool = chain->pool;
+	int cls, done;
+
+	if (!pool->dead && pool->owner == EVTHREAD_GET_ID()) {
+		--pool->allocated;
+		cls = evbuffer_pool_class(chain->buffer_len + EVBUFFER_CHAIN_SIZE);
+		if (pool->n_free[cls] < EVBUFFER_POOL_MAX_FREE) {
+			chain->next = pool->free[cls];
+			pool->free[cls] = chain;
+			++pool->n_free[cls];
+		} else {
+			mm_free(chain);
+		}
+		return;
+	}
+
+	mm_free(chain);
+	EVLOCK_LOCK(pool->lock, 0);
+	++pool->released;
+	done = pool->dead && pool->released == pool->allocated;
+	EVLOCK_UNLOCK(pool->lock, 0);
+	if (done) {
+		EVTHREAD_FREE_LOCK(pool->lock, 0);
+		mm_free(pool);
+	}
+}
+
+struct evbuffer_chain_pool *
+evbuffer_chain_pool_new_(void)
+{
+	struct evbuffer_chain_pool *pool;
+
+	if ((pool = mm_calloc(1, sizeof(struct evbuffer_chain_pool))) == NULL)
+		return (NULL);
+	pool->owner = EVTHREAD_GET_ID();
+	EVTHREAD_ALLOC_LOCK(pool->lock, 0);
+	return (pool);
+}
+
+void
+evbuffer_chain_pool_free_(struct evbuffer_chain_pool *pool)
+{
+	struct evbuffer_chain *chain, *next;
+	int i, done;
+
+	for (i = 0; i < EVBUFFER_POOL_CLASSES; ++i) {
+		for (chain = pool->free[i]; chain; chain = next) {
+			next = chain->next;
+			mm_free(chain);
+		}
+		pool->free[i] = NULL;
+		pool->n_free[i] = 0;
+	}
+
+	EVLOCK_LOCK(pool->lock, 0);
+	pool->dead = 1;
+	done = pool->released == pool->allocated;
+	EVLOCK_UNLOCK(pool->lock, 0);
+	if (done) {
+		EVTHREAD_FREE_LOCK(pool->lock, 0);
+		mm_free(pool);
+	}
+}
+
+void
+evbuffer_set_chain_pool_(struct evbuffer *buf,
+    struct evbuffer_chain_pool *pool)
+{
+	EVBUFFER_LOCK(buf);
+	buf->pool = pool;
+	EVBUFFER_UNLOCK(buf);
+}
+
+int
+evbuffer_get_pool_stats(struct event_base *base,
+    struct evbuffer_pool_stats *stats)
+{
+	struct evbuffer_chain_pool *pool = base->buffer_pool;
+	int i;
+
+	if (pool == NULL)
+		return (-1);
+	memset(stats, 0, sizeof(*stats));
+	stats->hits = pool->hits;
+	stats->misses = pool->misses;
+	for (i = 0; i < EVBUFFER_POOL_CLASSES; ++i) {
+		stats->cached += pool->n_free[i];
+		stats->cached_bytes +=
+		    (size_t)pool->n_free[i] * ((size_t)MIN_BUFFER_SIZE << i);
+	}
+	return (0);
+}
+
 static inline void
 evbuffer_chain_free(struct evbuffer_chain *chain)
 {
@@ -248,7 +399,10 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 		evbuffer_decref_and_unlock_(info->source);
 	}
 
-	mm_free(chain);
+	if (chain->pool)
+		evbuffer_chain_pool_put(chain);
+	else
+		mm_free(chain);
 }
 
 static void
@@ -329,7 +483,7 @@ static inline struct evbuffer_chain *
 evbuffer_chain_insert_new(struct evbuffer *buf, size_t datlen)
 {
 	struct evbuffer_chain *chain;
-	if ((chain = evbuffer_chain_new(datlen)) == NULL)
+	if ((chain = evbuffer_chain_new_membuf(buf, datlen)) == NULL)
 		return NULL;
 	evbuffer_chain_insert(buf, chain);
 	return chain;
@@ -831,7 +985,7 @@ PRESERVE_PINNED(struct evbuffer *src, struct evbuffer_chain **first,
 		struct evbuffer_chain *tmp;
 
 		EVUTIL_ASSERT(pinned == src->last_with_datap);
-		tmp = evbuffer_chain_new(chain->off);
+		tmp = evbuffer_chain_new_membuf(src, chain->off);
 		if (!tmp)
 			return -1;
 		memcpy(tmp->buffer, chain->buffer + chain->misalign,
@@ -1400,7 +1554,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 		size -= old_off;
 		chain = chain->next;
 	} else {
-		if ((tmp = evbuffer_chain_new(size)) == NULL) {
+		if ((tmp = evbuffer_chain_new_membuf(buf, size)) == NULL) {
 			event_warn("%s: out of memory", __func__);
 			goto done;
 		}
@@ -1746,7 +1900,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 	/* If there are no chains allocated for this buffer, allocate one
 	 * big enough to hold all the data. */
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new_membuf(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
@@ -1788,7 +1942,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 		to_alloc <<= 1;
 	if (datlen > to_alloc)
 		to_alloc = datlen;
-	tmp = evbuffer_chain_new(to_alloc);
+	tmp = evbuffer_chain_new_membuf(buf, to_alloc);
 	if (tmp == NULL)
 		goto done;
 
@@ -1834,7 +1988,7 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 	chain = buf->first;
 
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new_membuf(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
@@ -1874,7 +2028,7 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 	}
 
 	/* we need to add another chain */
-	if ((tmp = evbuffer_chain_new(datlen)) == NULL)
+	if ((tmp = evbuffer_chain_new_membuf(buf, datlen)) == NULL)
 		goto done;
 	buf->first = tmp;
 	if (buf->last_with_datap == &buf->first)
@@ -2003,7 +2157,7 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 		 * MAX_TO_COPY_IN_EXPAND bytes. */
 		/* figure out how much space we need */
 		size_t length = chain->off + datlen;
-		struct evbuffer_chain *tmp = evbuffer_chain_new(length);
+		struct evbuffer_chain *tmp = evbuffer_chain_new_membuf(buf, length);
 		if (tmp == NULL)
 			goto err;
 
@@ -2049,7 +2203,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 	if (chain == NULL || (chain->flags & EVBUFFER_IMMUTABLE)) {
 		/* There is no last chunk, or we can't touch the last chunk.
 		 * Just add a new chunk. */
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new_membuf(buf, datlen);
 		if (chain == NULL)
 			return (-1);
 
@@ -2092,7 +2246,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 		 * chains; we can add another. */
 		EVUTIL_ASSERT(chain == NULL);
 
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new_membuf(buf, datlen - avail);
 		if (tmp == NULL)
 			return (-1);
 
@@ -2124,7 +2278,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 			evbuffer_chain_free(chain);
 		}
 		EVUTIL_ASSERT(datlen >= avail);
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new_membuf(buf, datlen - avail);
 		if (tmp == NULL) {
 			if (rmv_all) {
 				ZERO_CHAIN(buf);
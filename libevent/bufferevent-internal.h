@@ -73,22 +73,32 @@ extern "C" {
 /* On a base bufferevent, for reading: used when a filter has choked this
  * (underlying) bufferevent because it has stopped reading from it. */
 #define BEV_SUSPEND_FILT_READ 0x10
+/* On a bufferevent being forwarded, for reading: used while the data is
+ * moved by bufferevent_forward() rather than read into the input buffer,
+ * or while the destination is behind. */
+#define BEV_SUSPEND_FORWARD 0x20
 
 typedef ev_uint16_t bufferevent_suspend_flags;
 
 struct bufferevent_rate_limit_group {
 	/** List of all members in the group */
 	LIST_HEAD(rlim_group_member_list, bufferevent_private) members;
-	/** Current limits for the group. */
+	/** Current limits for the group.  The read and write limits are
+	 * decremented without taking 'lock' where atomics are available;
+	 * see bufferevent_ratelim.c. */
 	struct ev_token_bucket rate_limit;
 	struct ev_token_bucket_cfg rate_limit_cfg;
 
 	/** True iff we don't want to read from any member of the group.until
-	 * the token bucket refills.  */
-	unsigned read_suspended : 1;
+	 * the token bucket refills.  Only set with 'lock' held, but may be
+	 * read without it. */
+	int read_suspended;
 	/** True iff we don't want to write from any member of the group.until
-	 * the token bucket refills.  */
-	unsigned write_suspended : 1;
+	 * the token bucket refills.  As read_suspended. */
+	int write_suspended;
+	/** True while the refill callback is unsuspending members.  Only set
+	 * with 'lock' held, but may be read without it. */
+	int unsuspending;
 	/** True iff we were unable to suspend one of the bufferevents in the
 	 * group for reading the last time we tried, and we should try
 	 * again. */
@@ -172,6 +182,9 @@ struct bufferevent_private {
 	/** Flag: set if a connect failed prematurely; this is a hack for
 	 * getting around the bufferevent abstraction. */
 	unsigned connection_refused : 1;
+	/** Flag: set while bufferevent_forward() is moving the data we read
+	 * to another bufferevent. */
+	unsigned forwarding : 1;
 	/** Set to the events pending if we have deferred callbacks and
 	 * an events callback is pending. */
 	short eventcb_pending;
@@ -230,6 +243,10 @@ struct bufferevent_private {
 	} conn_address;
 
 	struct evdns_getaddrinfo_request *dns_request;
+
+	/** State for bufferevent_forward(), if this bufferevent has ever
+	 * been forwarded. */
+	struct bufferevent_forward *forward;
 };
 
 /** Possible operations for a control callback. */
@@ -340,6 +357,16 @@ void bufferevent_suspend_write_(struct bufferevent *bufev, bufferevent_suspend_f
  * writing if there are no conditions left. */
 void bufferevent_unsuspend_write_(struct bufferevent *bufev, bufferevent_suspend_flags what);
 
+/** Internal: stop forwarding from bufev, if it is being forwarded. Must
+ * hold the lock on bufev. */
+void bufferevent_forward_stop_(struct bufferevent *bufev);
+/** Internal: store in cbs the callbacks that must be finalized along with
+ * bufev for its forwarding state, and return how many there were. */
+int bufferevent_forward_get_callbacks_(struct bufferevent *bufev,
+    struct event_callback **cbs, int max_cbs);
+/** Internal: free the forwarding state of bufev when it is finalized. */
+void bufferevent_forward_free_(struct bufferevent *bufev);
+
 #define bufferevent_wm_suspend_read(b) \
 	bufferevent_suspend_read_((b), BEV_SUSPEND_WM)
 #define bufferevent_wm_unsuspend_read(b) \
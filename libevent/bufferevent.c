@@ -223,7 +223,8 @@ bufferevent_run_readcb_(struct bufferevent *bufev, int options)
 	/* Requires that we hold the lock and a reference */
 	struct bufferevent_private *p =
 	    EVUTIL_UPCAST(bufev, struct bufferevent_private, bev);
-	if (bufev->readcb == NULL)
+	/* While forwarding, whatever arrives belongs to the destination. */
+	if (bufev->readcb == NULL || p->forwarding)
 		return;
 	if ((p->options|options) & BEV_OPT_DEFER_CALLBACKS) {
 		p->readcb_pending = 1;
@@ -308,6 +309,11 @@ bufferevent_init_common_(struct bufferevent_private *bufev_private,
 		}
 	}
 
+	if (base && base->buffer_pool) {
+		evbuffer_set_chain_pool_(bufev->input, base->buffer_pool);
+		evbuffer_set_chain_pool_(bufev->output, base->buffer_pool);
+	}
+
 	bufev_private->refcnt = 1;
 	bufev->ev_base = base;
 
@@ -697,6 +703,9 @@ bufferevent_decref_and_unlock_(struct bufferevent *bufev)
 		return 0;
 	}
 
+	if (bufev_private->forward)
+		bufferevent_forward_stop_(bufev);
+
 	if (bufev->be_ops->unlink)
 		bufev->be_ops->unlink(bufev);
 
@@ -711,6 +720,9 @@ bufferevent_decref_and_unlock_(struct bufferevent *bufev)
 		if (event_initialized(e))
 			cbs[n_cbs++] = &e->ev_evcallback;
 	}
+	if (bufev_private->forward)
+		n_cbs += bufferevent_forward_get_callbacks_(bufev, cbs+n_cbs,
+		    MAX_CBS-n_cbs);
 	n_cbs += evbuffer_get_callbacks_(bufev->input, cbs+n_cbs, MAX_CBS-n_cbs);
 	n_cbs += evbuffer_get_callbacks_(bufev->output, cbs+n_cbs, MAX_CBS-n_cbs);
 
@@ -752,6 +764,8 @@ bufferevent_finalize_cb_(struct event_callback *evcb, void *arg_)
 		bufev_private->rate_limiting = NULL;
 	}
 
+	if (bufev_private->forward)
+		bufferevent_forward_free_(bufev);
 
 	BEV_UNLOCK(bufev);
 
@@ -786,7 +800,14 @@ bufferevent_decref(struct bufferevent *bufev)
 void
 bufferevent_free(struct bufferevent *bufev)
 {
+	struct bufferevent_private *bufev_private = BEV_UPCAST(bufev);
+
 	BEV_LOCK(bufev);
+	/* Stop forwarding now, not when the last reference goes away: two
+	 * bufferevents forwarded to each other hold references on each
+	 * other. */
+	if (bufev_private->forward)
+		bufferevent_forward_stop_(bufev);
 	bufferevent_setcb(bufev, NULL, NULL, NULL, NULL);
 	bufferevent_cancel_all_(bufev);
 	bufferevent_decref_and_unlock_(bufev);
@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * bufferevent_forward(): move everything one bufferevent reads to another
+ * one.
+ *
+ * Between two socket bufferevents the data never enters user space: it is
+ * spliced from the source socket into a pipe, and from the pipe into the
+ * destination socket.  The source bufferevent's own reading is suspended
+ * (BEV_SUSPEND_FORWARD) and we watch its fd with an event of our own; while
+ * the pipe holds data the destination's own writing is suspended too, so
+ * anything the user writes to it queues behind what is in flight.  Before
+ * each splice we wait for the destination's output buffer to drain, which
+ * keeps the two streams in order.
+ *
+ * For anything else (filters, pairs, rate-limited bufferevents, no
+ * splice()) we fall back to the copying path: a callback on the source's
+ * input buffer hands each chunk to the destination's output buffer with
+ * evbuffer_add_buffer(), as be_pair_transfer() does.
+ *
+ * Locks are always taken source first.  Callbacks that run under the
+ * destination's lock only activate ev_resume, which does the rest from the
+ * source's side.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#include "event2/util.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/bufferevent_struct.h"
+#include "event2/event.h"
+#include "bufferevent-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "log-internal.h"
+
+#if defined(EVENT__HAVE_SPLICE) && defined(EVENT__HAVE_PIPE2)
+#define USE_SPLICE
+#endif
+
+/* In the copying path, stop reading the source once this much is waiting
+ * in the destination's output buffer, and start again below half of it. */
+#define FORWARD_HIGH_WM (256*1024)
+/* Most bytes to splice into the pipe at once: the default pipe size. */
+#define FORWARD_SPLICE_CHUNK 65536
+/* Most trips through the pipe in one callback before we let other events
+ * run. */
+#define FORWARD_MAX_ROUNDS 16
+
+struct bufferevent_forward {
+	/** The bufferevent being forwarded; this lives as long as it does. */
+	struct bufferevent *src;
+	/** Where the data goes, or NULL when not forwarding.  We hold a
+	 * reference to it. */
+	struct bufferevent *dst;
+
+	/** Callback on dst->output that notices when it drains. */
+	struct evbuffer_cb_entry *output_cb;
+	/** Copying path only: callback on src->input. */
+	struct evbuffer_cb_entry *input_cb;
+	/** Activated from output_cb, to carry on from src's side. */
+	struct event ev_resume;
+
+	/** True iff we are using splice() rather than copying. */
+	unsigned splice : 1;
+	/** Copying path: set when we have suspended reading on src because
+	 * dst was behind. */
+	unsigned paused : 1;
+	/** Splice path: set when src has reached EOF. */
+	unsigned eof : 1;
+	/** Splice path: set once EOF or an error has been reported. */
+	unsigned done : 1;
+	/** Splice path: set once any data has been spliced. */
+	unsigned spliced : 1;
+
+#ifdef USE_SPLICE
+	/** Splice path: src's fd is readable. */
+	struct event ev_read;
+	/** Splice path: dst's fd is writable; only added while the pipe
+	 * holds data. */
+	struct event ev_write;
+	/** The pipe we splice through. */
+	int pipe[2];
+	/** How many bytes are in the pipe. */
+	size_t pipe_len;
+#endif
+};
+
+static void forward_resume_cb(evutil_socket_t fd, short what, void *arg);
+static void forward_copy_start(struct bufferevent_forward *fwd);
+
+static void
+forward_output_cb(struct evbuffer *buf, const struct evbuffer_cb_info *info,
+    void *arg)
+{
+	struct bufferevent_forward *fwd = arg;
+	size_t len;
+
+	if (!info->n_deleted)
+		return;
+	len = evbuffer_get_length(buf);
+	if (fwd->splice ? len == 0 : (fwd->paused && len <= FORWARD_HIGH_WM/2))
+		event_active(&fwd->ev_resume, EV_WRITE, 1);
+}
+
+static void
+forward_input_cb(struct evbuffer *buf, const struct evbuffer_cb_info *info,
+    void *arg)
+{
+	struct bufferevent_forward *fwd = arg;
+	struct bufferevent *dst = fwd->dst;
+
+	if (!info->n_added || !dst || !evbuffer_get_length(buf))
+		return;
+	BEV_LOCK(dst);
+	evbuffer_add_buffer(dst->output, buf);
+	if (!fwd->paused &&
+	    evbuffer_get_length(dst->output) >= FORWARD_HIGH_WM) {
+		fwd->paused = 1;
+		bufferevent_suspend_read_(fwd->src, BEV_SUSPEND_FORWARD);
+	}
+	BEV_UNLOCK(dst);
+}
+
+static void
+forward_copy_start(struct bufferevent_forward *fwd)
+{
+	struct bufferevent *src = fwd->src;
+
+	fwd->splice = 0;
+	fwd->input_cb = evbuffer_add_cb(src->input, forward_input_cb, fwd);
+	if (!fwd->input_cb)
+		event_warn("%s: evbuffer_add_cb", __func__);
+	bufferevent_unsuspend_read_(src, BEV_SUSPEND_FORWARD);
+}
+
+#ifdef USE_SPLICE
+static int
+forward_can_splice(struct bufferevent *src, struct bufferevent *dst)
+{
+	struct bufferevent_private *src_p = BEV_UPCAST(src);
+	struct bufferevent_private *dst_p = BEV_UPCAST(dst);
+
+	return BEV_IS_SOCKET(src) && BEV_IS_SOCKET(dst) &&
+	    src->ev_base == dst->ev_base &&
+	    !src_p->rate_limiting && !dst_p->rate_limiting &&
+	    !src_p->connecting && !dst_p->connecting &&
+	    bufferevent_getfd(src) >= 0 && bufferevent_getfd(dst) >= 0;
+}
+
+static void
+forward_splice_close(struct bufferevent_forward *fwd)
+{
+	event_del_noblock(&fwd->ev_read);
+	event_del_noblock(&fwd->ev_write);
+	if (fwd->pipe[0] >= 0)
+		close(fwd->pipe[0]);
+	if (fwd->pipe[1] >= 0)
+		close(fwd->pipe[1]);
+	fwd->pipe[0] = fwd->pipe[1] = -1;
+	fwd->pipe_len = 0;
+}
+
+/* Report EOF or an error on bev, and stop moving data.  As in
+ * bufferevent_readcb() and bufferevent_writecb(), the side that failed is
+ * disabled first. */
+static void
+forward_splice_finish(struct bufferevent_forward *fwd, struct bufferevent *bev,
+    short what)
+{
+	int err = EVUTIL_SOCKET_ERROR();
+
+	fwd->done = 1;
+	event_del_noblock(&fwd->ev_read);
+	event_del_noblock(&fwd->ev_write);
+	bufferevent_disable(bev, (what & BEV_EVENT_READING) ? EV_READ : EV_WRITE);
+	EVUTIL_SET_SOCKET_ERROR(err);
+	bufferevent_run_eventcb_(bev, what, 0);
+}
+
+/* Move as much as we can through the pipe, then decide what to wait for.
+ * Requires that we hold the locks and references on src and dst. */
+static void
+forward_splice_run(struct bufferevent_forward *fwd)
+{
+	struct bufferevent *src = fwd->src, *dst = fwd->dst;
+	evutil_socket_t in = bufferevent_getfd(src);
+	evutil_socket_t out = bufferevent_getfd(dst);
+	int rounds;
+	ssize_t n;
+
+	if (fwd->done)
+		return;
+
+	for (rounds = 0; rounds < FORWARD_MAX_ROUNDS; ++rounds) {
+		if (fwd->pipe_len) {
+			n = splice(fwd->pipe[0], NULL, out, NULL, fwd->pipe_len,
+			    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+			if (n < 0) {
+				if (EVUTIL_ERR_RW_RETRIABLE(errno))
+					break;
+				forward_splice_finish(fwd, dst,
+				    BEV_EVENT_ERROR|BEV_EVENT_WRITING);
+				return;
+			}
+			fwd->pipe_len -= n;
+			continue;
+		}
+		if (fwd->eof || evbuffer_get_length(dst->output))
+			break;
+		n = splice(in, NULL, fwd->pipe[1], NULL, FORWARD_SPLICE_CHUNK,
+		    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n == 0) {
+			fwd->eof = 1;
+			break;
+		} else if (n < 0) {
+			if (EVUTIL_ERR_RW_RETRIABLE(errno))
+				break;
+			if (!fwd->spliced && (errno == EINVAL ||
+				errno == ENOSYS)) {
+				/* This kind of socket can't be spliced
+				 * after all: copy instead. */
+				forward_splice_close(fwd);
+				forward_copy_start(fwd);
+				return;
+			}
+			forward_splice_finish(fwd, src,
+			    BEV_EVENT_ERROR|BEV_EVENT_READING);
+			return;
+		}
+		fwd->spliced = 1;
+		fwd->pipe_len = n;
+	}
+
+	if (fwd->pipe_len) {
+		/* dst is full: hold everything else back until the pipe
+		 * has drained. */
+		bufferevent_suspend_write_(dst, BEV_SUSPEND_FORWARD);
+		event_del_noblock(&fwd->ev_read);
+		event_add(&fwd->ev_write, NULL);
+		return;
+	}
+	event_del_noblock(&fwd->ev_write);
+	if (BEV_UPCAST(dst)->write_suspended & BEV_SUSPEND_FORWARD)
+		bufferevent_unsuspend_write_(dst, BEV_SUSPEND_FORWARD);
+	if (fwd->eof) {
+		forward_splice_finish(fwd, src, BEV_EVENT_EOF|BEV_EVENT_READING);
+	} else if (evbuffer_get_length(dst->output)) {
+		/* Let dst write what it has first; forward_output_cb will
+		 * wake us when it is done. */
+		event_del_noblock(&fwd->ev_read);
+	} else {
+		event_add(&fwd->ev_read, NULL);
+	}
+}
+
+static int
+forward_splice_start(struct bufferevent_forward *fwd)
+{
+	struct bufferevent *src = fwd->src, *dst = fwd->dst;
+
+	if (pipe2(fwd->pipe, O_NONBLOCK|O_CLOEXEC) < 0) {
+		event_warn("%s: pipe2", __func__);
+		fwd->pipe[0] = fwd->pipe[1] = -1;
+		return -1;
+	}
+	fwd->pipe_len = 0;
+	event_assign(&fwd->ev_read, src->ev_base, bufferevent_getfd(src),
+	    EV_READ|EV_PERSIST, forward_resume_cb, fwd);
+	event_assign(&fwd->ev_write, src->ev_base, bufferevent_getfd(dst),
+	    EV_WRITE|EV_PERSIST, forward_resume_cb, fwd);
+	event_priority_set(&fwd->ev_read, event_get_priority(&src->ev_read));
+	event_priority_set(&fwd->ev_write, event_get_priority(&dst->ev_write));
+	fwd->splice = 1;
+	return 0;
+}
+#endif
+
+static void
+forward_resume_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bufferevent_forward *fwd = arg;
+	struct bufferevent *src = fwd->src, *dst;
+
+	bufferevent_incref_and_lock_(src);
+	dst = fwd->dst;
+	if (!dst) {
+		bufferevent_decref_and_unlock_(src);
+		return;
+	}
+	bufferevent_incref_and_lock_(dst);
+#ifdef USE_SPLICE
+	if (fwd->splice) {
+		forward_splice_run(fwd);
+		bufferevent_decref_and_unlock_(dst);
+		bufferevent_decref_and_unlock_(src);
+		return;
+	}
+#endif
+	if (fwd->paused &&
+	    evbuffer_get_length(dst->output) <= FORWARD_HIGH_WM/2) {
+		fwd->paused = 0;
+		bufferevent_unsuspend_read_(src, BEV_SUSPEND_FORWARD);
+	}
+	bufferevent_decref_and_unlock_(dst);
+	bufferevent_decref_and_unlock_(src);
+}
+
+int
+bufferevent_forward(struct bufferevent *src, struct bufferevent *dst)
+{
+	struct bufferevent_private *src_p = BEV_UPCAST(src);
+	struct bufferevent_forward *fwd;
+	int r = -1;
+
+	if (src == dst)
+		return -1;
+
+	bufferevent_incref_and_lock_(src);
+	fwd = src_p->forward;
+	if (fwd && fwd->dst)
+		goto done;
+	if (!fwd) {
+		if (!(fwd = mm_calloc(1, sizeof(*fwd))))
+			goto done;
+		fwd->src = src;
+#ifdef USE_SPLICE
+		fwd->pipe[0] = fwd->pipe[1] = -1;
+#endif
+		src_p->forward = fwd;
+	}
+	event_assign(&fwd->ev_resume, src->ev_base, -1, 0,
+	    forward_resume_cb, fwd);
+
+	/* This reference is dropped by bufferevent_forward_stop_(). */
+	bufferevent_incref_and_lock_(dst);
+	fwd->output_cb = evbuffer_add_cb(dst->output, forward_output_cb, fwd);
+	if (!fwd->output_cb) {
+		bufferevent_decref_and_unlock_(dst);
+		goto done;
+	}
+	fwd->dst = dst;
+	fwd->paused = fwd->eof = fwd->done = fwd->spliced = 0;
+	src_p->forwarding = 1;
+
+	/* Whatever src has already read goes first. */
+	evbuffer_add_buffer(dst->output, src->input);
+	bufferevent_suspend_read_(src, BEV_SUSPEND_FORWARD);
+	bufferevent_enable(src, EV_READ);
+
+#ifdef USE_SPLICE
+	if (forward_can_splice(src, dst) && forward_splice_start(fwd) == 0)
+		forward_splice_run(fwd);
+	else
+#endif
+		forward_copy_start(fwd);
+
+	BEV_UNLOCK(dst);
+	r = 0;
+done:
+	bufferevent_decref_and_unlock_(src);
+	return r;
+}
+
+void
+bufferevent_forward_stop_(struct bufferevent *src)
+{
+	struct bufferevent_private *src_p = BEV_UPCAST(src);
+	struct bufferevent_forward *fwd = src_p->forward;
+	struct bufferevent *dst;
+
+	if (!fwd || !(dst = fwd->dst))
+		return;
+
+	BEV_LOCK(dst);
+#ifdef USE_SPLICE
+	if (fwd->splice) {
+		/* Anything still in the pipe goes into dst's output buffer,
+		 * ahead of whatever the user writes next. */
+		while (fwd->pipe_len) {
+			int n = evbuffer_read(dst->output, fwd->pipe[0],
+			    (int)fwd->pipe_len);
+			if (n <= 0)
+				break;
+			fwd->pipe_len -= n;
+		}
+		forward_splice_close(fwd);
+		bufferevent_unsuspend_write_(dst, BEV_SUSPEND_FORWARD);
+	}
+#endif
+	if (fwd->input_cb) {
+		evbuffer_remove_cb_entry(src->input, fwd->input_cb);
+		fwd->input_cb = NULL;
+	}
+	evbuffer_remove_cb_entry(dst->output, fwd->output_cb);
+	fwd->output_cb = NULL;
+	event_del_noblock(&fwd->ev_resume);
+	fwd->dst = NULL;
+	fwd->splice = fwd->paused = 0;
+	src_p->forwarding = 0;
+	bufferevent_unsuspend_read_(src, BEV_SUSPEND_FORWARD);
+	bufferevent_decref_and_unlock_(dst);
+}
+
+int
+bufferevent_forward_stop(struct bufferevent *src)
+{
+	struct bufferevent_private *src_p = BEV_UPCAST(src);
+	int r = -1;
+
+	BEV_LOCK(src);
+	if (src_p->forward && src_p->forward->dst) {
+		bufferevent_forward_stop_(src);
+		r = 0;
+	}
+	BEV_UNLOCK(src);
+	return r;
+}
+
+int
+bufferevent_forward_get_callbacks_(struct bufferevent *src,
+    struct event_callback **cbs, int max_cbs)
+{
+	struct bufferevent_forward *fwd = BEV_UPCAST(src)->forward;
+	int n = 0;
+
+	if (n < max_cbs)
+		cbs[n++] = &fwd->ev_resume.ev_evcallback;
+#ifdef USE_SPLICE
+	if (n < max_cbs && event_initialized(&fwd->ev_read))
+		cbs[n++] = &fwd->ev_read.ev_evcallback;
+	if (n < max_cbs && event_initialized(&fwd->ev_write))
+		cbs[n++] = &fwd->ev_write.ev_evcallback;
+#endif
+	return n;
+}
+
+void
+bufferevent_forward_free_(struct bufferevent *src)
+{
+	struct bufferevent_private *src_p = BEV_UPCAST(src);
+
+	mm_free(src_p->forward);
+	src_p->forward = NULL;
+}
@@ -185,6 +185,39 @@ ev_token_bucket_cfg_free(struct ev_token_bucket_cfg *cfg)
 #define LOCK_GROUP(g) EVLOCK_LOCK((g)->lock, 0)
 #define UNLOCK_GROUP(g) EVLOCK_UNLOCK((g)->lock, 0)
 
+/* Every member of a group charges the group bucket for each read and write,
+ * so with many bufferevents on several threads the group lock becomes the
+ * bottleneck.  Where the compiler gives us lock-free atomics of the right
+ * width, the group's limits, totals, suspension flags and share are instead
+ * accessed atomically: the hot paths below (LOCK_GROUP_FAST) take no lock,
+ * and the group lock is only taken to suspend or unsuspend the members and
+ * to refill the bucket.  Elsewhere LOCK_GROUP_FAST is the group lock and the
+ * RLIM_* operations are plain loads and stores under it.
+ */
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && \
+    defined(__GCC_ATOMIC_POINTER_LOCK_FREE) && \
+    __GCC_ATOMIC_LLONG_LOCK_FREE == 2 && __GCC_ATOMIC_POINTER_LOCK_FREE == 2
+#define RLIM_ATOMIC_GROUPS
+#define LOCK_GROUP_FAST(g)
+#define UNLOCK_GROUP_FAST(g)
+#define RLIM_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define RLIM_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+/* Adds 'v' to '*p' and yields the new value. */
+#define RLIM_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+/* If '*p' is still '*expp', sets it to 'v' and yields true; otherwise loads
+ * the current value into '*expp' and yields false. */
+#define RLIM_CAS(p, expp, v)						\
+	__atomic_compare_exchange_n((p), (expp), (v), 1,		\
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define LOCK_GROUP_FAST(g) LOCK_GROUP(g)
+#define UNLOCK_GROUP_FAST(g) UNLOCK_GROUP(g)
+#define RLIM_LOAD(p) (*(p))
+#define RLIM_STORE(p, v) (*(p) = (v))
+#define RLIM_ADD(p, v) (*(p) += (v))
+#define RLIM_CAS(p, expp, v) (*(p) = (v), 1)
+#endif
+
 static int bev_group_suspend_reading_(struct bufferevent_rate_limit_group *g);
 static int bev_group_suspend_writing_(struct bufferevent_rate_limit_group *g);
 static void bev_group_unsuspend_reading_(struct bufferevent_rate_limit_group *g);
@@ -204,7 +237,11 @@ bufferevent_get_rlim_max_(struct bufferevent_private *bev, int is_write)
 	(is_write ? (x).write_limit : (x).read_limit)
 
 #define GROUP_SUSPENDED(g)			\
-	(is_write ? (g)->write_suspended : (g)->read_suspended)
+	RLIM_LOAD(is_write ? &(g)->write_suspended : &(g)->read_suspended)
+
+#define GROUP_LIM(g)						\
+	RLIM_LOAD(is_write ? &(g)->rate_limit.write_limit :	\
+	    &(g)->rate_limit.read_limit)
 
 	/* Sets max_so_far to MIN(x, max_so_far) */
 #define CLAMPTO(x)				\
@@ -228,8 +265,17 @@ bufferevent_get_rlim_max_(struct bufferevent_private *bev, int is_write)
 	if (bev->rate_limiting->group) {
 		struct bufferevent_rate_limit_group *g =
 		    bev->rate_limiting->group;
-		ev_ssize_t share;
-		LOCK_GROUP(g);
+		ev_ssize_t share, min_share;
+		int locked = 0;
+		/* While the group is being unsuspended, wait for that to
+		 * finish as we would with the group lock; otherwise the first
+		 * members to wake up can take the whole refill before the rest
+		 * are back. */
+		if (RLIM_LOAD(&g->unsuspending)) {
+			LOCK_GROUP(g);
+			locked = 1;
+		}
+		LOCK_GROUP_FAST(g);
 		if (GROUP_SUSPENDED(g)) {
 			/* We can get here if we failed to lock this
 			 * particular bufferevent while suspending the whole
@@ -244,11 +290,14 @@ bufferevent_get_rlim_max_(struct bufferevent_private *bev, int is_write)
 		} else {
 			/* XXXX probably we should divide among the active
 			 * members, not the total members. */
-			share = LIM(g->rate_limit) / g->n_members;
-			if (share < g->min_share)
-				share = g->min_share;
+			share = GROUP_LIM(g) / RLIM_LOAD(&g->n_members);
+			min_share = RLIM_LOAD(&g->min_share);
+			if (share < min_share)
+				share = min_share;
 		}
-		UNLOCK_GROUP(g);
+		UNLOCK_GROUP_FAST(g);
+		if (locked)
+			UNLOCK_GROUP(g);
 		CLAMPTO(share);
 	}
 
@@ -293,15 +342,30 @@ bufferevent_decrement_read_buckets_(struct bufferevent_private *bev, ev_ssize_t
 	}
 
 	if (bev->rate_limiting->group) {
-		LOCK_GROUP(bev->rate_limiting->group);
-		bev->rate_limiting->group->rate_limit.read_limit -= bytes;
-		bev->rate_limiting->group->total_read += bytes;
-		if (bev->rate_limiting->group->rate_limit.read_limit <= 0) {
-			bev_group_suspend_reading_(bev->rate_limiting->group);
-		} else if (bev->rate_limiting->group->read_suspended) {
-			bev_group_unsuspend_reading_(bev->rate_limiting->group);
+		struct bufferevent_rate_limit_group *g =
+		    bev->rate_limiting->group;
+		ev_ssize_t limit;
+		LOCK_GROUP_FAST(g);
+		limit = RLIM_ADD(&g->rate_limit.read_limit, -bytes);
+		RLIM_ADD(&g->total_read, bytes);
+		/* Only the slow transitions need the group lock; check again
+		 * once we hold it, since the bucket may have been refilled or
+		 * drained in the meantime. */
+		if (limit <= 0) {
+			if (!RLIM_LOAD(&g->read_suspended)) {
+				LOCK_GROUP(g);
+				if (RLIM_LOAD(&g->rate_limit.read_limit) <= 0)
+					bev_group_suspend_reading_(g);
+				UNLOCK_GROUP(g);
+			}
+		} else if (RLIM_LOAD(&g->read_suspended)) {
+			LOCK_GROUP(g);
+			if (g->read_suspended &&
+			    RLIM_LOAD(&g->rate_limit.read_limit) > 0)
+				bev_group_unsuspend_reading_(g);
+			UNLOCK_GROUP(g);
 		}
-		UNLOCK_GROUP(bev->rate_limiting->group);
+		UNLOCK_GROUP_FAST(g);
 	}
 
 	return r;
@@ -331,15 +395,30 @@ bufferevent_decrement_write_buckets_(struct bufferevent_private *bev, ev_ssize_t
 	}
 
 	if (bev->rate_limiting->group) {
-		LOCK_GROUP(bev->rate_limiting->group);
-		bev->rate_limiting->group->rate_limit.write_limit -= bytes;
-		bev->rate_limiting->group->total_written += bytes;
-		if (bev->rate_limiting->group->rate_limit.write_limit <= 0) {
-			bev_group_suspend_writing_(bev->rate_limiting->group);
-		} else if (bev->rate_limiting->group->write_suspended) {
-			bev_group_unsuspend_writing_(bev->rate_limiting->group);
+		struct bufferevent_rate_limit_group *g =
+		    bev->rate_limiting->group;
+		ev_ssize_t limit;
+		LOCK_GROUP_FAST(g);
+		limit = RLIM_ADD(&g->rate_limit.write_limit, -bytes);
+		RLIM_ADD(&g->total_written, bytes);
+		/* Only the slow transitions need the group lock; check again
+		 * once we hold it, since the bucket may have been refilled or
+		 * drained in the meantime. */
+		if (limit <= 0) {
+			if (!RLIM_LOAD(&g->write_suspended)) {
+				LOCK_GROUP(g);
+				if (RLIM_LOAD(&g->rate_limit.write_limit) <= 0)
+					bev_group_suspend_writing_(g);
+				UNLOCK_GROUP(g);
+			}
+		} else if (RLIM_LOAD(&g->write_suspended)) {
+			LOCK_GROUP(g);
+			if (g->write_suspended &&
+			    RLIM_LOAD(&g->rate_limit.write_limit) > 0)
+				bev_group_unsuspend_writing_(g);
+			UNLOCK_GROUP(g);
 		}
-		UNLOCK_GROUP(bev->rate_limiting->group);
+		UNLOCK_GROUP_FAST(g);
 	}
 
 	return r;
@@ -351,7 +430,7 @@ bev_group_suspend_reading_(struct bufferevent_rate_limit_group *g)
 {
 	/* Needs group lock */
 	struct bufferevent_private *bev;
-	g->read_suspended = 1;
+	RLIM_STORE(&g->read_suspended, 1);
 	g->pending_unsuspend_read = 0;
 
 	/* Note that in this loop we call EVLOCK_TRY_LOCK_ instead of BEV_LOCK,
@@ -376,7 +455,7 @@ bev_group_suspend_writing_(struct bufferevent_rate_limit_group *g)
 {
 	/* Needs group lock */
 	struct bufferevent_private *bev;
-	g->write_suspended = 1;
+	RLIM_STORE(&g->write_suspended, 1);
 	g->pending_unsuspend_write = 0;
 	LIST_FOREACH(bev, &g->members, rate_limiting->next_in_group) {
 		if (EVLOCK_TRY_LOCK_(bev->lock)) {
@@ -490,7 +569,7 @@ bev_group_unsuspend_reading_(struct bufferevent_rate_limit_group *g)
 	int again = 0;
 	struct bufferevent_private *bev, *first;
 
-	g->read_suspended = 0;
+	RLIM_STORE(&g->read_suspended, 0);
 	FOREACH_RANDOM_ORDER({
 		if (EVLOCK_TRY_LOCK_(bev->lock)) {
 			bufferevent_unsuspend_read_(&bev->bev,
@@ -508,7 +587,7 @@ bev_group_unsuspend_writing_(struct bufferevent_rate_limit_group *g)
 {
 	int again = 0;
 	struct bufferevent_private *bev, *first;
-	g->write_suspended = 0;
+	RLIM_STORE(&g->write_suspended, 0);
 
 	FOREACH_RANDOM_ORDER({
 		if (EVLOCK_TRY_LOCK_(bev->lock)) {
@@ -522,6 +601,33 @@ bev_group_unsuspend_writing_(struct bufferevent_rate_limit_group *g)
 	g->pending_unsuspend_write = again;
 }
 
+/** Helper: add 'n_ticks' worth of 'rate' to the group limit at 'limit',
+    without going over 'maximum'.  Like ev_token_bucket_update_(), but safe
+    against members decrementing the limit concurrently. */
+static void
+bev_group_refill_limit_(ev_ssize_t *limit, unsigned n_ticks,
+    size_t rate, size_t maximum)
+{
+	ev_ssize_t old_limit = RLIM_LOAD(limit), new_limit;
+	do {
+		if ((maximum - old_limit) / n_ticks < rate)
+			new_limit = maximum;
+		else
+			new_limit = old_limit + n_ticks * rate;
+	} while (!RLIM_CAS(limit, &old_limit, new_limit));
+}
+
+/** Helper: lower the group limit at 'limit' to 'maximum' if it is above
+    it. */
+static void
+bev_group_clip_limit_(ev_ssize_t *limit, size_t maximum)
+{
+	ev_ssize_t old_limit = RLIM_LOAD(limit);
+	while (old_limit > (ev_ssize_t)maximum &&
+	    !RLIM_CAS(limit, &old_limit, (ev_ssize_t)maximum))
+		;
+}
+
 /** Callback invoked every tick to add more elements to the group bucket
     and unsuspend group members as needed.
  */
@@ -529,24 +635,37 @@ static void
 bev_group_refill_callback_(evutil_socket_t fd, short what, void *arg)
 {
 	struct bufferevent_rate_limit_group *g = arg;
-	unsigned tick;
+	const struct ev_token_bucket_cfg *cfg = &g->rate_limit_cfg;
+	unsigned tick, n_ticks;
 	struct timeval now;
 
 	event_base_gettimeofday_cached(event_get_base(&g->master_refill_event), &now);
 
 	LOCK_GROUP(g);
 
-	tick = ev_token_bucket_get_tick_(&now, &g->rate_limit_cfg);
-	ev_token_bucket_update_(&g->rate_limit, &g->rate_limit_cfg, tick);
+	/* As in ev_token_bucket_update_(). */
+	tick = ev_token_bucket_get_tick_(&now, cfg);
+	n_ticks = tick - g->rate_limit.last_updated;
+	if (n_ticks != 0 && n_ticks <= INT_MAX) {
+		bev_group_refill_limit_(&g->rate_limit.read_limit, n_ticks,
+		    cfg->read_rate, cfg->read_maximum);
+		bev_group_refill_limit_(&g->rate_limit.write_limit, n_ticks,
+		    cfg->write_rate, cfg->write_maximum);
+		g->rate_limit.last_updated = tick;
+	}
 
+	RLIM_STORE(&g->unsuspending, 1);
 	if (g->pending_unsuspend_read ||
-	    (g->read_suspended && (g->rate_limit.read_limit >= g->min_share))) {
+	    (g->read_suspended &&
+		(RLIM_LOAD(&g->rate_limit.read_limit) >= g->min_share))) {
 		bev_group_unsuspend_reading_(g);
 	}
 	if (g->pending_unsuspend_write ||
-	    (g->write_suspended && (g->rate_limit.write_limit >= g->min_share))){
+	    (g->write_suspended &&
+		(RLIM_LOAD(&g->rate_limit.write_limit) >= g->min_share))) {
 		bev_group_unsuspend_writing_(g);
 	}
+	RLIM_STORE(&g->unsuspending, 0);
 
 	/* XXXX Rather than waiting to the next tick to unsuspend stuff
 	 * with pending_unsuspend_write/read, we should do it on the
@@ -683,10 +802,8 @@ bufferevent_rate_limit_group_set_cfg(
 		&g->rate_limit_cfg.tick_timeout, &cfg->tick_timeout, ==);
 	memcpy(&g->rate_limit_cfg, cfg, sizeof(g->rate_limit_cfg));
 
-	if (g->rate_limit.read_limit > (ev_ssize_t)cfg->read_maximum)
-		g->rate_limit.read_limit = cfg->read_maximum;
-	if (g->rate_limit.write_limit > (ev_ssize_t)cfg->write_maximum)
-		g->rate_limit.write_limit = cfg->write_maximum;
+	bev_group_clip_limit_(&g->rate_limit.read_limit, cfg->read_maximum);
+	bev_group_clip_limit_(&g->rate_limit.write_limit, cfg->write_maximum);
 
 	if (!same_tick) {
 		/* This can cause a hiccup in the schedule */
@@ -717,7 +834,7 @@ bufferevent_rate_limit_group_set_min_share(
 	if (share > g->rate_limit_cfg.write_rate)
 		share = g->rate_limit_cfg.write_rate;
 
-	g->min_share = share;
+	RLIM_STORE(&g->min_share, (ev_ssize_t)share);
 	return 0;
 }
 
@@ -762,7 +879,7 @@ bufferevent_add_to_rate_limit_group(struct bufferevent *bev,
 
 	LOCK_GROUP(g);
 	bevp->rate_limiting->group = g;
-	++g->n_members;
+	RLIM_STORE(&g->n_members, g->n_members + 1);
 	LIST_INSERT_HEAD(&g->members, bevp, rate_limiting->next_in_group);
 
 	rsuspend = g->read_suspended;
@@ -797,7 +914,7 @@ bufferevent_remove_from_rate_limit_group_internal_(struct bufferevent *bev,
 		    bevp->rate_limiting->group;
 		LOCK_GROUP(g);
 		bevp->rate_limiting->group = NULL;
-		--g->n_members;
+		RLIM_STORE(&g->n_members, g->n_members - 1);
 		LIST_REMOVE(bevp, rate_limiting->next_in_group);
 		UNLOCK_GROUP(g);
 	}
@@ -949,9 +1066,9 @@ bufferevent_rate_limit_group_get_read_limit(
 	struct bufferevent_rate_limit_group *grp)
 {
 	ev_ssize_t r;
-	LOCK_GROUP(grp);
-	r = grp->rate_limit.read_limit;
-	UNLOCK_GROUP(grp);
+	LOCK_GROUP_FAST(grp);
+	r = RLIM_LOAD(&grp->rate_limit.read_limit);
+	UNLOCK_GROUP_FAST(grp);
 	return r;
 }
 
@@ -962,9 +1079,9 @@ bufferevent_rate_limit_group_get_write_limit(
 	struct bufferevent_rate_limit_group *grp)
 {
 	ev_ssize_t r;
-	LOCK_GROUP(grp);
-	r = grp->rate_limit.write_limit;
-	UNLOCK_GROUP(grp);
+	LOCK_GROUP_FAST(grp);
+	r = RLIM_LOAD(&grp->rate_limit.write_limit);
+	UNLOCK_GROUP_FAST(grp);
 	return r;
 }
 
@@ -1031,8 +1148,8 @@ bufferevent_rate_limit_group_decrement_read(
 	int r = 0;
 	ev_ssize_t old_limit, new_limit;
 	LOCK_GROUP(grp);
-	old_limit = grp->rate_limit.read_limit;
-	new_limit = (grp->rate_limit.read_limit -= decr);
+	new_limit = RLIM_ADD(&grp->rate_limit.read_limit, -decr);
+	old_limit = new_limit + decr;
 
 	if (old_limit > 0 && new_limit <= 0) {
 		bev_group_suspend_reading_(grp);
@@ -1051,8 +1168,8 @@ bufferevent_rate_limit_group_decrement_write(
 	int r = 0;
 	ev_ssize_t old_limit, new_limit;
 	LOCK_GROUP(grp);
-	old_limit = grp->rate_limit.write_limit;
-	new_limit = (grp->rate_limit.write_limit -= decr);
+	new_limit = RLIM_ADD(&grp->rate_limit.write_limit, -decr);
+	old_limit = new_limit + decr;
 
 	if (old_limit > 0 && new_limit <= 0) {
 		bev_group_suspend_writing_(grp);
@@ -1070,15 +1187,16 @@ bufferevent_rate_limit_group_get_totals(struct bufferevent_rate_limit_group *grp
 {
 	EVUTIL_ASSERT(grp != NULL);
 	if (total_read_out)
-		*total_read_out = grp->total_read;
+		*total_read_out = RLIM_LOAD(&grp->total_read);
 	if (total_written_out)
-		*total_written_out = grp->total_written;
+		*total_written_out = RLIM_LOAD(&grp->total_written);
 }
 
 void
 bufferevent_rate_limit_group_reset_totals(struct bufferevent_rate_limit_group *grp)
 {
-	grp->total_read = grp->total_written = 0;
+	RLIM_STORE(&grp->total_read, 0);
+	RLIM_STORE(&grp->total_written, 0);
 }
 
 int
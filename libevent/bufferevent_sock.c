@@ -66,11 +66,14 @@
 #include "event2/buffer.h"
 #include "event2/bufferevent_struct.h"
 #include "event2/bufferevent_compat.h"
+#include "event2/buffer_compat.h"
 #include "event2/event.h"
 #include "log-internal.h"
 #include "mm-internal.h"
 #include "bufferevent-internal.h"
 #include "util-internal.h"
+#include "event-internal.h"
+#include "evbuffer-internal.h"
 #ifdef _WIN32
 #include "iocp-internal.h"
 #endif
@@ -715,6 +718,10 @@ bufferevent_base_set(struct event_base *base, struct bufferevent *bufev)
 		goto done;
 
 	bufev->ev_base = base;
+	evbuffer_set_chain_pool_(bufev->input,
+	    base ? base->buffer_pool : NULL);
+	evbuffer_set_chain_pool_(bufev->output,
+	    base ? base->buffer_pool : NULL);
 
 	res = event_base_set(base, &bufev->ev_read);
 	if (res == -1)
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * evdgram: batched datagram reads and writes.
+ *
+ * Each evdgram owns max_batch receive slots and max_batch send slots of
+ * max_size bytes each.  evdgram_recv() fills the receive slots with one
+ * recvmmsg() call; evdgram_add() copies a datagram into the next free send
+ * slot, and evdgram_flush() hands all the queued ones to sendmmsg().  The
+ * queued datagrams always occupy consecutive slots starting at tx_first,
+ * so that a run of them can be described by consecutive iovecs: with
+ * EVDGRAM_OPT_GSO, such a run of equal-sized datagrams to one address goes
+ * out as a single message carrying a UDP_SEGMENT size, and the kernel
+ * splits it again.
+ *
+ * Without recvmmsg() or sendmmsg() we loop over recvfrom() and sendto(),
+ * which keeps the API (and the number of event loop wakeups) the same.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef EVENT__HAVE_NETINET_UDP_H
+#include <netinet/udp.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "event2/dgram.h"
+#include "event2/util.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "log-internal.h"
+
+#ifdef EVENT__HAVE_RECVMMSG
+#define USE_RECVMMSG
+#endif
+#ifdef EVENT__HAVE_SENDMMSG
+#define USE_SENDMMSG
+#endif
+#if defined(USE_SENDMMSG) && defined(UDP_SEGMENT)
+#define USE_GSO
+/* Most segments the kernel accepts in one GSO send (UDP_MAX_SEGMENTS). */
+#define DGRAM_GSO_MAX_SEGMENTS 64
+/* Most bytes in one GSO send; a bit under the largest UDP payload. */
+#define DGRAM_GSO_MAX_BYTES 65000
+#endif
+
+/* The largest datagram anybody can send. */
+#define DGRAM_MAX_SIZE 65535
+
+#ifdef _WIN32
+#define DGRAM_LEN(n) ((int)(n))
+#else
+#define DGRAM_LEN(n) (n)
+#endif
+
+/** One receive or send slot. */
+struct evdgram_msg {
+	/** This slot's max_size bytes of storage. */
+	char *data;
+	/** How many of them hold the datagram. */
+	size_t len;
+	/** Where the datagram came from or goes to; addrlen is 0 for none. */
+	struct sockaddr_storage addr;
+	ev_socklen_t addrlen;
+};
+
+#ifdef USE_GSO
+/** Room for a UDP_SEGMENT control message. */
+union evdgram_cmsg {
+	char buf[CMSG_SPACE(sizeof(ev_uint16_t))];
+	struct cmsghdr align;
+};
+#endif
+
+struct evdgram {
+	int max_batch;
+	size_t max_size;
+	unsigned options;
+
+	/** The datagrams read by the last evdgram_recv() are rx[0..n_rx). */
+	struct evdgram_msg *rx;
+	int n_rx;
+	/** The datagrams waiting to be sent are tx[tx_first..tx_first+n_tx),
+	 * oldest first. */
+	struct evdgram_msg *tx;
+	int tx_first;
+	int n_tx;
+
+	/** Storage for all the slots: the rx ones, then the tx ones. */
+	char *buf;
+
+#if defined(USE_RECVMMSG) || defined(USE_SENDMMSG)
+	/** Message headers for recvmmsg() and sendmmsg(). */
+	struct mmsghdr *mmsg;
+	/** iov[i] describes rx[i] or tx[i]. */
+	struct iovec *iov;
+#endif
+#ifdef USE_GSO
+	/** Control buffers for the messages that carry a GSO run. */
+	union evdgram_cmsg *cmsg;
+#endif
+};
+
+struct evdgram *
+evdgram_new(int max_batch, size_t max_size, unsigned options)
+{
+	struct evdgram *dg;
+	int i;
+
+	if (max_batch <= 0 || max_size == 0 || max_size > DGRAM_MAX_SIZE ||
+	    (size_t)max_batch > EV_SIZE_MAX / 2 / max_size)
+		return NULL;
+
+	if (!(dg = mm_calloc(1, sizeof(struct evdgram))))
+		return NULL;
+	dg->max_batch = max_batch;
+	dg->max_size = max_size;
+	dg->options = options;
+
+	dg->rx = mm_calloc(max_batch, sizeof(struct evdgram_msg));
+	dg->tx = mm_calloc(max_batch, sizeof(struct evdgram_msg));
+	dg->buf = mm_malloc(2 * max_batch * max_size);
+	if (!dg->rx || !dg->tx || !dg->buf)
+		goto err;
+#if defined(USE_RECVMMSG) || defined(USE_SENDMMSG)
+	dg->mmsg = mm_calloc(max_batch, sizeof(struct mmsghdr));
+	dg->iov = mm_calloc(max_batch, sizeof(struct iovec));
+	if (!dg->mmsg || !dg->iov)
+		goto err;
+#endif
+#ifdef USE_GSO
+	if (options & EVDGRAM_OPT_GSO) {
+		dg->cmsg = mm_calloc(max_batch, sizeof(union evdgram_cmsg));
+		if (!dg->cmsg)
+			goto err;
+	}
+#else
+	dg->options &= ~EVDGRAM_OPT_GSO;
+#endif
+
+	for (i = 0; i < max_batch; ++i) {
+		dg->rx[i].data = dg->buf + i * max_size;
+		dg->tx[i].data = dg->buf + (max_batch + i) * max_size;
+	}
+	return dg;
+err:
+	evdgram_free(dg);
+	return NULL;
+}
+
+void
+evdgram_free(struct evdgram *dg)
+{
+	if (dg->rx)
+		mm_free(dg->rx);
+	if (dg->tx)
+		mm_free(dg->tx);
+	if (dg->buf)
+		mm_free(dg->buf);
+#if defined(USE_RECVMMSG) || defined(USE_SENDMMSG)
+	if (dg->mmsg)
+		mm_free(dg->mmsg);
+	if (dg->iov)
+		mm_free(dg->iov);
+#endif
+#ifdef USE_GSO
+	if (dg->cmsg)
+		mm_free(dg->cmsg);
+#endif
+	mm_free(dg);
+}
+
+int
+evdgram_recv(struct evdgram *dg, evutil_socket_t fd)
+{
+	int n;
+#ifdef USE_RECVMMSG
+	int i, flags = 0;
+
+	dg->n_rx = 0;
+	for (i = 0; i < dg->max_batch; ++i) {
+		struct msghdr *m = &dg->mmsg[i].msg_hdr;
+		dg->iov[i].iov_base = dg->rx[i].data;
+		dg->iov[i].iov_len = dg->max_size;
+		memset(m, 0, sizeof(*m));
+		m->msg_name = &dg->rx[i].addr;
+		m->msg_namelen = sizeof(dg->rx[i].addr);
+		m->msg_iov = &dg->iov[i];
+		m->msg_iovlen = 1;
+	}
+#ifdef MSG_WAITFORONE
+	/* Don't wait for a whole batch if somebody gave us a blocking
+	 * socket. */
+	flags = MSG_WAITFORONE;
+#endif
+	n = recvmmsg(fd, dg->mmsg, dg->max_batch, flags, NULL);
+	if (n < 0)
+		return EVUTIL_ERR_RW_RETRIABLE(errno) ? 0 : -1;
+	for (i = 0; i < n; ++i) {
+		dg->rx[i].len = dg->mmsg[i].msg_len;
+		dg->rx[i].addrlen = dg->mmsg[i].msg_hdr.msg_namelen;
+	}
+#else
+	dg->n_rx = 0;
+	for (n = 0; n < dg->max_batch; ++n) {
+		struct evdgram_msg *msg = &dg->rx[n];
+		ev_ssize_t r;
+
+		msg->addrlen = sizeof(msg->addr);
+		r = recvfrom(fd, msg->data, DGRAM_LEN(dg->max_size), 0,
+		    (struct sockaddr *)&msg->addr, &msg->addrlen);
+		if (r < 0) {
+			int err = evutil_socket_geterror(fd);
+			if (n)
+				break;
+			return EVUTIL_ERR_RW_RETRIABLE(err) ? 0 : -1;
+		}
+		/* Windows reports longer datagrams as an error; elsewhere we
+		 * just see the truncated length. */
+		msg->len = (size_t)r;
+	}
+#endif
+	dg->n_rx = n;
+	return n;
+}
+
+ev_ssize_t
+evdgram_get(struct evdgram *dg, int i, void **data,
+    struct sockaddr **addr, ev_socklen_t *addrlen)
+{
+	struct evdgram_msg *msg;
+
+	if (i < 0 || i >= dg->n_rx)
+		return -1;
+	msg = &dg->rx[i];
+	*data = msg->data;
+	if (addr)
+		*addr = (struct sockaddr *)&msg->addr;
+	if (addrlen)
+		*addrlen = msg->addrlen;
+	return (ev_ssize_t)msg->len;
+}
+
+int
+evdgram_add(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *addr, ev_socklen_t addrlen)
+{
+	struct evdgram_msg *msg;
+
+	if (len > dg->max_size || dg->n_tx == dg->max_batch ||
+	    (addr && (size_t)addrlen > sizeof(msg->addr)))
+		return -1;
+
+	if (dg->tx_first + dg->n_tx == dg->max_batch) {
+		/* Move what is still queued to the front, so that the queue
+		 * stays in consecutive slots. */
+		int i;
+		for (i = 0; i < dg->n_tx; ++i) {
+			struct evdgram_msg *from = &dg->tx[dg->tx_first + i];
+			struct evdgram_msg *to = &dg->tx[i];
+			memcpy(to->data, from->data, from->len);
+			to->len = from->len;
+			memcpy(&to->addr, &from->addr, from->addrlen);
+			to->addrlen = from->addrlen;
+		}
+		dg->tx_first = 0;
+	}
+
+	msg = &dg->tx[dg->tx_first + dg->n_tx];
+	memcpy(msg->data, data, len);
+	msg->len = len;
+	if (addr) {
+		memcpy(&msg->addr, addr, addrlen);
+		msg->addrlen = addrlen;
+	} else {
+		msg->addrlen = 0;
+	}
+	++dg->n_tx;
+	return 0;
+}
+
+int
+evdgram_get_queued(const struct evdgram *dg)
+{
+	return dg->n_tx;
+}
+
+#ifdef USE_GSO
+/** Helper: return how many of the queued datagrams from tx[first] on, up to
+ * tx[end - 1], can go out as one GSO send: they must all have the same
+ * destination, and all but the last the same size as tx[first]. */
+static int
+evdgram_gso_run(struct evdgram *dg, int first, int end)
+{
+	const struct evdgram_msg *head = &dg->tx[first];
+	size_t total = head->len;
+	int i;
+
+	if (!(dg->options & EVDGRAM_OPT_GSO) || head->len == 0)
+		return 1;
+	for (i = first + 1; i < end && i - first < DGRAM_GSO_MAX_SEGMENTS;
+	     ++i) {
+		const struct evdgram_msg *msg = &dg->tx[i];
+		if (msg->len == 0 || msg->len > head->len ||
+		    total + msg->len > DGRAM_GSO_MAX_BYTES ||
+		    msg->addrlen != head->addrlen ||
+		    memcmp(&msg->addr, &head->addr, head->addrlen))
+			break;
+		total += msg->len;
+		if (msg->len < head->len) {
+			/* Only the last segment may be short. */
+			++i;
+			break;
+		}
+	}
+	return i - first;
+}
+#endif
+
+/** Helper: try to send everything queued in 'dg' on 'fd'.  Return the
+ * number of datagrams sent, 0 if the socket would block, or -1 if the
+ * first one failed. */
+static int
+evdgram_send_(struct evdgram *dg, evutil_socket_t fd)
+{
+#ifdef USE_SENDMMSG
+	int i = dg->tx_first, end = dg->tx_first + dg->n_tx;
+	int n_mmsg = 0, r, k, n_sent;
+
+	for (k = i; k < end; ++k) {
+		dg->iov[k].iov_base = dg->tx[k].data;
+		dg->iov[k].iov_len = dg->tx[k].len;
+	}
+	while (i < end) {
+		struct evdgram_msg *msg = &dg->tx[i];
+		struct msghdr *m = &dg->mmsg[n_mmsg].msg_hdr;
+		int run = 1;
+
+		memset(m, 0, sizeof(*m));
+		if (msg->addrlen) {
+			m->msg_name = &msg->addr;
+			m->msg_namelen = msg->addrlen;
+		}
+		m->msg_iov = &dg->iov[i];
+#ifdef USE_GSO
+		run = evdgram_gso_run(dg, i, end);
+		if (run > 1) {
+			struct cmsghdr *cm;
+			ev_uint16_t segment = (ev_uint16_t)msg->len;
+			m->msg_control = dg->cmsg[n_mmsg].buf;
+			m->msg_controllen = sizeof(dg->cmsg[n_mmsg].buf);
+			cm = CMSG_FIRSTHDR(m);
+			cm->cmsg_level = IPPROTO_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(segment));
+			memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+		}
+#endif
+		m->msg_iovlen = run;
+		i += run;
+		++n_mmsg;
+	}
+
+	r = sendmmsg(fd, dg->mmsg, n_mmsg, 0);
+	if (r < 0) {
+		int err = errno;
+		if (EVUTIL_ERR_RW_RETRIABLE(err))
+			return 0;
+#ifdef USE_GSO
+		if (dg->mmsg[0].msg_hdr.msg_iovlen > 1) {
+			/* The socket (or the route) won't do GSO; don't try
+			 * it again. */
+			dg->options &= ~EVDGRAM_OPT_GSO;
+			return evdgram_send_(dg, fd);
+		}
+#endif
+		return -1;
+	}
+	for (k = 0, n_sent = 0; k < r; ++k)
+		n_sent += (int)dg->mmsg[k].msg_hdr.msg_iovlen;
+	return n_sent;
+#else
+	int n;
+
+	for (n = 0; n < dg->n_tx; ++n) {
+		struct evdgram_msg *msg = &dg->tx[dg->tx_first + n];
+		ev_ssize_t r = sendto(fd, msg->data, DGRAM_LEN(msg->len), 0,
+		    msg->addrlen ? (struct sockaddr *)&msg->addr : NULL,
+		    msg->addrlen);
+		if (r < 0) {
+			int err = evutil_socket_geterror(fd);
+			if (n)
+				break;
+			return EVUTIL_ERR_RW_RETRIABLE(err) ? 0 : -1;
+		}
+	}
+	return n;
+#endif
+}
+
+int
+evdgram_flush(struct evdgram *dg, evutil_socket_t fd)
+{
+	int sent = 0, r;
+
+	while (dg->n_tx) {
+		r = evdgram_send_(dg, fd);
+		if (r == 0)
+			break;
+		if (r < 0) {
+			/* Drop the datagram that failed, as sendto() would
+			 * have. */
+			r = 1;
+			sent = -1;
+		}
+		dg->tx_first += r;
+		dg->n_tx -= r;
+		if (sent < 0)
+			break;
+		sent += r;
+	}
+	if (!dg->n_tx)
+		dg->tx_first = 0;
+	return sent;
+}
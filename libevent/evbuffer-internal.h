@@ -153,6 +153,10 @@ struct evbuffer {
 	/** The parent bufferevent object this evbuffer belongs to.
 	 * NULL if the evbuffer stands alone. */
 	struct bufferevent *parent;
+
+	/** Where to get new chains from, if the buffer was set up to use the
+	 * chain pool of an event_base; NULL otherwise. */
+	struct evbuffer_chain_pool *pool;
 };
 
 #if EVENT__SIZEOF_OFF_T < EVENT__SIZEOF_SIZE_T
@@ -211,6 +215,41 @@ struct evbuffer_chain {
 	 * may point to NULL.
 	 */
 	unsigned char *buffer;
+
+	/** The pool to give this chain back to when it is freed, or NULL if
+	 * it came from mm_malloc directly. */
+	struct evbuffer_chain_pool *pool;
+};
+
+/* Chains of MIN_BUFFER_SIZE << 0 .. EVBUFFER_POOL_CLASSES-1 bytes,
+ * header included, can come from a pool. */
+#define EVBUFFER_POOL_CLASSES 5
+/* Free chains a pool keeps for each size; beyond that they are freed. */
+#define EVBUFFER_POOL_MAX_FREE 128
+
+/** A cache of freed chains of the common sizes, owned by an event_base
+ * made with EVENT_BASE_FLAG_BUFFER_POOL.  The free lists are only touched
+ * from the thread that made the base, so they need no lock; chains taken
+ * or freed in other threads just go to mm_malloc and mm_free. */
+struct evbuffer_chain_pool {
+	/** The thread that may use the free lists */
+	unsigned long owner;
+	/** Free chains of each size class, linked through their next field */
+	struct evbuffer_chain *free[EVBUFFER_POOL_CLASSES];
+	unsigned n_free[EVBUFFER_POOL_CLASSES];
+	/** Chains handed out by the owner thread, less those it took back */
+	size_t allocated;
+	/** Chains taken from a free list, and chains that had to be malloced */
+	ev_uint64_t hits, misses;
+
+	/** Protects the fields below. */
+	void *lock;
+	/** Chains from this pool freed outside the owner thread, or after the
+	 * base was freed */
+	size_t released;
+	/** True once the base is gone; the pool itself goes when the last of
+	 * its chains does. */
+	int dead;
 };
 
 /** callback for a reference chain; lets us know what to do with it when
@@ -334,6 +373,15 @@ int evbuffer_read_setup_vecs_(struct evbuffer *buf, ev_ssize_t howmuch,
 /* XXXX the cast above is safe for now, but not if we allow mmaps on win64.
  * See note in buffer_iocp's launch_write function */
 
+/** Allocate a chain pool owned by the calling thread. */
+struct evbuffer_chain_pool *evbuffer_chain_pool_new_(void);
+/** Release a pool along with its base.  Chains still in use are freed
+ * normally later. */
+void evbuffer_chain_pool_free_(struct evbuffer_chain_pool *pool);
+/** Make buf take its new chains from pool, which may be NULL. */
+void evbuffer_set_chain_pool_(struct evbuffer *buf,
+    struct evbuffer_chain_pool *pool);
+
 /** Set the parent bufferevent object for buf to bev */
 void evbuffer_set_parent_(struct evbuffer *buf, struct bufferevent *bev);
 
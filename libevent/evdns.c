@@ -87,6 +87,7 @@
 #include "event2/dns.h"
 #include "event2/dns_struct.h"
 #include "event2/dns_compat.h"
+#include "event2/dgram.h"
 #include "event2/util.h"
 #include "event2/event.h"
 #include "event2/event_struct.h"
@@ -99,6 +100,7 @@
 #include "ipv6-internal.h"
 #include "util-internal.h"
 #include "evthread-internal.h"
+#include "ht-internal.h"
 #ifdef _WIN32
 #include <ctype.h>
 #include <winsock2.h>
@@ -141,6 +143,11 @@
 #define MAX_V4_ADDRS 32
 #define MAX_V6_ADDRS 32
 
+/* largest UDP packet we read */
+#define EVDNS_MAX_UDP_PACKET 1500
+/* how many UDP packets we read with one call */
+#define EVDNS_DGRAM_BATCH 16
+
 
 #define TYPE_A	       EVDNS_TYPE_A
 #define TYPE_CNAME     5
@@ -214,6 +221,20 @@ struct reply {
 	} data;
 };
 
+/* An answer in the cache of an evdns_base, keyed by the question. */
+struct evdns_cache_entry {
+	HT_ENTRY(evdns_cache_entry) node;
+	/* in base->cache_lru, most recently used first */
+	TAILQ_ENTRY(evdns_cache_entry) lru;
+
+	char *name;		/* the name as the user asked for it */
+	u8 request_type;
+	u8 searched;		/* true iff the search list was applied */
+	u32 err;		/* 0, DNS_ERR_NOTEXIST or DNS_ERR_NODATA */
+	struct timeval expires;
+	struct reply reply;	/* valid if err == 0 */
+};
+
 struct nameserver {
 	evutil_socket_t socket;	 /* a connected UDP socket */
 	struct sockaddr_storage address;
@@ -252,6 +273,8 @@ struct evdns_server_port {
 	/* circular list of replies that we want to write. */
 	struct server_request *pending_replies;
 	struct event_base *event_base;
+	/* batch of queries read from socket; allocated on first read */
+	struct evdgram *dgram;
 
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
 	void *lock;
@@ -355,6 +378,18 @@ struct evdns_base {
 
 	TAILQ_HEAD(hosts_list, hosts_entry) hostsdb;
 
+	/* Cache of answers; off while cache_max_entries is 0. */
+	HT_HEAD(evdns_cache_map, evdns_cache_entry) cache;
+	TAILQ_HEAD(evdns_cache_lru, evdns_cache_entry) cache_lru;
+	int cache_max_entries;
+	/* TTL of cached errors whose reply carried no SOA record */
+	int cache_negative_ttl;
+	struct evdns_cache_stats cache_stats;
+
+	/* batch of replies read from a nameserver socket; allocated on first
+	 * read, and shared by all the nameservers */
+	struct evdgram *dgram;
+
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
 	void *lock;
 #endif
@@ -413,6 +448,8 @@ static int evdns_base_set_option_impl(struct evdns_base *base,
     const char *option, const char *val, int flags);
 static void evdns_base_free_and_unlock(struct evdns_base *base, int fail_requests);
 static void evdns_request_timeout_callback(evutil_socket_t fd, short events, void *arg);
+static void evdns_cache_clear_(struct evdns_base *base);
+static int evdns_cache_searched_(struct evdns_base *base, int flags);
 
 static int strtoint(const char *const str);
 
@@ -863,6 +900,188 @@ reply_schedule_callback(struct request *const req, u32 ttl, u32 err, struct repl
 		&d->deferred);
 }
 
+static int name_parse(u8 *packet, int length, int *idx, char *name_out,
+    int name_out_len);
+
+static unsigned
+evdns_cache_entry_hash(const struct evdns_cache_entry *e)
+{
+	/* FNV-1a, ignoring case as DNS does */
+	unsigned h = 2166136261u ^ e->request_type ^ (e->searched << 8);
+	const char *cp;
+
+	for (cp = e->name; *cp; ++cp) {
+		h ^= (u8)EVUTIL_TOLOWER_(*cp);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int
+evdns_cache_entry_eq(const struct evdns_cache_entry *a,
+    const struct evdns_cache_entry *b)
+{
+	return a->request_type == b->request_type &&
+	    a->searched == b->searched &&
+	    !evutil_ascii_strcasecmp(a->name, b->name);
+}
+
+HT_PROTOTYPE(evdns_cache_map, evdns_cache_entry, node, evdns_cache_entry_hash,
+    evdns_cache_entry_eq)
+HT_GENERATE(evdns_cache_map, evdns_cache_entry, node, evdns_cache_entry_hash,
+    evdns_cache_entry_eq, 0.5, mm_malloc, mm_realloc, mm_free)
+
+static void
+evdns_cache_remove_(struct evdns_base *base, struct evdns_cache_entry *e)
+{
+	HT_REMOVE(evdns_cache_map, &base->cache, e);
+	TAILQ_REMOVE(&base->cache_lru, e, lru);
+	mm_free(e);
+}
+
+static void
+evdns_cache_clear_(struct evdns_base *base)
+{
+	struct evdns_cache_entry *e;
+
+	ASSERT_LOCKED(base);
+	while ((e = TAILQ_FIRST(&base->cache_lru)) != NULL)
+		evdns_cache_remove_(base, e);
+}
+
+/* Drop least recently used entries until at most max are left. */
+static void
+evdns_cache_shrink_(struct evdns_base *base, int max)
+{
+	struct evdns_cache_entry *e;
+
+	while ((int)HT_SIZE(&base->cache) > max &&
+	    (e = TAILQ_LAST(&base->cache_lru, evdns_cache_lru)) != NULL) {
+		evdns_cache_remove_(base, e);
+		++base->cache_stats.evictions;
+	}
+}
+
+/* Remember the final answer to req, if it may be cached. */
+static void
+evdns_cache_store_(struct request *const req, u32 ttl, u32 err,
+    const struct reply *reply)
+{
+	struct evdns_base *base = req->base;
+	struct evdns_request *handle = req->handle;
+	struct evdns_cache_entry find, *e;
+	char namebuf[HOST_NAME_MAX];
+	struct timeval now;
+	size_t len;
+	int idx = 12;	/* the question follows the header */
+
+	ASSERT_LOCKED(base);
+	if (base->cache_max_entries <= 0)
+		return;
+	if (err == DNS_ERR_NOTEXIST || err == DNS_ERR_NODATA) {
+		if (!ttl)
+			ttl = base->cache_negative_ttl;
+	} else if (err) {
+		return;
+	}
+	if (!ttl)
+		return;
+
+	if (handle->search_state && handle->search_origname) {
+		find.name = handle->search_origname;
+		find.searched = 1;
+	} else {
+		if (name_parse(req->request, req->request_len, &idx,
+			namebuf, sizeof(namebuf)) < 0)
+			return;
+		find.name = namebuf;
+		find.searched = 0;
+	}
+	find.request_type = req->request_type;
+
+	if ((e = HT_FIND(evdns_cache_map, &base->cache, &find)) != NULL)
+		evdns_cache_remove_(base, e);
+	else
+		evdns_cache_shrink_(base, base->cache_max_entries - 1);
+
+	len = strlen(find.name);
+	e = mm_malloc(sizeof(*e) + len + 1);
+	if (e == NULL)
+		return;
+	e->name = (char *)(e + 1);
+	memcpy(e->name, find.name, len + 1);
+	e->request_type = find.request_type;
+	e->searched = find.searched;
+	e->err = err;
+	if (reply)
+		memcpy(&e->reply, reply, sizeof(struct reply));
+	event_base_gettimeofday_cached(base->event_base, &now);
+	e->expires = now;
+	e->expires.tv_sec += ttl;
+
+	HT_INSERT(evdns_cache_map, &base->cache, e);
+	TAILQ_INSERT_HEAD(&base->cache_lru, e, lru);
+}
+
+/* Answer a lookup from the cache: schedules the callback, as a reply from
+ * the network would, and returns 0; or returns -1 if the network has to be
+ * asked. */
+static int
+evdns_cache_lookup_(struct evdns_base *base, struct evdns_request *handle,
+    int type, const char *name, int searched,
+    evdns_callback_type callback, void *ptr)
+{
+	struct evdns_cache_entry find, *e;
+	struct deferred_reply_callback *d;
+	struct timeval now;
+
+	ASSERT_LOCKED(base);
+	if (base->cache_max_entries <= 0)
+		return -1;
+
+	find.name = (char *)name;
+	find.request_type = type;
+	find.searched = searched;
+	e = HT_FIND(evdns_cache_map, &base->cache, &find);
+	if (e != NULL) {
+		event_base_gettimeofday_cached(base->event_base, &now);
+		if (evutil_timercmp(&e->expires, &now, <=)) {
+			evdns_cache_remove_(base, e);
+			++base->cache_stats.expirations;
+			e = NULL;
+		}
+	}
+	if (e == NULL || (d = mm_calloc(1, sizeof(*d))) == NULL) {
+		++base->cache_stats.misses;
+		return -1;
+	}
+
+	d->request_type = type;
+	d->user_callback = callback;
+	d->ttl = (u32)(e->expires.tv_sec - now.tv_sec);
+	d->err = e->err;
+	if (!e->err) {
+		d->have_reply = 1;
+		memcpy(&d->reply, &e->reply, sizeof(struct reply));
+	}
+	handle->pending_cb = 1;
+	d->handle = handle;
+
+	event_deferred_cb_init_(
+	    &d->deferred,
+	    event_base_get_npriorities(base->event_base) / 2,
+	    reply_run_callback,
+	    ptr);
+	event_deferred_cb_schedule_(base->event_base, &d->deferred);
+
+	TAILQ_REMOVE(&base->cache_lru, e, lru);
+	TAILQ_INSERT_HEAD(&base->cache_lru, e, lru);
+	++base->cache_stats.hits;
+	if (e->err)
+		++base->cache_stats.negative_hits;
+	return 0;
+}
+
 /* this processes a parsed reply packet */
 static void
 reply_handle(struct request *const req, u16 flags, u32 ttl, struct reply *reply) {
@@ -944,10 +1163,12 @@ reply_handle(struct request *const req, u16 flags, u32 ttl, struct reply *reply)
 		}
 
 		/* all else failed. Pass the failure up */
+		evdns_cache_store_(req, ttl, error, NULL);
 		reply_schedule_callback(req, ttl, error, NULL);
 		request_finished(req, &REQ_HEAD(req->base, req->trans_id), 1);
 	} else {
 		/* all ok, tell the user */
+		evdns_cache_store_(req, ttl, 0, reply);
 		reply_schedule_callback(req, ttl, 0, reply);
 		if (req->handle == req->ns->probe_request)
 			req->ns->probe_request = NULL; /* Avoid double-free */
@@ -1369,36 +1590,47 @@ nameserver_pick(struct evdns_base *base) {
 /* this is called when a namesever socket is ready for reading */
 static void
 nameserver_read(struct nameserver *ns) {
-	struct sockaddr_storage ss;
-	ev_socklen_t addrlen = sizeof(ss);
-	u8 packet[1500];
+	struct evdns_base *base = ns->base;
+	struct sockaddr *sa;
+	void *packet;
+	ev_ssize_t len;
 	char addrbuf[128];
-	ASSERT_LOCKED(ns->base);
+	int i, n;
+	ASSERT_LOCKED(base);
+
+	if (!base->dgram && !(base->dgram = evdgram_new(EVDNS_DGRAM_BATCH,
+		    EVDNS_MAX_UDP_PACKET, 0))) {
+		log(EVDNS_LOG_WARN,
+		    "Unable to allocate memory for reading replies");
+		return;
+	}
 
 	for (;;) {
-		const int r = recvfrom(ns->socket, (void*)packet,
-		    sizeof(packet), 0,
-		    (struct sockaddr*)&ss, &addrlen);
-		if (r < 0) {
+		n = evdgram_recv(base->dgram, ns->socket);
+		if (n < 0) {
 			int err = evutil_socket_geterror(ns->socket);
-			if (EVUTIL_ERR_RW_RETRIABLE(err))
-				return;
 			nameserver_failed(ns,
 			    evutil_socket_error_to_string(err));
 			return;
 		}
-		if (evutil_sockaddr_cmp((struct sockaddr*)&ss,
-			(struct sockaddr*)&ns->address, 0)) {
-			log(EVDNS_LOG_WARN, "Address mismatch on received "
-			    "DNS packet.  Apparent source was %s",
-			    evutil_format_sockaddr_port_(
-				    (struct sockaddr *)&ss,
-				    addrbuf, sizeof(addrbuf)));
-			return;
-		}
+		for (i = 0; i < n; ++i) {
+			len = evdgram_get(base->dgram, i, &packet, &sa, NULL);
+			if (evutil_sockaddr_cmp(sa,
+				(struct sockaddr*)&ns->address, 0)) {
+				log(EVDNS_LOG_WARN, "Address mismatch on "
+				    "received DNS packet.  Apparent source "
+				    "was %s",
+				    evutil_format_sockaddr_port_(sa,
+					addrbuf, sizeof(addrbuf)));
+				continue;
+			}
 
-		ns->timedout = 0;
-		reply_parse(ns->base, packet, r);
+			ns->timedout = 0;
+			reply_parse(base, packet, (int)len);
+		}
+		/* A short batch means we have drained the socket. */
+		if (n < EVDNS_DGRAM_BATCH)
+			return;
 	}
 }
 
@@ -1406,26 +1638,37 @@ nameserver_read(struct nameserver *ns) {
 /* act accordingly. */
 static void
 server_port_read(struct evdns_server_port *s) {
-	u8 packet[1500];
-	struct sockaddr_storage addr;
+	struct sockaddr *addr;
 	ev_socklen_t addrlen;
-	int r;
+	void *packet;
+	ev_ssize_t len;
+	int i, n;
 	ASSERT_LOCKED(s);
 
+	if (!s->dgram && !(s->dgram = evdgram_new(EVDNS_DGRAM_BATCH,
+		    EVDNS_MAX_UDP_PACKET, 0))) {
+		log(EVDNS_LOG_WARN,
+		    "Unable to allocate memory for reading requests");
+		return;
+	}
+
 	for (;;) {
-		addrlen = sizeof(struct sockaddr_storage);
-		r = recvfrom(s->socket, (void*)packet, sizeof(packet), 0,
-					 (struct sockaddr*) &addr, &addrlen);
-		if (r < 0) {
+		n = evdgram_recv(s->dgram, s->socket);
+		if (n < 0) {
 			int err = evutil_socket_geterror(s->socket);
-			if (EVUTIL_ERR_RW_RETRIABLE(err))
-				return;
 			log(EVDNS_LOG_WARN,
 			    "Error %s (%d) while reading request.",
 			    evutil_socket_error_to_string(err), err);
 			return;
 		}
-		request_parse(packet, r, s, (struct sockaddr*) &addr, addrlen);
+		for (i = 0; i < n; ++i) {
+			len = evdgram_get(s->dgram, i, &packet, &addr,
+			    &addrlen);
+			request_parse(packet, (int)len, s, addr, addrlen);
+		}
+		/* A short batch means we have drained the socket. */
+		if (n < EVDNS_DGRAM_BATCH)
+			return;
 	}
 }
 
@@ -2128,6 +2371,8 @@ server_port_free(struct evdns_server_port *port)
 	}
 	(void) event_del(&port->event);
 	event_debug_unassign(&port->event);
+	if (port->dgram)
+		evdgram_free(port->dgram);
 	EVTHREAD_FREE_LOCK(port->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
 	mm_free(port);
 }
@@ -2888,6 +3133,11 @@ evdns_base_resolve_ipv4(struct evdns_base *base, const char *name, int flags,
 	if (handle == NULL)
 		return NULL;
 	EVDNS_LOCK(base);
+	if (!evdns_cache_lookup_(base, handle, TYPE_A, name,
+		evdns_cache_searched_(base, flags), callback, ptr)) {
+		EVDNS_UNLOCK(base);
+		return handle;
+	}
 	if (flags & DNS_QUERY_NO_SEARCH) {
 		req =
 			request_new(base, handle, TYPE_A, name, flags,
@@ -2927,6 +3177,11 @@ evdns_base_resolve_ipv6(struct evdns_base *base,
 	if (handle == NULL)
 		return NULL;
 	EVDNS_LOCK(base);
+	if (!evdns_cache_lookup_(base, handle, TYPE_AAAA, name,
+		evdns_cache_searched_(base, flags), callback, ptr)) {
+		EVDNS_UNLOCK(base);
+		return handle;
+	}
 	if (flags & DNS_QUERY_NO_SEARCH) {
 		req = request_new(base, handle, TYPE_AAAA, name, flags,
 				  callback, ptr);
@@ -2968,6 +3223,11 @@ evdns_base_resolve_reverse(struct evdns_base *base, const struct in_addr *in, in
 		return NULL;
 	log(EVDNS_LOG_DEBUG, "Resolve requested for %s (reverse)", buf);
 	EVDNS_LOCK(base);
+	if (!evdns_cache_lookup_(base, handle, TYPE_PTR, buf, 0,
+		callback, ptr)) {
+		EVDNS_UNLOCK(base);
+		return (handle);
+	}
 	req = request_new(base, handle, TYPE_PTR, buf, flags, callback, ptr);
 	if (req)
 		request_submit(req);
@@ -3008,6 +3268,11 @@ evdns_base_resolve_reverse_ipv6(struct evdns_base *base, const struct in6_addr *
 		return NULL;
 	log(EVDNS_LOG_DEBUG, "Resolve requested for %s (reverse)", buf);
 	EVDNS_LOCK(base);
+	if (!evdns_cache_lookup_(base, handle, TYPE_PTR, buf, 0,
+		callback, ptr)) {
+		EVDNS_UNLOCK(base);
+		return (handle);
+	}
 	req = request_new(base, handle, TYPE_PTR, buf, flags, callback, ptr);
 	if (req)
 		request_submit(req);
@@ -3050,6 +3315,15 @@ struct search_state {
 	struct search_domain *head;
 };
 
+/* Return true iff a lookup of a name with these flags uses the search list;
+ * must agree with search_request_new(). */
+static int
+evdns_cache_searched_(struct evdns_base *base, int flags)
+{
+	return !(flags & DNS_QUERY_NO_SEARCH) && base->global_search_state &&
+	    base->global_search_state->num_domains;
+}
+
 static void
 search_state_decref(struct search_state *const state) {
 	if (!state) return;
@@ -3077,6 +3351,8 @@ search_state_new(void) {
 
 static void
 search_postfix_clear(struct evdns_base *base) {
+	/* cached answers for searched names may be wrong now */
+	evdns_cache_clear_(base);
 	search_state_decref(base->global_search_state);
 
 	base->global_search_state = search_state_new();
@@ -3104,6 +3380,7 @@ search_postfix_add(struct evdns_base *base, const char *domain) {
 	domain_len = strlen(domain);
 
 	ASSERT_LOCKED(base);
+	evdns_cache_clear_(base);
 	if (!base->global_search_state) base->global_search_state = search_state_new();
 	if (!base->global_search_state) return;
 	base->global_search_state->num_domains++;
@@ -3150,6 +3427,7 @@ evdns_search_add(const char *domain) {
 void
 evdns_base_search_ndots_set(struct evdns_base *base, const int ndots) {
 	EVDNS_LOCK(base);
+	evdns_cache_clear_(base);
 	if (!base->global_search_state) base->global_search_state = search_state_new();
 	if (base->global_search_state)
 		base->global_search_state->ndots = ndots;
@@ -3452,6 +3730,7 @@ evdns_base_set_option_impl(struct evdns_base *base,
 		if (ndots == -1) return -1;
 		if (!(flags & DNS_OPTION_SEARCH)) return 0;
 		log(EVDNS_LOG_DEBUG, "Setting ndots to %d", ndots);
+		evdns_cache_clear_(base);
 		if (!base->global_search_state) base->global_search_state = search_state_new();
 		if (!base->global_search_state) return -1;
 		base->global_search_state->ndots = ndots;
@@ -3513,10 +3792,41 @@ evdns_base_set_option_impl(struct evdns_base *base,
 		    val);
 		memcpy(&base->global_nameserver_probe_initial_timeout, &tv,
 		    sizeof(tv));
+	} else if (str_matches_option(option, "cache-size:")) {
+		const int size = strtoint(val);
+		if (size == -1) return -1;
+		if (!(flags & DNS_OPTION_MISC)) return 0;
+		log(EVDNS_LOG_DEBUG, "Setting cache size to %d", size);
+		base->cache_max_entries = size;
+		evdns_cache_shrink_(base, size);
+	} else if (str_matches_option(option, "cache-negative-ttl:")) {
+		const int ttl = strtoint(val);
+		if (ttl == -1) return -1;
+		if (!(flags & DNS_OPTION_MISC)) return 0;
+		log(EVDNS_LOG_DEBUG, "Setting negative cache TTL to %d", ttl);
+		base->cache_negative_ttl = ttl;
 	}
 	return 0;
 }
 
+void
+evdns_base_get_cache_stats(struct evdns_base *base,
+    struct evdns_cache_stats *stats)
+{
+	EVDNS_LOCK(base);
+	*stats = base->cache_stats;
+	stats->entries = HT_SIZE(&base->cache);
+	EVDNS_UNLOCK(base);
+}
+
+void
+evdns_base_clear_cache(struct evdns_base *base)
+{
+	EVDNS_LOCK(base);
+	evdns_cache_clear_(base);
+	EVDNS_UNLOCK(base);
+}
+
 int
 evdns_set_option(const char *option, const char *val, int flags)
 {
@@ -3946,6 +4256,8 @@ evdns_base_new(struct event_base *event_base, int flags)
 	base->global_nameserver_probe_initial_timeout.tv_usec = 0;
 
 	TAILQ_INIT(&base->hostsdb);
+	HT_INIT(evdns_cache_map, &base->cache);
+	TAILQ_INIT(&base->cache_lru);
 
 #define EVDNS_BASE_ALL_FLAGS (0x8001)
 	if (flags & ~EVDNS_BASE_ALL_FLAGS) {
@@ -4079,6 +4391,11 @@ evdns_base_free_and_unlock(struct evdns_base *base, int fail_requests)
 		}
 	}
 
+	evdns_cache_clear_(base);
+	HT_CLEAR(evdns_cache_map, &base->cache);
+
+	if (base->dgram)
+		evdgram_free(base->dgram);
 	mm_free(base->req_heads);
 
 	EVDNS_UNLOCK(base);
@@ -38,6 +38,7 @@ extern "C" {
 #include <sys/queue.h>
 #include "event2/event_struct.h"
 #include "minheap-internal.h"
+#include "timewheel-internal.h"
 #include "evsignal-internal.h"
 #include "mm-internal.h"
 #include "defer-internal.h"
@@ -308,6 +309,17 @@ struct event_base {
 	/** Priority queue of events with timeouts. */
 	// 使用 最小堆 管理超时时间的队列
 	struct min_heap timeheap;
+	/** Used instead of timeheap if EVENT_BASE_FLAG_TIMING_WHEEL is set;
+	 * NULL otherwise. */
+	struct timewheel *timewheel;
+
+	/** Pool of evbuffer chains if EVENT_BASE_FLAG_BUFFER_POOL is set;
+	 * NULL otherwise. */
+	struct evbuffer_chain_pool *buffer_pool;
+
+	/** Loop statistics if event_base_enable_stats() has turned them on;
+	 * NULL otherwise. */
+	struct event_stats_ *stats;
 
 	/** Stored timeval: used to avoid calling gettimeofday/clock_gettime
 	 * too often. */
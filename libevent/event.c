@@ -65,6 +65,9 @@
 #include "evmap-internal.h"
 #include "iocp-internal.h"
 #include "changelist-internal.h"
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
+#include "evbuffer-internal.h"
 #define HT_NO_CACHE_HASH_VALUES
 #include "ht-internal.h"
 #include "util-internal.h"
@@ -86,6 +89,9 @@ extern const struct eventop pollops;
 #ifdef EVENT__HAVE_EPOLL
 extern const struct eventop epollops;
 #endif
+#ifdef EVENT__HAVE_IO_URING
+extern const struct eventop iouringops;
+#endif
 #ifdef EVENT__HAVE_WORKING_KQUEUE
 extern const struct eventop kqops;
 #endif
@@ -107,6 +113,9 @@ static const struct eventop *eventops[] = {
 #ifdef EVENT__HAVE_EPOLL
 	&epollops,
 #endif
+#ifdef EVENT__HAVE_IO_URING
+	&iouringops,
+#endif
 #ifdef EVENT__HAVE_DEVPOLL
 	&devpollops,
 #endif
@@ -131,6 +140,25 @@ struct event_base *event_global_current_base_ = NULL;
 
 static void *event_self_cbarg_ptr_ = NULL;
 
+/** Number of slots in the table of timed callbacks.  It is only filled to
+ * three quarters, so that probes stay short. */
+#define EVENT_STATS_TABLE_SIZE 64
+
+/** Statistics kept by an event_base while event_base_enable_stats() has
+ * them on.  Protected by th_base_lock. */
+struct event_stats_ {
+	/** Everything but the callbacks, in the form we hand out. */
+	struct event_base_stats pub;
+	/** Time one callback in this many. */
+	int sample_interval;
+	/** Callbacks left to run before we time one. */
+	int until_sample;
+	/** Number of used slots in callbacks. */
+	int n_callbacks;
+	/** Open-addressed table of timed callbacks, keyed by function. */
+	struct event_base_callback_stats callbacks[EVENT_STATS_TABLE_SIZE];
+};
+
 /* Prototypes */
 static void	event_queue_insert_active(struct event_base *, struct event_callback *);
 static void	event_queue_insert_active_later(struct event_base *, struct event_callback *);
@@ -155,6 +183,12 @@ static int	event_haveevents(struct event_base *);
 static int	event_process_active(struct event_base *);
 
 static int	timeout_next(struct event_base *, struct timeval **);
+static void	stats_note_iteration(struct event_base *,
+    const struct timeval *before, const struct timeval *after, int n_active);
+static void	stats_note_stall(struct event_base *, const struct timeval *since);
+static void	*stats_callback_fn(const struct event_callback *);
+static void	stats_note_callback(struct event_base *, void *fn,
+    const struct timeval *since);
 static void	timeout_process(struct event_base *);
 
 static inline void	event_signal_closure(struct event_base *, struct event *ev);
@@ -653,6 +687,18 @@ event_base_new_with_config(const struct event_config *cfg)
 		evutil_configure_monotonic_time_(&base->monotonic_timer, flags);
 
 		gettime(base, &tmp);  //??作用
+
+		if (should_check_environment &&
+		    evutil_getenv_("EVENT_TIMING_WHEEL") != NULL)
+			base->flags |= EVENT_BASE_FLAG_TIMING_WHEEL;
+		if (base->flags & EVENT_BASE_FLAG_TIMING_WHEEL) {
+			base->timewheel = timewheel_new_(&tmp);
+			if (base->timewheel == NULL) {
+				event_warn("%s: calloc", __func__);
+				mm_free(base);
+				return NULL;
+			}
+		}
 	}
 
 	// 初始化堆
@@ -729,6 +775,13 @@ event_base_new_with_config(const struct event_config *cfg)
 	if (evutil_getenv_("EVENT_SHOW_METHOD"))
 		event_msgx("libevent using: %s", base->evsel->name);
 
+	if (base->flags & EVENT_BASE_FLAG_BUFFER_POOL) {
+		if ((base->buffer_pool = evbuffer_chain_pool_new_()) == NULL) {
+			event_base_free(base);
+			return NULL;
+		}
+	}
+
 	/* allocate a single active event queue */
 	if (event_base_priority_init(base, 1) < 0) {
 		event_base_free(base);
@@ -899,6 +952,11 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		event_del(ev);
 		++n_deleted;
 	}
+	while (base->timewheel &&
+	    (ev = timewheel_any_(base->timewheel)) != NULL) {
+		event_del(ev);
+		++n_deleted;
+	}
 	for (i = 0; i < base->n_common_timeouts; ++i) {
 		struct common_timeout_list *ctl =
 		    base->common_timeout_queues[i];
@@ -952,6 +1010,14 @@ event_base_free_(struct event_base *base, int run_finalizers)
 
 	EVUTIL_ASSERT(min_heap_empty_(&base->timeheap));
 	min_heap_dtor_(&base->timeheap);
+	if (base->timewheel) {
+		EVUTIL_ASSERT(timewheel_empty_(base->timewheel));
+		timewheel_free_(base->timewheel);
+	}
+	if (base->buffer_pool)
+		evbuffer_chain_pool_free_(base->buffer_pool);
+	if (base->stats)
+		mm_free(base->stats);
 
 	mm_free(base->activequeues);
 
@@ -1669,6 +1735,16 @@ event_process_active_single_queue(struct event_base *base,
 
 	for (evcb = TAILQ_FIRST(activeq); evcb; evcb = TAILQ_FIRST(activeq)) {
 		struct event *ev=NULL;
+		struct timeval cb_start;
+		void *timed_fn = NULL;
+
+		/* Pick the callback out now: a finalizer may free it. */
+		if (base->stats && --base->stats->until_sample <= 0) {
+			base->stats->until_sample = base->stats->sample_interval;
+			timed_fn = stats_callback_fn(evcb);
+			evutil_gettime_monotonic_(&base->monotonic_timer,
+			    &cb_start);
+		}
 		if (evcb->evcb_flags & EVLIST_INIT) {
 			ev = event_callback_to_event(evcb);
 
@@ -1752,6 +1828,8 @@ event_process_active_single_queue(struct event_base *base,
 		}
 
 		EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		if (timed_fn && base->stats)
+			stats_note_callback(base, timed_fn, &cb_start);
 		base->current_event = NULL;
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
 		if (base->current_event_waiters) {
@@ -1958,7 +2036,8 @@ event_base_loop(struct event_base *base, int flags)
 	const struct eventop *evsel = base->evsel;
 	struct timeval tv;
 	struct timeval *tv_p;
-	int res, done, retval = 0;
+	struct timeval dispatch_start, dispatch_end;
+	int res, done, timed, retval = 0;
 
 	/* Grab the lock.  We will release it inside evsel.dispatch, and again
 	 * as we invoke user callbacks. */
@@ -2024,6 +2103,11 @@ event_base_loop(struct event_base *base, int flags)
 		event_queue_make_later_events_active(base);
 
 		clear_time_cache(base);
+
+		timed = base->stats != NULL;
+		if (timed)
+			evutil_gettime_monotonic_(&base->monotonic_timer,
+			    &dispatch_start);
 		
 		// 获取当前的active事件
 		// 这个tv_p,非常有意思。指的是，当前的最小超时时间，
@@ -2042,6 +2126,15 @@ event_base_loop(struct event_base *base, int flags)
 		// 处理超时事件
 		timeout_process(base);
 
+		if (timed && base->stats) {
+			evutil_gettime_monotonic_(&base->monotonic_timer,
+			    &dispatch_end);
+			stats_note_iteration(base, &dispatch_start,
+			    &dispatch_end, N_ACTIVE_CALLBACKS(base));
+		} else {
+			timed = 0;
+		}
+
 		if (N_ACTIVE_CALLBACKS(base)) {
 			// 处理当前active的事件
 			int n = event_process_active(base);
@@ -2051,6 +2144,9 @@ event_base_loop(struct event_base *base, int flags)
 				done = 1;
 		} else if (flags & EVLOOP_NONBLOCK)
 			done = 1;
+
+		if (timed && base->stats)
+			stats_note_stall(base, &dispatch_end);
 	}
 	event_debug(("%s: asked to terminate loop.", __func__));
 
@@ -2701,7 +2797,8 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 	 * prepare for timeout insertion further below, if we get a
 	 * failure on any step, we should not change any state.
 	 */
-	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT)) {
+	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT) &&
+	    base->timewheel == NULL) {
 		// 分配内存，增加1个元素的内存空间
 		if (min_heap_reserve_(&base->timeheap,
 			1 + min_heap_size_(&base->timeheap)) == -1)
@@ -2841,7 +2938,9 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 			 * We double check the timeout of the top element to
 			 * handle time distortions due to system suspension.
 			 */
-			if (min_heap_elt_is_top_(ev))
+			if (base->timewheel)
+				notify = timewheel_elt_is_next_(base->timewheel, ev);
+			else if (min_heap_elt_is_top_(ev))
 				notify = 1;
 			else if ((top = min_heap_top_(&base->timeheap)) != NULL &&
 					 evutil_timercmp(&top->ev_timeout, &now, <))
@@ -3249,6 +3348,26 @@ timeout_next(struct event_base *base, struct timeval **tv_p)
 	struct timeval *tv = *tv_p;
 	int res = 0;
 
+	if (base->timewheel) {
+		ev_uint64_t tick;
+		struct timeval when;
+
+		if (!timewheel_next_(base->timewheel, &tick)) {
+			*tv_p = NULL;
+			goto out;
+		}
+		if (gettime(base, &now) == -1) {
+			res = -1;
+			goto out;
+		}
+		timewheel_tick_to_tv_(tick, &when);
+		if (evutil_timercmp(&when, &now, <=))
+			evutil_timerclear(tv);
+		else
+			evutil_timersub(&when, &now, tv);
+		goto out;
+	}
+
 	// 获取具体
 	ev = min_heap_top_(&base->timeheap);
 
@@ -3289,6 +3408,21 @@ timeout_process(struct event_base *base)
 	struct timeval now;
 	struct event *ev;
 
+	/* The wheel hands out whole slots of events that are due. */
+	if (base->timewheel) {
+		ev_uint64_t tick;
+
+		gettime(base, &now);
+		tick = timewheel_tick_(&now, 0);
+		while ((ev = timewheel_expire_(base->timewheel, tick))) {
+			event_del_nolock_(ev, EVENT_DEL_NOBLOCK);
+			event_debug(("timeout_process: event: %p, call %p",
+				 ev, ev->ev_callback));
+			event_active_nolock_(ev, EV_TIMEOUT, 1);
+		}
+		return;
+	}
+
 	// 判断堆是否为空
 	if (min_heap_empty_(&base->timeheap)) {
 		return;
@@ -3392,6 +3526,8 @@ event_queue_remove_timeout(struct event_base *base, struct event *ev)
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
+	} else if (base->timewheel) {
+		timewheel_erase_(base->timewheel, ev);
 	} else {
 		min_heap_erase_(&base->timeheap, ev);
 	}
@@ -3547,6 +3683,8 @@ event_queue_insert_timeout(struct event_base *base, struct event *ev)
 		struct common_timeout_list *ctl =
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
+	} else if (base->timewheel) {
+		timewheel_push_(base->timewheel, ev);
 	} else {
 		min_heap_push_(&base->timeheap, ev);
 	}
@@ -3816,6 +3954,15 @@ event_base_foreach_event_nolock_(struct event_base *base,
 		if ((r = fn(base, ev, arg)))
 			return r;
 	}
+	for (u = 0; base->timewheel && u < TIMEWHEEL_NSLOTS; ++u) {
+		ev = timewheel_slot_first_(base->timewheel, u);
+		for (; ev; ev = timewheel_slot_next_(ev)) {
+			if (ev->ev_flags & EVLIST_INSERTED)
+				continue;
+			if ((r = fn(base, ev, arg)))
+				return r;
+		}
+	}
 
 	/* Now for the events in one of the timeout queues.
 	 * the min-heap. */
@@ -3955,6 +4102,172 @@ event_base_active_by_signal(struct event_base *base, int sig)
 }
 
 
+/* Return the histogram bucket for v: see struct event_base_stats. */
+static int
+stats_bucket(ev_uint64_t v)
+{
+	int i = 0;
+	while (v && i < EVENT_BASE_STATS_BUCKETS - 1) {
+		v >>= 1;
+		++i;
+	}
+	return i;
+}
+
+static ev_uint64_t
+stats_usec_since(const struct timeval *since, const struct timeval *now)
+{
+	struct timeval diff;
+	if (evutil_timercmp(now, since, <))
+		return 0;
+	evutil_timersub(now, since, &diff);
+	return (ev_uint64_t)diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+static void
+stats_note_iteration(struct event_base *base, const struct timeval *before,
+    const struct timeval *after, int n_active)
+{
+	struct event_base_stats *st = &base->stats->pub;
+
+	++st->iterations;
+	++st->dispatch_hist[stats_bucket(stats_usec_since(before, after))];
+	++st->active_hist[stats_bucket((ev_uint64_t)n_active)];
+	st->active_total += n_active;
+	if ((ev_uint64_t)n_active > st->active_max)
+		st->active_max = n_active;
+}
+
+static void
+stats_note_stall(struct event_base *base, const struct timeval *since)
+{
+	struct timeval now;
+	ev_uint64_t usec;
+
+	evutil_gettime_monotonic_(&base->monotonic_timer, &now);
+	usec = stats_usec_since(since, &now);
+	if (usec > base->stats->pub.longest_stall_usec)
+		base->stats->pub.longest_stall_usec = usec;
+}
+
+/* Return the function that running evcb will call. */
+static void *
+stats_callback_fn(const struct event_callback *evcb)
+{
+	switch (evcb->evcb_closure) {
+	case EV_CLOSURE_EVENT:
+	case EV_CLOSURE_EVENT_SIGNAL:
+	case EV_CLOSURE_EVENT_PERSIST:
+		return (void *)evcb->evcb_cb_union.evcb_callback;
+	case EV_CLOSURE_CB_SELF:
+		return (void *)evcb->evcb_cb_union.evcb_selfcb;
+	case EV_CLOSURE_EVENT_FINALIZE:
+	case EV_CLOSURE_EVENT_FINALIZE_FREE:
+		return (void *)evcb->evcb_cb_union.evcb_evfinalize;
+	case EV_CLOSURE_CB_FINALIZE:
+		return (void *)evcb->evcb_cb_union.evcb_cbfinalize;
+	default:
+		return NULL;
+	}
+}
+
+static void
+stats_note_callback(struct event_base *base, void *fn,
+    const struct timeval *since)
+{
+	struct event_stats_ *stats = base->stats;
+	struct event_base_callback_stats *ent;
+	struct timeval now;
+	ev_uint64_t usec;
+	unsigned i;
+
+	evutil_gettime_monotonic_(&base->monotonic_timer, &now);
+	usec = stats_usec_since(since, &now);
+
+	/* Functions are aligned, so the low bits say little. */
+	i = (unsigned)(((ev_uintptr_t)fn >> 4) * 2654435761u);
+	for (;;) {
+		ent = &stats->callbacks[i % EVENT_STATS_TABLE_SIZE];
+		if (ent->callback == fn)
+			break;
+		if (ent->callback == NULL) {
+			if (stats->n_callbacks >= EVENT_STATS_TABLE_SIZE*3/4) {
+				++stats->pub.callbacks_untracked;
+				return;
+			}
+			++stats->n_callbacks;
+			ent->callback = fn;
+			break;
+		}
+		++i;
+	}
+	++ent->samples;
+	ent->total_usec += usec;
+	if (usec > ent->max_usec)
+		ent->max_usec = usec;
+}
+
+static int
+stats_compare_callbacks(const void *a_, const void *b_)
+{
+	const struct event_base_callback_stats *a = a_, *b = b_;
+	if (a->total_usec != b->total_usec)
+		return a->total_usec > b->total_usec ? -1 : 1;
+	return 0;
+}
+
+int
+event_base_enable_stats(struct event_base *base, int sample_interval)
+{
+	int r = 0;
+
+	if (sample_interval < 0)
+		return -1;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (sample_interval == 0) {
+		if (base->stats) {
+			mm_free(base->stats);
+			base->stats = NULL;
+		}
+	} else if (base->stats ||
+	    (base->stats = mm_malloc(sizeof(*base->stats))) != NULL) {
+		memset(base->stats, 0, sizeof(*base->stats));
+		base->stats->sample_interval = sample_interval;
+		base->stats->until_sample = sample_interval;
+	} else {
+		r = -1;
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return r;
+}
+
+int
+event_base_get_stats(struct event_base *base, struct event_base_stats *st)
+{
+	struct event_base_callback_stats sorted[EVENT_STATS_TABLE_SIZE];
+	int i, n = 0;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (!base->stats) {
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
+		return -1;
+	}
+	*st = base->stats->pub;
+	for (i = 0; i < EVENT_STATS_TABLE_SIZE; ++i) {
+		if (base->stats->callbacks[i].callback)
+			sorted[n++] = base->stats->callbacks[i];
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	qsort(sorted, n, sizeof(sorted[0]), stats_compare_callbacks);
+	if (n > EVENT_BASE_STATS_CALLBACKS)
+		n = EVENT_BASE_STATS_CALLBACKS;
+	memcpy(st->callbacks, sorted, n * sizeof(sorted[0]));
+	st->n_callbacks = n;
+	return 0;
+}
+
 void
 event_base_add_virtual_(struct event_base *base)
 {
@@ -4068,6 +4381,23 @@ event_base_assert_ok_nolock_(struct event_base *base)
 		EVUTIL_ASSERT(ev->ev_timeout_pos.min_heap_idx == i);
 	}
 
+	/* Check the timing wheel links */
+	if (base->timewheel) {
+		unsigned u, n = 0;
+		for (u = 0; u < TIMEWHEEL_NSLOTS; ++u) {
+			struct event *ev = timewheel_slot_first_(base->timewheel, u);
+			for (; ev; ev = timewheel_slot_next_(ev)) {
+				struct event *next = timewheel_slot_next_(ev);
+				EVUTIL_ASSERT(ev->ev_flags & EVLIST_TIMEOUT);
+				EVUTIL_ASSERT(!is_common_timeout(&ev->ev_timeout, base));
+				if (next)
+					EVUTIL_ASSERT(TIMEWHEEL_PREV(next) == &TIMEWHEEL_NEXT(ev));
+				++n;
+			}
+		}
+		EVUTIL_ASSERT(n == base->timewheel->n);
+	}
+
 	/* Check that the common timeouts are fine */
 	for (i = 0; i < base->n_common_timeouts; ++i) {
 		struct common_timeout_list *ctl = base->common_timeout_queues[i];
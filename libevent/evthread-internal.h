@@ -53,6 +53,7 @@ EVENT2_EXPORT_SYMBOL
 extern struct evthread_lock_callbacks evthread_lock_fns_;
 EVENT2_EXPORT_SYMBOL
 extern struct evthread_condition_callbacks evthread_cond_fns_;
+EVENT2_EXPORT_SYMBOL
 extern unsigned long (*evthread_id_fn_)(void);
 EVENT2_EXPORT_SYMBOL
 extern int evthread_lock_debugging_enabled_;
@@ -184,6 +185,7 @@ EVLOCK_TRY_LOCK_(void *lock)
 
 #elif ! defined(EVENT__DISABLE_THREAD_SUPPORT)
 
+EVENT2_EXPORT_SYMBOL
 unsigned long evthreadimpl_get_id_(void);
 EVENT2_EXPORT_SYMBOL
 int evthreadimpl_is_lock_debugging_enabled_(void);
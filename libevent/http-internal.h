@@ -117,6 +117,38 @@ struct evhttp_cb {
 	void *cbarg;
 };
 
+/* One header in an evhttp_header_arena. */
+struct evhttp_header_entry {
+	const char *key;
+	const char *value;
+	ev_uint32_t key_len;
+	ev_uint32_t value_len;
+};
+
+/* Strings of an evhttp_header_arena; followed by 'size' bytes. */
+struct evhttp_header_block {
+	struct evhttp_header_block *next;	/* the block filled before */
+	ev_uint32_t size;
+	ev_uint32_t used;
+};
+
+#define EVHTTP_HEADER_ARENA_ENTRIES 16
+
+/* Input headers of a request parsed with EVHTTP_CON_ARENA_HEADERS.
+ * NUL-terminated keys and values are packed into a chain of blocks, which
+ * never move: a string handed out stays put while the trailers come in.
+ * The first block and the first entries are part of the arena, so that
+ * most requests need a single allocation. */
+struct evhttp_header_arena {
+	struct evhttp_header_block *block;	/* the one being filled */
+	struct evhttp_header_entry *entries;
+	ev_uint32_t n_entries;
+	ev_uint32_t max_entries;
+	unsigned materialized:1;	/* copied into input_headers */
+	struct evhttp_header_entry first_entries[EVHTTP_HEADER_ARENA_ENTRIES];
+	struct evhttp_header_block first;	/* followed by its memory */
+};
+
 /* both the http server as well as the rpc system need to queue connections */
 TAILQ_HEAD(evconq, evhttp_connection);
 
@@ -187,6 +187,8 @@ static void evhttp_read_header(struct evhttp_connection *evcon,
     struct evhttp_request *req);
 static int evhttp_add_header_internal(struct evkeyvalq *headers,
     const char *key, const char *value);
+static int evhttp_append_to_last_header(struct evkeyvalq *headers,
+    char *line);
 static const char *evhttp_response_phrase_internal(int code);
 static void evhttp_get_request(struct evhttp *, evutil_socket_t, struct sockaddr *, ev_socklen_t);
 static void evhttp_write_buffer(struct evhttp_connection *,
@@ -455,18 +457,30 @@ evhttp_make_header_request(struct evhttp_connection *evcon,
 	}
 }
 
-/** Return true if the list of headers in 'headers', intepreted with respect
- * to flags, means that we should send a "connection: close" when the request
- * is done. */
+/* Find a header in the input or the output headers of req. */
+static const char *
+evhttp_request_find_header_(struct evhttp_request *req, int input,
+    const char *key)
+{
+	if (input)
+		return (evhttp_request_find_input_header(req, key));
+	return (evhttp_find_header(req->output_headers, key));
+}
+
+/** Return true if the input or output headers of req, intepreted with respect
+ * to its flags, mean that we should send a "connection: close" when the
+ * request is done. */
 static int
-evhttp_is_connection_close(int flags, struct evkeyvalq* headers)
+evhttp_is_connection_close(struct evhttp_request *req, int input)
 {
-	if (flags & EVHTTP_PROXY_REQUEST) {
+	if (req->flags & EVHTTP_PROXY_REQUEST) {
 		/* proxy connection */
-		const char *connection = evhttp_find_header(headers, "Proxy-Connection");
+		const char *connection =
+		    evhttp_request_find_header_(req, input, "Proxy-Connection");
 		return (connection == NULL || evutil_ascii_strcasecmp(connection, "keep-alive") != 0);
 	} else {
-		const char *connection = evhttp_find_header(headers, "Connection");
+		const char *connection =
+		    evhttp_request_find_header_(req, input, "Connection");
 		return (connection != NULL && evutil_ascii_strcasecmp(connection, "close") == 0);
 	}
 }
@@ -474,15 +488,16 @@ static int
 evhttp_is_request_connection_close(struct evhttp_request *req)
 {
 	return
-		evhttp_is_connection_close(req->flags, req->input_headers) ||
-		evhttp_is_connection_close(req->flags, req->output_headers);
+		evhttp_is_connection_close(req, 1) ||
+		evhttp_is_connection_close(req, 0);
 }
 
-/* Return true iff 'headers' contains 'Connection: keep-alive' */
+/* Return true iff the input headers of req contain 'Connection: keep-alive' */
 static int
-evhttp_is_connection_keepalive(struct evkeyvalq* headers)
+evhttp_is_connection_keepalive(struct evhttp_request *req)
 {
-	const char *connection = evhttp_find_header(headers, "Connection");
+	const char *connection =
+	    evhttp_request_find_input_header(req, "Connection");
 	return (connection != NULL
 	    && evutil_ascii_strncasecmp(connection, "keep-alive", 10) == 0);
 }
@@ -522,7 +537,7 @@ static void
 evhttp_make_header_response(struct evhttp_connection *evcon,
     struct evhttp_request *req)
 {
-	int is_keepalive = evhttp_is_connection_keepalive(req->input_headers);
+	int is_keepalive = evhttp_is_connection_keepalive(req);
 	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
 	    "HTTP/%d.%d %d %s\r\n",
 	    req->major, req->minor, req->response_code,
@@ -565,7 +580,7 @@ evhttp_make_header_response(struct evhttp_connection *evcon,
 	}
 
 	/* if the request asked for a close, we send a close, too */
-	if (evhttp_is_connection_close(req->flags, req->input_headers)) {
+	if (evhttp_is_connection_close(req, 1)) {
 		evhttp_remove_header(req->output_headers, "Connection");
 		if (!(req->flags & EVHTTP_PROXY_REQUEST))
 		    evhttp_add_header(req->output_headers, "Connection", "close");
@@ -577,12 +592,11 @@ enum expect { NO, CONTINUE, OTHER };
 static enum expect evhttp_have_expect(struct evhttp_request *req, int input)
 {
 	const char *expect;
-	struct evkeyvalq *h = input ? req->input_headers : req->output_headers;
 
 	if (!(req->kind == EVHTTP_REQUEST) || !REQ_VERSION_ATLEAST(req, 1, 1))
 		return NO;
 
-	expect = evhttp_find_header(h, "Expect");
+	expect = evhttp_request_find_header_(req, input, "Expect");
 	if (!expect)
 		return NO;
 
@@ -1977,6 +1991,311 @@ evhttp_add_header_internal(struct evkeyvalq *headers,
 	return (0);
 }
 
+/*
+ * Headers parsed with EVHTTP_CON_ARENA_HEADERS.
+ *
+ * Lines are found with memchr() in the first chain of the input buffer
+ * and parsed where they are; only a line that straddles two chains is
+ * pulled up.  Keys and values are copied once into the arena of the
+ * request, which replaces the three allocations per header of the
+ * evkeyvalq.
+ */
+
+#define EVHTTP_REQ_ARENA_HEADERS(req) \
+	((req)->evcon != NULL && ((req)->evcon->flags & EVHTTP_CON_ARENA_HEADERS))
+#define HEADER_ARENA_INITIAL_SIZE 1024
+#define HEADER_BLOCK_MEM(b) ((char *)((b) + 1))
+
+/* Returns room for len more bytes of strings, at the end of the current
+ * block or in a new one.  Blocks are never moved or resized, since the
+ * user may hold strings from them. */
+static char *
+evhttp_header_arena_reserve_(struct evhttp_request *req, size_t len)
+{
+	struct evhttp_header_arena *a = req->input_arena;
+	struct evhttp_header_block *b;
+	size_t size;
+
+	if (a == NULL) {
+		a = mm_malloc(sizeof(*a) + HEADER_ARENA_INITIAL_SIZE);
+		if (a == NULL) {
+			event_warn("%s: malloc", __func__);
+			return (NULL);
+		}
+		memset(a, 0, sizeof(*a));
+		a->entries = a->first_entries;
+		a->max_entries = EVHTTP_HEADER_ARENA_ENTRIES;
+		a->first.size = HEADER_ARENA_INITIAL_SIZE;
+		a->block = &a->first;
+		req->input_arena = a;
+	}
+	b = a->block;
+	if (len <= b->size - b->used)
+		return (HEADER_BLOCK_MEM(b) + b->used);
+
+	size = (size_t)b->size * 2;
+	while (size < len)
+		size <<= 1;
+	if (size > EV_UINT32_MAX / 2)
+		return (NULL);
+	if ((b = mm_malloc(sizeof(*b) + size)) == NULL) {
+		event_warn("%s: malloc", __func__);
+		return (NULL);
+	}
+	b->next = a->block;
+	b->size = (ev_uint32_t)size;
+	b->used = 0;
+	a->block = b;
+	return (HEADER_BLOCK_MEM(b));
+}
+
+static struct evhttp_header_entry *
+evhttp_header_arena_new_entry_(struct evhttp_header_arena *a)
+{
+	if (a->n_entries == a->max_entries) {
+		struct evhttp_header_entry *entries;
+		size_t max = (size_t)a->max_entries * 2;
+
+		if (max > EV_UINT32_MAX / sizeof(*entries))
+			return (NULL);
+		if (a->entries == a->first_entries) {
+			entries = mm_malloc(max * sizeof(*entries));
+			if (entries != NULL)
+				memcpy(entries, a->first_entries,
+				    sizeof(a->first_entries));
+		} else {
+			entries = mm_realloc(a->entries,
+			    max * sizeof(*entries));
+		}
+		if (entries == NULL) {
+			event_warn("%s: realloc", __func__);
+			return (NULL);
+		}
+		a->entries = entries;
+		a->max_entries = (ev_uint32_t)max;
+	}
+	return (&a->entries[a->n_entries++]);
+}
+
+static void
+evhttp_header_arena_free_(struct evhttp_header_arena *a)
+{
+	struct evhttp_header_block *b, *next;
+
+	for (b = a->block; b != &a->first; b = next) {
+		next = b->next;
+		mm_free(b);
+	}
+	if (a->entries != a->first_entries)
+		mm_free(a->entries);
+	mm_free(a);
+}
+
+static int
+evhttp_header_arena_add_(struct evhttp_request *req,
+    const char *key, size_t key_len, const char *value, size_t value_len)
+{
+	struct evhttp_header_arena *a;
+	struct evhttp_header_entry *e;
+	char *mem;
+
+	if ((mem = evhttp_header_arena_reserve_(req,
+		    key_len + value_len + 2)) == NULL)
+		return (-1);
+	a = req->input_arena;
+	if ((e = evhttp_header_arena_new_entry_(a)) == NULL)
+		return (-1);
+
+	e->key = mem;
+	e->key_len = (ev_uint32_t)key_len;
+	memcpy(mem, key, key_len);
+	mem[key_len] = '\0';
+	mem += key_len + 1;
+
+	e->value = mem;
+	e->value_len = (ev_uint32_t)value_len;
+	memcpy(mem, value, value_len);
+	mem[value_len] = '\0';
+
+	a->block->used += (ev_uint32_t)(key_len + value_len + 2);
+
+	/* Once the user holds the evkeyvalq, keep it up to date. */
+	if (a->materialized)
+		return (evhttp_add_header_internal(req->input_headers,
+			e->key, e->value));
+	return (0);
+}
+
+/* Append a continuation line to the last value.  That is the last string
+ * of the current block, where it grows in place if there is room; if not
+ * it is copied to a new block along with the line. */
+static int
+evhttp_header_arena_append_(struct evhttp_request *req,
+    const char *line, size_t len)
+{
+	struct evhttp_header_arena *a = req->input_arena;
+	struct evhttp_header_block *b;
+	struct evhttp_header_entry *e;
+	char *mem;
+
+	if (a == NULL || a->n_entries == 0)
+		return (-1);
+	e = &a->entries[a->n_entries - 1];
+	b = a->block;
+
+	if (e->value + e->value_len + 1 == HEADER_BLOCK_MEM(b) + b->used &&
+	    len + 1 <= b->size - b->used) {
+		mem = HEADER_BLOCK_MEM(b) + b->used - 1;
+		b->used += (ev_uint32_t)len + 1;
+	} else {
+		if ((mem = evhttp_header_arena_reserve_(req,
+			    e->value_len + len + 2)) == NULL)
+			return (-1);
+		memcpy(mem, e->value, e->value_len);
+		e->value = mem;
+		mem += e->value_len;
+		a->block->used += e->value_len + (ev_uint32_t)len + 2;
+	}
+	*mem++ = ' ';
+	memcpy(mem, line, len);
+	mem[len] = '\0';
+	e->value_len += (ev_uint32_t)len + 1;
+
+	if (a->materialized)
+		return (evhttp_append_to_last_header(req->input_headers, mem));
+	return (0);
+}
+
+/* Parse one header line of len bytes, not including the line ending. */
+static int
+evhttp_header_arena_parse_line_(struct evhttp_request *req,
+    const char *line, size_t len)
+{
+	const char *end = line + len;
+	const char *colon, *value, *p;
+
+	/* Check if this is a continuation line */
+	if (*line == ' ' || *line == '\t') {
+		while (line < end && (*line == ' ' || *line == '\t'))
+			++line;
+		while (end > line && (end[-1] == ' ' || end[-1] == '\t'))
+			--end;
+		return (evhttp_header_arena_append_(req, line, end - line));
+	}
+
+	colon = memchr(line, ':', len);
+	if (colon == NULL)
+		return (-1);
+	/* drop illegal headers, as evhttp_add_header() does */
+	if (memchr(line, '\r', colon - line) != NULL)
+		return (-1);
+
+	value = colon + 1;
+	while (value < end && *value == ' ')
+		++value;
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+		--end;
+
+	/* we expect a space or tab after any CR that made it this far */
+	for (p = value; (p = memchr(p, '\r', end - p)) != NULL; ) {
+		while (p < end && (*p == '\r' || *p == '\n'))
+			++p;
+		if (p == end || (*p != ' ' && *p != '\t'))
+			return (-1);
+	}
+
+	return (evhttp_header_arena_add_(req, line, colon - line,
+		value, end - value));
+}
+
+/*
+ * Returns the next line of buffer in contiguous memory, without draining
+ * it, or NULL if there is no complete line yet.  *line_len excludes and
+ * *drain_len includes the LF or CRLF at the end of the line.
+ */
+static const char *
+evhttp_peek_line_(struct evbuffer *buffer, size_t *line_len, size_t *drain_len)
+{
+	struct evbuffer_iovec v;
+	const char *line, *eol = NULL;
+
+	if (evbuffer_peek(buffer, -1, NULL, &v, 1) < 1)
+		return (NULL);
+	line = v.iov_base;
+	if (v.iov_len)
+		eol = memchr(line, '\n', v.iov_len);
+	if (eol == NULL) {
+		struct evbuffer_ptr pos;
+
+		if (v.iov_len == evbuffer_get_length(buffer))
+			return (NULL);
+		pos = evbuffer_search_eol(buffer, NULL, NULL, EVBUFFER_EOL_LF);
+		if (pos.pos < 0)
+			return (NULL);
+		line = (const char *)evbuffer_pullup(buffer, pos.pos + 1);
+		if (line == NULL)
+			return (NULL);
+		eol = line + pos.pos;
+	}
+
+	*drain_len = eol - line + 1;
+	if (eol > line && eol[-1] == '\r')
+		--eol;
+	*line_len = eol - line;
+	return (line);
+}
+
+static enum message_read_status
+evhttp_parse_headers_arena_(struct evhttp_request *req, struct evbuffer *buffer)
+{
+	const char *line;
+	size_t line_len, drain_len;
+
+	while ((line = evhttp_peek_line_(buffer, &line_len, &drain_len))
+	       != NULL) {
+		req->headers_size += line_len;
+
+		if (req->headers_size > req->evcon->max_headers_size)
+			return (DATA_TOO_LONG);
+
+		if (line_len == 0) { /* Last header - Done */
+			evbuffer_drain(buffer, drain_len);
+			return (ALL_DATA_READ);
+		}
+
+		if (evhttp_header_arena_parse_line_(req, line, line_len) < 0)
+			return (DATA_CORRUPTED);
+		evbuffer_drain(buffer, drain_len);
+	}
+
+	if (req->headers_size + evbuffer_get_length(buffer) >
+	    req->evcon->max_headers_size)
+		return (DATA_TOO_LONG);
+
+	return (MORE_DATA_EXPECTED);
+}
+
+/* Like evbuffer_readln(), but copies the line into the arena of req. */
+static char *
+evhttp_readln_arena_(struct evhttp_request *req, struct evbuffer *buffer,
+    size_t *line_len)
+{
+	const char *line;
+	size_t drain_len;
+	char *copy;
+
+	line = evhttp_peek_line_(buffer, line_len, &drain_len);
+	if (line == NULL)
+		return (NULL);
+	/* Scratch space after the strings; headers will overwrite it. */
+	if ((copy = evhttp_header_arena_reserve_(req, *line_len + 1)) == NULL)
+		return (NULL);
+	memcpy(copy, line, *line_len);
+	copy[*line_len] = '\0';
+	evbuffer_drain(buffer, drain_len);
+	return (copy);
+}
+
 /*
  * Parses header lines from a request or a response into the specified
  * request object given an event buffer.
@@ -1992,10 +2311,14 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 {
 	char *line;
 	enum message_read_status status = ALL_DATA_READ;
+	int in_arena = EVHTTP_REQ_ARENA_HEADERS(req);
 
 	size_t line_length;
 	/* XXX try */
-	line = evbuffer_readln(buffer, &line_length, EVBUFFER_EOL_CRLF);
+	if (in_arena)
+		line = evhttp_readln_arena_(req, buffer, &line_length);
+	else
+		line = evbuffer_readln(buffer, &line_length, EVBUFFER_EOL_CRLF);
 	if (line == NULL) {
 		if (req->evcon != NULL &&
 		    evbuffer_get_length(buffer) > req->evcon->max_headers_size)
@@ -2006,7 +2329,8 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 
 	if (req->evcon != NULL &&
 	    line_length > req->evcon->max_headers_size) {
-		mm_free(line);
+		if (!in_arena)
+			mm_free(line);
 		return (DATA_TOO_LONG);
 	}
 
@@ -2025,7 +2349,8 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 		status = DATA_CORRUPTED;
 	}
 
-	mm_free(line);
+	if (!in_arena)
+		mm_free(line);
 	return (status);
 }
 
@@ -2068,6 +2393,10 @@ evhttp_parse_headers_(struct evhttp_request *req, struct evbuffer* buffer)
 
 	struct evkeyvalq* headers = req->input_headers;
 	size_t line_length;
+
+	if (EVHTTP_REQ_ARENA_HEADERS(req))
+		return (evhttp_parse_headers_arena_(req, buffer));
+
 	while ((line = evbuffer_readln(buffer, &line_length, EVBUFFER_EOL_CRLF))
 	       != NULL) {
 		char *skey, *svalue;
@@ -2125,12 +2454,11 @@ evhttp_parse_headers_(struct evhttp_request *req, struct evbuffer* buffer)
 static int
 evhttp_get_body_length(struct evhttp_request *req)
 {
-	struct evkeyvalq *headers = req->input_headers;
 	const char *content_length;
 	const char *connection;
 
-	content_length = evhttp_find_header(headers, "Content-Length");
-	connection = evhttp_find_header(headers, "Connection");
+	content_length = evhttp_request_find_input_header(req, "Content-Length");
+	connection = evhttp_request_find_input_header(req, "Connection");
 
 	if (content_length == NULL && connection == NULL)
 		req->ntoread = -1;
@@ -2190,7 +2518,7 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 		return;
 	}
 	evcon->state = EVCON_READING_BODY;
-	xfer_enc = evhttp_find_header(req->input_headers, "Transfer-Encoding");
+	xfer_enc = evhttp_request_find_input_header(req, "Transfer-Encoding");
 	if (xfer_enc != NULL && evutil_ascii_strcasecmp(xfer_enc, "chunked") == 0) {
 		req->chunked = 1;
 		req->ntoread = -1;
@@ -2446,6 +2774,7 @@ int evhttp_connection_set_flags(struct evhttp_connection *evcon,
 	int avail_flags = 0;
 	avail_flags |= EVHTTP_CON_REUSE_CONNECTED_ADDR;
 	avail_flags |= EVHTTP_CON_READ_ON_WRITE_ERROR;
+	avail_flags |= EVHTTP_CON_ARENA_HEADERS;
 
 	if (flags & ~avail_flags || flags > EVHTTP_CON_PUBLIC_FLAGS_END)
 		return 1;
@@ -2745,7 +3074,7 @@ evhttp_send_done(struct evhttp_connection *evcon, void *arg)
 
 	need_close =
 	    (REQ_VERSION_BEFORE(req, 1, 1) &&
-	    !evhttp_is_connection_keepalive(req->input_headers)) ||
+	    !evhttp_is_connection_keepalive(req)) ||
 	    evhttp_is_request_connection_close(req);
 
 	EVUTIL_ASSERT(req->flags & EVHTTP_REQ_OWN_CONNECTION);
@@ -3855,6 +4184,7 @@ int evhttp_set_flags(struct evhttp *http, int flags)
 {
 	int avail_flags = 0;
 	avail_flags |= EVHTTP_SERVER_LINGERING_CLOSE;
+	avail_flags |= EVHTTP_SERVER_ARENA_HEADERS;
 
 	if (flags & ~avail_flags)
 		return 1;
@@ -4045,6 +4375,8 @@ evhttp_request_free(struct evhttp_request *req)
 
 	evhttp_clear_headers(req->input_headers);
 	mm_free(req->input_headers);
+	if (req->input_arena != NULL)
+		evhttp_header_arena_free_(req->input_arena);
 
 	evhttp_clear_headers(req->output_headers);
 	mm_free(req->output_headers);
@@ -4144,7 +4476,7 @@ evhttp_request_get_host(struct evhttp_request *req)
 		const char *p;
 		size_t len;
 
-		host = evhttp_find_header(req->input_headers, "Host");
+		host = evhttp_request_find_input_header(req, "Host");
 		/* The Host: header may include a port. Remove it here
 		   to be consistent with uri_elems case above. */
 		if (host) {
@@ -4188,9 +4520,44 @@ evhttp_request_get_response_code_line(const struct evhttp_request *req)
 /** Returns the input headers */
 struct evkeyvalq *evhttp_request_get_input_headers(struct evhttp_request *req)
 {
+	struct evhttp_header_arena *a = req->input_arena;
+
+	/* Build the list from the arena on first use; from then on the
+	 * list is what counts, since the user may change it. */
+	if (a != NULL && !a->materialized) {
+		ev_uint32_t i;
+
+		a->materialized = 1;
+		for (i = 0; i < a->n_entries; ++i) {
+			const struct evhttp_header_entry *e = &a->entries[i];
+			if (evhttp_add_header_internal(req->input_headers,
+				e->key, e->value) < 0)
+				break;
+		}
+	}
 	return (req->input_headers);
 }
 
+const char *
+evhttp_request_find_input_header(struct evhttp_request *req, const char *key)
+{
+	struct evhttp_header_arena *a = req->input_arena;
+	size_t key_len;
+	ev_uint32_t i;
+
+	if (a == NULL || a->materialized)
+		return (evhttp_find_header(req->input_headers, key));
+
+	key_len = strlen(key);
+	for (i = 0; i < a->n_entries; ++i) {
+		const struct evhttp_header_entry *e = &a->entries[i];
+		if (e->key_len == key_len &&
+		    evutil_ascii_strcasecmp(e->key, key) == 0)
+			return (e->value);
+	}
+	return (NULL);
+}
+
 /** Returns the output headers */
 struct evkeyvalq *evhttp_request_get_output_headers(struct evhttp_request *req)
 {
@@ -4256,6 +4623,8 @@ evhttp_get_request_connection(
 	evcon->max_body_size = http->default_max_body_size;
 	if (http->flags & EVHTTP_SERVER_LINGERING_CLOSE)
 		evcon->flags |= EVHTTP_CON_LINGERING_CLOSE;
+	if (http->flags & EVHTTP_SERVER_ARENA_HEADERS)
+		evcon->flags |= EVHTTP_CON_ARENA_HEADERS;
 
 	// 将该连接标注为 incoming
 	evcon->flags |= EVHTTP_CON_INCOMING;
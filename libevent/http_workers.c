@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * evhttp_workers: one HTTP server configuration served by several threads.
+ *
+ * Each worker is a thread with an event_base of its own and an evhttp
+ * copied from the template the user configured.  Nothing is shared between
+ * workers while serving: with SO_REUSEPORT each one has its own listening
+ * socket, and the kernel balances connections between them.
+ *
+ * An evhttp is not locked, so it may only be changed from the thread that
+ * runs its base.  Changes to running workers are therefore made by
+ * scheduling a job on every worker's base with event_base_once() and
+ * waiting for all of them to finish it.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <process.h>
+#endif
+
+#include <sys/queue.h>
+
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef EVENT__HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#ifdef EVENT__HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "event2/http.h"
+#include "event2/event.h"
+#include "event2/util.h"
+#include "event2/listener.h"
+#include "log-internal.h"
+#include "util-internal.h"
+#include "http-internal.h"
+#include "mm-internal.h"
+#include "evthread-internal.h"
+
+#if defined(EVENT__HAVE_PTHREADS)
+#define WORKER_THREAD_T pthread_t
+#define WORKER_THREAD_FN void *
+#define WORKER_THREAD_RETURN() return (NULL)
+#define WORKER_THREAD_START(threadvar, fn, arg) \
+	pthread_create(&(threadvar), NULL, fn, arg)
+#define WORKER_THREAD_JOIN(th) pthread_join(th, NULL)
+#elif defined(_WIN32)
+#define WORKER_THREAD_T HANDLE
+#define WORKER_THREAD_FN unsigned __stdcall
+#define WORKER_THREAD_RETURN() return (0)
+#define WORKER_THREAD_START(threadvar, fn, arg)			\
+	(((threadvar) = (HANDLE)_beginthreadex(NULL, 0, fn, (arg), 0,	\
+	    NULL)) == 0 ? -1 : 0)
+#define WORKER_THREAD_JOIN(th) do {			\
+		WaitForSingleObject(th, INFINITE);	\
+		CloseHandle(th);			\
+	} while (0)
+#endif
+
+struct evhttp_worker {
+	struct evhttp_workers *workers;
+	struct event_base *base;
+	struct evhttp *http;
+#ifdef WORKER_THREAD_T
+	WORKER_THREAD_T thread;
+#endif
+	/** EVTHREAD_GET_ID() of the worker thread, once it is running. */
+	unsigned long thread_id;
+	/** The thread was started, and has to be joined. */
+	unsigned started : 1;
+	/** The thread is inside event_base_loop(). */
+	unsigned running : 1;
+};
+
+struct evhttp_workers {
+	struct evhttp_worker *workers;
+	int n_workers;
+
+	/** Protects n_ready and the jobs below. */
+	void *lock;
+	/** Signalled when a worker starts, or finishes a job. */
+	void *cond;
+	/** Workers that are running, or that failed to. */
+	int n_ready;
+};
+
+/** A function run on every worker by evhttp_workers_run_(). */
+struct evhttp_workers_job {
+	int (*fn)(struct evhttp_worker *, void *);
+	void *arg;
+	/** Workers that have not yet run fn. */
+	int pending;
+	/** -1 if fn failed on any worker, otherwise what it returned on the
+	 * first one. */
+	int result;
+};
+
+struct evhttp_workers_job_ref {
+	struct evhttp_workers_job *job;
+	struct evhttp_worker *worker;
+};
+
+static struct evhttp *
+evhttp_clone_(struct evhttp *tmpl, struct event_base *base)
+{
+	struct evhttp *http, *vhost, *copy;
+	struct evhttp_cb *cb;
+	struct evhttp_server_alias *alias;
+
+	if ((http = evhttp_new(base)) == NULL)
+		return (NULL);
+
+	http->timeout = tmpl->timeout;
+	http->default_max_headers_size = tmpl->default_max_headers_size;
+	http->default_max_body_size = tmpl->default_max_body_size;
+	http->flags = tmpl->flags;
+	http->default_content_type = tmpl->default_content_type;
+	http->allowed_methods = tmpl->allowed_methods;
+	http->gencb = tmpl->gencb;
+	http->gencbarg = tmpl->gencbarg;
+	http->bevcb = tmpl->bevcb;
+	http->bevcbarg = tmpl->bevcbarg;
+	http->newreqcb = tmpl->newreqcb;
+	http->newreqcbarg = tmpl->newreqcbarg;
+
+	TAILQ_FOREACH(cb, &tmpl->callbacks, next) {
+		if (evhttp_set_cb(http, cb->what, cb->cb, cb->cbarg) != 0)
+			goto error;
+	}
+	TAILQ_FOREACH(alias, &tmpl->aliases, next) {
+		if (evhttp_add_server_alias(http, alias->alias) != 0)
+			goto error;
+	}
+	TAILQ_FOREACH(vhost, &tmpl->virtualhosts, next_vhost) {
+		if ((copy = evhttp_clone_(vhost, base)) == NULL)
+			goto error;
+		if (evhttp_add_virtual_host(http, vhost->vhost_pattern,
+			copy) != 0) {
+			evhttp_free(copy);
+			goto error;
+		}
+	}
+	return (http);
+
+error:
+	evhttp_free(http);
+	return (NULL);
+}
+
+#ifdef WORKER_THREAD_T
+static void
+evhttp_worker_ready_(struct evhttp_worker *worker, int running)
+{
+	struct evhttp_workers *workers = worker->workers;
+
+	EVLOCK_LOCK(workers->lock, 0);
+	worker->running = running;
+	++workers->n_ready;
+	EVTHREAD_COND_BROADCAST(workers->cond);
+	EVLOCK_UNLOCK(workers->lock, 0);
+}
+
+static void
+evhttp_worker_running_cb(evutil_socket_t fd, short what, void *arg)
+{
+	evhttp_worker_ready_(arg, 1);
+}
+
+static WORKER_THREAD_FN
+evhttp_worker_main(void *arg)
+{
+	struct evhttp_worker *worker = arg;
+	struct evhttp_workers *workers = worker->workers;
+
+	EVLOCK_LOCK(workers->lock, 0);
+	worker->thread_id = EVTHREAD_GET_ID();
+	EVLOCK_UNLOCK(workers->lock, 0);
+
+	/* event_base_loop() clears event_break when it starts, so a
+	 * loopbreak from evhttp_workers_free() only works once the loop
+	 * runs: that's when we say we are running. */
+	if (event_base_once(worker->base, -1, EV_TIMEOUT,
+		evhttp_worker_running_cb, worker, NULL) < 0) {
+		evhttp_worker_ready_(worker, 0);
+		WORKER_THREAD_RETURN();
+	}
+	event_base_loop(worker->base, EVLOOP_NO_EXIT_ON_EMPTY);
+
+	WORKER_THREAD_RETURN();
+}
+#endif
+
+static void
+evhttp_workers_job_done_(struct evhttp_workers *workers,
+    struct evhttp_workers_job *job, int first, int r)
+{
+	EVLOCK_LOCK(workers->lock, 0);
+	if (r < 0)
+		job->result = -1;
+	else if (first && job->result >= 0)
+		job->result = r;
+	if (--job->pending == 0)
+		EVTHREAD_COND_BROADCAST(workers->cond);
+	EVLOCK_UNLOCK(workers->lock, 0);
+}
+
+static void
+evhttp_workers_job_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evhttp_workers_job_ref *ref = arg;
+	struct evhttp_worker *worker = ref->worker;
+	struct evhttp_workers *workers = worker->workers;
+
+	evhttp_workers_job_done_(workers, ref->job,
+	    worker == &workers->workers[0], ref->job->fn(worker, ref->job->arg));
+}
+
+/* Run fn on every worker, in the worker's own thread, and wait until all
+ * are done.  If we are a worker ourselves we can't wait for our own base to
+ * run it, so we run our share directly. */
+static int
+evhttp_workers_run_(struct evhttp_workers *workers,
+    int (*fn)(struct evhttp_worker *, void *), void *arg)
+{
+	struct evhttp_workers_job job;
+	struct evhttp_workers_job_ref *refs;
+	struct evhttp_worker *self = NULL;
+	unsigned long id = EVTHREAD_GET_ID();
+	int i;
+
+	if ((refs = mm_calloc(workers->n_workers, sizeof(*refs))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (-1);
+	}
+	job.fn = fn;
+	job.arg = arg;
+	job.pending = workers->n_workers;
+	job.result = 0;
+
+	for (i = 0; i < workers->n_workers; ++i) {
+		struct evhttp_worker *worker = &workers->workers[i];
+		refs[i].job = &job;
+		refs[i].worker = worker;
+		if (worker->running && worker->thread_id == id) {
+			self = worker;
+		} else if (event_base_once(worker->base, -1, EV_TIMEOUT,
+			evhttp_workers_job_cb, &refs[i], NULL) < 0) {
+			evhttp_workers_job_done_(workers, &job, 0, -1);
+		}
+	}
+	if (self)
+		evhttp_workers_job_done_(workers, &job,
+		    self == &workers->workers[0], fn(self, arg));
+
+	EVLOCK_LOCK(workers->lock, 0);
+	while (job.pending)
+		EVTHREAD_COND_WAIT(workers->cond, workers->lock);
+	EVLOCK_UNLOCK(workers->lock, 0);
+
+	mm_free(refs);
+	return (job.result);
+}
+
+struct evhttp_workers *
+evhttp_workers_new(struct evhttp *http, int n_threads,
+    const struct event_config *cfg)
+{
+#ifdef WORKER_THREAD_T
+	struct evhttp_workers *workers;
+	int i, n_started;
+
+	if (n_threads < 1)
+		return (NULL);
+	if (!EVTHREAD_LOCKING_ENABLED()) {
+		event_warnx("%s: threading support is not enabled", __func__);
+		return (NULL);
+	}
+
+	if ((workers = mm_calloc(1, sizeof(*workers))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (NULL);
+	}
+	workers->workers = mm_calloc(n_threads, sizeof(struct evhttp_worker));
+	if (workers->workers == NULL) {
+		event_warn("%s: calloc", __func__);
+		mm_free(workers);
+		return (NULL);
+	}
+	EVTHREAD_ALLOC_LOCK(workers->lock, 0);
+	EVTHREAD_ALLOC_COND(workers->cond);
+
+	/* Set everything up before any thread starts, so nothing below has
+	 * to be done from the workers' side. */
+	for (i = 0; i < n_threads; ++i) {
+		struct evhttp_worker *worker = &workers->workers[i];
+		worker->workers = workers;
+		worker->base = cfg ? event_base_new_with_config(cfg) :
+		    event_base_new();
+		if (worker->base == NULL)
+			goto error;
+		++workers->n_workers;
+		if ((worker->http = evhttp_clone_(http, worker->base)) == NULL)
+			goto error;
+	}
+
+	for (n_started = 0; n_started < n_threads; ++n_started) {
+		struct evhttp_worker *worker = &workers->workers[n_started];
+		if (WORKER_THREAD_START(worker->thread, evhttp_worker_main,
+			worker) != 0) {
+			event_warn("%s: can't start thread", __func__);
+			break;
+		}
+		worker->started = 1;
+	}
+
+	/* Wait for the threads to run their loops, so that
+	 * evhttp_workers_free() can stop them if we failed. */
+	EVLOCK_LOCK(workers->lock, 0);
+	while (workers->n_ready < n_started)
+		EVTHREAD_COND_WAIT(workers->cond, workers->lock);
+	EVLOCK_UNLOCK(workers->lock, 0);
+
+	if (n_started < n_threads)
+		goto error;
+	for (i = 0; i < n_threads; ++i) {
+		if (!workers->workers[i].running) {
+			event_warnx("%s: worker %d did not start", __func__, i);
+			goto error;
+		}
+	}
+	return (workers);
+
+error:
+	evhttp_workers_free(workers);
+	return (NULL);
+#else
+	event_warnx("%s: no thread support", __func__);
+	return (NULL);
+#endif
+}
+
+struct evhttp_workers_bind {
+	struct sockaddr_storage ss;
+	ev_socklen_t socklen;
+	/** Set once the first worker has bound. */
+	evutil_socket_t first_fd;
+};
+
+static int
+evhttp_workers_bind_cb(struct evhttp_worker *worker, void *arg)
+{
+	struct evhttp_workers_bind *b = arg;
+	struct evconnlistener *listener;
+	int first = worker == &worker->workers->workers[0];
+
+	/* The first worker binds alone, so that the others can learn which
+	 * port it got. */
+	if (first != (b->first_fd == -1))
+		return (0);
+
+#ifdef SO_REUSEPORT
+	listener = evconnlistener_new_bind(worker->base, NULL, NULL,
+	    LEV_OPT_REUSEABLE|LEV_OPT_REUSEABLE_PORT|LEV_OPT_CLOSE_ON_EXEC|
+	    LEV_OPT_CLOSE_ON_FREE, -1, (struct sockaddr *)&b->ss, b->socklen);
+#else
+	if (first)
+		listener = evconnlistener_new_bind(worker->base, NULL, NULL,
+		    LEV_OPT_REUSEABLE|LEV_OPT_CLOSE_ON_EXEC|
+		    LEV_OPT_CLOSE_ON_FREE, -1, (struct sockaddr *)&b->ss,
+		    b->socklen);
+	else
+		/* Shared with the first worker, which closes it. */
+		listener = evconnlistener_new(worker->base, NULL, NULL,
+		    LEV_OPT_REUSEABLE, -1, b->first_fd);
+#endif
+	if (listener == NULL)
+		return (-1);
+	if (evhttp_bind_listener(worker->http, listener) == NULL) {
+		evconnlistener_free(listener);
+		return (-1);
+	}
+	if (first) {
+		evutil_socket_t fd = evconnlistener_get_fd(listener);
+		struct sockaddr_storage ss;
+		ev_socklen_t socklen = sizeof(ss);
+		if (getsockname(fd, (struct sockaddr *)&ss, &socklen) == 0 &&
+		    ss.ss_family == b->ss.ss_family) {
+			memcpy(&b->ss, &ss, socklen);
+			b->socklen = socklen;
+		}
+		return (fd);
+	}
+	return (0);
+}
+
+static int
+evhttp_workers_port(const struct sockaddr_storage *ss)
+{
+	if (ss->ss_family == AF_INET)
+		return ntohs(((const struct sockaddr_in *)ss)->sin_port);
+#ifdef AF_INET6
+	if (ss->ss_family == AF_INET6)
+		return ntohs(((const struct sockaddr_in6 *)ss)->sin6_port);
+#endif
+	return (-1);
+}
+
+int
+evhttp_workers_bind_socket(struct evhttp_workers *workers,
+    const char *address, ev_uint16_t port)
+{
+	struct evhttp_workers_bind b;
+	struct evutil_addrinfo hints, *ai = NULL;
+	char strport[NI_MAXSERV];
+	int r;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = EVUTIL_AI_PASSIVE|EVUTIL_AI_ADDRCONFIG;
+	evutil_snprintf(strport, sizeof(strport), "%d", port);
+	if ((r = evutil_getaddrinfo(address, strport, &hints, &ai)) != 0) {
+		event_warnx("getaddrinfo: %s", evutil_gai_strerror(r));
+		return (-1);
+	}
+	memset(&b, 0, sizeof(b));
+	memcpy(&b.ss, ai->ai_addr, ai->ai_addrlen);
+	b.socklen = (ev_socklen_t)ai->ai_addrlen;
+	b.first_fd = -1;
+	evutil_freeaddrinfo(ai);
+
+	if ((r = evhttp_workers_run_(workers, evhttp_workers_bind_cb,
+		    &b)) < 0)
+		return (-1);
+	b.first_fd = r;
+	if (evhttp_workers_run_(workers, evhttp_workers_bind_cb, &b) < 0)
+		return (-1);
+	return evhttp_workers_port(&b.ss);
+}
+
+struct evhttp_workers_foreach {
+	void (*fn)(struct evhttp *, void *);
+	void *arg;
+};
+
+static int
+evhttp_workers_foreach_cb(struct evhttp_worker *worker, void *arg)
+{
+	struct evhttp_workers_foreach *f = arg;
+	f->fn(worker->http, f->arg);
+	return (0);
+}
+
+int
+evhttp_workers_foreach(struct evhttp_workers *workers,
+    void (*fn)(struct evhttp *, void *), void *arg)
+{
+	struct evhttp_workers_foreach f;
+	f.fn = fn;
+	f.arg = arg;
+	return evhttp_workers_run_(workers, evhttp_workers_foreach_cb, &f);
+}
+
+struct evhttp_workers_cb {
+	const char *path;
+	void (*cb)(struct evhttp_request *, void *);
+	void *cb_arg;
+};
+
+static int
+evhttp_workers_set_cb_cb(struct evhttp_worker *worker, void *arg)
+{
+	struct evhttp_workers_cb *c = arg;
+	return -evhttp_set_cb(worker->http, c->path, c->cb, c->cb_arg);
+}
+
+int
+evhttp_workers_set_cb(struct evhttp_workers *workers, const char *path,
+    void (*cb)(struct evhttp_request *, void *), void *cb_arg)
+{
+	struct evhttp_workers_cb c;
+	int r;
+
+	c.path = path;
+	c.cb = cb;
+	c.cb_arg = cb_arg;
+	/* evhttp_set_cb() fails with -1 if the path is taken, which every
+	 * worker will agree on, and with -2 otherwise. */
+	r = evhttp_workers_run_(workers, evhttp_workers_set_cb_cb, &c);
+	if (r < 0)
+		return (-2);
+	return (-r);
+}
+
+static int
+evhttp_workers_del_cb_cb(struct evhttp_worker *worker, void *arg)
+{
+	return evhttp_del_cb(worker->http, arg);
+}
+
+int
+evhttp_workers_del_cb(struct evhttp_workers *workers, const char *path)
+{
+	return evhttp_workers_run_(workers, evhttp_workers_del_cb_cb,
+	    (void *)path);
+}
+
+void
+evhttp_workers_free(struct evhttp_workers *workers)
+{
+	int i;
+
+	for (i = 0; i < workers->n_workers; ++i) {
+		struct evhttp_worker *worker = &workers->workers[i];
+		if (worker->started) {
+			if (worker->running)
+				event_base_loopbreak(worker->base);
+#ifdef WORKER_THREAD_T
+			WORKER_THREAD_JOIN(worker->thread);
+#endif
+		}
+	}
+	/* Backwards: without SO_REUSEPORT, the first worker owns the
+	 * listening socket the others share. */
+	for (i = workers->n_workers - 1; i >= 0; --i) {
+		struct evhttp_worker *worker = &workers->workers[i];
+		if (worker->http)
+			evhttp_free(worker->http);
+		event_base_free(worker->base);
+	}
+	EVTHREAD_FREE_COND(workers->cond);
+	EVTHREAD_FREE_LOCK(workers->lock, 0);
+	mm_free(workers->workers);
+	mm_free(workers);
+}
@@ -1053,6 +1053,35 @@ struct event_base;
 EVENT2_EXPORT_SYMBOL
 int evbuffer_defer_callbacks(struct evbuffer *buffer, struct event_base *base);
 
+/** Statistics for the chain pool of an event_base.
+
+    @see evbuffer_get_pool_stats()
+ */
+struct evbuffer_pool_stats {
+	/** Chains of a pooled size that were taken from the pool */
+	ev_uint64_t hits;
+	/** Chains of a pooled size that had to be allocated */
+	ev_uint64_t misses;
+	/** Free chains held by the pool right now */
+	size_t cached;
+	/** Total size of those chains, in bytes */
+	size_t cached_bytes;
+};
+
+/**
+   Get the statistics of the evbuffer chain pool of an event_base made with
+   EVENT_BASE_FLAG_BUFFER_POOL.  The hit rate is hits / (hits + misses).
+
+   Call this from the thread that created the base.
+
+   @param base the event_base
+   @param stats filled in on success
+   @return 0 on success, -1 if the base has no pool.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_get_pool_stats(struct event_base *base,
+    struct evbuffer_pool_stats *stats);
+
 /**
   Append data from 1 or more iovec's to an evbuffer
 
@@ -748,6 +748,45 @@ int bufferevent_pair_new(struct event_base *base, int options,
 EVENT2_EXPORT_SYMBOL
 struct bufferevent *bufferevent_pair_get_partner(struct bufferevent *bev);
 
+/**
+   Forward everything that arrives on one bufferevent to another.
+
+   Any data already in the input buffer of src is moved to the output buffer
+   of dst, and from then on data read by src is written by dst.  When both
+   are socket bufferevents on the same base with no rate limits, the bytes
+   are moved from one socket to the other with splice(2) through a pipe, and
+   never pass through an evbuffer; otherwise (filters, pairs, or no splice
+   on this platform) they are moved from src's input buffer to dst's output
+   buffer as they arrive.  Either way, reading is enabled on src, and pauses
+   while dst is behind.
+
+   The read callback of src is not called for forwarded data.  End of file
+   and errors are reported to the event callback of src when reading fails,
+   and to the event callback of dst when writing does.  Data written to dst
+   directly while forwarding is sent in order with the forwarded data.
+
+   Forwarding holds a reference to dst; it ends when
+   bufferevent_forward_stop() is called or src is freed.
+
+   @param src the bufferevent to read from
+   @param dst the bufferevent to write to
+   @return 0 on success, -1 on failure (including if src is already being
+     forwarded).
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_forward(struct bufferevent *src, struct bufferevent *dst);
+
+/**
+   Stop forwarding data from src, as set up by bufferevent_forward().  Data
+   that has been read from src but not yet written is left in the output
+   buffer of dst, and src can be read from as usual again.
+
+   @param src the bufferevent that was passed to bufferevent_forward()
+   @return 0 on success, -1 if src was not being forwarded.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_forward_stop(struct bufferevent *src);
+
 /**
    Abstract type used to configure rate-limiting on a bufferevent or a group
    of bufferevents.
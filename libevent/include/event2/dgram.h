@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_DGRAM_H_INCLUDED_
+#define EVENT2_DGRAM_H_INCLUDED_
+
+/** @file event2/dgram.h
+
+  Batched datagram I/O.
+
+  An evdgram holds a batch of received datagrams and a queue of datagrams
+  waiting to be sent on a datagram socket.  evdgram_recv() reads as many
+  datagrams as are ready, up to the batch size, with a single recvmmsg()
+  call where the platform has one; evdgram_flush() sends the queued
+  datagrams with sendmmsg(), and can hand runs of equal-sized datagrams to
+  the same address to the kernel as one UDP GSO send.  Elsewhere the same
+  calls loop over recvfrom() and sendto().
+
+  An evdgram is not tied to a socket or an event_base: call evdgram_recv()
+  from the read callback of an event on a nonblocking socket, and
+  evdgram_flush() when there is something queued and the socket is
+  writable.  It does no locking of its own.
+ */
+
+#include <event2/visibility.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/util.h>
+
+struct sockaddr;
+struct evdgram;
+
+/** Option: send runs of datagrams that have the same size and destination
+ * as a single UDP GSO (generic segmentation offload) send, where the
+ * platform supports it.  Ignored elsewhere, and turned off again if the
+ * socket refuses it. */
+#define EVDGRAM_OPT_GSO		(1u<<0)
+
+/**
+   Allocate a new evdgram.
+
+   @param max_batch the largest number of datagrams to read with one call
+     to evdgram_recv(), and to keep queued for sending
+   @param max_size the largest datagram to read or queue; longer incoming
+     datagrams are truncated, as with recvfrom()
+   @param options a combination of EVDGRAM_OPT_* flags
+   @return a new evdgram, or NULL on error
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram *evdgram_new(int max_batch, size_t max_size, unsigned options);
+
+/**
+   Free an evdgram, along with any datagrams it holds or has queued.
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_free(struct evdgram *dg);
+
+/**
+   Read up to the batch size of datagrams from a socket.
+
+   Any datagrams held from the previous call are discarded first.
+
+   @param dg the evdgram to read into
+   @param fd a datagram socket, which should be nonblocking
+   @return the number of datagrams read; 0 if none were ready; or -1 on
+     error, in which case the socket error is set
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_recv(struct evdgram *dg, evutil_socket_t fd);
+
+/**
+   Look at one of the datagrams read by the last evdgram_recv().
+
+   @param dg the evdgram
+   @param i which datagram to look at, from 0
+   @param data set to the contents of the datagram; these stay valid until
+     the next call to evdgram_recv() or evdgram_free()
+   @param addr if not NULL, set to the address it came from
+   @param addrlen if not NULL, set to the length of *addr
+   @return the length of the datagram, or -1 if there is no datagram i
+ */
+EVENT2_EXPORT_SYMBOL
+ev_ssize_t evdgram_get(struct evdgram *dg, int i, void **data,
+    struct sockaddr **addr, ev_socklen_t *addrlen);
+
+/**
+   Queue a datagram to be sent by evdgram_flush().
+
+   The data and address are copied.
+
+   @param dg the evdgram
+   @param data the datagram to send
+   @param len its length, at most the max_size given to evdgram_new()
+   @param addr the address to send it to, or NULL on a connected socket
+   @param addrlen the length of addr
+   @return 0 on success, or -1 if the datagram is too large or the queue
+     already holds max_batch datagrams
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_add(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *addr, ev_socklen_t addrlen);
+
+/**
+   Send as many of the queued datagrams as the socket will take.
+
+   Datagrams that could not be sent because the socket would block stay
+   queued, in order.  A datagram that fails with any other error is
+   dropped, the ones after it stay queued, and -1 is returned.
+
+   @param dg the evdgram
+   @param fd the datagram socket to send on, which should be nonblocking
+   @return the number of datagrams sent, or -1 on error, in which case the
+     socket error is set
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_flush(struct evdgram *dg, evutil_socket_t fd);
+
+/**
+   Return the number of datagrams queued and not yet sent.
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_get_queued(const struct evdgram *dg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_DGRAM_H_INCLUDED_ */
@@ -423,7 +423,13 @@ void evdns_cancel_request(struct evdns_base *base, struct evdns_request *req);
   The currently available configuration options are:
 
     ndots, timeout, max-timeouts, max-inflight, attempts, randomize-case,
-    bind-to, initial-probe-timeout, getaddrinfo-allow-skew.
+    bind-to, initial-probe-timeout, getaddrinfo-allow-skew, cache-size,
+    cache-negative-ttl.
+
+  cache-size is the number of answers to keep in the cache of the base; 0
+  (the default) disables the cache.  cache-negative-ttl is how many seconds
+  to cache a "no such name" or "no data" answer that came without an SOA
+  record to take the TTL from; 0 (the default) does not cache those.
 
   In versions before Libevent 2.0.3-alpha, the option name needed to end with
   a colon.
@@ -436,6 +442,52 @@ void evdns_cancel_request(struct evdns_base *base, struct evdns_request *req);
 EVENT2_EXPORT_SYMBOL
 int evdns_base_set_option(struct evdns_base *base, const char *option, const char *val);
 
+/**
+   Statistics of the answer cache of an evdns_base.
+
+   @see evdns_base_get_cache_stats()
+ */
+struct evdns_cache_stats {
+	/** Lookups answered from the cache */
+	ev_uint64_t hits;
+	/** Of the hits, those answered with a cached error */
+	ev_uint64_t negative_hits;
+	/** Lookups that had to go to the network */
+	ev_uint64_t misses;
+	/** Entries dropped to stay within cache-size */
+	ev_uint64_t evictions;
+	/** Entries dropped because their TTL ran out */
+	ev_uint64_t expirations;
+	/** Entries in the cache now */
+	unsigned entries;
+};
+
+/**
+  Get the statistics of the answer cache.
+
+  The cache is enabled with the "cache-size" option.  It keeps the answers
+  to evdns_base_resolve_ipv4(), evdns_base_resolve_ipv6(), the reverse
+  lookups, and thus evdns_getaddrinfo(), for as long as their TTL allows.
+  A cached answer is passed to the callback without a network round trip,
+  but still not before the resolve function has returned.
+
+  @param base the evdns_base whose cache to look at
+  @param stats filled in with the statistics
+ */
+EVENT2_EXPORT_SYMBOL
+void evdns_base_get_cache_stats(struct evdns_base *base,
+    struct evdns_cache_stats *stats);
+
+/**
+  Remove all answers from the cache of an evdns_base.
+
+  Changing the search list does this as well.
+
+  @param base the evdns_base whose cache to clear
+ */
+EVENT2_EXPORT_SYMBOL
+void evdns_base_clear_cache(struct evdns_base *base);
+
 
 /**
   Parse a resolv.conf file.
@@ -570,7 +570,29 @@ enum event_base_config_flag {
 	    however, we use less efficient more precise timer, assuming one is
 	    present.
 	 */
-	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20
+	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20,
+
+	/** Keep timeouts in a hierarchical timing wheel instead of a min-heap.
+
+	    Adding, resetting and deleting a timeout become O(1) instead of
+	    O(log n), which pays off with many events whose timeouts are
+	    pushed back on every bit of activity.  The price is resolution:
+	    timeouts are grouped into 1 millisecond ticks, and may fire up to
+	    a tick late.
+
+	    This flag can also be activated by setting the EVENT_TIMING_WHEEL
+	    environment variable.
+	 */
+	EVENT_BASE_FLAG_TIMING_WHEEL = 0x40,
+
+	/** Keep a pool of freed evbuffer chains of the common sizes, and
+	    use it for the buffers of bufferevents made on this base.
+
+	    The pool is only used from the thread that created the base;
+	    buffers touched from other threads allocate as usual.  See
+	    evbuffer_get_pool_stats() for how well it is doing.
+	 */
+	EVENT_BASE_FLAG_BUFFER_POOL = 0x80
 };
 
 /**
@@ -1638,6 +1660,92 @@ typedef int (*event_base_foreach_event_cb)(const struct event_base *, const stru
 EVENT2_EXPORT_SYMBOL
 int event_base_foreach_event(struct event_base *base, event_base_foreach_event_cb fn, void *arg);
 
+/** Number of buckets in each histogram of struct event_base_stats. */
+#define EVENT_BASE_STATS_BUCKETS 24
+/** Largest number of callbacks reported in struct event_base_stats. */
+#define EVENT_BASE_STATS_CALLBACKS 16
+
+/** Timings of one callback function.
+
+    @see event_base_stats
+ */
+struct event_base_callback_stats {
+	/** The callback function, cast to void * */
+	void *callback;
+	/** How many of its runs were timed */
+	ev_uint64_t samples;
+	/** Their total running time, in microseconds */
+	ev_uint64_t total_usec;
+	/** The longest of them, in microseconds */
+	ev_uint64_t max_usec;
+};
+
+/** Statistics gathered by an event loop since event_base_enable_stats().
+
+    Each histogram has EVENT_BASE_STATS_BUCKETS buckets: bucket 0 counts
+    values of 0, bucket i counts values from 2^(i-1) up to 2^i - 1, and the
+    last bucket also counts anything larger.
+
+    @see event_base_get_stats()
+ */
+struct event_base_stats {
+	/** Number of times round the loop, that is, calls to the backend's
+	 * dispatch function. */
+	ev_uint64_t iterations;
+	/** Time spent in each call to the backend's dispatch function,
+	 * including any time it spent waiting, in microseconds. */
+	ev_uint64_t dispatch_hist[EVENT_BASE_STATS_BUCKETS];
+	/** Number of active callbacks found on each iteration. */
+	ev_uint64_t active_hist[EVENT_BASE_STATS_BUCKETS];
+	/** Total number of active callbacks found over all iterations. */
+	ev_uint64_t active_total;
+	/** Most active callbacks found on one iteration. */
+	ev_uint64_t active_max;
+	/** Longest time, in microseconds, from the dispatch function
+	 * returning until the end of that iteration: the time spent on
+	 * timeouts and callbacks, when no new events could be noticed. */
+	ev_uint64_t longest_stall_usec;
+	/** Timed callbacks, with the largest total_usec first. */
+	struct event_base_callback_stats callbacks[EVENT_BASE_STATS_CALLBACKS];
+	/** Number of entries of callbacks[] that are filled in. */
+	int n_callbacks;
+	/** Timed runs that belonged to callbacks which could not be tracked,
+	 * because too many different callbacks had already been seen. */
+	ev_uint64_t callbacks_untracked;
+};
+
+/**
+   Start or stop gathering statistics about an event loop.
+
+   While statistics are on, every iteration of the loop is timed, and one
+   callback in every sample_interval is timed and its time charged to the
+   callback function.  This costs a few clock reads per iteration, so it
+   is off by default.  Turning statistics on when they are already on
+   clears them.
+
+   @param base the event_base
+   @param sample_interval time one in this many callbacks, so 1 times
+     every callback; or 0 to stop gathering and discard the statistics
+   @return 0 on success, -1 on failure.
+   @see event_base_get_stats()
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_enable_stats(struct event_base *base, int sample_interval);
+
+/**
+   Get the statistics gathered since event_base_enable_stats().
+
+   This may be called from any thread, including from a callback running
+   in the loop.
+
+   @param base the event_base
+   @param stats filled in on success
+   @return 0 on success, -1 if statistics are not on.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_get_stats(struct event_base *base,
+    struct event_base_stats *stats);
+
 
 /** Sets 'tv' to the current time (as returned by gettimeofday()),
     looking at the cached value in 'base' if possible, and calling
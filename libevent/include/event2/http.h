@@ -395,6 +395,9 @@ void evhttp_set_timeout_tv(struct evhttp *http, const struct timeval* tv);
 /* Read all the clients body, and only after this respond with an error if the
  * clients body exceed max_body_size */
 #define EVHTTP_SERVER_LINGERING_CLOSE	0x0001
+/* Parse request headers in place into a per-request arena instead of a list
+ * of separately allocated entries, @see EVHTTP_CON_ARENA_HEADERS */
+#define EVHTTP_SERVER_ARENA_HEADERS	0x0002
 /**
  * Set connection flags for HTTP server.
  *
@@ -405,6 +408,96 @@ void evhttp_set_timeout_tv(struct evhttp *http, const struct timeval* tv);
 EVENT2_EXPORT_SYMBOL
 int evhttp_set_flags(struct evhttp *http, int flags);
 
+/* Multi-threaded servers */
+
+struct evhttp_workers;
+struct event_config;
+
+/**
+ * Run copies of an HTTP server on a number of worker threads.
+ *
+ * Each worker thread gets its own event_base and its own evhttp, set up
+ * from the template http: its callbacks, virtual hosts, server aliases and
+ * settings.  The template is only read; it is never bound or used to serve
+ * requests, and may be freed once this function returns.  Callbacks are run
+ * on the worker that accepted the connection, so their arguments are shared
+ * between threads.
+ *
+ * Threading support must have been enabled, with evthread_use_pthreads()
+ * or evthread_use_windows_threads().
+ *
+ * @param http the configuration to copy
+ * @param n_threads the number of worker threads to start
+ * @param cfg the configuration for each worker's event_base, or NULL
+ * @return a new evhttp_workers object, or NULL on error
+ * @see evhttp_workers_bind_socket(), evhttp_workers_free()
+ */
+EVENT2_EXPORT_SYMBOL
+struct evhttp_workers *evhttp_workers_new(struct evhttp *http, int n_threads,
+    const struct event_config *cfg);
+
+/**
+ * Make every worker listen on the specified address and port.
+ *
+ * Where SO_REUSEPORT is available each worker gets a listening socket of
+ * its own and the kernel spreads new connections between them; otherwise
+ * the workers share one listening socket.  If port is 0, all workers use
+ * the port picked for the first one.
+ *
+ * @param workers the workers returned by evhttp_workers_new()
+ * @param address a string containing the IP address to listen(2) on
+ * @param port the port number to listen on, or 0
+ * @return the port bound to on success, or -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_workers_bind_socket(struct evhttp_workers *workers,
+    const char *address, ev_uint16_t port);
+
+/**
+ * Run a function on the evhttp of every worker, from that worker's thread,
+ * and wait until it has run on all of them.  This is the thread-safe way to
+ * change the settings of running workers.
+ *
+ * It can be called from any thread, including a callback running on a
+ * worker, but not from two workers at once.
+ *
+ * @param workers the workers returned by evhttp_workers_new()
+ * @param fn the function to run
+ * @param arg an argument passed to fn
+ * @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_workers_foreach(struct evhttp_workers *workers,
+    void (*fn)(struct evhttp *, void *), void *arg);
+
+/**
+ * Set a callback for a specified URI on every worker, as evhttp_set_cb()
+ * does for a single server.
+ *
+ * @return 0 on success, -1 if the callback existed already, -2 on failure
+ * @see evhttp_workers_foreach()
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_workers_set_cb(struct evhttp_workers *workers, const char *path,
+    void (*cb)(struct evhttp_request *, void *), void *cb_arg);
+
+/**
+ * Remove a callback for a specified URI from every worker.
+ *
+ * @return 0 on success, -1 if the callback did not exist
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_workers_del_cb(struct evhttp_workers *workers, const char *path);
+
+/**
+ * Stop all worker threads and free their servers, connections and
+ * event_bases.  Must not be called from a worker thread.
+ *
+ * @param workers the workers returned by evhttp_workers_new()
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_workers_free(struct evhttp_workers *workers);
+
 /* Request/Response functionality */
 
 /**
@@ -679,6 +772,11 @@ void evhttp_connection_set_family(struct evhttp_connection *evcon,
 #define EVHTTP_CON_READ_ON_WRITE_ERROR	0x0010
 /* @see EVHTTP_SERVER_LINGERING_CLOSE */
 #define EVHTTP_CON_LINGERING_CLOSE	0x0020
+/* Parse the headers of incoming messages in place into a compact table that
+ * lives in one allocation per request.  The evkeyvalq returned by
+ * evhttp_request_get_input_headers() is only built when that function is
+ * first called; use evhttp_request_find_input_header() to avoid it. */
+#define EVHTTP_CON_ARENA_HEADERS	0x0040
 /* Padding for public flags, @see EVHTTP_CON_* in http-internal.h */
 #define EVHTTP_CON_PUBLIC_FLAGS_END	0x100000
 /**
@@ -850,6 +948,25 @@ const char * evhttp_request_get_response_code_line(const struct evhttp_request *
 /** Returns the input headers */
 EVENT2_EXPORT_SYMBOL
 struct evkeyvalq *evhttp_request_get_input_headers(struct evhttp_request *req);
+
+/**
+   Finds the value belonging to a header of an incoming request or response.
+
+   Unlike evhttp_find_header() on evhttp_request_get_input_headers(), this
+   does not build the list of input headers when they were parsed with
+   EVHTTP_CON_ARENA_HEADERS.  The returned string stays valid until the
+   request is freed or the header is removed, also while more headers are
+   read, such as the trailers of a chunked message; a continuation line
+   read later may however not show up in it.
+
+   @param req the request or response
+   @param key the name of the header to find, compared case-insensitively
+   @returns a pointer to the value of the first such header, or NULL
+   @see evhttp_find_header()
+*/
+EVENT2_EXPORT_SYMBOL
+const char *evhttp_request_find_input_header(struct evhttp_request *req,
+    const char *key);
 /** Returns the output headers */
 EVENT2_EXPORT_SYMBOL
 struct evkeyvalq *evhttp_request_get_output_headers(struct evhttp_request *req);
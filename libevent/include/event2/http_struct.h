@@ -142,6 +142,13 @@ struct {
 	 */
 	void (*on_complete_cb)(struct evhttp_request *, void *);
 	void *on_complete_cb_arg;
+
+	/*
+	 * Input headers parsed in place, @see EVHTTP_CON_ARENA_HEADERS.
+	 * Until evhttp_request_get_input_headers() is called, input_headers
+	 * stays empty and the headers live here only.
+	 */
+	struct evhttp_header_arena *input_arena;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,574 @@
+/*
+ * Copyright 2000-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright 2007-2012 Niels Provos, Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_IO_URING
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <endian.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "event-internal.h"
+#include "evsignal-internal.h"
+#include "event2/thread.h"
+#include "evthread-internal.h"
+#include "log-internal.h"
+#include "evmap-internal.h"
+#include "changelist-internal.h"
+#include "time-internal.h"
+
+/*
+ * io_uring backend.
+ *
+ * Readiness is still reported the way poll() would, but through poll
+ * requests on an io_uring: every change queued on the changelist since the
+ * last dispatch becomes a submission queue entry, and all of them go to the
+ * kernel in the same io_uring_enter() that waits for completions.  So a loop
+ * iteration costs one syscall however many fds changed, where epoll needs an
+ * epoll_ctl() for each.
+ *
+ * Edge-triggered events use multishot poll requests, which stay armed and
+ * post a completion on every wakeup.  Level-triggered events use one-shot
+ * requests that are armed again in the next dispatch if the event is still
+ * wanted; the kernel checks readiness when arming, so data left unread is
+ * reported again just as with epoll.
+ */
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+
+#define IOURING_ENTRIES 1024
+
+/* Per-fd state, stored after the evmap_io of each fd. */
+struct iouring_fdinfo {
+	/* Belongs to the changelist code, which expects it first. */
+	int changelist_idxplus1;
+	/* Events wanted on the fd, with EV_ET if edge-triggered. */
+	short events;
+	/* Events the poll request in the kernel waits for; 0 if none. */
+	short armed;
+	/* Tags the poll request in the kernel.  Completions with another
+	 * generation belong to requests since cancelled. */
+	ev_uint32_t gen;
+	/* Whether the fd is on iouringop.rearm. */
+	ev_uint8_t queued;
+};
+
+struct iouringop {
+	int ring_fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_local_tail; /* entries up to here are filled in */
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring; /* same as sq_ring with IORING_FEAT_SINGLE_MMAP */
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	/* Fds whose one-shot poll completed and that may need it again. */
+	evutil_socket_t *rearm;
+	int n_rearm;
+	int rearm_size;
+
+	ev_uint32_t gen;
+	/* Cleared if the kernel turns down multishot poll requests. */
+	int multishot;
+};
+
+static void *iouring_init(struct event_base *);
+static int iouring_dispatch(struct event_base *, struct timeval *);
+static void iouring_dealloc(struct event_base *);
+
+const struct eventop iouringops = {
+	"io_uring",
+	iouring_init,
+	event_changelist_add_,
+	event_changelist_del_,
+	iouring_dispatch,
+	iouring_dealloc,
+	1, /* need reinit */
+	EV_FEATURE_ET|EV_FEATURE_O1|EV_FEATURE_FDS|EV_FEATURE_EARLY_CLOSE,
+	sizeof(struct iouring_fdinfo)
+};
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, arg, argsz);
+}
+
+static void
+iouring_free(struct iouringop *iop)
+{
+	if (iop->sqes)
+		munmap(iop->sqes, iop->sqes_size);
+	if (iop->cq_ring && iop->cq_ring != iop->sq_ring)
+		munmap(iop->cq_ring, iop->cq_ring_size);
+	if (iop->sq_ring)
+		munmap(iop->sq_ring, iop->sq_ring_size);
+	if (iop->ring_fd >= 0)
+		close(iop->ring_fd);
+	if (iop->rearm)
+		mm_free(iop->rearm);
+	memset(iop, 0, sizeof(struct iouringop));
+	mm_free(iop);
+}
+
+static void *
+iouring_init(struct event_base *base)
+{
+	struct io_uring_params p;
+	struct iouringop *iop;
+	char *sq, *cq;
+	unsigned i;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = sys_io_uring_setup(IOURING_ENTRIES, &p);
+	if (fd < 0) {
+		if (errno != ENOSYS && errno != EPERM)
+			event_warn("io_uring_setup");
+		return (NULL);
+	}
+	/* We wait with a timeout through IORING_ENTER_EXT_ARG (Linux
+	 * 5.11), and can't afford to lose completions when many fds become
+	 * ready at once. */
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		close(fd);
+		return (NULL);
+	}
+
+	if (!(iop = mm_calloc(1, sizeof(struct iouringop)))) {
+		close(fd);
+		return (NULL);
+	}
+	iop->ring_fd = fd;
+
+	iop->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	iop->cq_ring_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (iop->cq_ring_size > iop->sq_ring_size)
+			iop->sq_ring_size = iop->cq_ring_size;
+		iop->cq_ring_size = iop->sq_ring_size;
+	}
+	iop->sq_ring = mmap(NULL, iop->sq_ring_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (iop->sq_ring == MAP_FAILED) {
+		iop->sq_ring = NULL;
+		goto err;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		iop->cq_ring = iop->sq_ring;
+	} else {
+		iop->cq_ring = mmap(NULL, iop->cq_ring_size,
+		    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd,
+		    IORING_OFF_CQ_RING);
+		if (iop->cq_ring == MAP_FAILED) {
+			iop->cq_ring = NULL;
+			goto err;
+		}
+	}
+	iop->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	iop->sqes = mmap(NULL, iop->sqes_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (iop->sqes == MAP_FAILED) {
+		iop->sqes = NULL;
+		goto err;
+	}
+
+	sq = iop->sq_ring;
+	cq = iop->cq_ring;
+	iop->sq_head = (unsigned *)(sq + p.sq_off.head);
+	iop->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	iop->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	iop->sq_entries = p.sq_entries;
+	iop->sq_local_tail = *iop->sq_tail;
+	iop->cq_head = (unsigned *)(cq + p.cq_off.head);
+	iop->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	iop->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	iop->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* Entries are always used in ring order. */
+	for (i = 0; i < p.sq_entries; ++i)
+		((unsigned *)(sq + p.sq_off.array))[i] = i;
+
+	iop->multishot = 1;
+
+	evsig_init_(base);
+
+	return (iop);
+err:
+	event_warn("mmap(io_uring)");
+	iouring_free(iop);
+	return (NULL);
+}
+
+/* Hands the queued entries to the kernel and, if wait is set, waits up to
+ * ts (forever if NULL) for a completion. */
+static int
+iouring_enter(struct iouringop *iop, int wait, struct __kernel_timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+	unsigned to_submit;
+
+	__atomic_store_n(iop->sq_tail, iop->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = iop->sq_local_tail -
+	    __atomic_load_n(iop->sq_head, __ATOMIC_ACQUIRE);
+	if (!wait) {
+		if (!to_submit)
+			return (0);
+		return sys_io_uring_enter(iop->ring_fd, to_submit, 0, 0,
+		    NULL, 0);
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = (ev_uint64_t)(ev_uintptr_t)ts;
+	return sys_io_uring_enter(iop->ring_fd, to_submit, 1,
+	    IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static struct io_uring_sqe *
+iouring_get_sqe(struct iouringop *iop)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head = __atomic_load_n(iop->sq_head, __ATOMIC_ACQUIRE);
+
+	if (iop->sq_local_tail - head >= iop->sq_entries) {
+		/* The ring is full of changes; submit them now. */
+		if (iouring_enter(iop, 0, NULL) < 0) {
+			event_warn("io_uring_enter");
+			return (NULL);
+		}
+		head = __atomic_load_n(iop->sq_head, __ATOMIC_ACQUIRE);
+		if (iop->sq_local_tail - head >= iop->sq_entries)
+			return (NULL);
+	}
+
+	sqe = &iop->sqes[iop->sq_local_tail & iop->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	iop->sq_local_tail++;
+	return (sqe);
+}
+
+static ev_uint64_t
+iouring_user_data(evutil_socket_t fd, ev_uint32_t gen)
+{
+	return ((ev_uint64_t)gen << 32) | (ev_uint32_t)fd;
+}
+
+/* Queues a poll request for fdi->events on fd. */
+static int
+iouring_arm(struct iouringop *iop, evutil_socket_t fd,
+    struct iouring_fdinfo *fdi)
+{
+	struct io_uring_sqe *sqe;
+	ev_uint32_t mask = 0;
+
+	if (!(sqe = iouring_get_sqe(iop)))
+		return (-1);
+
+	if (fdi->events & EV_READ)
+		mask |= POLLIN;
+	if (fdi->events & EV_WRITE)
+		mask |= POLLOUT;
+	if (fdi->events & EV_CLOSED)
+		mask |= POLLRDHUP;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	/* poll32_events holds the halfwords swapped on big-endian hosts */
+	mask = (mask << 16) | (mask >> 16);
+#endif
+
+	if (++iop->gen == 0)
+		++iop->gen;
+	fdi->gen = iop->gen;
+	fdi->armed = fdi->events;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = mask;
+	if ((fdi->events & EV_ET) && iop->multishot)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = iouring_user_data(fd, fdi->gen);
+	return (0);
+}
+
+/* Queues the removal of the poll request in the kernel for fd. */
+static int
+iouring_cancel(struct iouringop *iop, evutil_socket_t fd,
+    struct iouring_fdinfo *fdi)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = iouring_get_sqe(iop)))
+		return (-1);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = iouring_user_data(fd, fdi->gen);
+	/* generation 0: the completion of the removal is ignored */
+	sqe->user_data = iouring_user_data(fd, 0);
+	fdi->gen = 0;
+	fdi->armed = 0;
+	return (0);
+}
+
+static short
+iouring_apply_change_bits(short events, ev_uint8_t change, short ev)
+{
+	if (change & EV_CHANGE_ADD)
+		events |= ev;
+	else if (change & EV_CHANGE_DEL)
+		events &= ~ev;
+	return (events);
+}
+
+static int
+iouring_apply_one_change(struct event_base *base, struct iouringop *iop,
+    const struct event_change *ch)
+{
+	struct iouring_fdinfo *fdi;
+	ev_uint8_t all = ch->read_change|ch->write_change|ch->close_change;
+	short events;
+
+	if (!(all & (EV_CHANGE_ADD|EV_CHANGE_DEL)))
+		return (0);
+	if (!(fdi = evmap_io_get_fdinfo_(&base->io, ch->fd)))
+		return (-1);
+
+	events = ch->old_events & (EV_READ|EV_WRITE|EV_CLOSED);
+	events = iouring_apply_change_bits(events, ch->read_change, EV_READ);
+	events = iouring_apply_change_bits(events, ch->write_change, EV_WRITE);
+	events = iouring_apply_change_bits(events, ch->close_change, EV_CLOSED);
+	if (events) {
+		if (all & EV_CHANGE_ADD)
+			events |= (all & EV_CHANGE_ET);
+		else
+			events |= (fdi->events & EV_ET);
+	}
+
+	/* Always replace the request: an add may be for a new file that
+	 * reuses the fd number, and the request in the kernel holds on to
+	 * the file it was made for. */
+	if (fdi->armed && iouring_cancel(iop, ch->fd, fdi) < 0)
+		return (-1);
+	fdi->events = events;
+	if (events && iouring_arm(iop, ch->fd, fdi) < 0) {
+		event_warn("%s: can't poll fd %d", __func__, (int)ch->fd);
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+iouring_apply_changes(struct event_base *base)
+{
+	struct event_changelist *changelist = &base->changelist;
+	struct iouringop *iop = base->evbase;
+	int i, r = 0;
+
+	for (i = 0; i < changelist->n_changes; ++i) {
+		if (iouring_apply_one_change(base, iop,
+			&changelist->changes[i]) < 0)
+			r = -1;
+	}
+
+	for (i = 0; i < iop->n_rearm; ++i) {
+		evutil_socket_t fd = iop->rearm[i];
+		struct iouring_fdinfo *fdi =
+		    evmap_io_get_fdinfo_(&base->io, fd);
+		if (!fdi)
+			continue;
+		fdi->queued = 0;
+		if (fdi->events && !fdi->armed && iouring_arm(iop, fd, fdi) < 0)
+			r = -1;
+	}
+	iop->n_rearm = 0;
+
+	return (r);
+}
+
+static void
+iouring_queue_rearm(struct iouringop *iop, evutil_socket_t fd,
+    struct iouring_fdinfo *fdi)
+{
+	if (fdi->queued)
+		return;
+	if (iop->n_rearm == iop->rearm_size) {
+		int new_size = iop->rearm_size ? iop->rearm_size * 2 : 64;
+		evutil_socket_t *tmp = mm_realloc(iop->rearm,
+		    new_size * sizeof(evutil_socket_t));
+		if (tmp == NULL) {
+			event_warn("realloc");
+			return;
+		}
+		iop->rearm = tmp;
+		iop->rearm_size = new_size;
+	}
+	iop->rearm[iop->n_rearm++] = fd;
+	fdi->queued = 1;
+}
+
+static void
+iouring_complete(struct event_base *base, struct iouringop *iop,
+    const struct io_uring_cqe *cqe)
+{
+	evutil_socket_t fd = (evutil_socket_t)(ev_uint32_t)cqe->user_data;
+	ev_uint32_t gen = (ev_uint32_t)(cqe->user_data >> 32);
+	struct iouring_fdinfo *fdi;
+	int what = cqe->res;
+	short ev = 0;
+
+	if (gen == 0)
+		return;
+	fdi = evmap_io_get_fdinfo_(&base->io, fd);
+	if (!fdi || fdi->gen != gen)
+		return;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		/* The request is done: one-shot, or a multishot one that
+		 * the kernel had to stop. */
+		fdi->armed = 0;
+		fdi->gen = 0;
+		if (what >= 0 || (what == -EINVAL && iop->multishot))
+			iouring_queue_rearm(iop, fd, fdi);
+	}
+
+	if (what < 0) {
+		if (what == -EINVAL && iop->multishot) {
+			/* Before Linux 5.13 poll requests are one-shot. */
+			event_debug(("%s: no multishot poll", __func__));
+			iop->multishot = 0;
+		} else {
+			event_debug(("%s: poll on fd %d failed: %s", __func__,
+				(int)fd, strerror(-what)));
+		}
+		return;
+	}
+
+	if (what & (POLLHUP|POLLERR|POLLNVAL)) {
+		ev = EV_READ | EV_WRITE;
+	} else {
+		if (what & POLLIN)
+			ev |= EV_READ;
+		if (what & POLLOUT)
+			ev |= EV_WRITE;
+		if (what & POLLRDHUP)
+			ev |= EV_CLOSED;
+	}
+
+	if (!ev)
+		return;
+
+	evmap_io_active_(base, fd, ev | EV_ET);
+}
+
+static int
+iouring_dispatch(struct event_base *base, struct timeval *tv)
+{
+	struct iouringop *iop = base->evbase;
+	struct __kernel_timespec ts, *tsp = NULL;
+	unsigned head, tail;
+	int res;
+
+	if (tv != NULL) {
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = tv->tv_usec * 1000;
+		tsp = &ts;
+	}
+
+	iouring_apply_changes(base);
+	event_changelist_remove_all_(&base->changelist, base);
+
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	res = iouring_enter(iop, 1, tsp);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+
+	if (res == -1 && errno != EINTR && errno != ETIME) {
+		event_warn("io_uring_enter");
+		return (-1);
+	}
+
+	head = *iop->cq_head;
+	tail = __atomic_load_n(iop->cq_tail, __ATOMIC_ACQUIRE);
+	event_debug(("%s: io_uring reports %u", __func__, tail - head));
+	for (; head != tail; ++head)
+		iouring_complete(base, iop, &iop->cqes[head & iop->cq_mask]);
+	__atomic_store_n(iop->cq_head, head, __ATOMIC_RELEASE);
+
+	return (0);
+}
+
+static void
+iouring_dealloc(struct event_base *base)
+{
+	struct iouringop *iop = base->evbase;
+
+	evsig_dealloc_(base);
+	iouring_free(iop);
+}
+
+#endif /* EVENT__HAVE_IO_URING */
@@ -64,11 +64,28 @@
 #include <event.h>
 #include <evutil.h>
 
+#include "bench_common.h"
+
 static int count, writes, fired, failures;
 static evutil_socket_t *pipes;
-static int num_pipes, num_active, num_writes;
+static int num_pipes, num_active, num_writes, timeout_msec;
 static struct event *events;
+static struct event_base *base;
+
+
+/* Idle timeouts that never fire, spread out so they don't all land in
+ * the same place.  Every time a persistent event fires its timeout is
+ * pushed back, as a server does with each connection it hears from. */
+static struct timeval *
+bench_timeout(int i)
+{
+	static struct timeval tv;
+	int msec = timeout_msec + i % 1000;
 
+	tv.tv_sec = msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+	return timeout_msec ? &tv : NULL;
+}
 
 static void
 read_cb(evutil_socket_t fd, short which, void *arg)
@@ -104,10 +121,11 @@ run_once(void)
 		if (event_initialized(&events[i]))
 			event_del(&events[i]);
 		event_set(&events[i], cp[0], EV_READ | EV_PERSIST, read_cb, (void *)(ev_intptr_t) i);
-		event_add(&events[i], NULL);
+		event_base_set(base, &events[i]);
+		event_add(&events[i], bench_timeout(i));
 	}
 
-	event_loop(EVLOOP_ONCE | EVLOOP_NONBLOCK);
+	event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
 
 	fired = 0;
 	space = num_pipes / num_active;
@@ -120,7 +138,7 @@ run_once(void)
 	{ int xcount = 0;
 	evutil_gettimeofday(&ts, NULL);
 	do {
-		event_loop(EVLOOP_ONCE | EVLOOP_NONBLOCK);
+		event_base_loop(base, EVLOOP_ONCE | EVLOOP_NONBLOCK);
 		xcount++;
 	} while (count != fired);
 	evutil_gettimeofday(&te, NULL);
@@ -142,6 +160,8 @@ main(int argc, char **argv)
 	int i, c;
 	struct timeval *tv;
 	evutil_socket_t *cp;
+	const char *method = NULL;
+	int flags = 0;
 
 #ifdef _WIN32
 	WSADATA WSAData;
@@ -150,7 +170,7 @@ main(int argc, char **argv)
 	num_pipes = 100;
 	num_active = 1;
 	num_writes = num_pipes;
-	while ((c = getopt(argc, argv, "n:a:w:")) != -1) {
+	while ((c = getopt(argc, argv, "n:a:w:m:t:W")) != -1) {
 		switch (c) {
 		case 'n':
 			num_pipes = atoi(optarg);
@@ -161,6 +181,15 @@ main(int argc, char **argv)
 		case 'w':
 			num_writes = atoi(optarg);
 			break;
+		case 'm':
+			method = optarg;
+			break;
+		case 't':
+			timeout_msec = atoi(optarg);
+			break;
+		case 'W':
+			flags |= EVENT_BASE_FLAG_TIMING_WHEEL;
+			break;
 		default:
 			fprintf(stderr, "Illegal argument \"%c\"\n", c);
 			exit(1);
@@ -182,7 +211,8 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
-	event_init();
+	if ((base = bench_base_new(method, flags)) == NULL)
+		exit(1);
 
 	for (cp = pipes, i = 0; i < num_pipes; i++, cp += 2) {
 #ifdef USE_PIPES
@@ -52,6 +52,8 @@
 #include <event.h>
 #include <evutil.h>
 
+#include "bench_common.h"
+
 /*
  * This benchmark tests how quickly we can propagate a write down a chain
  * of socket pairs.  We start by writing to the first socket pair and all
@@ -62,6 +64,7 @@
 static int fired;
 static evutil_socket_t *pipes;
 static struct event *events;
+static struct event_base *base;
 
 static void
 read_cb(evutil_socket_t fd, short which, void *arg)
@@ -110,6 +113,7 @@ run_once(int num_pipes)
 		evutil_socket_t fd = i < num_pipes - 1 ? cp[3] : -1;
 		event_set(&events[i], cp[0], EV_READ, read_cb,
 		    (void *)(ev_intptr_t)fd);
+		event_base_set(base, &events[i]);
 		event_add(&events[i], &tv_timeout);
 	}
 
@@ -119,7 +123,7 @@ run_once(int num_pipes)
 	if (send(pipes[1], "e", 1, 0) < 0)
 		perror("send");
 
-	event_dispatch();
+	event_base_dispatch(base);
 
 	evutil_gettimeofday(&te, NULL);
 	evutil_timersub(&te, &ts, &te);
@@ -146,16 +150,20 @@ main(int argc, char **argv)
 	struct timeval *tv;
 
 	int num_pipes = 100;
+	const char *method = NULL;
 #ifdef _WIN32
 	WSADATA WSAData;
 	WSAStartup(0x101, &WSAData);
 #endif
 
-	while ((c = getopt(argc, argv, "n:")) != -1) {
+	while ((c = getopt(argc, argv, "n:m:")) != -1) {
 		switch (c) {
 		case 'n':
 			num_pipes = atoi(optarg);
 			break;
+		case 'm':
+			method = optarg;
+			break;
 		default:
 			fprintf(stderr, "Illegal argument \"%c\"\n", c);
 			exit(1);
@@ -170,7 +178,8 @@ main(int argc, char **argv)
 	}
 #endif
 
-	event_init();
+	if ((base = bench_base_new(method, 0)) == NULL)
+		exit(1);
 
 	for (i = 0; i < 25; i++) {
 		tv = run_once(num_pipes);
@@ -0,0 +1,301 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This benchmark sends UDP datagrams between two loopback sockets in one
+ * event loop and prints how many arrive per second.  It does so three
+ * ways: with one recv() per readable event and one send() per writable
+ * event, as callers without evdgram do; with an evdgram on each side,
+ * which reads and sends up to a batch of datagrams per event (recvmmsg()
+ * and sendmmsg() where available); and the same with EVDGRAM_OPT_GSO on
+ * the sending side.  No more than a window of datagrams is in flight at
+ * once, so that the receiver's socket buffer does not overflow.
+ *
+ *   bench_dgram [-n datagrams] [-s size] [-b batch] [-w window]
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "event2/event.h"
+#include "event2/dgram.h"
+#include "event2/util.h"
+
+enum mode {
+	MODE_SINGLE,
+	MODE_BATCH,
+	MODE_GSO
+};
+
+struct bench {
+	enum mode mode;
+	struct event_base *base;
+	evutil_socket_t tx_fd, rx_fd;
+	struct event *tx_event, *rx_event, *stall_event;
+	struct evdgram *tx, *rx;
+	long sent, received, lost;
+	long last_received;
+	int tx_paused;
+};
+
+static long num_dgrams = 1000000;
+static size_t dgram_size = 64;
+static int batch = 32;
+static long window = 256;
+static char buf[65536];
+
+#define IN_FLIGHT(b) ((b)->sent - (b)->received - (b)->lost)
+
+static void
+check_done(struct bench *b)
+{
+	if (b->received + b->lost >= num_dgrams)
+		event_base_loopbreak(b->base);
+	else if (b->tx_paused && IN_FLIGHT(b) <= window / 2 &&
+	    b->sent < num_dgrams) {
+		b->tx_paused = 0;
+		event_add(b->tx_event, NULL);
+	}
+}
+
+static void
+tx_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bench *b = arg;
+	long queued = b->tx ? evdgram_get_queued(b->tx) : 0;
+	long room = window - IN_FLIGHT(b) - queued;
+	int r;
+
+	if (room > num_dgrams - b->sent - queued)
+		room = num_dgrams - b->sent - queued;
+
+	if (b->mode == MODE_SINGLE) {
+		if (room > 0 && send(fd, buf, dgram_size, 0) >= 0)
+			++b->sent;
+	} else {
+		while (room-- > 0 &&
+		    evdgram_add(b->tx, buf, dgram_size, NULL, 0) == 0)
+			;
+		if ((r = evdgram_flush(b->tx, fd)) > 0)
+			b->sent += r;
+		queued = evdgram_get_queued(b->tx);
+	}
+
+	if (IN_FLIGHT(b) + queued >= window || b->sent >= num_dgrams) {
+		b->tx_paused = 1;
+		event_del(b->tx_event);
+	}
+}
+
+static void
+rx_cb(evutil_socket_t fd, short what, void *arg)
+{
+	static char sink[65536];
+	struct bench *b = arg;
+	int n;
+
+	if (b->mode == MODE_SINGLE) {
+		if (recv(fd, sink, sizeof(sink), 0) >= 0)
+			++b->received;
+	} else if ((n = evdgram_recv(b->rx, fd)) > 0) {
+		b->received += n;
+	}
+	check_done(b);
+}
+
+/* If nothing has arrived for a while, count what is in flight as lost and
+ * carry on. */
+static void
+stall_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bench *b = arg;
+
+	if (b->received == b->last_received && IN_FLIGHT(b) > 0)
+		b->lost += IN_FLIGHT(b);
+	b->last_received = b->received;
+	check_done(b);
+}
+
+static evutil_socket_t
+udp_socket(struct sockaddr_in *sin)
+{
+	ev_socklen_t slen = sizeof(*sin);
+	int rcvbuf = 4*1024*1024;
+	evutil_socket_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0)
+		return fd;
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x7f000001);
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *)&rcvbuf, sizeof(rcvbuf));
+	if (bind(fd, (struct sockaddr *)sin, sizeof(*sin)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)sin, &slen) < 0) {
+		evutil_closesocket(fd);
+		return -1;
+	}
+	evutil_make_socket_nonblocking(fd);
+	return fd;
+}
+
+/* Returns datagrams per second, or -1 on error. */
+static double
+run_once(enum mode mode, long *lost)
+{
+	struct bench b;
+	struct sockaddr_in sin_tx, sin_rx;
+	struct timeval start, end, tv = { 0, 100*1000 };
+	double usec;
+	int r = -1;
+
+	memset(&b, 0, sizeof(b));
+	b.mode = mode;
+	b.tx_fd = udp_socket(&sin_tx);
+	b.rx_fd = udp_socket(&sin_rx);
+	if ((b.base = event_base_new()) == NULL ||
+	    b.tx_fd < 0 || b.rx_fd < 0 ||
+	    connect(b.tx_fd, (struct sockaddr *)&sin_rx, sizeof(sin_rx)) < 0)
+		goto done;
+	if (mode != MODE_SINGLE) {
+		b.tx = evdgram_new(batch, dgram_size,
+		    mode == MODE_GSO ? EVDGRAM_OPT_GSO : 0);
+		b.rx = evdgram_new(batch, dgram_size, 0);
+		if (!b.tx || !b.rx)
+			goto done;
+	}
+	b.tx_event = event_new(b.base, b.tx_fd, EV_WRITE|EV_PERSIST, tx_cb, &b);
+	b.rx_event = event_new(b.base, b.rx_fd, EV_READ|EV_PERSIST, rx_cb, &b);
+	b.stall_event = event_new(b.base, -1, EV_PERSIST, stall_cb, &b);
+	if (!b.tx_event || !b.rx_event || !b.stall_event)
+		goto done;
+	event_add(b.tx_event, NULL);
+	event_add(b.rx_event, NULL);
+	event_add(b.stall_event, &tv);
+
+	evutil_gettimeofday(&start, NULL);
+	event_base_dispatch(b.base);
+	evutil_gettimeofday(&end, NULL);
+	r = 0;
+
+done:
+	if (b.tx_event)
+		event_free(b.tx_event);
+	if (b.rx_event)
+		event_free(b.rx_event);
+	if (b.stall_event)
+		event_free(b.stall_event);
+	if (b.tx)
+		evdgram_free(b.tx);
+	if (b.rx)
+		evdgram_free(b.rx);
+	if (b.tx_fd >= 0)
+		evutil_closesocket(b.tx_fd);
+	if (b.rx_fd >= 0)
+		evutil_closesocket(b.rx_fd);
+	if (b.base)
+		event_base_free(b.base);
+	if (r < 0)
+		return -1;
+
+	*lost = b.lost;
+	evutil_timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000.0 + end.tv_usec;
+	return usec > 0 ? b.received * 1000000.0 / usec : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *names[] = { "single", "batch", "gso" };
+	double pps[3];
+	long lost[3];
+	int c, i;
+
+#ifdef _WIN32
+	WSADATA WSAData;
+	WSAStartup(0x101, &WSAData);
+#endif
+
+	while ((c = getopt(argc, argv, "n:s:b:w:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_dgrams = atol(optarg);
+			break;
+		case 's':
+			dgram_size = (size_t)atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'w':
+			window = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_dgrams < 1 || dgram_size < 1 || dgram_size > sizeof(buf) ||
+	    batch < 1 || window < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+	memset(buf, 'd', sizeof(buf));
+
+	for (i = MODE_SINGLE; i <= MODE_GSO; ++i) {
+		if ((pps[i] = run_once((enum mode)i, &lost[i])) < 0) {
+			fprintf(stderr, "%s run failed\n", names[i]);
+			exit(1);
+		}
+	}
+	printf("%14s %14s %14s\n", "single pkt/s", "batch pkt/s", "gso pkt/s");
+	printf("%14.0f %14.0f %14.0f\n", pps[0], pps[1], pps[2]);
+	for (i = MODE_SINGLE; i <= MODE_GSO; ++i) {
+		if (lost[i])
+			printf("%s: %ld datagrams lost\n", names[i], lost[i]);
+	}
+	return (0);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This benchmark bounces messages between the two ends of a number of
+ * socket pairs, each end a bufferevent: one side echoes whatever it reads,
+ * the other sends the next message once the last one has come back.  It
+ * does so for a range of message sizes, with and without the evbuffer
+ * chain pool (EVENT_BASE_FLAG_BUFFER_POOL), and prints round trips per
+ * second along with the pool's hit rate.
+ *
+ *   bench_echo [-c connections] [-n round trips] [-s size]
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <signal.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/util.h"
+
+static int num_conns = 100;
+static int num_trips = 200000;
+static size_t msg_size;
+static char *msg;
+static int trips;
+
+static void
+echo_readcb(struct bufferevent *bev, void *arg)
+{
+	bufferevent_write_buffer(bev, bufferevent_get_input(bev));
+}
+
+static void
+client_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	while (evbuffer_get_length(input) >= msg_size) {
+		evbuffer_drain(input, msg_size);
+		if (++trips >= num_trips) {
+			event_base_loopbreak(bufferevent_get_base(bev));
+			return;
+		}
+		bufferevent_write(bev, msg, msg_size);
+	}
+}
+
+/* Returns round trips per second, or -1 on error. */
+static double
+run_once(size_t size, int flags, struct evbuffer_pool_stats *stats)
+{
+	struct event_config *cfg;
+	struct event_base *base;
+	struct bufferevent **bevs;
+	struct timeval start, end;
+	evutil_socket_t pair[2];
+	double usec;
+	int i;
+
+	cfg = event_config_new();
+	event_config_set_flag(cfg, flags);
+	base = event_base_new_with_config(cfg);
+	event_config_free(cfg);
+	if (base == NULL)
+		return -1;
+
+	bevs = calloc(num_conns * 2, sizeof(struct bufferevent *));
+	if (bevs == NULL)
+		return -1;
+	for (i = 0; i < num_conns; ++i) {
+		if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+			perror("socketpair");
+			return -1;
+		}
+		evutil_make_socket_nonblocking(pair[0]);
+		evutil_make_socket_nonblocking(pair[1]);
+		bevs[2*i] = bufferevent_socket_new(base, pair[0],
+		    BEV_OPT_CLOSE_ON_FREE);
+		bevs[2*i+1] = bufferevent_socket_new(base, pair[1],
+		    BEV_OPT_CLOSE_ON_FREE);
+		bufferevent_setcb(bevs[2*i], client_readcb, NULL, NULL, NULL);
+		bufferevent_setcb(bevs[2*i+1], echo_readcb, NULL, NULL, NULL);
+		bufferevent_enable(bevs[2*i], EV_READ);
+		bufferevent_enable(bevs[2*i+1], EV_READ);
+	}
+
+	msg_size = size;
+	trips = 0;
+	evutil_gettimeofday(&start, NULL);
+	for (i = 0; i < num_conns; ++i)
+		bufferevent_write(bevs[2*i], msg, msg_size);
+	event_base_dispatch(base);
+	evutil_gettimeofday(&end, NULL);
+
+	evutil_timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000.0 + end.tv_usec;
+	if (evbuffer_get_pool_stats(base, stats) < 0)
+		memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < num_conns * 2; ++i)
+		bufferevent_free(bevs[i]);
+	free(bevs);
+	event_base_free(base);
+
+	return usec > 0 ? trips / usec * 1000000.0 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 64, 256, 1024, 4096, 0 };
+	size_t one_size[2] = { 0, 0 };
+	const size_t *size = sizes;
+	struct evbuffer_pool_stats stats;
+	double plain, pooled, lookups;
+	int c;
+
+#ifdef _WIN32
+	WSADATA WSAData;
+	WSAStartup(0x101, &WSAData);
+#else
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+		return (1);
+#endif
+
+	while ((c = getopt(argc, argv, "c:n:s:")) != -1) {
+		switch (c) {
+		case 'c':
+			num_conns = atoi(optarg);
+			break;
+		case 'n':
+			num_trips = atoi(optarg);
+			break;
+		case 's':
+			one_size[0] = (size_t)atoi(optarg);
+			size = one_size;
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_conns < 1 || num_trips < 1 || size[0] == 0) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	if ((msg = malloc(4096 > size[0] ? 4096 : size[0])) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(msg, 'e', 4096 > size[0] ? 4096 : size[0]);
+
+	printf("%8s %14s %14s %9s\n", "size", "trips/s", "pooled/s",
+	    "hit rate");
+	for (; *size; ++size) {
+		plain = run_once(*size, 0, &stats);
+		pooled = run_once(*size, EVENT_BASE_FLAG_BUFFER_POOL, &stats);
+		if (plain < 0 || pooled < 0) {
+			fprintf(stderr, "run failed\n");
+			exit(1);
+		}
+		lookups = (double)(stats.hits + stats.misses);
+		printf("%8u %14.0f %14.0f %8.2f%%\n", (unsigned)*size, plain,
+		    pooled, lookups ? stats.hits * 100.0 / lookups : 0.0);
+	}
+
+	free(msg);
+	return (0);
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This benchmark pushes data through a number of proxied connections:
+ * a producer socket feeds a bufferevent, whose data is passed on to a
+ * second bufferevent, whose socket is drained by a consumer.  The data is
+ * passed on in three ways: by the read callback copy loop of
+ * sample/le-proxy.c, by bufferevent_forward() between the two socket
+ * bufferevents (splice(2) where available), and by bufferevent_forward()
+ * from a filtering bufferevent (which always copies).  It prints the
+ * throughput of each in MB per second.
+ *
+ *   bench_forward [-c connections] [-n megabytes per connection]
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <signal.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/util.h"
+
+#define CHUNK (64*1024)
+/* As in sample/le-proxy.c */
+#define MAX_OUTPUT (512*1024)
+
+enum mode {
+	MODE_COPY,
+	MODE_FORWARD,
+	MODE_FORWARD_FILTER
+};
+
+struct conn {
+	evutil_socket_t producer;
+	evutil_socket_t consumer;
+	struct event *produce;
+	struct event *consume;
+	struct bufferevent *src;
+	struct bufferevent *dst;
+	size_t to_send;
+};
+
+static int num_conns = 10;
+static size_t conn_bytes = 64*1024*1024;
+static size_t total_received;
+static char buf[CHUNK];
+
+static void
+produce_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct conn *c = arg;
+	ev_ssize_t n;
+
+	n = send(fd, buf, c->to_send < CHUNK ? c->to_send : CHUNK, 0);
+	if (n > 0)
+		c->to_send -= n;
+	if (c->to_send == 0)
+		event_del(c->produce);
+}
+
+static void
+consume_cb(evutil_socket_t fd, short what, void *arg)
+{
+	static char sink[CHUNK];
+	struct conn *c = arg;
+	ev_ssize_t n;
+
+	n = recv(fd, sink, sizeof(sink), 0);
+	if (n > 0)
+		total_received += n;
+	if (total_received >= conn_bytes * num_conns)
+		event_base_loopbreak(event_get_base(c->consume));
+}
+
+static void
+drained_writecb(struct bufferevent *bev, void *arg)
+{
+	struct conn *c = arg;
+
+	bufferevent_setcb(bev, NULL, NULL, NULL, c);
+	bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
+	bufferevent_enable(c->src, EV_READ);
+}
+
+static void
+copy_readcb(struct bufferevent *bev, void *arg)
+{
+	struct conn *c = arg;
+	struct evbuffer *dst = bufferevent_get_output(c->dst);
+
+	evbuffer_add_buffer(dst, bufferevent_get_input(bev));
+	if (evbuffer_get_length(dst) >= MAX_OUTPUT) {
+		bufferevent_setcb(c->dst, NULL, drained_writecb, NULL, c);
+		bufferevent_setwatermark(c->dst, EV_WRITE, MAX_OUTPUT/2,
+		    MAX_OUTPUT);
+		bufferevent_disable(bev, EV_READ);
+	}
+}
+
+static int
+conn_setup(struct event_base *base, struct conn *c, enum mode mode)
+{
+	evutil_socket_t in[2], out[2];
+
+	if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, in) == -1 ||
+	    evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, out) == -1) {
+		perror("socketpair");
+		return -1;
+	}
+	evutil_make_socket_nonblocking(in[0]);
+	evutil_make_socket_nonblocking(in[1]);
+	evutil_make_socket_nonblocking(out[0]);
+	evutil_make_socket_nonblocking(out[1]);
+
+	c->producer = in[0];
+	c->consumer = out[1];
+	c->to_send = conn_bytes;
+	c->produce = event_new(base, c->producer, EV_WRITE|EV_PERSIST,
+	    produce_cb, c);
+	c->consume = event_new(base, c->consumer, EV_READ|EV_PERSIST,
+	    consume_cb, c);
+	c->src = bufferevent_socket_new(base, in[1], BEV_OPT_CLOSE_ON_FREE);
+	c->dst = bufferevent_socket_new(base, out[0], BEV_OPT_CLOSE_ON_FREE);
+	if (mode == MODE_FORWARD_FILTER)
+		c->src = bufferevent_filter_new(c->src, NULL, NULL,
+		    BEV_OPT_CLOSE_ON_FREE, NULL, NULL);
+	if (!c->produce || !c->consume || !c->src || !c->dst)
+		return -1;
+
+	if (mode == MODE_COPY) {
+		bufferevent_setcb(c->src, copy_readcb, NULL, NULL, c);
+		bufferevent_enable(c->src, EV_READ);
+	} else if (bufferevent_forward(c->src, c->dst) < 0) {
+		return -1;
+	}
+	event_add(c->produce, NULL);
+	event_add(c->consume, NULL);
+	return 0;
+}
+
+static void
+conn_free(struct conn *c)
+{
+	if (c->produce)
+		event_free(c->produce);
+	if (c->consume)
+		event_free(c->consume);
+	if (c->src)
+		bufferevent_free(c->src);
+	if (c->dst)
+		bufferevent_free(c->dst);
+	if (c->producer >= 0)
+		evutil_closesocket(c->producer);
+	if (c->consumer >= 0)
+		evutil_closesocket(c->consumer);
+}
+
+/* Returns megabytes per second, or -1 on error. */
+static double
+run_once(enum mode mode)
+{
+	struct event_base *base;
+	struct conn *conns;
+	struct timeval start, end;
+	double usec;
+	int i, r = 0;
+
+	if ((base = event_base_new()) == NULL)
+		return -1;
+	if ((conns = calloc(num_conns, sizeof(struct conn))) == NULL)
+		return -1;
+	for (i = 0; i < num_conns; ++i)
+		conns[i].producer = conns[i].consumer = -1;
+	for (i = 0; i < num_conns && r == 0; ++i)
+		r = conn_setup(base, &conns[i], mode);
+
+	total_received = 0;
+	evutil_gettimeofday(&start, NULL);
+	if (r == 0)
+		event_base_dispatch(base);
+	evutil_gettimeofday(&end, NULL);
+
+	for (i = 0; i < num_conns; ++i)
+		conn_free(&conns[i]);
+	free(conns);
+	event_base_free(base);
+	if (r < 0)
+		return -1;
+
+	evutil_timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000.0 + end.tv_usec;
+	return usec > 0 ? total_received / usec : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	double copy, forward, filter;
+	int c;
+
+#ifdef _WIN32
+	WSADATA WSAData;
+	WSAStartup(0x101, &WSAData);
+#else
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+		return (1);
+#endif
+
+	while ((c = getopt(argc, argv, "c:n:")) != -1) {
+		switch (c) {
+		case 'c':
+			num_conns = atoi(optarg);
+			break;
+		case 'n':
+			conn_bytes = (size_t)atoi(optarg) * 1024 * 1024;
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_conns < 1 || conn_bytes == 0) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+	memset(buf, 'f', sizeof(buf));
+
+	copy = run_once(MODE_COPY);
+	forward = run_once(MODE_FORWARD);
+	filter = run_once(MODE_FORWARD_FILTER);
+	if (copy < 0 || forward < 0 || filter < 0) {
+		fprintf(stderr, "run failed\n");
+		exit(1);
+	}
+	printf("%14s %14s %14s\n", "copy MB/s", "forward MB/s", "filter MB/s");
+	printf("%14.1f %14.1f %14.1f\n", copy, forward, filter);
+	return (0);
+}
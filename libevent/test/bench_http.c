@@ -25,10 +25,29 @@
  *
  */
 
+/*
+ * Serves fixed-size replies on /ind and /ref.
+ *
+ *   bench_http [-p port] [-l content length] [-t threads] [-a]
+ *   bench_http -b [-l content length] [-t max threads] [-c connections]
+ *       [-n requests] [-a]
+ *
+ * With -t the server runs on several threads through evhttp_workers.  With
+ * -b no port is opened for outside clients; instead the server is started
+ * with 1, 2, 4, ... up to -t worker threads on a loopback port, loaded by
+ * keep-alive client connections from the same process, and the number of
+ * requests per second is printed for each thread count.  With -a headers
+ * are parsed with EVHTTP_SERVER_ARENA_HEADERS (and EVHTTP_CON_ARENA_HEADERS
+ * on the client side).
+ */
+
+#include "event2/event-config.h"
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #ifdef _WIN32
 #include <winsock2.h>
+#include <process.h>
 #else
 #include <sys/socket.h>
 #include <sys/resource.h>
@@ -48,10 +67,183 @@
 #include "event2/http.h"
 #include "event2/thread.h"
 
+#ifdef EVENT__HAVE_PTHREADS
+#include <pthread.h>
+#define THREAD_T pthread_t
+#define THREAD_FN void *
+#define THREAD_RETURN() return (NULL)
+#define THREAD_START(threadvar, fn, arg) \
+	pthread_create(&(threadvar), NULL, fn, arg)
+#define THREAD_JOIN(th) pthread_join(th, NULL)
+#elif defined(_WIN32)
+#define THREAD_T HANDLE
+#define THREAD_FN unsigned __stdcall
+#define THREAD_RETURN() return (0)
+#define THREAD_START(threadvar, fn, arg) do {				\
+	uintptr_t threadhandle = _beginthreadex(NULL, 0, fn, (arg), 0, NULL); \
+	(threadvar) = (HANDLE) threadhandle;				\
+} while (0)
+#define THREAD_JOIN(th) WaitForSingleObject(th, INFINITE)
+#endif
+
 static void http_basic_cb(struct evhttp_request *req, void *arg);
 
 static char *content;
 static size_t content_len = 0;
+static int arena_headers = 0;
+
+#ifdef THREAD_T
+struct bench_client;
+
+struct bench_conn {
+	struct bench_client *client;
+	struct evhttp_connection *evcon;
+};
+
+struct bench_client {
+	struct event_base *base;
+	struct bench_conn *conns;
+	int n_conns;
+	int issued;
+	int done;
+	int errors;
+	int quota;
+	THREAD_T thread;
+};
+
+static int
+use_threads(void)
+{
+#if defined(EVTHREAD_USE_PTHREADS_IMPLEMENTED)
+	return evthread_use_pthreads();
+#elif defined(EVTHREAD_USE_WINDOWS_THREADS_IMPLEMENTED)
+	return evthread_use_windows_threads();
+#else
+	return -1;
+#endif
+}
+
+static void bench_request(struct bench_conn *conn);
+
+static void
+bench_request_done(struct evhttp_request *req, void *arg)
+{
+	struct bench_conn *conn = arg;
+	struct bench_client *cl = conn->client;
+
+	++cl->done;
+	if (req == NULL || evhttp_request_get_response_code(req) != HTTP_OK)
+		++cl->errors;
+	else if (cl->issued < cl->quota)
+		bench_request(conn);
+	if (cl->done == cl->issued)
+		event_base_loopbreak(cl->base);
+}
+
+static void
+bench_request(struct bench_conn *conn)
+{
+	struct evhttp_request *req;
+
+	req = evhttp_request_new(bench_request_done, conn);
+	if (req == NULL)
+		return;
+	evhttp_add_header(evhttp_request_get_output_headers(req),
+	    "Host", "127.0.0.1");
+	if (evhttp_make_request(conn->evcon, req, EVHTTP_REQ_GET, "/ind") == 0)
+		++conn->client->issued;
+}
+
+static THREAD_FN
+bench_client_main(void *arg)
+{
+	struct bench_client *cl = arg;
+
+	event_base_dispatch(cl->base);
+	THREAD_RETURN();
+}
+
+/* Returns requests per second, or -1 on error. */
+static double
+bench_run(struct evhttp *http, int n_threads, int n_clients, int n_conns,
+    int n_requests)
+{
+	struct evhttp_workers *workers;
+	struct bench_client *clients;
+	struct timeval start, end;
+	double usec;
+	int port, i, j, done = 0, errors = 0;
+
+	workers = evhttp_workers_new(http, n_threads, NULL);
+	if (workers == NULL)
+		return -1;
+	port = evhttp_workers_bind_socket(workers, "127.0.0.1", 0);
+	if (port < 0) {
+		evhttp_workers_free(workers);
+		return -1;
+	}
+
+	clients = calloc(n_clients, sizeof(*clients));
+	for (i = 0; clients && i < n_clients; ++i) {
+		struct bench_client *cl = &clients[i];
+
+		cl->base = event_base_new();
+		cl->n_conns = n_conns / n_clients + (i < n_conns % n_clients);
+		cl->quota = n_requests / n_clients;
+		cl->conns = calloc(cl->n_conns, sizeof(*cl->conns));
+		if (cl->base == NULL || cl->conns == NULL)
+			continue;
+		for (j = 0; j < cl->n_conns; ++j) {
+			struct bench_conn *conn = &cl->conns[j];
+
+			conn->client = cl;
+			conn->evcon = evhttp_connection_base_new(cl->base,
+			    NULL, "127.0.0.1", port);
+			if (conn->evcon && arena_headers)
+				evhttp_connection_set_flags(conn->evcon,
+				    EVHTTP_CON_ARENA_HEADERS);
+			if (conn->evcon && cl->issued < cl->quota)
+				bench_request(conn);
+		}
+	}
+
+	evutil_gettimeofday(&start, NULL);
+	for (i = 0; clients && i < n_clients; ++i) {
+		if (clients[i].issued)
+			THREAD_START(clients[i].thread, bench_client_main,
+			    &clients[i]);
+	}
+	for (i = 0; clients && i < n_clients; ++i) {
+		if (clients[i].issued)
+			THREAD_JOIN(clients[i].thread);
+	}
+	evutil_gettimeofday(&end, NULL);
+
+	for (i = 0; clients && i < n_clients; ++i) {
+		struct bench_client *cl = &clients[i];
+
+		done += cl->done;
+		errors += cl->errors;
+		for (j = 0; cl->conns && j < cl->n_conns; ++j) {
+			if (cl->conns[j].evcon)
+				evhttp_connection_free(cl->conns[j].evcon);
+		}
+		free(cl->conns);
+		if (cl->base)
+			event_base_free(cl->base);
+	}
+	free(clients);
+	evhttp_workers_free(workers);
+
+	if (errors || done == 0) {
+		fprintf(stderr, "%d of %d requests failed\n", errors, done);
+		return -1;
+	}
+	evutil_timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000.0 + end.tv_usec;
+	return usec > 0 ? done * 1000000.0 / usec : 0;
+}
+#endif
 
 static void
 http_basic_cb(struct evhttp_request *req, void *arg)
@@ -90,6 +282,10 @@ main(int argc, char **argv)
 	int i;
 	int c;
 	int use_iocp = 0;
+	int n_threads = 0;
+	int bench = 0;
+	int n_conns = 64;
+	int n_requests = 100000;
 	ev_uint16_t port = 8080;
 	char *endptr = NULL;
 
@@ -107,7 +303,8 @@ main(int argc, char **argv)
 
 		c = argv[i][1];
 
-		if ((c == 'p' || c == 'l') && i + 1 >= argc) {
+		if ((c == 'p' || c == 'l' || c == 't' || c == 'c' || c == 'n') &&
+		    i + 1 >= argc) {
 			fprintf(stderr, "-%c requires argument.\n", c);
 			exit(1);
 		}
@@ -135,6 +332,33 @@ main(int argc, char **argv)
 				exit(1);
 			}
 			break;
+		case 't':
+			n_threads = (int)strtol(argv[i+1], &endptr, 10);
+			if (*endptr != '\0' || n_threads < 1) {
+				fprintf(stderr, "Bad number of threads\n");
+				exit(1);
+			}
+			break;
+		case 'c':
+			n_conns = (int)strtol(argv[i+1], &endptr, 10);
+			if (*endptr != '\0' || n_conns < 1) {
+				fprintf(stderr, "Bad number of connections\n");
+				exit(1);
+			}
+			break;
+		case 'n':
+			n_requests = (int)strtol(argv[i+1], &endptr, 10);
+			if (*endptr != '\0' || n_requests < 1) {
+				fprintf(stderr, "Bad number of requests\n");
+				exit(1);
+			}
+			break;
+		case 'b':
+			bench = 1;
+			break;
+		case 'a':
+			arena_headers = 1;
+			break;
 #ifdef _WIN32
 		case 'i':
 			use_iocp = 1;
@@ -150,6 +374,18 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (n_threads || bench) {
+#ifdef THREAD_T
+		if (use_threads() < 0) {
+			fprintf(stderr, "Cannot enable threading support\n");
+			exit(1);
+		}
+#else
+		fprintf(stderr, "-t and -b need threading support\n");
+		exit(1);
+#endif
+	}
+
 	base = event_base_new_with_config(cfg);
 	if (!base) {
 		fprintf(stderr, "creating event_base failed. Exiting.\n");
@@ -157,6 +393,8 @@ main(int argc, char **argv)
 	}
 
 	http = evhttp_new(base);
+	if (arena_headers)
+		evhttp_set_flags(http, EVHTTP_SERVER_ARENA_HEADERS);
 
 	content = malloc(content_len);
 	if (content == NULL) {
@@ -174,6 +412,46 @@ main(int argc, char **argv)
 	evhttp_set_cb(http, "/ref", http_ref_cb, NULL);
 	fprintf(stderr, "/ref - basic content (reference)\n");
 
+#ifdef THREAD_T
+	if (bench) {
+		int max_threads = n_threads ? n_threads : 4;
+		double rps;
+
+		printf("%8s %14s\n", "threads", "requests/s");
+		for (i = 1; i <= max_threads; i *= 2) {
+			/* One client thread per server thread, so that the
+			 * load grows with the server. */
+			rps = bench_run(http, i, i, n_conns, n_requests);
+			if (rps < 0) {
+				fprintf(stderr, "run with %d threads failed\n", i);
+				exit(1);
+			}
+			printf("%8d %14.0f\n", i, rps);
+		}
+		evhttp_free(http);
+		event_base_free(base);
+		event_config_free(cfg);
+		free(content);
+		return (0);
+	}
+
+	if (n_threads) {
+		struct evhttp_workers *workers;
+
+		workers = evhttp_workers_new(http, n_threads, cfg);
+		if (workers == NULL ||
+		    evhttp_workers_bind_socket(workers, "0.0.0.0", port) < 0) {
+			fprintf(stderr, "Cannot start %d workers\n", n_threads);
+			exit(1);
+		}
+		fprintf(stderr, "Serving %d bytes on port %d using %d threads\n",
+		    (int)content_len, port, n_threads);
+		/* The workers do the serving; just keep this thread parked. */
+		event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+		return (0);
+	}
+#endif
+
 	fprintf(stderr, "Serving %d bytes on port %d using %s\n",
 	    (int)content_len, port,
 	    use_iocp? "IOCP" : event_base_get_method(base));
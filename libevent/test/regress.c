@@ -3230,6 +3230,94 @@ end:
 	}
 }
 
+static void
+stats_slow_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct timeval delay = { 0, 30*1000 };
+	evutil_usleep_(&delay);
+}
+
+static void
+stats_fast_cb(evutil_socket_t fd, short what, void *arg)
+{
+	int *count = arg;
+	++*count;
+}
+
+static void
+test_event_base_stats(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct event_base_stats st;
+	struct event *slow = NULL, *fast[4];
+	struct timeval ten_msec = { 0, 10*1000 };
+	ev_uint64_t sum;
+	int i, count = 0;
+
+	for (i = 0; i < 4; ++i)
+		fast[i] = event_new(base, -1, 0, stats_fast_cb, &count);
+	slow = event_new(base, -1, 0, stats_slow_cb, NULL);
+
+	/* Off by default. */
+	tt_int_op(-1, ==, event_base_get_stats(base, &st));
+	tt_int_op(-1, ==, event_base_enable_stats(base, -1));
+
+	tt_int_op(0, ==, event_base_enable_stats(base, 1));
+	for (i = 0; i < 4; ++i)
+		event_active(fast[i], EV_TIMEOUT, 1);
+	event_add(slow, &ten_msec);
+	event_base_dispatch(base);
+	tt_int_op(count, ==, 4);
+
+	tt_int_op(0, ==, event_base_get_stats(base, &st));
+	tt_assert(st.iterations >= 2);
+	for (sum = 0, i = 0; i < EVENT_BASE_STATS_BUCKETS; ++i)
+		sum += st.dispatch_hist[i];
+	tt_assert(sum == st.iterations);
+	for (sum = 0, i = 0; i < EVENT_BASE_STATS_BUCKETS; ++i)
+		sum += st.active_hist[i];
+	tt_assert(sum == st.iterations);
+	/* The first iteration finds the four active events: 4 is in
+	 * bucket 3.  The dispatch before the timeout waits for it. */
+	tt_assert(st.active_max == 4);
+	tt_assert(st.active_total == 5);
+	tt_assert(st.active_hist[3] == 1);
+	tt_assert(st.longest_stall_usec >= 20*1000);
+
+	/* The slow callback took more time in total, so it comes first. */
+	tt_int_op(st.n_callbacks, ==, 2);
+	tt_ptr_op(st.callbacks[0].callback, ==, (void *)stats_slow_cb);
+	tt_assert(st.callbacks[0].samples == 1);
+	tt_assert(st.callbacks[0].max_usec >= 20*1000);
+	tt_assert(st.callbacks[0].total_usec == st.callbacks[0].max_usec);
+	tt_ptr_op(st.callbacks[1].callback, ==, (void *)stats_fast_cb);
+	tt_assert(st.callbacks[1].samples == 4);
+	tt_assert(st.callbacks[1].max_usec < st.callbacks[0].max_usec);
+	tt_assert(st.callbacks_untracked == 0);
+
+	/* Sample one callback in two, after clearing. */
+	tt_int_op(0, ==, event_base_enable_stats(base, 2));
+	tt_int_op(0, ==, event_base_get_stats(base, &st));
+	tt_assert(st.iterations == 0);
+	tt_int_op(st.n_callbacks, ==, 0);
+	for (i = 0; i < 4; ++i)
+		event_active(fast[i], EV_TIMEOUT, 1);
+	event_base_dispatch(base);
+	tt_int_op(0, ==, event_base_get_stats(base, &st));
+	tt_int_op(st.n_callbacks, ==, 1);
+	tt_assert(st.callbacks[0].samples == 2);
+
+	tt_int_op(0, ==, event_base_enable_stats(base, 0));
+	tt_int_op(-1, ==, event_base_get_stats(base, &st));
+
+end:
+	for (i = 0; i < 4; ++i)
+		event_free(fast[i]);
+	if (slow)
+		event_free(slow);
+}
+
 static struct event_base *cached_time_base = NULL;
 static int cached_time_reset = 0;
 static int cached_time_sleep = 0;
@@ -3401,6 +3489,124 @@ end:
 #endif
 }
 
+struct timing_wheel_info {
+	struct event *ev;
+	int msec;
+	int fired;
+	long elapsed;
+};
+
+static struct timeval timing_wheel_start;
+
+static void
+timing_wheel_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct timing_wheel_info *ti = arg;
+	struct timeval now;
+
+	evutil_gettimeofday(&now, NULL);
+	ti->elapsed = timeval_msec_diff(&timing_wheel_start, &now);
+	++ti->fired;
+}
+
+static int
+timing_wheel_count_cb(const struct event_base *base, const struct event *ev,
+    void *arg)
+{
+	if (event_get_callback(ev) == timing_wheel_cb)
+		++*(int *)arg;
+	return 0;
+}
+
+static void
+test_timing_wheel(void *arg)
+{
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL;
+	struct timing_wheel_info info[100], far[2];
+	struct timeval tv, pending;
+	int i, round, n;
+
+	memset(info, 0, sizeof(info));
+	memset(far, 0, sizeof(far));
+
+	cfg = event_config_new();
+	event_config_set_flag(cfg, EVENT_BASE_FLAG_TIMING_WHEEL);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+
+	evutil_gettimeofday(&timing_wheel_start, NULL);
+
+	/* Spread timeouts over level 0 (< 256 msec) and the level above it,
+	 * and push them around a few times before they can fire, as
+	 * activity on an idle connection would. */
+	for (i = 0; i < 100; ++i) {
+		info[i].ev = event_new(base, -1, 0, timing_wheel_cb, &info[i]);
+		tt_assert(info[i].ev);
+	}
+	for (round = 0; round < 3; ++round) {
+		for (i = 0; i < 100; ++i) {
+			info[i].msec = ((i + round * 31) * 37) % 700 + 1;
+			tv.tv_sec = info[i].msec / 1000;
+			tv.tv_usec = (info[i].msec % 1000) * 1000;
+			tt_int_op(event_add(info[i].ev, &tv), ==, 0);
+		}
+	}
+	/* Some never fire at all. */
+	for (i = 0; i < 100; i += 10)
+		event_del(info[i].ev);
+
+	/* One on the top level of the wheel, one beyond its end */
+	tv.tv_sec = 3 * 24 * 3600;
+	tv.tv_usec = 0;
+	for (i = 0; i < 2; ++i) {
+		far[i].ev = event_new(base, -1, 0, timing_wheel_cb, &far[i]);
+		tt_int_op(event_add(far[i].ev, &tv), ==, 0);
+		tv.tv_sec = 100 * 24 * 3600;
+	}
+	event_base_assert_ok_(base);
+
+	n = 0;
+	event_base_foreach_event(base, timing_wheel_count_cb, &n);
+	tt_int_op(n, ==, 92);
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+	event_base_assert_ok_(base);
+
+	for (i = 0; i < 100; ++i) {
+		if (i % 10 == 0) {
+			tt_int_op(info[i].fired, ==, 0);
+			continue;
+		}
+		tt_int_op(info[i].fired, ==, 1);
+		/* Never early, give or take the resolution of the coarse
+		 * monotonic clock; late by at most a tick plus scheduling. */
+		tt_int_op(info[i].elapsed, >=, info[i].msec - 10);
+		tt_int_op(info[i].elapsed, <=, info[i].msec + 100);
+	}
+	for (i = 0; i < 2; ++i) {
+		tt_int_op(far[i].fired, ==, 0);
+		tt_assert(event_pending(far[i].ev, EV_TIMEOUT, &pending));
+	}
+	evutil_gettimeofday(&tv, NULL);
+	tt_int_op(pending.tv_sec - tv.tv_sec, >, 99 * 24 * 3600);
+
+end:
+	for (i = 0; i < 100; ++i)
+		if (info[i].ev)
+			event_free(info[i].ev);
+	for (i = 0; i < 2; ++i)
+		if (far[i].ev)
+			event_free(far[i].ev);
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+}
+
 struct testcase_t main_testcases[] = {
 	/* Some converted-over tests */
 	{ "methods", test_methods, TT_FORK, NULL, NULL },
@@ -3421,6 +3627,7 @@ struct testcase_t main_testcases[] = {
 	BASIC(bad_reentrant, TT_FORK|TT_NEED_BASE|TT_NO_LOGS),
 	BASIC(active_later, TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR),
 	BASIC(event_remove_timeout, TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR),
+	BASIC(timing_wheel, TT_FORK),
 
 	/* These are still using the old API */
 	LEGACY(persistent_timeout, TT_FORK|TT_NEED_BASE),
@@ -3466,6 +3673,7 @@ struct testcase_t main_testcases[] = {
 	BASIC(get_assignment, TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR),
 
 	BASIC(event_foreach, TT_FORK|TT_NEED_BASE),
+	BASIC(event_base_stats, TT_FORK|TT_NEED_BASE),
 	{ "gettimeofday_cached", test_gettimeofday_cached, TT_FORK, &basic_setup, (void*)"" },
 	{ "gettimeofday_cached_sleep", test_gettimeofday_cached, TT_FORK, &basic_setup, (void*)"sleep" },
 	{ "gettimeofday_cached_reset", test_gettimeofday_cached, TT_FORK, &basic_setup, (void*)"sleep reset" },
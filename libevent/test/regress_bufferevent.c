@@ -1327,6 +1327,270 @@ end:
 		bufferevent_free(filter);
 }
 
+struct pool_echo_info {
+	struct bufferevent *client;
+	struct evbuffer *kept;
+	int received;
+	int rounds;
+};
+
+static void
+pool_echo_server_readcb(struct bufferevent *bev, void *arg)
+{
+	bufferevent_write_buffer(bev, bufferevent_get_input(bev));
+}
+
+static void
+pool_echo_client_readcb(struct bufferevent *bev, void *arg)
+{
+	struct pool_echo_info *info = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+	char msg[1000];
+
+	if (evbuffer_get_length(input) < sizeof(msg))
+		return;
+	/* Keep the last message's chains past the end of the base. */
+	if (++info->received == info->rounds) {
+		evbuffer_add_buffer(info->kept, input);
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+		return;
+	}
+	evbuffer_drain(input, sizeof(msg));
+	memset(msg, info->received, sizeof(msg));
+	bufferevent_write(bev, msg, sizeof(msg));
+}
+
+static void
+test_bufferevent_pool(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL;
+	struct bufferevent *server = NULL;
+	struct pool_echo_info info;
+	struct evbuffer_pool_stats stats;
+	char msg[1000];
+
+	memset(&info, 0, sizeof(info));
+	info.rounds = 200;
+	info.kept = evbuffer_new();
+
+	tt_int_op(evbuffer_get_pool_stats(data->base, &stats), ==, -1);
+
+	cfg = event_config_new();
+	event_config_set_flag(cfg, EVENT_BASE_FLAG_BUFFER_POOL);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+	tt_int_op(evbuffer_get_pool_stats(base, &stats), ==, 0);
+	tt_int_op(stats.hits, ==, 0);
+	tt_int_op(stats.misses, ==, 0);
+
+	info.client = bufferevent_socket_new(base, data->pair[0], 0);
+	server = bufferevent_socket_new(base, data->pair[1], 0);
+	bufferevent_setcb(info.client, pool_echo_client_readcb, NULL, NULL,
+	    &info);
+	bufferevent_setcb(server, pool_echo_server_readcb, NULL, NULL, NULL);
+	bufferevent_enable(info.client, EV_READ);
+	bufferevent_enable(server, EV_READ);
+
+	memset(msg, 0, sizeof(msg));
+	bufferevent_write(info.client, msg, sizeof(msg));
+	event_base_dispatch(base);
+
+	tt_int_op(info.received, ==, info.rounds);
+	tt_int_op(evbuffer_get_length(info.kept), ==, sizeof(msg));
+	tt_int_op(evbuffer_get_pool_stats(base, &stats), ==, 0);
+	TT_BLATHER(("hits %d misses %d cached %d",
+		(int)stats.hits, (int)stats.misses, (int)stats.cached));
+	/* After the first few rounds every chain comes from the pool. */
+	tt_int_op(stats.misses, <, 10);
+	tt_int_op(stats.hits, >, info.rounds);
+	tt_int_op(stats.cached_bytes, >=, stats.cached * 512);
+
+	bufferevent_free(info.client);
+	info.client = NULL;
+	bufferevent_free(server);
+	server = NULL;
+	event_base_free(base);
+	base = NULL;
+	tt_int_op(evbuffer_get_length(info.kept), ==, sizeof(msg));
+
+end:
+	if (info.client)
+		bufferevent_free(info.client);
+	if (server)
+		bufferevent_free(server);
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+	/* Frees the last pooled chains after their pool's base is gone. */
+	if (info.kept)
+		evbuffer_free(info.kept);
+}
+
+#define FORWARD_TOTAL (1024*1024)
+
+struct forward_info {
+	struct bufferevent *src;
+	struct bufferevent *dst;
+	size_t written;
+	size_t received;
+	int src_reads;
+	int src_eof;
+	int dst_eof;
+	int bad;
+};
+
+static void
+forward_writer_writecb(struct bufferevent *bev, void *arg)
+{
+	struct forward_info *info = arg;
+	char buf[4096];
+	size_t i;
+
+	if (info->written == FORWARD_TOTAL) {
+		shutdown(bufferevent_getfd(bev), EVUTIL_SHUT_WR);
+		bufferevent_disable(bev, EV_WRITE);
+		return;
+	}
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = (char)((info->written + i) % 251);
+	info->written += sizeof(buf);
+	bufferevent_write(bev, buf, sizeof(buf));
+}
+
+static void
+forward_src_readcb(struct bufferevent *bev, void *arg)
+{
+	struct forward_info *info = arg;
+	++info->src_reads;
+}
+
+static void
+forward_src_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct forward_info *info = arg;
+
+	if (what & BEV_EVENT_EOF) {
+		++info->src_eof;
+		/* This goes out after everything that was forwarded. */
+		tt_int_op(bufferevent_forward_stop(bev), ==, 0);
+		tt_int_op(bufferevent_forward_stop(bev), ==, -1);
+		bufferevent_write(info->dst, "END", 3);
+	} else {
+		info->bad = 1;
+	}
+end:
+	;
+}
+
+static void
+forward_dst_writecb(struct bufferevent *bev, void *arg)
+{
+	struct forward_info *info = arg;
+
+	if (info->src_eof && !evbuffer_get_length(bufferevent_get_output(bev)))
+		shutdown(bufferevent_getfd(bev), EVUTIL_SHUT_WR);
+}
+
+static void
+forward_reader_readcb(struct bufferevent *bev, void *arg)
+{
+	struct forward_info *info = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+	char buf[4096];
+	int i, n;
+
+	while ((n = evbuffer_remove(input, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; ++i) {
+			size_t off = info->received + i;
+			char c = off < FORWARD_TOTAL ? (char)(off % 251) :
+			    "END"[off - FORWARD_TOTAL];
+			if (off >= FORWARD_TOTAL + 3 || buf[i] != c)
+				info->bad = 1;
+		}
+		info->received += n;
+	}
+}
+
+static void
+forward_reader_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct forward_info *info = arg;
+
+	if (what & BEV_EVENT_EOF)
+		++info->dst_eof;
+	else
+		info->bad = 1;
+	event_base_loopexit(bufferevent_get_base(bev), NULL);
+}
+
+static void
+test_bufferevent_forward(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *writer = NULL, *reader = NULL, *src = NULL;
+	struct bufferevent *dst = NULL;
+	struct forward_info info;
+	evutil_socket_t pair2[2] = { -1, -1 };
+
+	memset(&info, 0, sizeof(info));
+	tt_int_op(evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair2), ==, 0);
+	evutil_make_socket_nonblocking(pair2[0]);
+	evutil_make_socket_nonblocking(pair2[1]);
+
+	/* writer -> src ==forward==> dst -> reader */
+	writer = bufferevent_socket_new(data->base, data->pair[0], 0);
+	src = bufferevent_socket_new(data->base, data->pair[1], 0);
+	dst = bufferevent_socket_new(data->base, pair2[0], BEV_OPT_CLOSE_ON_FREE);
+	reader = bufferevent_socket_new(data->base, pair2[1],
+	    BEV_OPT_CLOSE_ON_FREE);
+	pair2[0] = pair2[1] = -1;
+	if (strstr((char*)data->setup_data, "filter")) {
+		src = bufferevent_filter_new(src, NULL, NULL,
+		    BEV_OPT_CLOSE_ON_FREE, NULL, NULL);
+		tt_assert(src);
+	}
+	info.src = src;
+	info.dst = dst;
+
+	bufferevent_setcb(writer, NULL, forward_writer_writecb, NULL, &info);
+	bufferevent_setcb(src, forward_src_readcb, NULL, forward_src_eventcb,
+	    &info);
+	bufferevent_setcb(dst, NULL, forward_dst_writecb, NULL, &info);
+	bufferevent_setcb(reader, forward_reader_readcb, NULL,
+	    forward_reader_eventcb, &info);
+	bufferevent_enable(reader, EV_READ);
+
+	tt_int_op(bufferevent_forward(src, src), ==, -1);
+	tt_int_op(bufferevent_forward(src, dst), ==, 0);
+	tt_int_op(bufferevent_forward(src, dst), ==, -1);
+
+	forward_writer_writecb(writer, &info);
+	event_base_dispatch(data->base);
+
+	tt_assert(!info.bad);
+	tt_int_op(info.src_reads, ==, 0);
+	tt_int_op(info.src_eof, ==, 1);
+	tt_int_op(info.dst_eof, ==, 1);
+	tt_int_op(info.received, ==, FORWARD_TOTAL + 3);
+
+end:
+	if (writer)
+		bufferevent_free(writer);
+	if (src)
+		bufferevent_free(src);
+	if (dst)
+		bufferevent_free(dst);
+	if (reader)
+		bufferevent_free(reader);
+	if (pair2[0] >= 0)
+		evutil_closesocket(pair2[0]);
+	if (pair2[1] >= 0)
+		evutil_closesocket(pair2[1]);
+}
+
 struct testcase_t bufferevent_testcases[] = {
 
 	LEGACY(bufferevent, TT_ISOLATED),
@@ -1402,6 +1666,13 @@ struct testcase_t bufferevent_testcases[] = {
 	{ "bufferevent_filter_data_stuck",
 	  test_bufferevent_filter_data_stuck,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_pool", test_bufferevent_pool,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_forward", test_bufferevent_forward,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, (void*)"" },
+	{ "bufferevent_forward_filter", test_bufferevent_forward,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup,
+	  (void*)"filter" },
 
 	END_OF_TESTCASES,
 };
@@ -1736,6 +1736,144 @@ end:
 		evdns_base_free(dns_base, 0);
 }
 
+static struct regress_dns_server_table cache_table[] = {
+	{ "cached.example.com", "A", "1.2.3.4", 0, 0 },
+	{ "other.example.com", "A", "5.6.7.8", 0, 0 },
+	{ "gone.example.com", "errsoa", "3", 0, 0 },
+	{ "nodata.example.com", "err", "0", 0, 0 },
+	{ "*", "err", "3", 0, 0 },
+	{ NULL, NULL, NULL, 0, 0 }
+};
+
+static void
+dns_cache_resolve(struct event_base *base, struct evdns_base *dns,
+    const char *name, struct generic_dns_callback_result *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->result = -1;
+	n_replies_left = 1;
+	exit_base = base;
+	evdns_base_resolve_ipv4(dns, name, DNS_NO_SEARCH,
+	    generic_dns_callback, r);
+	/* Cached answers are still delivered from the loop. */
+	tt_int_op(r->result, ==, -1);
+	event_base_dispatch(base);
+end:
+	;
+}
+
+static void
+dns_cache_test(void *arg)
+{
+	struct regress_dns_server_table table[ARRAY_SIZE(cache_table)];
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evdns_base *dns = NULL;
+	struct evdns_cache_stats st;
+	struct generic_dns_callback_result r;
+	struct evutil_addrinfo hints;
+	struct gai_outcome out;
+	ev_uint16_t portnum = 0;
+	char buf[64];
+	size_t i;
+
+	memset(&out, 0, sizeof(out));
+	for (i = 0; i < ARRAY_SIZE(table); ++i)
+		table[i] = cache_table[i];
+
+	tt_assert(regress_dnsserver(base, &portnum, table));
+	evutil_snprintf(buf, sizeof(buf), "127.0.0.1:%d", (int)portnum);
+
+	dns = evdns_base_new(base, 0);
+	tt_assert(!evdns_base_nameserver_ip_add(dns, buf));
+
+	/* Off by default: every lookup goes to the server. */
+	dns_cache_resolve(base, dns, "cached.example.com", &r);
+	dns_cache_resolve(base, dns, "cached.example.com", &r);
+	tt_int_op(table[0].seen, ==, 2);
+	evdns_base_get_cache_stats(dns, &st);
+	tt_int_op(st.entries, ==, 0);
+	tt_int_op(st.hits, ==, 0);
+
+	tt_assert(!evdns_base_set_option(dns, "cache-size:", "2"));
+
+	/* Positive answers are cached with their TTL. */
+	dns_cache_resolve(base, dns, "cached.example.com", &r);
+	tt_int_op(table[0].seen, ==, 3);
+	dns_cache_resolve(base, dns, "CACHED.example.com", &r);
+	tt_int_op(table[0].seen, ==, 3);
+	tt_int_op(r.result, ==, DNS_ERR_NONE);
+	tt_int_op(r.type, ==, DNS_IPv4_A);
+	tt_int_op(r.count, ==, 1);
+	tt_int_op(((ev_uint32_t*)r.addrs)[0], ==, htonl(0x01020304));
+	tt_int_op(r.ttl, >, 0);
+	tt_int_op(r.ttl, <=, 100);
+
+	/* NXDOMAIN with an SOA is cached negatively. */
+	dns_cache_resolve(base, dns, "gone.example.com", &r);
+	dns_cache_resolve(base, dns, "gone.example.com", &r);
+	tt_int_op(table[2].seen, ==, 1);
+	tt_int_op(r.result, ==, DNS_ERR_NOTEXIST);
+	tt_int_op(r.ttl, >, 0);
+	tt_int_op(r.ttl, <=, 42);
+
+	/* Without an SOA nothing is cached unless asked for. */
+	dns_cache_resolve(base, dns, "nodata.example.com", &r);
+	dns_cache_resolve(base, dns, "nodata.example.com", &r);
+	tt_int_op(table[3].seen, ==, 2);
+	tt_int_op(r.result, ==, DNS_ERR_NODATA);
+
+	evdns_base_get_cache_stats(dns, &st);
+	tt_int_op(st.hits, ==, 2);
+	tt_int_op(st.negative_hits, ==, 1);
+	tt_int_op(st.entries, ==, 2);
+	tt_int_op(st.evictions, ==, 0);
+
+	/* The least recently used entry ("cached") makes room. */
+	tt_assert(!evdns_base_set_option(dns, "cache-negative-ttl:", "30"));
+	dns_cache_resolve(base, dns, "gone.example.com", &r);
+	dns_cache_resolve(base, dns, "nodata.example.com", &r);
+	dns_cache_resolve(base, dns, "nodata.example.com", &r);
+	tt_int_op(table[3].seen, ==, 3);
+	tt_int_op(r.result, ==, DNS_ERR_NODATA);
+	tt_int_op(r.ttl, <=, 30);
+	evdns_base_get_cache_stats(dns, &st);
+	tt_int_op(st.evictions, ==, 1);
+	tt_int_op(st.entries, ==, 2);
+
+	dns_cache_resolve(base, dns, "cached.example.com", &r);
+	tt_int_op(table[0].seen, ==, 4);
+
+	/* evdns_getaddrinfo() is answered through the same cache. */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	n_gai_results_pending = 1;
+	exit_base_on_no_pending_results = base;
+	evdns_getaddrinfo(dns, "cached.example.com", "80", &hints,
+	    gai_cb, &out);
+	event_base_dispatch(base);
+	tt_int_op(out.err, ==, 0);
+	tt_assert(out.ai);
+	test_ai_eq(out.ai, "1.2.3.4:80", SOCK_STREAM, IPPROTO_TCP);
+	tt_int_op(table[0].seen, ==, 4);
+
+	evdns_base_clear_cache(dns);
+	evdns_base_get_cache_stats(dns, &st);
+	tt_int_op(st.entries, ==, 0);
+	dns_cache_resolve(base, dns, "cached.example.com", &r);
+	tt_int_op(table[0].seen, ==, 5);
+
+end:
+	if (out.ai)
+		evutil_freeaddrinfo(out.ai);
+	exit_base_on_no_pending_results = NULL;
+	if (dns)
+		evdns_base_free(dns, 0);
+
+	regress_clean_dnsserver();
+}
+
 struct gaic_request_status {
 	int magic;
 	struct event_base *base;
@@ -2286,6 +2424,7 @@ struct testcase_t dns_testcases[] = {
 	{ "search_lower", dns_search_lower_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "search_cancel", dns_search_cancel_test,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "cache", dns_cache_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "retry", dns_retry_test, TT_FORK|TT_NEED_BASE|TT_NO_LOGS, &basic_setup, NULL },
 	{ "retry_disable_when_inactive", dns_retry_disable_when_inactive_test,
 	  TT_FORK|TT_NEED_BASE|TT_NO_LOGS, &basic_setup, NULL },
@@ -108,6 +108,7 @@ test_edgetriggered(void *et)
 
 	if (!strcmp(event_base_get_method(base), "epoll") ||
 	    !strcmp(event_base_get_method(base), "epoll (with changelist)") ||
+	    !strcmp(event_base_get_method(base), "io_uring") ||
 	    !strcmp(event_base_get_method(base), "kqueue"))
 		supports_et = 1;
 	else
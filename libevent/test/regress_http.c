@@ -56,6 +56,7 @@
 
 #include "event2/event.h"
 #include "event2/http.h"
+#include "event2/http_struct.h"
 #include "event2/buffer.h"
 #include "event2/bufferevent.h"
 #include "event2/bufferevent_ssl.h"
@@ -87,6 +88,7 @@ static void http_on_complete_cb(struct evhttp_request *req, void *arg);
 #define HTTP_BIND_IPV6 1
 #define HTTP_BIND_SSL 2
 #define HTTP_SSL_FILTER 4
+#define HTTP_BIND_ARENA 8
 static int
 http_bind(struct evhttp *myhttp, ev_uint16_t *pport, int mask)
 {
@@ -139,6 +141,8 @@ http_setup_gencb(ev_uint16_t *pport, struct event_base *base, int mask,
 
 	if (http_bind(myhttp, pport, mask) < 0)
 		return NULL;
+	if (mask & HTTP_BIND_ARENA)
+		evhttp_set_flags(myhttp, EVHTTP_SERVER_ARENA_HEADERS);
 #ifdef EVENT__HAVE_OPENSSL
 	if (mask & HTTP_BIND_SSL) {
 		init_ssl();
@@ -2411,6 +2415,150 @@ http_bad_header_test(void *ptr)
 	evhttp_clear_headers(&headers);
 }
 
+static void
+http_parse_headers_arena_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp_request *req = NULL;
+	struct evbuffer *buf = NULL;
+	struct evkeyvalq *headers;
+	struct evkeyval *header;
+	const char *value;
+	char line[64];
+	int i;
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1", 80);
+	tt_assert(evcon);
+	tt_int_op(evhttp_connection_set_flags(evcon,
+		EVHTTP_CON_ARENA_HEADERS), ==, 0);
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	req = evhttp_request_new(NULL, NULL);
+	tt_assert(req);
+	req->kind = EVHTTP_REQUEST;
+	req->evcon = evcon;
+
+	/* References give separate chains, so lines straddle chains. */
+#define ADD_CHAIN(s) evbuffer_add_reference(buf, s, strlen(s), NULL, NULL)
+	ADD_CHAIN("GET /x HTTP/1.1\r\nHo");
+	tt_int_op(evhttp_parse_firstline_(req, buf), ==, ALL_DATA_READ);
+	tt_str_op(req->uri, ==, "/x");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, MORE_DATA_EXPECTED);
+	ADD_CHAIN("st: a\r\nX-Multi:  one \r\n\t two\r");
+	ADD_CHAIN("\nhost: b\nContent-Length: 0\r\n\r\nbody");
+#undef ADD_CHAIN
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+	tt_int_op(evbuffer_get_length(buf), ==, 4);
+
+	tt_str_op(evhttp_request_find_input_header(req, "HOST"), ==, "a");
+	tt_str_op(evhttp_request_find_input_header(req, "x-multi"), ==,
+	    "one two");
+	tt_assert(!evhttp_request_find_input_header(req, "Hos"));
+	tt_assert(TAILQ_EMPTY(req->input_headers));
+
+	/* The list is built on demand, in order, and then takes over. */
+	headers = evhttp_request_get_input_headers(req);
+	header = TAILQ_FIRST(headers);
+	tt_assert(header);
+	tt_str_op(header->key, ==, "Host");
+	tt_str_op(header->value, ==, "a");
+	header = TAILQ_NEXT(header, next);
+	tt_assert(header);
+	tt_str_op(header->key, ==, "X-Multi");
+	tt_str_op(header->value, ==, "one two");
+	header = TAILQ_NEXT(header, next);
+	tt_assert(header);
+	tt_str_op(header->key, ==, "host");
+	tt_str_op(header->value, ==, "b");
+	tt_int_op(evhttp_remove_header(headers, "Host"), ==, 0);
+	tt_str_op(evhttp_request_find_input_header(req, "Host"), ==, "b");
+	evhttp_request_free(req);
+
+	/* Enough headers to grow the arena a few times. */
+	req = evhttp_request_new(NULL, NULL);
+	tt_assert(req);
+	req->kind = EVHTTP_REQUEST;
+	req->evcon = evcon;
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	for (i = 0; i < 500; ++i)
+		evbuffer_add_printf(buf, "X-Header-%d: value %d\r\n", i, i);
+	evbuffer_add(buf, "\r\n", 2);
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+	for (i = 0; i < 500; i += 99) {
+		evutil_snprintf(line, sizeof(line), "X-Header-%d", i);
+		tt_assert(evhttp_request_find_input_header(req, line));
+		tt_int_op(atoi(evhttp_request_find_input_header(req, line) + 6),
+		    ==, i);
+	}
+	evhttp_request_free(req);
+	req = NULL;
+
+	/* Trailers go to the same arena after the body; a header looked up
+	 * before them must stay where it is, even once there is more to
+	 * them than malloc() grows in place. */
+	req = evhttp_request_new(NULL, NULL);
+	tt_assert(req);
+	req->kind = EVHTTP_RESPONSE;
+	req->evcon = evcon;
+	evbuffer_add_printf(buf, "Content-Type: text/plain\r\n"
+	    "Transfer-Encoding: chunked\r\n\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+	value = evhttp_request_find_input_header(req, "Content-Type");
+	tt_str_op(value, ==, "text/plain");
+	for (i = 0; i < 10000; ++i)
+		evbuffer_add_printf(buf, "X-Trailer-%d: value %d\r\n", i, i);
+	evbuffer_add(buf, "\r\n", 2);
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+	tt_ptr_op(evhttp_request_find_input_header(req, "Content-Type"), ==,
+	    value);
+	tt_str_op(value, ==, "text/plain");
+	tt_str_op(evhttp_request_find_input_header(req, "X-Trailer-9999"), ==,
+	    "value 9999");
+	evhttp_request_free(req);
+	req = NULL;
+
+	/* Lines evhttp_add_header() would refuse, and overlong headers */
+	{
+		const char *bad[] = {
+			"No colon\r\n",
+			"Bad\rkey: value\r\n",
+			"Key: bad\rvalue\r\n",
+			" continuation first\r\n",
+		};
+		for (i = 0; i < (int)(sizeof(bad)/sizeof(bad[0])); ++i) {
+			req = evhttp_request_new(NULL, NULL);
+			tt_assert(req);
+			req->kind = EVHTTP_REQUEST;
+			req->evcon = evcon;
+			evbuffer_drain(buf, evbuffer_get_length(buf));
+			evbuffer_add(buf, bad[i], strlen(bad[i]));
+			tt_int_op(evhttp_parse_headers_(req, buf), ==,
+			    DATA_CORRUPTED);
+			evhttp_request_free(req);
+			req = NULL;
+		}
+	}
+
+	evhttp_connection_set_max_headers_size(evcon, 16);
+	req = evhttp_request_new(NULL, NULL);
+	tt_assert(req);
+	req->kind = EVHTTP_REQUEST;
+	req->evcon = evcon;
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	evbuffer_add_printf(buf, "Key: 0123456789abcdef\r\n\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, DATA_TOO_LONG);
+
+ end:
+	if (req)
+		evhttp_request_free(req);
+	if (buf)
+		evbuffer_free(buf);
+	if (evcon)
+		evhttp_connection_free(evcon);
+}
+
 static int validate_header(
 	const struct evkeyvalq* headers,
 	const char *key, const char *value)
@@ -3887,7 +4035,8 @@ http_multi_line_header_test(void *arg)
 	evutil_socket_t fd = -1;
 	const char *http_start_request;
 	ev_uint16_t port = 0;
-	struct evhttp *http = http_setup(&port, data->base, 0);
+	int mask = (int)(ev_intptr_t)data->setup_data;
+	struct evhttp *http = http_setup(&port, data->base, mask);
 
 	exit_base = data->base;
 	test_ok = 0;
@@ -4750,6 +4899,174 @@ http_newreqcb_test(void *arg)
 	{ #name, run_legacy_test_fn, TT_ISOLATED|TT_LEGACY, &legacy_setup, \
 		    http_##name##_test }
 
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+struct http_workers_test_state {
+	int n;
+	int done;
+	int expect;
+	int matched;
+	/* The workers that answered /base, by the base they printed. */
+	char bases[8][32];
+	int n_bases;
+};
+
+static void
+http_workers_base_cb(struct evhttp_request *req, void *arg)
+{
+	struct evbuffer *evb = evbuffer_new();
+	struct event_base *base =
+	    evhttp_connection_get_base(evhttp_request_get_connection(req));
+
+	evbuffer_add_printf(evb, "%p", (void *)base);
+	evhttp_send_reply(req, HTTP_OK, "Everything is fine", evb);
+	evbuffer_free(evb);
+}
+
+static void
+http_workers_request_done(struct evhttp_request *req, void *arg)
+{
+	struct http_workers_test_state *state = arg;
+	struct evbuffer *body;
+	char buf[32];
+	int i, n;
+
+	if (req && evhttp_request_get_response_code(req) == state->expect) {
+		++state->matched;
+		body = evhttp_request_get_input_buffer(req);
+		n = evbuffer_remove(body, buf, sizeof(buf) - 1);
+		buf[n > 0 ? n : 0] = '\0';
+		for (i = 0; i < state->n_bases; ++i)
+			if (!strcmp(state->bases[i], buf))
+				break;
+		if (i == state->n_bases && i < 8)
+			strcpy(state->bases[state->n_bases++], buf);
+	}
+	if (++state->done == state->n)
+		event_base_loopexit(exit_base, NULL);
+}
+
+/* Make n requests, each on a new connection, and wait for all of them. */
+static void
+http_workers_requests(struct event_base *base, ev_uint16_t port,
+    struct http_workers_test_state *state, int n, enum evhttp_cmd_type type,
+    const char *uri, int expect)
+{
+	struct evhttp_connection *evcons[32];
+	struct evhttp_request *req;
+	int i;
+
+	memset(state, 0, sizeof(*state));
+	memset(evcons, 0, sizeof(evcons));
+	state->n = n;
+	state->expect = expect;
+	for (i = 0; i < n; ++i) {
+		evcons[i] = evhttp_connection_base_new(base, NULL, "127.0.0.1",
+		    port);
+		tt_assert(evcons[i]);
+		req = evhttp_request_new(http_workers_request_done, state);
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    "Connection", "close");
+		if (type == EVHTTP_REQ_POST)
+			evbuffer_add_printf(evhttp_request_get_output_buffer(req),
+			    "%0100d", 0);
+		tt_int_op(evhttp_make_request(evcons[i], req, type, uri), ==, 0);
+	}
+	event_base_dispatch(base);
+
+end:
+	for (i = 0; i < n; ++i)
+		if (evcons[i])
+			evhttp_connection_free(evcons[i]);
+}
+
+static void
+http_workers_limit_body(struct evhttp *http, void *arg)
+{
+	evhttp_set_max_body_size(http, *(int *)arg);
+}
+
+static void
+http_workers_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *tmpl = NULL;
+	struct evhttp_workers *workers = NULL;
+	struct http_workers_test_state state;
+	int port, limit = 10;
+
+	exit_base = data->base;
+
+	tmpl = evhttp_new(NULL);
+	tt_assert(tmpl);
+	tt_int_op(evhttp_set_cb(tmpl, "/base", http_workers_base_cb, NULL), ==, 0);
+	workers = evhttp_workers_new(tmpl, 4, NULL);
+	tt_assert(workers);
+	/* The workers have copies of their own. */
+	evhttp_free(tmpl);
+	tmpl = NULL;
+
+	port = evhttp_workers_bind_socket(workers, "127.0.0.1", 0);
+	tt_int_op(port, >, 0);
+
+	http_workers_requests(data->base, port, &state, 32, EVHTTP_REQ_GET,
+	    "/base", HTTP_OK);
+	tt_int_op(state.matched, ==, 32);
+	TT_BLATHER(("%d workers answered", state.n_bases));
+#ifdef SO_REUSEPORT
+	/* The kernel spreads connections over the workers' sockets. */
+	tt_int_op(state.n_bases, >, 1);
+#endif
+
+	tt_int_op(evhttp_workers_set_cb(workers, "/late", http_workers_base_cb,
+		NULL), ==, 0);
+	tt_int_op(evhttp_workers_set_cb(workers, "/late", http_workers_base_cb,
+		NULL), ==, -1);
+	tt_int_op(evhttp_workers_del_cb(workers, "/base"), ==, 0);
+	tt_int_op(evhttp_workers_del_cb(workers, "/base"), ==, -1);
+
+	http_workers_requests(data->base, port, &state, 8, EVHTTP_REQ_GET,
+	    "/late", HTTP_OK);
+	tt_int_op(state.matched, ==, 8);
+	http_workers_requests(data->base, port, &state, 8, EVHTTP_REQ_GET,
+	    "/base", HTTP_NOTFOUND);
+	tt_int_op(state.matched, ==, 8);
+
+	tt_int_op(evhttp_workers_foreach(workers, http_workers_limit_body,
+		&limit), ==, 0);
+	http_workers_requests(data->base, port, &state, 8, EVHTTP_REQ_POST,
+	    "/late", HTTP_ENTITYTOOLARGE);
+	tt_int_op(state.matched, ==, 8);
+
+end:
+	if (tmpl)
+		evhttp_free(tmpl);
+	if (workers)
+		evhttp_workers_free(workers);
+}
+
+static void
+http_workers_new_free_test(void *arg)
+{
+	struct evhttp *tmpl = NULL;
+	struct evhttp_workers *workers;
+	int i;
+
+	tmpl = evhttp_new(NULL);
+	tt_assert(tmpl);
+	/* Freed before the workers ever get busy: none of them may miss
+	 * being stopped. */
+	for (i = 0; i < 1000; ++i) {
+		workers = evhttp_workers_new(tmpl, 4, NULL);
+		tt_assert(workers);
+		evhttp_workers_free(workers);
+	}
+
+end:
+	if (tmpl)
+		evhttp_free(tmpl);
+}
+#endif
+
 #define HTTP_CAST_ARG(a) ((void *)(a))
 #define HTTP_OFF_N(title, name, arg) \
 	{ #title, http_##name##_test, TT_ISOLATED|TT_OFF_BY_DEFAULT, &basic_setup, HTTP_CAST_ARG(arg) }
@@ -4796,6 +5113,8 @@ struct testcase_t http_testcases[] = {
 	{ "primitives", http_primitives, 0, NULL, NULL },
 	{ "base", http_base_test, TT_FORK, NULL, NULL },
 	{ "bad_headers", http_bad_header_test, 0, NULL, NULL },
+	{ "parse_headers_arena", http_parse_headers_arena_test, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
 	{ "parse_query", http_parse_query_test, 0, NULL, NULL },
 	{ "parse_uri", http_parse_uri_test, 0, NULL, NULL },
 	{ "parse_uri_nc", http_parse_uri_test, 0, &basic_setup, (void*)"nc" },
@@ -4838,6 +5157,7 @@ struct testcase_t http_testcases[] = {
 	HTTP(highport),
 	HTTP(dispatcher),
 	HTTP(multi_line_header),
+	HTTP_N(multi_line_header_arena, multi_line_header, HTTP_BIND_ARENA),
 	HTTP(negative_content_length),
 	HTTP(chunk_out),
 	HTTP(stream_out),
@@ -4868,6 +5188,12 @@ struct testcase_t http_testcases[] = {
 	HTTP(request_extra_body),
 
 	HTTP(newreqcb),
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+	{ "workers", http_workers_test, TT_ISOLATED|TT_NEED_THREADS,
+	  &basic_setup, NULL },
+	{ "workers_new_free", http_workers_new_free_test,
+	  TT_ISOLATED|TT_NEED_THREADS, &basic_setup, NULL },
+#endif
 
 #ifdef EVENT__HAVE_OPENSSL
 	HTTPS(basic),
@@ -53,6 +53,7 @@
 #include <string.h>
 
 #include "event2/event.h"
+#include "event2/dgram.h"
 #include "event2/util.h"
 #include "../ipv6-internal.h"
 #include "../log-internal.h"
@@ -1455,6 +1456,106 @@ end:
 	;
 }
 
+static evutil_socket_t
+dgram_socket(struct sockaddr_in *sin)
+{
+	ev_socklen_t slen = sizeof(*sin);
+	evutil_socket_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0)
+		return fd;
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x7f000001);
+	if (bind(fd, (struct sockaddr *)sin, sizeof(*sin)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)sin, &slen) < 0 ||
+	    evutil_make_socket_nonblocking(fd) < 0) {
+		evutil_closesocket(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+test_evutil_dgram(void *data_)
+{
+	struct basic_test_data *data = data_;
+	unsigned options =
+	    strstr(data->setup_data, "gso") ? EVDGRAM_OPT_GSO : 0;
+	struct evdgram *tx = NULL, *rx = NULL;
+	evutil_socket_t fd1 = -1, fd2 = -1;
+	struct sockaddr_in sin1, sin2;
+	struct sockaddr *sa;
+	ev_socklen_t salen;
+	char buf[64];
+	void *p;
+	int i;
+
+	fd1 = dgram_socket(&sin1);
+	fd2 = dgram_socket(&sin2);
+	tt_assert(fd1 >= 0 && fd2 >= 0);
+
+	tt_ptr_op(evdgram_new(0, 64, 0), ==, NULL);
+	tt_ptr_op(evdgram_new(4, 0, 0), ==, NULL);
+	tx = evdgram_new(4, 64, options);
+	rx = evdgram_new(8, 64, 0);
+	tt_assert(tx && rx);
+
+	/* Nothing to read yet. */
+	tt_int_op(evdgram_recv(rx, fd2), ==, 0);
+	tt_int_op(evdgram_get(rx, 0, &p, NULL, NULL), ==, -1);
+
+	/* Three equal datagrams and a short one: one GSO run, if we have
+	 * GSO. */
+	memset(buf, 'x', sizeof(buf));
+	tt_int_op(evdgram_add(tx, buf, 65, (struct sockaddr *)&sin2,
+		sizeof(sin2)), ==, -1);
+	for (i = 0; i < 4; ++i) {
+		memset(buf, 'a' + i, sizeof(buf));
+		tt_int_op(evdgram_add(tx, buf, i == 3 ? 10 : 20,
+			(struct sockaddr *)&sin2, sizeof(sin2)), ==, 0);
+	}
+	tt_int_op(evdgram_add(tx, buf, 1, (struct sockaddr *)&sin2,
+		sizeof(sin2)), ==, -1);
+	tt_int_op(evdgram_get_queued(tx), ==, 4);
+	tt_int_op(evdgram_flush(tx, fd1), ==, 4);
+	tt_int_op(evdgram_get_queued(tx), ==, 0);
+
+	tt_int_op(evdgram_recv(rx, fd2), ==, 4);
+	for (i = 0; i < 4; ++i) {
+		ev_ssize_t len = evdgram_get(rx, i, &p, &sa, &salen);
+		tt_int_op(len, ==, i == 3 ? 10 : 20);
+		memset(buf, 'a' + i, sizeof(buf));
+		tt_int_op(memcmp(p, buf, len), ==, 0);
+		tt_int_op(sa->sa_family, ==, AF_INET);
+		tt_int_op(((struct sockaddr_in *)sa)->sin_port, ==,
+		    sin1.sin_port);
+	}
+	tt_int_op(evdgram_get(rx, 4, &p, NULL, NULL), ==, -1);
+	tt_int_op(evdgram_recv(rx, fd2), ==, 0);
+
+	/* No address on a connected socket. */
+	tt_int_op(connect(fd1, (struct sockaddr *)&sin2, sizeof(sin2)), ==, 0);
+	tt_int_op(evdgram_add(tx, "hello", 5, NULL, 0), ==, 0);
+	tt_int_op(evdgram_add(tx, "world", 5, NULL, 0), ==, 0);
+	tt_int_op(evdgram_flush(tx, fd1), ==, 2);
+	tt_int_op(evdgram_recv(rx, fd2), ==, 2);
+	tt_int_op(evdgram_get(rx, 0, &p, NULL, NULL), ==, 5);
+	tt_int_op(memcmp(p, "hello", 5), ==, 0);
+	tt_int_op(evdgram_get(rx, 1, &p, NULL, NULL), ==, 5);
+	tt_int_op(memcmp(p, "world", 5), ==, 0);
+
+end:
+	if (tx)
+		evdgram_free(tx);
+	if (rx)
+		evdgram_free(rx);
+	if (fd1 >= 0)
+		evutil_closesocket(fd1);
+	if (fd2 >= 0)
+		evutil_closesocket(fd2);
+}
+
 struct testcase_t util_testcases[] = {
 	{ "ipv4_parse", regress_ipv4_parse, 0, NULL, NULL },
 	{ "ipv6_parse", regress_ipv6_parse, 0, NULL, NULL },
@@ -1486,6 +1587,8 @@ struct testcase_t util_testcases[] = {
 	{ "monotonic_prc_precise", test_evutil_monotonic_prc, 0, &basic_setup, (void*)"precise" },
 	{ "monotonic_prc_fallback", test_evutil_monotonic_prc, 0, &basic_setup, (void*)"fallback" },
 	{ "date_rfc1123", test_evutil_date_rfc1123, 0, NULL, NULL },
+	{ "dgram", test_evutil_dgram, 0, &basic_setup, (void*)"" },
+	{ "dgram_gso", test_evutil_dgram, 0, &basic_setup, (void*)"gso" },
 	END_OF_TESTCASES,
 };
 
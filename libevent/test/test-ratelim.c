@@ -34,6 +34,7 @@
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <process.h>
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -50,6 +51,33 @@
 #include "event2/listener.h"
 #include "event2/thread.h"
 
+#if defined(EVTHREAD_USE_PTHREADS_IMPLEMENTED)
+#include <pthread.h>
+#define THREAD_T pthread_t
+#define THREAD_FN void *
+#define THREAD_RETURN() return (NULL)
+#define THREAD_START(threadvar, fn, arg) \
+	pthread_create(&(threadvar), NULL, fn, arg)
+#define THREAD_JOIN(th) pthread_join(th, NULL)
+#define MUTEX_T pthread_mutex_t
+#define MUTEX_INIT(m) pthread_mutex_init(&(m), NULL)
+#define MUTEX_LOCK(m) pthread_mutex_lock(&(m))
+#define MUTEX_UNLOCK(m) pthread_mutex_unlock(&(m))
+#elif defined(EVTHREAD_USE_WINDOWS_THREADS_IMPLEMENTED)
+#define THREAD_T HANDLE
+#define THREAD_FN unsigned __stdcall
+#define THREAD_RETURN() return (0)
+#define THREAD_START(threadvar, fn, arg) do {				\
+	uintptr_t threadhandle = _beginthreadex(NULL, 0, fn, (arg), 0, NULL); \
+	(threadvar) = (HANDLE) threadhandle;				\
+} while (0)
+#define THREAD_JOIN(th) WaitForSingleObject(th, INFINITE)
+#define MUTEX_T CRITICAL_SECTION
+#define MUTEX_INIT(m) InitializeCriticalSection(&(m))
+#define MUTEX_LOCK(m) EnterCriticalSection(&(m))
+#define MUTEX_UNLOCK(m) LeaveCriticalSection(&(m))
+#endif
+
 static struct evutil_weakrand_state weakrand_state;
 
 static int cfg_verbose = 0;
@@ -62,6 +90,7 @@ static int cfg_grouplimit = 0;
 static int cfg_tick_msec = 1000;
 static int cfg_min_share = -1;
 static int cfg_group_drain = 0;
+static int cfg_n_threads = 0;
 
 static int cfg_connlimit_tolerance = -1;
 static int cfg_grouplimit_tolerance = -1;
@@ -101,6 +130,34 @@ static ev_int64_t total_group_wbucket_level = 0;
 
 static int n_echo_conns_open = 0;
 
+/* With -T, the echo side of every connection is spread over this many
+ * threads, each running its own event_base, so that the members of the
+ * group charge its bucket concurrently. */
+struct echo_thread {
+	struct event_base *base;
+#ifdef THREAD_T
+	THREAD_T thread;
+#endif
+};
+static struct echo_thread *echo_threads = NULL;
+static int n_echo_conns_accepted = 0;
+static struct event_base *main_base = NULL;
+#ifdef THREAD_T
+/* Protects n_echo_conns_open once there are echo threads. */
+static MUTEX_T echo_conns_lock;
+#define LOCK_ECHO_CONNS() do {				\
+		if (echo_threads)			\
+			MUTEX_LOCK(echo_conns_lock);	\
+	} while (0)
+#define UNLOCK_ECHO_CONNS() do {			\
+		if (echo_threads)			\
+			MUTEX_UNLOCK(echo_conns_lock);	\
+	} while (0)
+#else
+#define LOCK_ECHO_CONNS()
+#define UNLOCK_ECHO_CONNS()
+#endif
+
 /* Info on the open connections */
 struct bufferevent **bevs;
 struct client_state *states;
@@ -165,7 +222,9 @@ static void
 echo_eventcb(struct bufferevent *bev, short what, void *ctx)
 {
 	if (what & (BEV_EVENT_EOF|BEV_EVENT_ERROR)) {
+		LOCK_ECHO_CONNS();
 		--n_echo_conns_open;
+		UNLOCK_ECHO_CONNS();
 		bufferevent_free(bev);
 	}
 }
@@ -178,7 +237,14 @@ echo_listenercb(struct evconnlistener *listener, evutil_socket_t newsock,
 	int flags = BEV_OPT_CLOSE_ON_FREE|BEV_OPT_THREADSAFE;
 	struct bufferevent *bev;
 
-	bev = bufferevent_socket_new(base, newsock, flags);
+	if (echo_threads) {
+		int i = n_echo_conns_accepted % cfg_n_threads;
+		bev = bufferevent_socket_new(echo_threads[i].base, newsock,
+		    flags);
+	} else {
+		bev = bufferevent_socket_new(base, newsock, flags);
+	}
+	++n_echo_conns_accepted;
 	bufferevent_setcb(bev, echo_readcb, echo_writecb, echo_eventcb, NULL);
 	if (conn_bucket_cfg) {
 		struct event *check_event =
@@ -190,7 +256,9 @@ echo_listenercb(struct evconnlistener *listener, evutil_socket_t newsock,
 	}
 	if (ratelim_group)
 		bufferevent_add_to_rate_limit_group(bev, ratelim_group);
+	LOCK_ECHO_CONNS();
 	++n_echo_conns_open;
+	UNLOCK_ECHO_CONNS();
 	bufferevent_enable(bev, EV_READ|EV_WRITE);
 }
 
@@ -221,7 +289,7 @@ check_bucket_levels_cb(evutil_socket_t fd, short events, void *arg)
 
 	total_n_bev_checks++;
 	if (total_n_bev_checks >= .8 * ((double)cfg_duration / cfg_tick_msec) * cfg_n_connections) {
-		event_free(event_base_get_running_event(bufferevent_get_base(bev)));
+		event_free(event_base_get_running_event(main_base));
 	}
 }
 
@@ -244,6 +312,49 @@ group_drain_cb(evutil_socket_t fd, short events, void *arg)
 	bufferevent_rate_limit_group_decrement_write(ratelim_group, cfg_group_drain);
 }
 
+#ifdef THREAD_T
+static THREAD_FN
+echo_thread_fn(void *arg)
+{
+	struct echo_thread *et = arg;
+	event_base_loop(et->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	THREAD_RETURN();
+}
+
+static int
+start_echo_threads(void)
+{
+	int i;
+
+	MUTEX_INIT(echo_conns_lock);
+	echo_threads = calloc(cfg_n_threads, sizeof(struct echo_thread));
+	if (!echo_threads)
+		return -1;
+	for (i = 0; i < cfg_n_threads; ++i) {
+		echo_threads[i].base = event_base_new();
+		if (!echo_threads[i].base)
+			return -1;
+		THREAD_START(echo_threads[i].thread, echo_thread_fn,
+		    &echo_threads[i]);
+	}
+	return 0;
+}
+
+static void
+stop_echo_threads(void)
+{
+	int i;
+
+	for (i = 0; i < cfg_n_threads; ++i) {
+		event_base_loopbreak(echo_threads[i].base);
+		THREAD_JOIN(echo_threads[i].thread);
+		event_base_free(echo_threads[i].base);
+	}
+	free(echo_threads);
+	echo_threads = NULL;
+}
+#endif
+
 static int
 test_ratelimiting(void)
 {
@@ -263,6 +374,7 @@ test_ratelimiting(void)
 	double variance;
 	double expected_total_persec = -1.0, expected_avg_persec = -1.0;
 	int ok = 1;
+	int n_open;
 	struct event_config *base_cfg;
 	struct event *periodic_level_check;
 	struct event *group_drain_event=NULL;
@@ -292,6 +404,14 @@ test_ratelimiting(void)
 		fprintf(stderr, "Couldn't create event_base");
 		return 1;
 	}
+	main_base = base;
+
+#ifdef THREAD_T
+	if (cfg_n_threads > 0 && start_echo_threads() < 0) {
+		fprintf(stderr, "Couldn't start echo threads");
+		return 1;
+	}
+#endif
 
 	listener = evconnlistener_new_bind(base, echo_listenercb, base,
 	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, -1,
@@ -387,13 +507,22 @@ test_ratelimiting(void)
 	ratelim_group = NULL;
 
 	/* This should get _everybody_ freed */
-	while (n_echo_conns_open) {
-		printf("waiting for %d conns\n", n_echo_conns_open);
+	for (;;) {
+		LOCK_ECHO_CONNS();
+		n_open = n_echo_conns_open;
+		UNLOCK_ECHO_CONNS();
+		if (!n_open)
+			break;
+		printf("waiting for %d conns\n", n_open);
 		tv.tv_sec = 0;
 		tv.tv_usec = 300000;
 		event_base_loopexit(base, &tv);
 		event_base_dispatch(base);
 	}
+#ifdef THREAD_T
+	if (echo_threads)
+		stop_echo_threads();
+#endif
 
 	if (group)
 		bufferevent_rate_limit_group_free(group);
@@ -482,6 +611,9 @@ static struct option {
 	{ "-g", &cfg_grouplimit, 0, 0 },
 	{ "-G", &cfg_group_drain, -100000, 0 },
 	{ "-t", &cfg_tick_msec, 10, 0 },
+#ifdef THREAD_T
+	{ "-T", &cfg_n_threads, 0, 0 },
+#endif
 	{ "--min-share", &cfg_min_share, 0, 0 },
 	{ "--check-connlimit", &cfg_connlimit_tolerance, 0, 0 },
 	{ "--check-grouplimit", &cfg_grouplimit_tolerance, 0, 0 },
@@ -525,7 +657,7 @@ static void
 usage(void)
 {
 	fprintf(stderr,
-"test-ratelim [-v] [-n INT] [-d INT] [-c INT] [-g INT] [-t INT]\n\n"
+"test-ratelim [-v] [-n INT] [-d INT] [-c INT] [-g INT] [-t INT] [-T INT]\n\n"
 "Pushes bytes through a number of possibly rate-limited connections, and\n"
 "displays average throughput.\n\n"
 "  -n INT: Number of connections to open (default: 30)\n"
@@ -536,7 +668,9 @@ usage(void)
 "  -g INT: Group-rate limit applied to sum of all usage in bytes per second\n"
 "	   (default: None.)\n"
 "  -G INT: drain INT bytes from the group limit every tick. (default: 0)\n"
-"  -t INT: Granularity of timing, in milliseconds (default: 1000 msec)\n");
+"  -t INT: Granularity of timing, in milliseconds (default: 1000 msec)\n"
+"  -T INT: Serve the connections from INT threads, all charging the same\n"
+"	   group, to stress concurrent rate limiting (default: 0, no threads)\n");
 }
 
 int
@@ -595,6 +729,15 @@ main(int argc, char **argv)
 #endif
 	}
 
+#ifdef THREAD_T
+	if (cfg_n_threads > 0) {
+#if defined(EVTHREAD_USE_PTHREADS_IMPLEMENTED)
+		evthread_use_pthreads();
+#else
+		evthread_use_windows_threads();
+#endif
+	}
+#endif
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
 	evthread_enable_lock_debugging();
 #endif
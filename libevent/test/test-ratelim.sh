@@ -76,6 +76,18 @@ run_tests () {
 		FAILED=yes
 	fi
 
+	if $TEST_DIR/test-ratelim -h 2>&1 | grep -e '-T INT' >/dev/null
+	then
+		announce_n "  Group limits, members on several threads:"
+		if $TEST_DIR/test-ratelim -g 30000 -n 30 -t 100 -T 4 --check-grouplimit 1000 --check-stddev 500 >>"$TEST_OUTPUT_FILE"
+		then
+			announce OKAY ;
+		else
+			announce FAILED ;
+			FAILED=yes
+		fi
+	fi
+
 
 }
 
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TIMEWHEEL_INTERNAL_H_INCLUDED_
+#define TIMEWHEEL_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "event2/util.h"
+#include "util-internal.h"
+#include "mm-internal.h"
+
+#include <string.h>
+
+/*
+ * Hierarchical timing wheel, used in place of the min-heap by bases made
+ * with EVENT_BASE_FLAG_TIMING_WHEEL.
+ *
+ * Time is cut into ticks of TIMEWHEEL_TICK_USEC.  Level 0 has a slot for
+ * each of the next 256 ticks; every level above it has 64 slots, each one
+ * a whole turn of the level below.  Each time level 0 comes round, the due
+ * slot of every level whose turn is also complete is emptied into the
+ * levels below it ("cascading").  Adding and removing a timeout are O(1);
+ * expiry hands out a whole slot at a time, so an event fires up to one
+ * tick after its timeout, but never before it.
+ *
+ * An event on the wheel is never on a common timeout list, so the slots
+ * reuse ev_timeout_pos.ev_next_with_common_timeout for their links.  Slots
+ * are used like LISTs rather than TAILQs: an event can be unlinked without
+ * knowing which slot it is in.
+ */
+
+/* 1ms ticks */
+#define TIMEWHEEL_TICK_USEC 1000
+#define TIMEWHEEL_L0_BITS 8
+#define TIMEWHEEL_LN_BITS 6
+#define TIMEWHEEL_L0_SIZE (1 << TIMEWHEEL_L0_BITS)
+#define TIMEWHEEL_LN_SIZE (1 << TIMEWHEEL_LN_BITS)
+/* levels above level 0 */
+#define TIMEWHEEL_LEVELS 4
+/* 2^32 ticks, about 49 days.  Later timeouts wait in the last slot and
+ * are placed again each time it comes round. */
+#define TIMEWHEEL_SPAN \
+	((ev_uint64_t)1 << (TIMEWHEEL_L0_BITS + TIMEWHEEL_LEVELS*TIMEWHEEL_LN_BITS))
+
+typedef struct timewheel
+{
+	ev_uint64_t now;	/* first tick not yet expired */
+	unsigned n;		/* events on the wheel */
+	ev_uint64_t l0_map[TIMEWHEEL_L0_SIZE / 64]; /* non-empty slots */
+	ev_uint64_t ln_map[TIMEWHEEL_LEVELS];
+	struct event *l0[TIMEWHEEL_L0_SIZE];
+	struct event *ln[TIMEWHEEL_LEVELS][TIMEWHEEL_LN_SIZE];
+} timewheel_t;
+
+#define TIMEWHEEL_NEXT(e) ((e)->ev_timeout_pos.ev_next_with_common_timeout.tqe_next)
+#define TIMEWHEEL_PREV(e) ((e)->ev_timeout_pos.ev_next_with_common_timeout.tqe_prev)
+
+static inline timewheel_t   *timewheel_new_(const struct timeval *now);
+static inline void	     timewheel_free_(timewheel_t *w);
+static inline int	     timewheel_empty_(timewheel_t *w);
+static inline ev_uint64_t    timewheel_tick_(const struct timeval *tv, int round_up);
+static inline void	     timewheel_tick_to_tv_(ev_uint64_t tick, struct timeval *tv);
+static inline void	     timewheel_push_(timewheel_t *w, struct event *e);
+static inline void	     timewheel_erase_(timewheel_t *w, struct event *e);
+static inline int	     timewheel_next_(timewheel_t *w, ev_uint64_t *tick);
+static inline int	     timewheel_elt_is_next_(timewheel_t *w, struct event *e);
+static inline struct event  *timewheel_expire_(timewheel_t *w, ev_uint64_t tick);
+static inline struct event  *timewheel_any_(timewheel_t *w);
+static inline struct event  *timewheel_slot_first_(timewheel_t *w, unsigned i);
+static inline struct event  *timewheel_slot_next_(struct event *e);
+
+#define TIMEWHEEL_NSLOTS (TIMEWHEEL_L0_SIZE + TIMEWHEEL_LEVELS*TIMEWHEEL_LN_SIZE)
+
+static inline int
+timewheel_ctz_(ev_uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		++n;
+	}
+	return n;
+#endif
+}
+
+timewheel_t *
+timewheel_new_(const struct timeval *now)
+{
+	timewheel_t *w = mm_calloc(1, sizeof(timewheel_t));
+	if (w)
+		w->now = timewheel_tick_(now, 0);
+	return w;
+}
+
+void timewheel_free_(timewheel_t *w) { mm_free(w); }
+int timewheel_empty_(timewheel_t *w) { return 0u == w->n; }
+
+ev_uint64_t
+timewheel_tick_(const struct timeval *tv, int round_up)
+{
+	ev_uint64_t t = (ev_uint64_t)tv->tv_sec * (1000000 / TIMEWHEEL_TICK_USEC);
+	if (round_up)
+		t += (tv->tv_usec + TIMEWHEEL_TICK_USEC - 1) / TIMEWHEEL_TICK_USEC;
+	else
+		t += tv->tv_usec / TIMEWHEEL_TICK_USEC;
+	return t;
+}
+
+void
+timewheel_tick_to_tv_(ev_uint64_t tick, struct timeval *tv)
+{
+	tv->tv_sec = (time_t)(tick / (1000000 / TIMEWHEEL_TICK_USEC));
+	tv->tv_usec = (long)(tick % (1000000 / TIMEWHEEL_TICK_USEC)) *
+	    TIMEWHEEL_TICK_USEC;
+}
+
+/* Sets or clears the map bit of the slot that 'slot' points at. */
+static inline void
+timewheel_mark_(timewheel_t *w, struct event **slot, int on)
+{
+	ev_uint64_t *word, bit;
+	if (slot >= &w->l0[0] && slot < &w->l0[TIMEWHEEL_L0_SIZE]) {
+		unsigned i = (unsigned)(slot - &w->l0[0]);
+		word = &w->l0_map[i >> 6];
+		bit = (ev_uint64_t)1 << (i & 63);
+	} else {
+		unsigned i = (unsigned)(slot - &w->ln[0][0]);
+		word = &w->ln_map[i / TIMEWHEEL_LN_SIZE];
+		bit = (ev_uint64_t)1 << (i % TIMEWHEEL_LN_SIZE);
+	}
+	if (on)
+		*word |= bit;
+	else
+		*word &= ~bit;
+}
+
+static inline int
+timewheel_is_slot_(timewheel_t *w, struct event **p)
+{
+	return (p >= &w->l0[0] && p < &w->l0[TIMEWHEEL_L0_SIZE]) ||
+	    (p >= &w->ln[0][0] &&
+		p < &w->ln[TIMEWHEEL_LEVELS-1][TIMEWHEEL_LN_SIZE]);
+}
+
+/* The tick at which slot 'i' of 'level' next cascades.  The cascade
+ * for w->now itself is already done. */
+static inline ev_uint64_t
+timewheel_cascade_tick_(timewheel_t *w, int level, unsigned i)
+{
+	int shift = TIMEWHEEL_L0_BITS + level * TIMEWHEEL_LN_BITS;
+	ev_uint64_t b = (w->now >> shift) + 1;
+	b += (i - (unsigned)b) & (TIMEWHEEL_LN_SIZE - 1);
+	return b << shift;
+}
+
+/* The slot for an event due at 'tick', and the tick at which that slot
+ * is expired or cascaded. */
+static inline struct event **
+timewheel_slot_(timewheel_t *w, ev_uint64_t tick, ev_uint64_t *when)
+{
+	ev_uint64_t delta;
+	int level, shift;
+	unsigned i;
+
+	if (tick < w->now)
+		tick = w->now;
+	delta = tick - w->now;
+	if (delta >= TIMEWHEEL_SPAN) {
+		delta = TIMEWHEEL_SPAN - 1;
+		tick = w->now + delta;
+	}
+	if (delta < TIMEWHEEL_L0_SIZE) {
+		*when = tick;
+		return &w->l0[tick & (TIMEWHEEL_L0_SIZE - 1)];
+	}
+	shift = TIMEWHEEL_L0_BITS;
+	for (level = 0; level < TIMEWHEEL_LEVELS - 1; ++level) {
+		if (delta < ((ev_uint64_t)1 << (shift + TIMEWHEEL_LN_BITS)))
+			break;
+		shift += TIMEWHEEL_LN_BITS;
+	}
+	i = (unsigned)(tick >> shift) & (TIMEWHEEL_LN_SIZE - 1);
+	*when = timewheel_cascade_tick_(w, level, i);
+	return &w->ln[level][i];
+}
+
+static inline void
+timewheel_link_(timewheel_t *w, struct event *e)
+{
+	ev_uint64_t when;
+	struct event **slot =
+	    timewheel_slot_(w, timewheel_tick_(&e->ev_timeout, 1), &when);
+	if ((TIMEWHEEL_NEXT(e) = *slot) != NULL)
+		TIMEWHEEL_PREV(*slot) = &TIMEWHEEL_NEXT(e);
+	else
+		timewheel_mark_(w, slot, 1);
+	*slot = e;
+	TIMEWHEEL_PREV(e) = slot;
+}
+
+void
+timewheel_push_(timewheel_t *w, struct event *e)
+{
+	timewheel_link_(w, e);
+	++w->n;
+}
+
+void
+timewheel_erase_(timewheel_t *w, struct event *e)
+{
+	struct event **prev = TIMEWHEEL_PREV(e);
+	struct event *next = TIMEWHEEL_NEXT(e);
+
+	if (next)
+		TIMEWHEEL_PREV(next) = prev;
+	else if (timewheel_is_slot_(w, prev))
+		timewheel_mark_(w, prev, 0);
+	*prev = next;
+	--w->n;
+}
+
+/* Empties every slot due to cascade now, highest level first, so that a
+ * slot already holds what came down from above when its own turn comes. */
+static inline void
+timewheel_cascade_(timewheel_t *w)
+{
+	int level;
+	for (level = TIMEWHEEL_LEVELS - 1; level >= 0; --level) {
+		int shift = TIMEWHEEL_L0_BITS + level * TIMEWHEEL_LN_BITS;
+		unsigned i;
+		struct event *e, *next;
+		if (w->now & (((ev_uint64_t)1 << shift) - 1))
+			continue;
+		i = (unsigned)(w->now >> shift) & (TIMEWHEEL_LN_SIZE - 1);
+		if (!(w->ln_map[level] & ((ev_uint64_t)1 << i)))
+			continue;
+		e = w->ln[level][i];
+		w->ln[level][i] = NULL;
+		w->ln_map[level] &= ~((ev_uint64_t)1 << i);
+		for (; e; e = next) {
+			next = TIMEWHEEL_NEXT(e);
+			timewheel_link_(w, e);
+		}
+	}
+}
+
+/* Finds the first tick with something to do: a level 0 slot to expire
+ * or a slot to cascade.  Returns 0 if the wheel is empty. */
+int
+timewheel_next_(timewheel_t *w, ev_uint64_t *tick)
+{
+	unsigned idx = (unsigned)(w->now & (TIMEWHEEL_L0_SIZE - 1));
+	ev_uint64_t block = w->now - idx, best;
+	unsigned i;
+	int level;
+
+	if (!w->n)
+		return 0;
+
+	/* The rest of this turn of level 0 comes before anything else. */
+	for (i = idx >> 6; i < TIMEWHEEL_L0_SIZE / 64; ++i) {
+		ev_uint64_t m = w->l0_map[i];
+		if (i == idx >> 6)
+			m &= ~(ev_uint64_t)0 << (idx & 63);
+		if (m) {
+			*tick = block + i * 64 + timewheel_ctz_(m);
+			return 1;
+		}
+	}
+
+	best = ~(ev_uint64_t)0;
+	for (i = 0; i < TIMEWHEEL_L0_SIZE / 64; ++i) {
+		if (w->l0_map[i]) {
+			best = block + TIMEWHEEL_L0_SIZE + i * 64 +
+			    timewheel_ctz_(w->l0_map[i]);
+			break;
+		}
+	}
+	for (level = 0; level < TIMEWHEEL_LEVELS; ++level) {
+		int shift = TIMEWHEEL_L0_BITS + level * TIMEWHEEL_LN_BITS;
+		ev_uint64_t m = w->ln_map[level], t;
+		unsigned start;
+		if (!m)
+			continue;
+		start = (unsigned)((w->now >> shift) + 1) & (TIMEWHEEL_LN_SIZE - 1);
+		if (start)
+			m = (m >> start) | (m << (TIMEWHEEL_LN_SIZE - start));
+		t = timewheel_cascade_tick_(w, level,
+		    (start + timewheel_ctz_(m)) & (TIMEWHEEL_LN_SIZE - 1));
+		if (t < best)
+			best = t;
+	}
+	*tick = best;
+	return 1;
+}
+
+/* True if nothing on the wheel needs the loop to wake up before 'e'. */
+int
+timewheel_elt_is_next_(timewheel_t *w, struct event *e)
+{
+	ev_uint64_t when, next;
+	timewheel_slot_(w, timewheel_tick_(&e->ev_timeout, 1), &when);
+	return timewheel_next_(w, &next) && when <= next;
+}
+
+/* Moves the wheel forward to 'tick' and returns an event that is due at
+ * or before it, or NULL once there are none left.  The caller must take
+ * the event off the wheel before calling again. */
+struct event *
+timewheel_expire_(timewheel_t *w, ev_uint64_t tick)
+{
+	while (w->now <= tick) {
+		unsigned idx = (unsigned)(w->now & (TIMEWHEEL_L0_SIZE - 1));
+		ev_uint64_t to, m;
+		unsigned i;
+
+		if (w->l0[idx])
+			return w->l0[idx];
+		if (!w->n) {
+			w->now = tick + 1;
+			break;
+		}
+
+		/* Skip to the next used slot of this turn, or to the end of
+		 * the turn, where the levels above may cascade. */
+		to = w->now - idx + TIMEWHEEL_L0_SIZE;
+		for (i = idx >> 6; i < TIMEWHEEL_L0_SIZE / 64; ++i) {
+			m = w->l0_map[i];
+			if (i == idx >> 6)
+				m &= ~(ev_uint64_t)0 << (idx & 63);
+			if (m) {
+				to = w->now - idx + i * 64 + timewheel_ctz_(m);
+				break;
+			}
+		}
+		if (to > tick + 1)
+			to = tick + 1;
+		w->now = to;
+		if (!(w->now & (TIMEWHEEL_L0_SIZE - 1)))
+			timewheel_cascade_(w);
+	}
+	return NULL;
+}
+
+struct event *
+timewheel_any_(timewheel_t *w)
+{
+	unsigned i;
+	if (!w->n)
+		return NULL;
+	for (i = 0; i < TIMEWHEEL_NSLOTS; ++i) {
+		struct event *e = timewheel_slot_first_(w, i);
+		if (e)
+			return e;
+	}
+	return NULL;
+}
+
+/* Slots numbered 0..TIMEWHEEL_NSLOTS-1, level 0 first, for iterating. */
+struct event *
+timewheel_slot_first_(timewheel_t *w, unsigned i)
+{
+	if (i < TIMEWHEEL_L0_SIZE)
+		return w->l0[i];
+	return (&w->ln[0][0])[i - TIMEWHEEL_L0_SIZE];
+}
+
+struct event *
+timewheel_slot_next_(struct event *e)
+{
+	return TIMEWHEEL_NEXT(e);
+}
+
+#endif /* TIMEWHEEL_INTERNAL_H_INCLUDED_ */
@@ -2,128 +2,450 @@
 #include <muduo/base/LogFile.h>
 #include <muduo/base/Timestamp.h>
 
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+#include <errno.h>
+#include <sched.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 using namespace muduo;
 
+namespace
+{
+
+int64_t g_nextLoggerId = 0;
+
+// ring of the last logger this thread appended to
+__thread int64_t t_ringOwner = 0;
+__thread void* t_ring = NULL;
+
+// times append() yields to the background thread before dropping a line
+const int kAppendRetries = 100;
+
+size_t roundUpToPowerOfTwo(size_t n)
+{
+  size_t size = 4096;
+  while (size < n)
+  {
+    size *= 2;
+  }
+  return size;
+}
+
+int64_t loadRelaxed(const int64_t* counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// only one thread writes the counter, the others read it
+void addRelaxed(int64_t* counter, int64_t n)
+{
+  __atomic_store_n(counter, loadRelaxed(counter) + n, __ATOMIC_RELAXED);
+}
+
+}
+
+// Single producer single consumer ring of bytes, the producer is the
+// thread that owns it, the consumer is the background thread.
+// head_ and tail_ only grow, a line is visible once tail_ passes it.
+// Each line is preceded by its sequence number and length.
+class AsyncLogging::LogRing : boost::noncopyable
+{
+ public:
+  static const size_t kHeaderSize = sizeof(int64_t) + sizeof(int32_t);
+
+  LogRing(size_t size)
+    : data_(new char[size]),
+      capacity_(size),
+      tid_(CurrentThread::tid()),
+      tail_(0),
+      cachedHead_(0),
+      lines_(0),
+      bytes_(0),
+      overflows_(0),
+      dropped_(0),
+      head_(0),
+      pos_(0),
+      end_(0),
+      exited_(0),
+      reportedDropped_(0)
+  {
+  }
+
+  ~LogRing()
+  {
+    delete[] data_;
+  }
+
+  // in the owner thread
+
+  // takes the line's number from nextSeq once there is room for it
+  bool tryAppend(const char* logline, size_t len, int64_t* nextSeq)
+  {
+    size_t size = kHeaderSize + len;
+    if (tail_ - cachedHead_ + size > capacity_)
+    {
+      cachedHead_ = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+      if (tail_ - cachedHead_ + size > capacity_)
+      {
+        return false;
+      }
+    }
+    int64_t seq = __atomic_fetch_add(nextSeq, 1, __ATOMIC_RELAXED);
+    int32_t len32 = static_cast<int32_t>(len);
+    copyIn(tail_, &seq, sizeof seq);
+    copyIn(tail_ + sizeof seq, &len32, sizeof len32);
+    copyIn(tail_ + kHeaderSize, logline, len);
+    __atomic_store_n(&tail_, tail_ + size, __ATOMIC_RELEASE);
+    addRelaxed(&lines_, 1);
+    addRelaxed(&bytes_, static_cast<int64_t>(len));
+    return true;
+  }
+
+  // may be more than what is left, never less
+  size_t used() const
+  {
+    return static_cast<size_t>(tail_ - cachedHead_);
+  }
+
+  size_t capacity() const
+  {
+    return capacity_;
+  }
+
+  void countOverflow()
+  {
+    addRelaxed(&overflows_, 1);
+  }
+
+  void countDropped()
+  {
+    addRelaxed(&dropped_, 1);
+  }
+
+  void setExited()
+  {
+    __atomic_store_n(&exited_, 1, __ATOMIC_RELEASE);
+  }
+
+  // in the background thread
+
+  bool exited() const
+  {
+    return __atomic_load_n(&exited_, __ATOMIC_ACQUIRE) != 0;
+  }
+
+  // takes the lines appended so far, writeLine() goes through them
+  void beginDrain()
+  {
+    pos_ = head_;
+    end_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+  }
+
+  bool hasLine() const
+  {
+    return pos_ < end_;
+  }
+
+  int64_t nextSeq() const
+  {
+    int64_t seq;
+    copyOut(pos_, &seq, sizeof seq);
+    return seq;
+  }
+
+  // returns the length of the line
+  size_t writeLine(LogFile* output)
+  {
+    int32_t len32;
+    copyOut(pos_ + sizeof(int64_t), &len32, sizeof len32);
+    size_t len = static_cast<size_t>(len32);
+    size_t pos = static_cast<size_t>((pos_ + kHeaderSize) & (capacity_ - 1));
+    size_t first = std::min(len, capacity_ - pos);
+    output->append(data_ + pos, static_cast<int>(first));
+    if (len > first)
+    {
+      output->append(data_, static_cast<int>(len - first));
+    }
+    pos_ += kHeaderSize + len;
+    return len;
+  }
+
+  // gives the room of the lines written back to the owner thread
+  void endDrain()
+  {
+    __atomic_store_n(&head_, pos_, __ATOMIC_RELEASE);
+  }
+
+  // dropped lines since the last call
+  int64_t takeDropped()
+  {
+    int64_t dropped = loadRelaxed(&dropped_);
+    int64_t n = dropped - reportedDropped_;
+    reportedDropped_ = dropped;
+    return n;
+  }
+
+  // anywhere
+
+  int tid() const
+  {
+    return tid_;
+  }
+
+  void addStatsTo(ThreadStats* stats) const
+  {
+    stats->lines += loadRelaxed(&lines_);
+    stats->bytes += loadRelaxed(&bytes_);
+    stats->overflows += loadRelaxed(&overflows_);
+    stats->dropped += loadRelaxed(&dropped_);
+  }
+
+ private:
+  void copyIn(uint64_t at, const void* src, size_t len)
+  {
+    size_t pos = static_cast<size_t>(at & (capacity_ - 1));
+    size_t first = std::min(len, capacity_ - pos);
+    memcpy(data_ + pos, src, first);
+    memcpy(data_, static_cast<const char*>(src) + first, len - first);
+  }
+
+  void copyOut(uint64_t at, void* dst, size_t len) const
+  {
+    size_t pos = static_cast<size_t>(at & (capacity_ - 1));
+    size_t first = std::min(len, capacity_ - pos);
+    memcpy(dst, data_ + pos, first);
+    memcpy(static_cast<char*>(dst) + first, data_, len - first);
+  }
+
+  char* const data_;
+  const size_t capacity_;
+  const int tid_;
+
+  // written by the owner thread
+  uint64_t tail_;
+  uint64_t cachedHead_;
+  int64_t lines_;
+  int64_t bytes_;
+  int64_t overflows_;
+  int64_t dropped_;
+  char pad_[64];
+
+  // written by the background thread
+  uint64_t head_;
+  uint64_t pos_;
+  uint64_t end_;
+  int exited_;
+  int64_t reportedDropped_;
+};
+
 AsyncLogging::AsyncLogging(const string& basename,
                            off_t rollSize,
-                           int flushInterval)
+                           int flushInterval,
+                           size_t ringSize)
   : flushInterval_(flushInterval),
     running_(false),
     basename_(basename),
     rollSize_(rollSize),
+    ringSize_(roundUpToPowerOfTwo(ringSize)),
+    id_(__atomic_add_fetch(&g_nextLoggerId, 1, __ATOMIC_RELAXED)),
     thread_(boost::bind(&AsyncLogging::threadFunc, this), "Logging"),
     latch_(1),
+    sleeping_(0),
+    nextSeq_(0),
     mutex_(),
-    cond_(mutex_),
-    currentBuffer_(new Buffer),
-    nextBuffer_(new Buffer),
-    buffers_()
+    rings_()
 {
-  currentBuffer_->bzero();
-  nextBuffer_->bzero();
-  buffers_.reserve(16);
+  pthread_key_create(&ringKey_, &AsyncLogging::ringThreadExit);
+  ::sem_init(&wakeup_, 0, 0);
+  memset(&exited_, 0, sizeof exited_);
 }
 
-void AsyncLogging::append(const char* logline, int len)
+AsyncLogging::~AsyncLogging()
 {
-  muduo::MutexLockGuard lock(mutex_);
-  if (currentBuffer_->avail() > len)
+  if (running_)
   {
-    currentBuffer_->append(logline, len);
+    stop();
   }
-  else
+  pthread_key_delete(ringKey_);
+  for (size_t i = 0; i < rings_.size(); ++i)
   {
-    buffers_.push_back(currentBuffer_.release());
+    delete rings_[i];
+  }
+  ::sem_destroy(&wakeup_);
+}
 
-    if (nextBuffer_)
+void AsyncLogging::append(const char* logline, int len)
+{
+  LogRing* ring = threadRing();
+  size_t n = static_cast<size_t>(len);
+  if (!ring->tryAppend(logline, n, &nextSeq_))
+  {
+    ring->countOverflow();
+    __atomic_store_n(&sleeping_, 0, __ATOMIC_SEQ_CST);
+    ::sem_post(&wakeup_);
+    bool appended = false;
+    bool fits = LogRing::kHeaderSize + n <= ring->capacity();
+    for (int i = 0; i < kAppendRetries && !appended && fits; ++i)
     {
-      currentBuffer_ = boost::ptr_container::move(nextBuffer_);
+      sched_yield();
+      appended = ring->tryAppend(logline, n, &nextSeq_);
     }
-    else
+    if (!appended)
     {
-      currentBuffer_.reset(new Buffer); // Rarely happens
+      ring->countDropped();
     }
-    currentBuffer_->append(logline, len);
-    cond_.notify();
+    return;
+  }
+
+  if (ring->used() >= ring->capacity() / 2
+      && __atomic_load_n(&sleeping_, __ATOMIC_SEQ_CST)
+      && __atomic_exchange_n(&sleeping_, 0, __ATOMIC_SEQ_CST))
+  {
+    ::sem_post(&wakeup_);
   }
 }
 
-void AsyncLogging::threadFunc()
+void AsyncLogging::getStats(std::vector<ThreadStats>* stats)
 {
-  assert(running_ == true);
-  latch_.countDown();
-  LogFile output(basename_, rollSize_, false);
-  BufferPtr newBuffer1(new Buffer);
-  BufferPtr newBuffer2(new Buffer);
-  newBuffer1->bzero();
-  newBuffer2->bzero();
-  BufferVector buffersToWrite;
-  buffersToWrite.reserve(16);
-  while (running_)
+  stats->clear();
+  muduo::MutexLockGuard lock(mutex_);
+  for (size_t i = 0; i < rings_.size(); ++i)
   {
-    assert(newBuffer1 && newBuffer1->length() == 0);
-    assert(newBuffer2 && newBuffer2->length() == 0);
-    assert(buffersToWrite.empty());
+    ThreadStats s;
+    memset(&s, 0, sizeof s);
+    s.tid = rings_[i]->tid();
+    rings_[i]->addStatsTo(&s);
+    stats->push_back(s);
+  }
+  if (exited_.lines > 0 || exited_.dropped > 0)
+  {
+    stats->push_back(exited_);
+  }
+}
 
-    {
-      muduo::MutexLockGuard lock(mutex_);
-      if (buffers_.empty())  // unusual usage!
-      {
-        cond_.waitForSeconds(flushInterval_);
-      }
-      buffers_.push_back(currentBuffer_.release());
-      currentBuffer_ = boost::ptr_container::move(newBuffer1);
-      buffersToWrite.swap(buffers_);
-      if (!nextBuffer_)
-      {
-        nextBuffer_ = boost::ptr_container::move(newBuffer2);
-      }
-    }
+AsyncLogging::LogRing* AsyncLogging::threadRing()
+{
+  if (t_ringOwner == id_)
+  {
+    return static_cast<LogRing*>(t_ring);
+  }
+  LogRing* ring = static_cast<LogRing*>(pthread_getspecific(ringKey_));
+  if (ring == NULL)
+  {
+    ring = new LogRing(ringSize_);
+    pthread_setspecific(ringKey_, ring);
+    muduo::MutexLockGuard lock(mutex_);
+    rings_.push_back(ring);
+  }
+  t_ringOwner = id_;
+  t_ring = ring;
+  return ring;
+}
 
-    assert(!buffersToWrite.empty());
+void AsyncLogging::ringThreadExit(void* ring)
+{
+  // the background thread frees it once drained
+  t_ringOwner = 0;
+  t_ring = NULL;
+  static_cast<LogRing*>(ring)->setExited();
+}
 
-    if (buffersToWrite.size() > 25)
-    {
-      char buf[256];
-      snprintf(buf, sizeof buf, "Dropped log messages at %s, %zd larger buffers\n",
-               Timestamp::now().toFormattedString().c_str(),
-               buffersToWrite.size()-2);
-      fputs(buf, stderr);
-      output.append(buf, static_cast<int>(strlen(buf)));
-      buffersToWrite.erase(buffersToWrite.begin()+2, buffersToWrite.end());
-    }
+size_t AsyncLogging::drain(LogFile* output, std::vector<LogRing*>* rings)
+{
+  {
+    muduo::MutexLockGuard lock(mutex_);
+    *rings = rings_;
+  }
 
-    for (size_t i = 0; i < buffersToWrite.size(); ++i)
+  // nothing is appended after exited, check it before draining
+  std::vector<bool> exited(rings->size());
+  typedef std::pair<int64_t, LogRing*> Head;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+  for (size_t i = 0; i < rings->size(); ++i)
+  {
+    LogRing* ring = (*rings)[i];
+    exited[i] = ring->exited();
+    ring->beginDrain();
+    if (ring->hasLine())
     {
-      // FIXME: use unbuffered stdio FILE ? or use ::writev ?
-      output.append(buffersToWrite[i].data(), buffersToWrite[i].length());
+      heads.push(Head(ring->nextSeq(), ring));
     }
+  }
 
-    if (buffersToWrite.size() > 2)
+  // merges the rings: the line with the lowest number goes first
+  size_t total = 0;
+  while (!heads.empty())
+  {
+    LogRing* ring = heads.top().second;
+    heads.pop();
+    int64_t next = heads.empty() ? INT64_MAX : heads.top().first;
+    do
+    {
+      total += ring->writeLine(output);
+    } while (ring->hasLine() && ring->nextSeq() < next);
+    if (ring->hasLine())
     {
-      // drop non-bzero-ed buffers, avoid trashing
-      buffersToWrite.resize(2);
+      heads.push(Head(ring->nextSeq(), ring));
     }
+  }
+
+  for (size_t i = 0; i < rings->size(); ++i)
+  {
+    LogRing* ring = (*rings)[i];
+    ring->endDrain();
 
-    if (!newBuffer1)
+    int64_t dropped = ring->takeDropped();
+    if (dropped > 0)
     {
-      assert(!buffersToWrite.empty());
-      newBuffer1 = buffersToWrite.pop_back();
-      newBuffer1->reset();
+      char buf[256];
+      snprintf(buf, sizeof buf, "Dropped %lld log messages of thread %d at %s\n",
+               static_cast<long long>(dropped), ring->tid(),
+               Timestamp::now().toFormattedString().c_str());
+      fputs(buf, stderr);
+      output->append(buf, static_cast<int>(strlen(buf)));
     }
 
-    if (!newBuffer2)
+    if (exited[i])
     {
-      assert(!buffersToWrite.empty());
-      newBuffer2 = buffersToWrite.pop_back();
-      newBuffer2->reset();
+      muduo::MutexLockGuard lock(mutex_);
+      ring->addStatsTo(&exited_);
+      rings_.erase(std::find(rings_.begin(), rings_.end(), ring));
+      delete ring;
     }
+  }
+  return total;
+}
 
-    buffersToWrite.clear();
+void AsyncLogging::threadFunc()
+{
+  assert(running_ == true);
+  latch_.countDown();
+  LogFile output(basename_, rollSize_, false);
+  std::vector<LogRing*> rings;
+  while (running_)
+  {
+    size_t written = drain(&output, &rings);
     output.flush();
+    if (written < ringSize_ / 2)
+    {
+      // appenders wake us up when a ring is half full
+      __atomic_store_n(&sleeping_, 1, __ATOMIC_SEQ_CST);
+      struct timespec abstime;
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      abstime.tv_sec += flushInterval_;
+      while (running_ && ::sem_timedwait(&wakeup_, &abstime) < 0 && errno == EINTR)
+      {
+      }
+      __atomic_store_n(&sleeping_, 0, __ATOMIC_SEQ_CST);
+    }
+  }
+  while (drain(&output, &rings) > 0)
+  {
   }
   output.flush();
 }
-
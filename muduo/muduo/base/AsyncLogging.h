@@ -11,26 +11,49 @@
 #include <boost/bind.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
-#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <vector>
+
+#include <pthread.h>
+#include <semaphore.h>
 
 namespace muduo
 {
 
+class LogFile;
+
+///
+/// Writes log lines to LogFile in a background thread.
+///
+/// Each thread that calls append() gets its own ring buffer, which only
+/// it writes to and only the background thread reads from, so append()
+/// takes no lock.  append() numbers the lines, and the background thread
+/// merges the rings by number, so lines reach the file in the order they
+/// were appended.  A line still being copied in when a drain starts may
+/// come after lines appended later, in the next drain.  When a ring is full,
+/// append() wakes the background thread and waits a little, then drops
+/// the line, see ThreadStats.
+///
 class AsyncLogging : boost::noncopyable
 {
  public:
 
+  struct ThreadStats
+  {
+    int tid;            // 0 sums up the threads that have exited
+    int64_t lines;      // lines appended
+    int64_t bytes;
+    int64_t overflows;  // times append() found the ring full
+    int64_t dropped;    // lines dropped after that
+  };
+
+  /// @c ringSize is per thread, rounded up to a power of two.
   AsyncLogging(const string& basename,
                off_t rollSize,
-               int flushInterval = 3);
+               int flushInterval = 3,
+               size_t ringSize = 1024 * 1024);
 
-  ~AsyncLogging()
-  {
-    if (running_)
-    {
-      stop();
-    }
-  }
+  ~AsyncLogging();
 
   void append(const char* logline, int len);
 
@@ -41,36 +64,41 @@ class AsyncLogging : boost::noncopyable
     latch_.wait();
   }
 
-  void stop() NO_THREAD_SAFETY_ANALYSIS
+  void stop()
   {
     running_ = false;
-    cond_.notify();
+    ::sem_post(&wakeup_);
     thread_.join();
   }
 
+  /// One entry for each thread that has a ring, thread safe.
+  void getStats(std::vector<ThreadStats>* stats);
+
  private:
 
-  // declare but not define, prevent compiler-synthesized functions
-  AsyncLogging(const AsyncLogging&);  // ptr_container
-  void operator=(const AsyncLogging&);  // ptr_container
+  class LogRing;
 
   void threadFunc();
-
-  typedef muduo::detail::FixedBuffer<muduo::detail::kLargeBuffer> Buffer;
-  typedef boost::ptr_vector<Buffer> BufferVector;
-  typedef BufferVector::auto_type BufferPtr;
+  LogRing* threadRing();
+  // copies out what is in the rings, returns the bytes written
+  size_t drain(LogFile* output, std::vector<LogRing*>* rings);
+  static void ringThreadExit(void* ring);
 
   const int flushInterval_;
   bool running_;
   const string basename_;
   const off_t rollSize_;
+  const size_t ringSize_;
+  const int64_t id_;  // tells apart the loggers in a thread's ring cache
   muduo::Thread thread_;
   muduo::CountDownLatch latch_;
+  pthread_key_t ringKey_;
+  sem_t wakeup_;
+  int sleeping_;  // atomic, the background thread waits on wakeup_
+  int64_t nextSeq_;  // atomic, numbers the lines of all threads
   muduo::MutexLock mutex_;
-  muduo::Condition cond_ GUARDED_BY(mutex_);
-  BufferPtr currentBuffer_ GUARDED_BY(mutex_);
-  BufferPtr nextBuffer_ GUARDED_BY(mutex_);
-  BufferVector buffers_ GUARDED_BY(mutex_);
+  std::vector<LogRing*> rings_ GUARDED_BY(mutex_);
+  ThreadStats exited_ GUARDED_BY(mutex_);
 };
 
 }
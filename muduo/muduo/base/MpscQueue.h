@@ -0,0 +1,118 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+
+#ifndef MUDUO_BASE_MPSCQUEUE_H
+#define MUDUO_BASE_MPSCQUEUE_H
+
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <assert.h>
+#include <stddef.h>
+
+namespace muduo
+{
+
+///
+/// Unbounded lock-free queue, many producers and a single consumer.
+///
+/// push() is wait-free: one atomic exchange and one store.
+/// pop() and empty() must only be called from the consumer thread.
+/// Dmitry Vyukov's intrusive MPSC queue, with a heap allocated node per item.
+///
+template<typename T>
+class MpscQueue : boost::noncopyable
+{
+ public:
+  MpscQueue()
+    : head_(new Node),
+      tail_(head_),
+      size_(0)
+  {
+  }
+
+  ~MpscQueue()
+  {
+    while (head_)
+    {
+      Node* next = head_->next;
+      delete head_;
+      head_ = next;
+    }
+  }
+
+  void push(const T& x)
+  {
+    Node* node = new Node;
+    node->value = x;
+    push(node);
+  }
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+  void push(T&& x)
+  {
+    Node* node = new Node;
+    node->value = std::move(x);
+    push(node);
+  }
+#endif
+
+  /// Swaps the front item into *x and removes it.
+  /// Returns false if the queue is empty, or if the item after the
+  /// last one taken is still being pushed by another thread.
+  bool pop(T* x)
+  {
+    Node* head = head_;
+    Node* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next == NULL)
+    {
+      return false;
+    }
+    using std::swap;
+    swap(*x, next->value);
+    head_ = next;  // next becomes the new stub
+    delete head;
+    __atomic_fetch_sub(&size_, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  /// Sequentially consistent, so that a consumer that announces it is
+  /// going to sleep and then finds the queue empty is sure to be seen by
+  /// any producer that pushes afterwards.
+  bool empty() const
+  {
+    return __atomic_load_n(&head_->next, __ATOMIC_SEQ_CST) == NULL;
+  }
+
+  /// Approximate, safe to call from any thread.
+  size_t size() const
+  {
+    return __atomic_load_n(&size_, __ATOMIC_RELAXED);
+  }
+
+ private:
+  struct Node
+  {
+    Node() : next(NULL) { }
+    Node* next;
+    T value;
+  };
+
+  void push(Node* node)
+  {
+    __atomic_fetch_add(&size_, 1, __ATOMIC_RELAXED);
+    Node* prev = __atomic_exchange_n(&tail_, node, __ATOMIC_SEQ_CST);
+    // between these two lines the consumer sees the queue end at prev
+    __atomic_store_n(&prev->next, node, __ATOMIC_SEQ_CST);
+  }
+
+  Node* head_;  // consumer only
+  char pad_[64 - sizeof(Node*)];  // keep producers off the consumer's line
+  Node* tail_;
+  size_t size_;
+};
+
+}
+
+#endif  // MUDUO_BASE_MPSCQUEUE_H
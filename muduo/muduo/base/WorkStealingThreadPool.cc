@@ -0,0 +1,446 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+
+#include <muduo/base/WorkStealingThreadPool.h>
+
+#include <muduo/base/Exception.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+
+using namespace muduo;
+
+namespace
+{
+
+// the pool and the worker of the current thread, if it is a worker
+__thread const void* t_pool = NULL;
+__thread void* t_worker = NULL;
+__thread uint32_t t_seed = 0;
+
+// rounds of looking for tasks before a worker parks
+const int kSpinRounds = 100;
+
+// xorshift, for picking workers and victims
+uint32_t nextRandom()
+{
+  if (t_seed == 0)
+  {
+    t_seed = static_cast<uint32_t>(CurrentThread::tid()) * 2654435761u | 1;
+  }
+  uint32_t x = t_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  t_seed = x;
+  return x;
+}
+
+}
+
+struct WorkStealingThreadPool::Worker : boost::noncopyable
+{
+  Worker()
+    : size(0)
+  {
+  }
+
+  template<typename Iterator>
+  void push(Iterator first, Iterator last)
+  {
+    MutexLockGuard lock(mutex);
+    tasks.insert(tasks.end(), first, last);
+    __atomic_store_n(&size, tasks.size(), __ATOMIC_RELAXED);
+  }
+
+  void push(const Task& task)
+  {
+    MutexLockGuard lock(mutex);
+    tasks.push_back(task);
+    __atomic_store_n(&size, tasks.size(), __ATOMIC_RELAXED);
+  }
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+  void push(Task&& task)
+  {
+    MutexLockGuard lock(mutex);
+    tasks.push_back(std::move(task));
+    __atomic_store_n(&size, tasks.size(), __ATOMIC_RELAXED);
+  }
+#endif
+
+  bool popFront(Task* task)
+  {
+    if (peekSize() == 0)
+    {
+      return false;
+    }
+    MutexLockGuard lock(mutex);
+    if (tasks.empty())
+    {
+      return false;
+    }
+    task->swap(tasks.front());
+    tasks.pop_front();
+    __atomic_store_n(&size, tasks.size(), __ATOMIC_RELAXED);
+    return true;
+  }
+
+  // moves the back half, in order
+  void stealBack(std::vector<Task>* stolen)
+  {
+    MutexLockGuard lock(mutex);
+    size_t n = (tasks.size() + 1) / 2;
+    size_t first = tasks.size() - n;
+    stolen->resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      (*stolen)[i].swap(tasks[first + i]);
+    }
+    tasks.erase(tasks.begin() + first, tasks.end());
+    __atomic_store_n(&size, tasks.size(), __ATOMIC_RELAXED);
+  }
+
+  size_t peekSize() const
+  {
+    return __atomic_load_n(&size, __ATOMIC_RELAXED);
+  }
+
+  MutexLock mutex;
+  std::deque<Task> tasks GUARDED_BY(mutex);
+  size_t size;  // peeked at without the lock
+  char pad[64];
+};
+
+WorkStealingThreadPool::WorkStealingThreadPool(const string& nameArg)
+  : mutex_(),
+    notEmpty_(mutex_),
+    notFull_(mutex_),
+    name_(nameArg),
+    maxQueueSize_(0),
+    running_(false),
+    idle_(0),
+    spinning_(0),
+    queued_(0),
+    fullWaiters_(0)
+{
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool()
+{
+  if (running_)
+  {
+    stop();
+  }
+}
+
+void WorkStealingThreadPool::start(int numThreads)
+{
+  assert(threads_.empty());
+  running_ = true;
+  workers_.reserve(numThreads);
+  for (int i = 0; i < numThreads; ++i)
+  {
+    workers_.push_back(new Worker);
+  }
+  threads_.reserve(numThreads);
+  for (int i = 0; i < numThreads; ++i)
+  {
+    char id[32];
+    snprintf(id, sizeof id, "%d", i+1);
+    threads_.push_back(new muduo::Thread(
+          boost::bind(&WorkStealingThreadPool::runInThread, this, i), name_+id));
+    threads_[i].start();
+  }
+  if (numThreads == 0 && threadInitCallback_)
+  {
+    threadInitCallback_();
+  }
+}
+
+void WorkStealingThreadPool::stop()
+{
+  {
+  MutexLockGuard lock(mutex_);
+  running_ = false;
+  notEmpty_.notifyAll();
+  notFull_.notifyAll();
+  }
+  for_each(threads_.begin(),
+           threads_.end(),
+           boost::bind(&muduo::Thread::join, _1));
+}
+
+size_t WorkStealingThreadPool::queueSize() const
+{
+  size_t size = 0;
+  for (size_t i = 0; i < workers_.size(); ++i)
+  {
+    size += workers_[i].peekSize();
+  }
+  return size;
+}
+
+void WorkStealingThreadPool::run(const Task& task)
+{
+  if (threads_.empty())
+  {
+    task();
+  }
+  else
+  {
+    waitNotFull(1);
+    pickWorker()->push(task);
+    wakeup(1);
+  }
+}
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+void WorkStealingThreadPool::run(Task&& task)
+{
+  if (threads_.empty())
+  {
+    task();
+  }
+  else
+  {
+    waitNotFull(1);
+    pickWorker()->push(std::move(task));
+    wakeup(1);
+  }
+}
+#endif
+
+void WorkStealingThreadPool::runBatch(const std::vector<Task>& tasks)
+{
+  if (threads_.empty())
+  {
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+      tasks[i]();
+    }
+  }
+  else if (!tasks.empty())
+  {
+    waitNotFull(tasks.size());
+    if (Worker* self = currentWorker())
+    {
+      // the idle workers will steal them
+      self->push(tasks.begin(), tasks.end());
+    }
+    else
+    {
+      size_t n = workers_.size();
+      size_t chunk = (tasks.size() + n - 1) / n;
+      size_t start = nextRandom() % n;
+      for (size_t i = 0, first = 0; first < tasks.size(); ++i, first += chunk)
+      {
+        size_t last = std::min(first + chunk, tasks.size());
+        workers_[(start + i) % n].push(tasks.begin() + first, tasks.begin() + last);
+      }
+    }
+    wakeup(static_cast<int>(std::min(tasks.size(), workers_.size())));
+  }
+}
+
+WorkStealingThreadPool::Worker* WorkStealingThreadPool::currentWorker() const
+{
+  return t_pool == this ? static_cast<Worker*>(t_worker) : NULL;
+}
+
+WorkStealingThreadPool::Worker* WorkStealingThreadPool::pickWorker()
+{
+  Worker* self = currentWorker();
+  return self ? self : &workers_[nextRandom() % workers_.size()];
+}
+
+void WorkStealingThreadPool::wakeup(int n)
+{
+  // pairs with park(), either we see the parking worker, or it sees the
+  // task we have just pushed
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  // a spinning worker will find one task, not a batch
+  if ((n > 1 || __atomic_load_n(&spinning_, __ATOMIC_SEQ_CST) == 0)
+      && __atomic_load_n(&idle_, __ATOMIC_SEQ_CST) > 0)
+  {
+    MutexLockGuard lock(mutex_);
+    if (n >= idle_)
+    {
+      notEmpty_.notifyAll();
+    }
+    else
+    {
+      for (int i = 0; i < n; ++i)
+      {
+        notEmpty_.notify();
+      }
+    }
+  }
+}
+
+void WorkStealingThreadPool::waitNotFull(size_t n)
+{
+  if (maxQueueSize_ == 0)
+  {
+    return;
+  }
+  if (__atomic_load_n(&queued_, __ATOMIC_SEQ_CST) + n > maxQueueSize_)
+  {
+    MutexLockGuard lock(mutex_);
+    __atomic_add_fetch(&fullWaiters_, 1, __ATOMIC_SEQ_CST);
+    size_t queued;
+    // a batch larger than the limit goes in once the pool is empty
+    while ((queued = __atomic_load_n(&queued_, __ATOMIC_SEQ_CST)) > 0
+           && queued + n > maxQueueSize_
+           && running_)
+    {
+      notFull_.wait();
+    }
+    __atomic_sub_fetch(&fullWaiters_, 1, __ATOMIC_SEQ_CST);
+  }
+  __atomic_add_fetch(&queued_, n, __ATOMIC_SEQ_CST);
+}
+
+void WorkStealingThreadPool::taken(size_t n)
+{
+  if (maxQueueSize_ > 0)
+  {
+    __atomic_sub_fetch(&queued_, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&fullWaiters_, __ATOMIC_SEQ_CST) > 0)
+    {
+      MutexLockGuard lock(mutex_);
+      notFull_.notifyAll();
+    }
+  }
+}
+
+bool WorkStealingThreadPool::take(Worker* self, Task* task)
+{
+  return self->popFront(task) || steal(self, task);
+}
+
+bool WorkStealingThreadPool::steal(Worker* self, Task* task)
+{
+  size_t n = workers_.size();
+  size_t start = nextRandom() % n;
+  for (size_t i = 0; i < n; ++i)
+  {
+    Worker* victim = &workers_[(start + i) % n];
+    if (victim != self && victim->peekSize() > 0)
+    {
+      std::vector<Task> stolen;
+      victim->stealBack(&stolen);
+      if (!stolen.empty())
+      {
+        task->swap(stolen.front());
+        if (stolen.size() > 1)
+        {
+          self->push(stolen.begin() + 1, stolen.end());
+        }
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool WorkStealingThreadPool::anyQueued() const
+{
+  // pairs with wakeup()
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return queueSize() > 0;
+}
+
+void WorkStealingThreadPool::park()
+{
+  MutexLockGuard lock(mutex_);
+  __atomic_add_fetch(&idle_, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch(&spinning_, 1, __ATOMIC_SEQ_CST);
+  // always use a while-loop, due to spurious wakeup
+  while (running_ && !anyQueued())
+  {
+    notEmpty_.wait();
+  }
+  __atomic_sub_fetch(&idle_, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&spinning_, 1, __ATOMIC_SEQ_CST);
+}
+
+void WorkStealingThreadPool::runInThread(int index)
+{
+  Worker* self = &workers_[index];
+  t_pool = this;
+  t_worker = self;
+  try
+  {
+    if (threadInitCallback_)
+    {
+      threadInitCallback_();
+    }
+    bool spinning = true;
+    __atomic_add_fetch(&spinning_, 1, __ATOMIC_SEQ_CST);
+    int rounds = 0;
+    while (running_)
+    {
+      Task task;
+      if (take(self, &task))
+      {
+        taken(1);
+        if (spinning)
+        {
+          spinning = false;
+          // the last one looking for tasks wakes up another one
+          if (__atomic_sub_fetch(&spinning_, 1, __ATOMIC_SEQ_CST) == 0
+              && anyQueued())
+          {
+            wakeup(1);
+          }
+        }
+        rounds = 0;
+        task();
+      }
+      else if (!spinning)
+      {
+        spinning = true;
+        __atomic_add_fetch(&spinning_, 1, __ATOMIC_SEQ_CST);
+      }
+      else if (++rounds < kSpinRounds)
+      {
+        sched_yield();
+      }
+      else
+      {
+        rounds = 0;
+        park();
+      }
+    }
+    if (spinning)
+    {
+      __atomic_sub_fetch(&spinning_, 1, __ATOMIC_SEQ_CST);
+    }
+  }
+  catch (const Exception& ex)
+  {
+    fprintf(stderr, "exception caught in WorkStealingThreadPool %s\n", name_.c_str());
+    fprintf(stderr, "reason: %s\n", ex.what());
+    fprintf(stderr, "stack trace: %s\n", ex.stackTrace());
+    abort();
+  }
+  catch (const std::exception& ex)
+  {
+    fprintf(stderr, "exception caught in WorkStealingThreadPool %s\n", name_.c_str());
+    fprintf(stderr, "reason: %s\n", ex.what());
+    abort();
+  }
+  catch (...)
+  {
+    fprintf(stderr, "unknown exception caught in WorkStealingThreadPool %s\n", name_.c_str());
+    throw; // rethrow
+  }
+}
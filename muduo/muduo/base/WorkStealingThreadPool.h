@@ -0,0 +1,97 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+
+#ifndef MUDUO_BASE_WORKSTEALINGTHREADPOOL_H
+#define MUDUO_BASE_WORKSTEALINGTHREADPOOL_H
+
+#include <muduo/base/Condition.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Types.h>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <deque>
+#include <vector>
+
+namespace muduo
+{
+
+///
+/// A ThreadPool with a task deque for each worker, a drop-in replacement
+/// when many threads contend on the single queue of ThreadPool.
+///
+/// run() from a worker pushes to its own deque, from other threads to the
+/// deque of a random worker, each deque has its own lock.  A worker takes
+/// tasks from the front of its deque, an idle one steals half of the back
+/// of a random victim, spins a while, and only then parks.
+///
+class WorkStealingThreadPool : boost::noncopyable
+{
+ public:
+  typedef boost::function<void ()> Task;
+
+  explicit WorkStealingThreadPool(const string& nameArg = string("WorkStealingThreadPool"));
+  ~WorkStealingThreadPool();
+
+  // Must be called before start().
+  // Bounds the tasks of all workers, more or less.
+  void setMaxQueueSize(int maxSize) { maxQueueSize_ = maxSize; }
+  void setThreadInitCallback(const Task& cb)
+  { threadInitCallback_ = cb; }
+
+  void start(int numThreads);
+  void stop();
+
+  const string& name() const
+  { return name_; }
+
+  size_t queueSize() const;
+
+  // Could block if maxQueueSize > 0
+  void run(const Task& f);
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+  void run(Task&& f);
+#endif
+
+  /// Spreads the tasks over the workers, taking each lock once.
+  // Could block if maxQueueSize > 0
+  void runBatch(const std::vector<Task>& tasks);
+
+ private:
+  struct Worker;
+
+  Worker* currentWorker() const;
+  Worker* pickWorker();
+  // wakes up to n parked workers, if any
+  void wakeup(int n);
+  void waitNotFull(size_t n);
+  void taken(size_t n);
+  bool take(Worker* self, Task* task);
+  bool steal(Worker* self, Task* task);
+  void park();
+  bool anyQueued() const;
+  void runInThread(int index);
+
+  MutexLock mutex_;
+  Condition notEmpty_ GUARDED_BY(mutex_);
+  Condition notFull_ GUARDED_BY(mutex_);
+  string name_;
+  Task threadInitCallback_;
+  boost::ptr_vector<muduo::Thread> threads_;
+  boost::ptr_vector<Worker> workers_;
+  size_t maxQueueSize_;
+  bool running_;
+  int idle_;         // atomic, parked or parking workers
+  int spinning_;     // atomic, workers looking for tasks
+  size_t queued_;    // atomic, only counted if maxQueueSize_ > 0
+  int fullWaiters_;  // atomic
+};
+
+}
+
+#endif  // MUDUO_BASE_WORKSTEALINGTHREADPOOL_H
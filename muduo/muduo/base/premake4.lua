@@ -21,4 +21,5 @@ project "base"
             'TimeZone.cc',
             'Thread.cc',
             'ThreadPool.cc',
+            'WorkStealingThreadPool.cc',
      }
@@ -1,9 +1,27 @@
+// Throughput and latency of LOG_INFO with AsyncLogging from many threads.
+//
+// Every thread logs its lines as fast as it can and times each one,
+// reports lines per second, the latency percentiles of one LOG_INFO,
+// and the per-thread overflows and drops of AsyncLogging.
+//
+// usage: asynclogging_test [threads] [lines per thread] [long]
+
 #include <muduo/base/AsyncLogging.h>
+#include <muduo/base/CountDownLatch.h>
 #include <muduo/base/Logging.h>
+#include <muduo/base/Thread.h>
 #include <muduo/base/Timestamp.h>
 
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <algorithm>
+#include <vector>
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
 
 off_t kRollSize = 500*1000*1000;
@@ -15,31 +33,42 @@ void asyncOutput(const char* msg, int len)
   g_asyncLog->append(msg, len);
 }
 
-void bench(bool longLog)
+int64_t nowNanos()
 {
-  muduo::Logger::setOutput(asyncOutput);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+muduo::CountDownLatch g_start(1);
+muduo::CountDownLatch g_exit(1);
+muduo::CountDownLatch* g_done = NULL;
 
-  int cnt = 0;
-  const int kBatch = 1000;
+void bench(bool longLog, int lines, std::vector<int>* latencies)
+{
   muduo::string empty = " ";
   muduo::string longStr(3000, 'X');
   longStr += " ";
+  latencies->reserve(lines);
 
-  for (int t = 0; t < 30; ++t)
+  g_start.wait();
+  for (int i = 0; i < lines; ++i)
   {
-    muduo::Timestamp start = muduo::Timestamp::now();
-    for (int i = 0; i < kBatch; ++i)
-    {
-      LOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz "
-               << (longLog ? longStr : empty)
-               << cnt;
-      ++cnt;
-    }
-    muduo::Timestamp end = muduo::Timestamp::now();
-    printf("%f\n", timeDifference(end, start)*1000000/kBatch);
-    struct timespec ts = { 0, 500*1000*1000 };
-    nanosleep(&ts, NULL);
+    int64_t begin = nowNanos();
+    LOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz "
+             << (longLog ? longStr : empty)
+             << i;
+    latencies->push_back(static_cast<int>(nowNanos() - begin));
   }
+  // stay alive until the stats are taken, rings of exited threads are merged
+  g_done->countDown();
+  g_exit.wait();
+}
+
+int percentile(const std::vector<int>& sorted, double p)
+{
+  size_t i = static_cast<size_t>(static_cast<double>(sorted.size() - 1) * p);
+  return sorted[i];
 }
 
 int main(int argc, char* argv[])
@@ -51,14 +80,62 @@ int main(int argc, char* argv[])
     setrlimit(RLIMIT_AS, &rl);
   }
 
-  printf("pid = %d\n", getpid());
+  int numThreads = argc > 1 ? atoi(argv[1]) : 4;
+  int lines = argc > 2 ? atoi(argv[2]) : 200000;
+  bool longLog = argc > 3;
+  printf("pid = %d, %d threads, %d lines each, %s lines\n",
+         getpid(), numThreads, lines, longLog ? "long" : "short");
 
   char name[256] = { 0 };
   strncpy(name, argv[0], sizeof name - 1);
   muduo::AsyncLogging log(::basename(name), kRollSize);
   log.start();
   g_asyncLog = &log;
+  muduo::Logger::setOutput(asyncOutput);
 
-  bool longLog = argc > 1;
-  bench(longLog);
+  muduo::CountDownLatch done(numThreads);
+  g_done = &done;
+  std::vector<std::vector<int> > latencies(numThreads);
+  boost::ptr_vector<muduo::Thread> threads;
+  for (int i = 0; i < numThreads; ++i)
+  {
+    threads.push_back(new muduo::Thread(
+          boost::bind(bench, longLog, lines, &latencies[i])));
+    threads.back().start();
+  }
+
+  std::vector<muduo::AsyncLogging::ThreadStats> stats;
+  muduo::Timestamp begin = muduo::Timestamp::now();
+  g_start.countDown();
+  done.wait();
+  muduo::Timestamp end = muduo::Timestamp::now();
+  log.getStats(&stats);
+  g_exit.countDown();
+  for_each(threads.begin(), threads.end(), boost::bind(&muduo::Thread::join, _1));
+
+  std::vector<int> all;
+  for (int i = 0; i < numThreads; ++i)
+  {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+  std::sort(all.begin(), all.end());
+  double seconds = timeDifference(end, begin);
+  printf("%.0f lines/s in %.3f seconds\n",
+         static_cast<double>(all.size()) / seconds, seconds);
+  if (!all.empty())
+  {
+    printf("latency ns: p50 %d p99 %d p99.9 %d max %d\n",
+           percentile(all, 0.5), percentile(all, 0.99),
+           percentile(all, 0.999), all.back());
+  }
+
+  printf("%8s %10s %12s %10s %10s\n", "tid", "lines", "bytes", "overflows", "dropped");
+  for (size_t i = 0; i < stats.size(); ++i)
+  {
+    printf("%8d %10lld %12lld %10lld %10lld\n", stats[i].tid,
+           static_cast<long long>(stats[i].lines),
+           static_cast<long long>(stats[i].bytes),
+           static_cast<long long>(stats[i].overflows),
+           static_cast<long long>(stats[i].dropped));
+  }
 }
@@ -0,0 +1,88 @@
+#include <muduo/base/MpscQueue.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Thread.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+
+// Each producer pushes (id << 32) | seq, the consumer checks that every
+// producer's items arrive once and in order.
+class Test
+{
+ public:
+  Test(int numThreads, int times)
+    : latch_(1),
+      times_(times),
+      threads_(numThreads)
+  {
+    for (int i = 0; i < numThreads; ++i)
+    {
+      threads_.push_back(new muduo::Thread(
+            boost::bind(&Test::threadFunc, this, i)));
+    }
+    for_each(threads_.begin(), threads_.end(), boost::bind(&muduo::Thread::start, _1));
+  }
+
+  void run()
+  {
+    assert(queue_.empty());
+    latch_.countDown();
+    std::vector<int64_t> next(threads_.size(), 0);
+    int64_t total = static_cast<int64_t>(threads_.size()) * times_;
+    for (int64_t received = 0; received < total; )
+    {
+      int64_t x = 0;
+      if (queue_.pop(&x))
+      {
+        size_t id = static_cast<size_t>(x >> 32);
+        assert(id < next.size());
+        assert((x & 0xffffffff) == next[id]);
+        ++next[id];
+        ++received;
+      }
+    }
+    for_each(threads_.begin(), threads_.end(), boost::bind(&muduo::Thread::join, _1));
+    assert(queue_.empty());
+    assert(queue_.size() == 0);
+    printf("%zd threads, %d items each, all in order\n", threads_.size(), times_);
+  }
+
+ private:
+  void threadFunc(int id)
+  {
+    latch_.wait();
+    for (int i = 0; i < times_; ++i)
+    {
+      queue_.push((static_cast<int64_t>(id) << 32) | i);
+    }
+  }
+
+  muduo::MpscQueue<int64_t> queue_;
+  muduo::CountDownLatch latch_;
+  int times_;
+  boost::ptr_vector<muduo::Thread> threads_;
+};
+
+int main()
+{
+  {
+  muduo::MpscQueue<int> q;
+  int x = 0;
+  assert(q.empty());
+  assert(!q.pop(&x));
+  q.push(1);
+  q.push(2);
+  assert(!q.empty());
+  assert(q.size() == 2);
+  assert(q.pop(&x) && x == 1);
+  assert(q.pop(&x) && x == 2);
+  assert(!q.pop(&x));
+  q.push(3);  // left for the destructor
+  }
+
+  Test t(4, 200000);
+  t.run();
+}
@@ -0,0 +1,136 @@
+// Scaling of ThreadPool and WorkStealingThreadPool with the number of
+// threads, for short CPU-bound tasks.
+//
+// As in examples/sudoku/server_threadpool.cc, one thread submits every
+// task with run(), "batch" submits them with runBatch() 64 at a time,
+// "spawn" has each task run() its children from inside the pool.
+// Reports tasks per second.
+//
+// usage: threadpool_bench [tasks] [work per task] [max threads]
+
+#include <muduo/base/ThreadPool.h>
+#include <muduo/base/WorkStealingThreadPool.h>
+#include <muduo/base/Atomic.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int numTasks = 1000000;
+int work = 200;
+
+muduo::AtomicInt32 g_done;
+muduo::CountDownLatch* g_latch = NULL;
+volatile int g_sink;
+
+void task()
+{
+  int sum = 0;
+  for (int i = 0; i < work; ++i)
+  {
+    sum += i * i;
+  }
+  g_sink = sum;
+  if (g_done.incrementAndGet() == numTasks)
+  {
+    g_latch->countDown();
+  }
+}
+
+template<typename Pool>
+void spawn(Pool* pool, int n)
+{
+  // split in two until one task is left
+  while (n > 1)
+  {
+    int half = n / 2;
+    pool->run(boost::bind(spawn<Pool>, pool, half));
+    n -= half;
+  }
+  task();
+}
+
+template<typename Pool>
+double bench(int numThreads, int mode)
+{
+  Pool pool;
+  pool.start(numThreads);
+  g_done.getAndSet(0);
+  muduo::CountDownLatch latch(1);
+  g_latch = &latch;
+
+  muduo::Timestamp start(muduo::Timestamp::now());
+  if (mode == 0)
+  {
+    for (int i = 0; i < numTasks; ++i)
+    {
+      pool.run(task);
+    }
+  }
+  else
+  {
+    pool.run(boost::bind(spawn<Pool>, &pool, numTasks));
+  }
+  latch.wait();
+  double seconds = timeDifference(muduo::Timestamp::now(), start);
+  pool.stop();
+  return numTasks / seconds;
+}
+
+double benchBatch(int numThreads)
+{
+  muduo::WorkStealingThreadPool pool;
+  pool.start(numThreads);
+  g_done.getAndSet(0);
+  muduo::CountDownLatch latch(1);
+  g_latch = &latch;
+
+  const int kBatch = 64;
+  std::vector<muduo::WorkStealingThreadPool::Task> tasks;
+  muduo::Timestamp start(muduo::Timestamp::now());
+  for (int i = 0; i < numTasks; i += kBatch)
+  {
+    tasks.assign(std::min(kBatch, numTasks - i), task);
+    pool.runBatch(tasks);
+  }
+  latch.wait();
+  double seconds = timeDifference(muduo::Timestamp::now(), start);
+  pool.stop();
+  return numTasks / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+  int maxThreads = 32;
+  if (argc > 1)
+  {
+    numTasks = atoi(argv[1]);
+  }
+  if (argc > 2)
+  {
+    work = atoi(argv[2]);
+  }
+  if (argc > 3)
+  {
+    maxThreads = atoi(argv[3]);
+  }
+  printf("%d tasks of %d iterations, tasks/s\n", numTasks, work);
+  printf("%7s %12s %12s %12s %12s %12s\n",
+         "threads", "pool run", "ws run", "ws batch", "pool spawn", "ws spawn");
+  for (int threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    printf("%7d %12.0f %12.0f %12.0f %12.0f %12.0f\n", threads,
+           bench<muduo::ThreadPool>(threads, 0),
+           bench<muduo::WorkStealingThreadPool>(threads, 0),
+           benchBatch(threads),
+           bench<muduo::ThreadPool>(threads, 1),
+           bench<muduo::WorkStealingThreadPool>(threads, 1));
+    fflush(stdout);
+  }
+}
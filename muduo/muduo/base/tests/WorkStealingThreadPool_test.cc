@@ -0,0 +1,166 @@
+#include <muduo/base/WorkStealingThreadPool.h>
+#include <muduo/base/Atomic.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Thread.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>  // usleep
+
+muduo::AtomicInt32 g_done;
+muduo::AtomicInt32 g_inits;
+
+void count(int total, muduo::CountDownLatch* latch)
+{
+  if (g_done.incrementAndGet() == total)
+  {
+    latch->countDown();
+  }
+}
+
+void submit(muduo::WorkStealingThreadPool* pool, int n, int total,
+            muduo::CountDownLatch* latch)
+{
+  for (int i = 0; i < n; ++i)
+  {
+    pool->run(boost::bind(count, total, latch));
+  }
+}
+
+// each task runs two more from inside the pool, down to the leaves
+void spawn(muduo::WorkStealingThreadPool* pool, int depth, int total,
+           muduo::CountDownLatch* latch)
+{
+  if (depth == 0)
+  {
+    count(total, latch);
+  }
+  else
+  {
+    pool->run(boost::bind(spawn, pool, depth - 1, total, latch));
+    pool->run(boost::bind(spawn, pool, depth - 1, total, latch));
+  }
+}
+
+void batch(muduo::WorkStealingThreadPool* pool, int n, int total,
+           muduo::CountDownLatch* latch)
+{
+  std::vector<muduo::WorkStealingThreadPool::Task> tasks(
+      n, boost::bind(count, total, latch));
+  pool->runBatch(tasks);
+}
+
+void slow(int total, muduo::CountDownLatch* latch)
+{
+  usleep(100);
+  count(total, latch);
+}
+
+void init()
+{
+  g_inits.increment();
+}
+
+void testInline()
+{
+  muduo::WorkStealingThreadPool pool;
+  pool.setThreadInitCallback(init);
+  pool.start(0);
+  assert(g_inits.get() == 1);
+  g_done.getAndSet(0);
+  muduo::CountDownLatch latch(1);
+  pool.run(boost::bind(count, 1, &latch));
+  assert(g_done.get() == 1);
+}
+
+void testSubmitters(int numThreads, int numSubmitters, int tasksEach)
+{
+  g_inits.getAndSet(0);
+  g_done.getAndSet(0);
+  muduo::WorkStealingThreadPool pool;
+  pool.setThreadInitCallback(init);
+  pool.start(numThreads);
+
+  int total = numSubmitters * tasksEach;
+  muduo::CountDownLatch latch(1);
+  boost::ptr_vector<muduo::Thread> submitters;
+  for (int i = 0; i < numSubmitters; ++i)
+  {
+    submitters.push_back(new muduo::Thread(
+          boost::bind(submit, &pool, tasksEach, total, &latch)));
+    submitters.back().start();
+  }
+  for_each(submitters.begin(), submitters.end(), boost::bind(&muduo::Thread::join, _1));
+  latch.wait();
+  assert(g_done.get() == total);
+  pool.stop();
+  assert(g_inits.get() == numThreads);
+  printf("%d threads, %d submitters: %d tasks done\n", numThreads, numSubmitters, total);
+}
+
+void testSpawn(int numThreads, int depth)
+{
+  g_done.getAndSet(0);
+  muduo::WorkStealingThreadPool pool;
+  pool.start(numThreads);
+  int total = 1 << depth;
+  muduo::CountDownLatch latch(1);
+  pool.run(boost::bind(spawn, &pool, depth, total, &latch));
+  latch.wait();
+  assert(g_done.get() == total);
+  printf("%d threads, spawn depth %d: %d tasks done\n", numThreads, depth, total);
+}
+
+void testBatch(int numThreads)
+{
+  g_done.getAndSet(0);
+  muduo::WorkStealingThreadPool pool;
+  pool.start(numThreads);
+  int total = 1000 + 10 * 100;
+  muduo::CountDownLatch latch(1);
+  batch(&pool, 1000, total, &latch);
+  for (int i = 0; i < 10; ++i)
+  {
+    // from inside the pool, to the worker's own deque
+    pool.run(boost::bind(batch, &pool, 100, total, &latch));
+  }
+  latch.wait();
+  assert(g_done.get() == total);
+  printf("%d threads, batches: %d tasks done\n", numThreads, total);
+}
+
+void testMaxQueueSize(int maxSize)
+{
+  g_done.getAndSet(0);
+  muduo::WorkStealingThreadPool pool;
+  pool.setMaxQueueSize(maxSize);
+  pool.start(2);
+  int total = 1000;
+  muduo::CountDownLatch latch(1);
+  for (int i = 0; i < total; ++i)
+  {
+    pool.run(boost::bind(slow, total, &latch));
+    assert(pool.queueSize() <= static_cast<size_t>(maxSize));
+  }
+  latch.wait();
+  assert(g_done.get() == total);
+  printf("max queue size %d: %d tasks done\n", maxSize, total);
+}
+
+int main()
+{
+  testInline();
+  testSubmitters(1, 1, 10000);
+  testSubmitters(4, 1, 100000);
+  testSubmitters(4, 3, 30000);
+  testSubmitters(8, 8, 10000);
+  testSpawn(4, 16);
+  testBatch(4);
+  testMaxQueueSize(1);
+  testMaxQueueSize(10);
+}
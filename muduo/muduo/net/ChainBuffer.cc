@@ -0,0 +1,386 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+
+#include <muduo/net/ChainBuffer.h>
+
+#include <muduo/base/ThreadLocalSingleton.h>
+#include <muduo/net/SocketsOps.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+namespace muduo
+{
+namespace net
+{
+namespace detail
+{
+
+struct BufferBlock
+{
+  int refCount;
+  BufferBlock* nextFree;
+  char data[ChainBuffer::kBlockSize];
+};
+
+}
+}
+}
+
+using muduo::net::detail::BufferBlock;
+
+namespace
+{
+
+// Free blocks of one thread, blocks go back to the pool of the thread
+// that drops the last reference.
+class BlockPool : boost::noncopyable
+{
+ public:
+  BlockPool()
+    : free_(NULL),
+      numFree_(0)
+  {
+  }
+
+  ~BlockPool()
+  {
+    while (free_)
+    {
+      BufferBlock* block = free_;
+      free_ = block->nextFree;
+      delete block;
+    }
+  }
+
+  BufferBlock* take()
+  {
+    BufferBlock* block = free_;
+    if (block)
+    {
+      free_ = block->nextFree;
+      --numFree_;
+    }
+    else
+    {
+      block = new BufferBlock;
+    }
+    block->refCount = 0;
+    block->nextFree = NULL;
+    return block;
+  }
+
+  void give(BufferBlock* block)
+  {
+    if (numFree_ < kMaxFree)
+    {
+      block->nextFree = free_;
+      free_ = block;
+      ++numFree_;
+    }
+    else
+    {
+      delete block;
+    }
+  }
+
+ private:
+  static const int kMaxFree = 64;  // 1MB per thread
+
+  BufferBlock* free_;
+  int numFree_;
+};
+
+typedef ThreadLocalSingleton<BlockPool> ThreadBlockPool;
+
+typedef boost::intrusive_ptr<BufferBlock> BlockPtr;
+
+// at most 64KB per readFd(), as Buffer::readFd() does with its extrabuf
+const int kReadBlocks = 4;
+
+// the chain may be longer, the rest goes with the next writev
+const int kMaxWriteIovec = 64;
+
+}
+
+void muduo::net::detail::intrusive_ptr_add_ref(BufferBlock* block)
+{
+  __atomic_add_fetch(&block->refCount, 1, __ATOMIC_RELAXED);
+}
+
+void muduo::net::detail::intrusive_ptr_release(BufferBlock* block)
+{
+  if (__atomic_sub_fetch(&block->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    ThreadBlockPool::instance().give(block);
+  }
+}
+
+const size_t ChainBuffer::kBlockSize;
+
+ChainBuffer::ChainBuffer()
+  : readable_(0)
+{
+}
+
+ChainBuffer::~ChainBuffer()
+{
+}
+
+void ChainBuffer::swap(ChainBuffer& rhs)
+{
+  slices_.swap(rhs.slices_);
+  std::swap(readable_, rhs.readable_);
+}
+
+StringPiece ChainBuffer::front() const
+{
+  if (slices_.empty())
+  {
+    return StringPiece();
+  }
+  const Slice& s = slices_.front();
+  return StringPiece(s.block->data + s.offset, static_cast<int>(s.len));
+}
+
+void ChainBuffer::append(const char* data, size_t len)
+{
+  size_t room = 0;
+  char* dest = tailRoom(&room);
+  if (dest)
+  {
+    size_t n = std::min(room, len);
+    memcpy(dest, data, n);
+    slices_.back().len += n;
+    readable_ += n;
+    data += n;
+    len -= n;
+  }
+  while (len > 0)
+  {
+    BlockPtr block(ThreadBlockPool::instance().take());
+    size_t n = std::min(kBlockSize, len);
+    memcpy(block->data, data, n);
+    appendNewBlock(block, n);
+    data += n;
+    len -= n;
+  }
+}
+
+void ChainBuffer::append(const ChainBuffer& buf)
+{
+  if (&buf == this)
+  {
+    ChainBuffer copy(buf);
+    append(copy);
+    return;
+  }
+  slices_.insert(slices_.end(), buf.slices_.begin(), buf.slices_.end());
+  readable_ += buf.readable_;
+}
+
+void ChainBuffer::appendAndClear(ChainBuffer* buf)
+{
+  assert(buf != this);
+  if (slices_.empty())
+  {
+    swap(*buf);
+  }
+  else
+  {
+    append(*buf);
+    buf->retrieveAll();
+  }
+}
+
+ChainBuffer ChainBuffer::slice(size_t offset, size_t len) const
+{
+  assert(offset + len <= readable_);
+  ChainBuffer result;
+  for (std::deque<Slice>::const_iterator it = slices_.begin();
+       len > 0 && it != slices_.end(); ++it)
+  {
+    if (offset >= it->len)
+    {
+      offset -= it->len;
+      continue;
+    }
+    Slice s = *it;
+    s.offset += offset;
+    s.len = std::min(s.len - offset, len);
+    offset = 0;
+    len -= s.len;
+    result.slices_.push_back(s);
+    result.readable_ += s.len;
+  }
+  return result;
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+  assert(len <= readable_);
+  readable_ -= len;
+  while (len > 0)
+  {
+    Slice& s = slices_.front();
+    if (len < s.len)
+    {
+      s.offset += len;
+      s.len -= len;
+      break;
+    }
+    len -= s.len;
+    slices_.pop_front();
+  }
+}
+
+void ChainBuffer::retrieveAll()
+{
+  slices_.clear();
+  readable_ = 0;
+}
+
+string ChainBuffer::retrieveAsString(size_t len)
+{
+  string result(len, '\0');
+  if (len > 0)
+  {
+    copyOut(0, &*result.begin(), len);
+  }
+  retrieve(len);
+  return result;
+}
+
+void ChainBuffer::copyOut(size_t offset, char* dest, size_t len) const
+{
+  assert(offset + len <= readable_);
+  for (std::deque<Slice>::const_iterator it = slices_.begin();
+       len > 0 && it != slices_.end(); ++it)
+  {
+    if (offset >= it->len)
+    {
+      offset -= it->len;
+      continue;
+    }
+    size_t n = std::min(it->len - offset, len);
+    memcpy(dest, it->block->data + it->offset + offset, n);
+    offset = 0;
+    dest += n;
+    len -= n;
+  }
+}
+
+int ChainBuffer::peekIovec(struct iovec* iov, int maxiov) const
+{
+  int n = 0;
+  for (std::deque<Slice>::const_iterator it = slices_.begin();
+       n < maxiov && it != slices_.end(); ++it, ++n)
+  {
+    iov[n].iov_base = it->block->data + it->offset;
+    iov[n].iov_len = it->len;
+  }
+  return n;
+}
+
+ssize_t ChainBuffer::readFd(int fd, int* savedErrno)
+{
+  struct iovec vec[kReadBlocks + 1];
+  BlockPtr blocks[kReadBlocks];
+  int iovcnt = 0;
+  size_t room = 0;
+  size_t wanted = 0;
+  char* dest = tailRoom(&room);
+  if (dest)
+  {
+    vec[0].iov_base = dest;
+    vec[0].iov_len = room;
+    wanted = room;
+    iovcnt = 1;
+  }
+  for (int i = 0; wanted < kReadBlocks * kBlockSize; ++i)
+  {
+    blocks[i] = ThreadBlockPool::instance().take();
+    vec[iovcnt].iov_base = blocks[i]->data;
+    vec[iovcnt].iov_len = kBlockSize;
+    wanted += kBlockSize;
+    ++iovcnt;
+  }
+
+  const ssize_t n = sockets::readv(fd, vec, iovcnt);
+  if (n < 0)
+  {
+    *savedErrno = errno;
+    return n;
+  }
+  size_t left = implicit_cast<size_t>(n);
+  if (dest)
+  {
+    size_t len = std::min(room, left);
+    slices_.back().len += len;
+    readable_ += len;
+    left -= len;
+  }
+  for (int i = 0; left > 0; ++i)
+  {
+    size_t len = std::min(kBlockSize, left);
+    appendNewBlock(blocks[i], len);
+    left -= len;
+  }
+  // unused blocks go back to the pool here
+  return n;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int* savedErrno)
+{
+  struct iovec vec[kMaxWriteIovec];
+  int iovcnt = peekIovec(vec, kMaxWriteIovec);
+  ssize_t n = sockets::writev(fd, vec, iovcnt);
+  if (n < 0)
+  {
+    *savedErrno = errno;
+  }
+  else
+  {
+    retrieve(implicit_cast<size_t>(n));
+  }
+  return n;
+}
+
+char* ChainBuffer::tailRoom(size_t* len)
+{
+  if (slices_.empty())
+  {
+    return NULL;
+  }
+  Slice& s = slices_.back();
+  size_t end = s.offset + s.len;
+  // the only reference is this slice, no one else reads past end
+  if (end < kBlockSize
+      && __atomic_load_n(&s.block->refCount, __ATOMIC_ACQUIRE) == 1)
+  {
+    *len = kBlockSize - end;
+    return s.block->data + end;
+  }
+  return NULL;
+}
+
+void ChainBuffer::appendNewBlock(const BlockPtr& block, size_t len)
+{
+  Slice s;
+  s.block = block;
+  s.offset = 0;
+  s.len = len;
+  slices_.push_back(s);
+  readable_ += len;
+}
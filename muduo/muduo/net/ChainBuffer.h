@@ -0,0 +1,130 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+//
+// This is a public header file, it must only include public header files.
+
+#ifndef MUDUO_NET_CHAINBUFFER_H
+#define MUDUO_NET_CHAINBUFFER_H
+
+#include <muduo/base/copyable.h>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Types.h>
+
+#include <boost/intrusive_ptr.hpp>
+
+#include <deque>
+
+struct iovec;
+
+namespace muduo
+{
+namespace net
+{
+
+namespace detail
+{
+struct BufferBlock;
+void intrusive_ptr_add_ref(BufferBlock* block);
+void intrusive_ptr_release(BufferBlock* block);
+}
+
+/// A buffer made of a chain of fixed-size blocks, an alternative to Buffer
+/// for large or forwarded data.
+///
+/// Blocks come from a per-thread pool and are reference counted, the
+/// buffer is a list of slices, each one a range of bytes in a block.
+/// Growing never moves the existing content, readFd() reads straight into
+/// blocks, and writeFd() hands the whole chain to writev(2).
+///
+/// Copying a ChainBuffer, append(const ChainBuffer&) and slice() share
+/// blocks instead of copying bytes, so a proxy can pass what it read from
+/// one TcpConnection to another, even one in another loop.  Shared blocks
+/// are never written to again, so both sides may use their copy freely,
+/// but a single ChainBuffer is not thread safe.
+///
+/// @code
+///   slices_:  [ block A: off, len ][ block B: 0, len ][ block C: 0, len ]
+///                                                      ^ written to if
+///                                                        not shared
+/// @endcode
+class ChainBuffer : public muduo::copyable
+{
+ public:
+  static const size_t kBlockSize = 16384;
+
+  ChainBuffer();
+  ~ChainBuffer();
+
+  // implicit copy-ctor and assignment share the blocks
+
+  void swap(ChainBuffer& rhs);
+
+  size_t readableBytes() const
+  { return readable_; }
+
+  /// Number of slices, the iovcnt writeFd() would use.
+  size_t numSlices() const
+  { return slices_.size(); }
+
+  /// The first contiguous piece of the content, may be shorter than
+  /// readableBytes().
+  StringPiece front() const;
+
+  void append(const char* data, size_t len);
+  void append(const void* data, size_t len)
+  { append(static_cast<const char*>(data), len); }
+  void append(const StringPiece& str)
+  { append(str.data(), str.size()); }
+
+  /// Appends the content of buf without copying the bytes.
+  void append(const ChainBuffer& buf);
+
+  /// Appends the content of buf without copying the bytes, and
+  /// empties buf.
+  void appendAndClear(ChainBuffer* buf);
+
+  /// Returns [offset, offset+len) of the content, sharing the blocks.
+  ChainBuffer slice(size_t offset, size_t len) const;
+
+  void retrieve(size_t len);
+  void retrieveAll();
+  string retrieveAsString(size_t len);
+  string retrieveAllAsString()
+  { return retrieveAsString(readableBytes()); }
+
+  /// Copies [offset, offset+len) of the content to dest.
+  void copyOut(size_t offset, char* dest, size_t len) const;
+
+  /// Fills iov with the slices from the front, returns the count.
+  int peekIovec(struct iovec* iov, int maxiov) const;
+
+  /// Reads data directly into blocks, at most 64KB at a time.
+  ssize_t readFd(int fd, int* savedErrno);
+
+  /// Writes as much as the kernel takes with one writev(2), and
+  /// retrieves that.
+  ssize_t writeFd(int fd, int* savedErrno);
+
+ private:
+  struct Slice
+  {
+    boost::intrusive_ptr<detail::BufferBlock> block;
+    size_t offset;
+    size_t len;
+  };
+
+  // room after the last slice, if its block is not shared
+  char* tailRoom(size_t* len);
+  void appendNewBlock(const boost::intrusive_ptr<detail::BufferBlock>& block,
+                      size_t len);
+
+  std::deque<Slice> slices_;
+  size_t readable_;
+};
+
+}
+}
+
+#endif  // MUDUO_NET_CHAINBUFFER_H
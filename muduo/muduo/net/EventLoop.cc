@@ -18,6 +18,7 @@
 #include <boost/bind.hpp>
 
 #include <signal.h>
+#include <stdlib.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 
@@ -72,7 +73,9 @@ EventLoop::EventLoop()
     timerQueue_(new TimerQueue(this)),
     wakeupFd_(createEventfd()),
     wakeupChannel_(new Channel(this, wakeupFd_)),
-    currentActiveChannel_(NULL)
+    currentActiveChannel_(NULL),
+    sleeping_(0),
+    wakeupPending_(0)
 {
   LOG_DEBUG << "EventLoop created " << this << " in thread " << threadId_;
   if (t_loopInThisThread)
@@ -89,6 +92,11 @@ EventLoop::EventLoop()
       boost::bind(&EventLoop::handleRead, this));
   // we are always reading the wakeupfd
   wakeupChannel_->enableReading();
+
+  if (::getenv("MUDUO_USE_TIMING_WHEEL"))
+  {
+    useTimingWheel();
+  }
 }
 
 EventLoop::~EventLoop()
@@ -112,7 +120,13 @@ void EventLoop::loop()
   while (!quit_)
   {
     activeChannels_.clear();
-    pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+    // Say we may sleep, then look at the queue once more: any functor
+    // queued after this either shows up here, or sees sleeping_ and
+    // wakes us up.
+    __atomic_store_n(&sleeping_, 1, __ATOMIC_SEQ_CST);
+    int timeoutMs = pendingFunctors_.empty() ? kPollTimeMs : 0;
+    pollReturnTime_ = poller_->poll(timeoutMs, &activeChannels_);
+    __atomic_store_n(&sleeping_, 0, __ATOMIC_RELAXED);
     ++iteration_;
     if (Logger::logLevel() <= Logger::TRACE)
     {
@@ -163,20 +177,12 @@ void EventLoop::runInLoop(const Functor& cb)
 
 void EventLoop::queueInLoop(const Functor& cb)
 {
-  {
-  MutexLockGuard lock(mutex_);
-  pendingFunctors_.push_back(cb);
-  }
-
-  if (!isInLoopThread() || callingPendingFunctors_)
-  {
-    wakeup();
-  }
+  pendingFunctors_.push(cb);
+  wakeupIfSleeping();
 }
 
 size_t EventLoop::queueSize() const
 {
-  MutexLockGuard lock(mutex_);
   return pendingFunctors_.size();
 }
 
@@ -213,15 +219,8 @@ void EventLoop::runInLoop(Functor&& cb)
 
 void EventLoop::queueInLoop(Functor&& cb)
 {
-  {
-  MutexLockGuard lock(mutex_);
-  pendingFunctors_.push_back(std::move(cb));  // emplace_back
-  }
-
-  if (!isInLoopThread() || callingPendingFunctors_)
-  {
-    wakeup();
-  }
+  pendingFunctors_.push(std::move(cb));
+  wakeupIfSleeping();
 }
 
 TimerId EventLoop::runAt(const Timestamp& time, TimerCallback&& cb)
@@ -247,6 +246,11 @@ void EventLoop::cancel(TimerId timerId)
   return timerQueue_->cancel(timerId);
 }
 
+void EventLoop::useTimingWheel()
+{
+  timerQueue_->useTimingWheel();
+}
+
 void EventLoop::updateChannel(Channel* channel)
 {
   assert(channel->ownerLoop() == this);
@@ -292,6 +296,19 @@ void EventLoop::wakeup()
   }
 }
 
+// Only the first functor queued while the loop sleeps writes wakeupFd_.
+// In the loop thread sleeping_ is clear, and loop() looks at the queue
+// again before it polls.
+void EventLoop::wakeupIfSleeping()
+{
+  if (__atomic_load_n(&sleeping_, __ATOMIC_SEQ_CST) &&
+      !__atomic_load_n(&wakeupPending_, __ATOMIC_RELAXED) &&
+      !__atomic_exchange_n(&wakeupPending_, 1, __ATOMIC_SEQ_CST))
+  {
+    wakeup();
+  }
+}
+
 void EventLoop::handleRead()
 {
   uint64_t one = 1;
@@ -300,30 +317,26 @@ void EventLoop::handleRead()
   {
     LOG_ERROR << "EventLoop::handleRead() reads " << n << " bytes instead of 8";
   }
+  // Cleared only once read: while set, wakeupFd_ has a write in it or on
+  // its way, which is what lets wakeupIfSleeping() skip writing again.
+  __atomic_store_n(&wakeupPending_, 0, __ATOMIC_SEQ_CST);
 }
 
 void EventLoop::doPendingFunctors()
 {
-  std::vector<Functor> functors;
-  // callingPendingFunctors_是个优化措施
-  // 标识了是否正在处理这些函数
-
-  // 因为doPendingFunctors是在eventloop的最后处理的
-  // 因此如果此项为false，且isInLoopThread为true
-  // 则说明稍后一定会调用doPendingFunctors处理这些函数的
-  // 这样可以减少调用一次wakeup，减少一次io读写。
   callingPendingFunctors_ = true;
 
-  // 这里也是个优化，因为我们不知道这些func会运行多久
-  // 这样可以减少加锁时长, 以免调用这些func时，时间太长，其他线程无法queueInloop
+  // Only run what was queued before we started, functors queued by these
+  // ones run in the next iteration, after polling without blocking.
+  size_t n = pendingFunctors_.size();
+  for (size_t i = 0; i < n; ++i)
   {
-  MutexLockGuard lock(mutex_);
-  functors.swap(pendingFunctors_);
-  }
-
-  for (size_t i = 0; i < functors.size(); ++i)
-  {
-    functors[i]();
+    Functor functor;
+    if (!pendingFunctors_.pop(&functor))
+    {
+      break;
+    }
+    functor();
   }
   callingPendingFunctors_ = false;
 }
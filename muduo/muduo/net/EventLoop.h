@@ -19,6 +19,7 @@
 #include <boost/scoped_ptr.hpp>
 
 #include <muduo/base/Mutex.h>
+#include <muduo/base/MpscQueue.h>
 #include <muduo/base/CurrentThread.h>
 #include <muduo/base/Timestamp.h>
 #include <muduo/net/Callbacks.h>
@@ -73,8 +74,10 @@ class EventLoop : boost::noncopyable
   /// Queues callback in the loop thread.
   /// Runs after finish pooling.
   /// Safe to call from other threads.
+  /// Lock free, and only wakes up the loop if it is blocked in poll.
   void queueInLoop(const Functor& cb);
 
+  /// Approximate.
   size_t queueSize() const;
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
@@ -104,6 +107,16 @@ class EventLoop : boost::noncopyable
   /// Safe to call from other threads.
   ///
   void cancel(TimerId timerId);
+  ///
+  /// Keeps timers in a hierarchical timing wheel of 1ms ticks, instead of
+  /// a balanced tree.  Adding and canceling become O(1), for loops with
+  /// very many timers, such as one per connection; timers may run up to
+  /// 1ms late.  Must be called in the loop thread before any timer is
+  /// added, e.g. from a ThreadInitCallback.
+  /// Setting the environment variable MUDUO_USE_TIMING_WHEEL does this
+  /// for every EventLoop.
+  ///
+  void useTimingWheel();
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
   TimerId runAt(const Timestamp& time, TimerCallback&& cb);
@@ -143,6 +156,7 @@ class EventLoop : boost::noncopyable
  private:
   void abortNotInLoopThread();
   void handleRead();  // waked up
+  void wakeupIfSleeping();
   void doPendingFunctors();
 
   void printActiveChannels() const; // DEBUG
@@ -168,8 +182,9 @@ class EventLoop : boost::noncopyable
   ChannelList activeChannels_;
   Channel* currentActiveChannel_;
 
-  mutable MutexLock mutex_;
-  std::vector<Functor> pendingFunctors_ GUARDED_BY(mutex_);
+  MpscQueue<Functor> pendingFunctors_;
+  int sleeping_; /* atomic, set while the loop may block in poll */
+  int wakeupPending_; /* atomic, set once wakeupFd_ has been written */
 };
 
 }
@@ -105,8 +105,9 @@ void TcpConnection::send(const StringPiece& message)
     {
       // 如果不在eventloop的线程，则调用runInLoop
       // 把这个过程在eventloop的线程中执行，为了保证线程安全
+      void (TcpConnection::*fp)(const StringPiece& message) = &TcpConnection::sendInLoop;
       loop_->runInLoop(
-          boost::bind(&TcpConnection::sendInLoop,
+          boost::bind(fp,
                       this,     // FIXME
                       message.as_string()));
                     //std::forward<string>(message)));
@@ -126,8 +127,9 @@ void TcpConnection::send(Buffer* buf)
     }
     else
     {
+      void (TcpConnection::*fp)(const StringPiece& message) = &TcpConnection::sendInLoop;
       loop_->runInLoop(
-          boost::bind(&TcpConnection::sendInLoop,
+          boost::bind(fp,
                       this,     // FIXME
                       buf->retrieveAllAsString()));
                     //std::forward<string>(message)));
@@ -135,6 +137,27 @@ void TcpConnection::send(Buffer* buf)
   }
 }
 
+void TcpConnection::send(ChainBuffer* buf)
+{
+  if (state_ == kConnected)
+  {
+    if (loop_->isInLoopThread())
+    {
+      sendInLoop(*buf);
+    }
+    else
+    {
+      // the copy in the functor shares the blocks
+      void (TcpConnection::*fp)(const ChainBuffer& message) = &TcpConnection::sendInLoop;
+      loop_->runInLoop(
+          boost::bind(fp,
+                      this,     // FIXME
+                      *buf));
+    }
+    buf->retrieveAll();
+  }
+}
+
 void TcpConnection::sendInLoop(const StringPiece& message)
 {
   sendInLoop(message.data(), message.size());
@@ -152,7 +175,9 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
     return;
   }
   // if no thing in output queue, try writing directly
-  if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0)
+  if (!channel_->isWriting()
+      && outputBuffer_.readableBytes() == 0
+      && outputChain_.readableBytes() == 0)
   {
     nwrote = sockets::write(channel_->fd(), data, len);
     if (nwrote >= 0)
@@ -180,14 +205,82 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
   assert(remaining <= len);
   if (!faultError && remaining > 0)
   {
-    size_t oldLen = outputBuffer_.readableBytes();
+    size_t oldLen = pendingOutputBytes();
     if (oldLen + remaining >= highWaterMark_
         && oldLen < highWaterMark_
         && highWaterMarkCallback_)
     {
       loop_->queueInLoop(boost::bind(highWaterMarkCallback_, shared_from_this(), oldLen + remaining));
     }
-    outputBuffer_.append(static_cast<const char*>(data)+nwrote, remaining);
+    if (outputChain_.readableBytes() > 0)
+    {
+      outputChain_.append(static_cast<const char*>(data)+nwrote, remaining);
+    }
+    else
+    {
+      outputBuffer_.append(static_cast<const char*>(data)+nwrote, remaining);
+    }
+    if (!channel_->isWriting())
+    {
+      channel_->enableWriting();
+    }
+  }
+}
+
+void TcpConnection::sendInLoop(const ChainBuffer& message)
+{
+  loop_->assertInLoopThread();
+  bool faultError = false;
+  if (state_ == kDisconnected)
+  {
+    LOG_WARN << "disconnected, give up writing";
+    return;
+  }
+  size_t oldLen = pendingOutputBytes();
+  if (outputBuffer_.readableBytes() > 0)
+  {
+    // keep the order, the chain takes over what is queued
+    outputChain_.append(outputBuffer_.peek(), outputBuffer_.readableBytes());
+    outputBuffer_.retrieveAll();
+  }
+  outputChain_.append(message);
+
+  // if no thing in output queue, try writing directly
+  if (!channel_->isWriting() && oldLen == 0)
+  {
+    int savedErrno = 0;
+    ssize_t nwrote = outputChain_.writeFd(channel_->fd(), &savedErrno);
+    if (nwrote >= 0)
+    {
+      if (outputChain_.readableBytes() == 0 && writeCompleteCallback_)
+      {
+        loop_->queueInLoop(boost::bind(writeCompleteCallback_, shared_from_this()));
+      }
+    }
+    else if (savedErrno != EWOULDBLOCK)
+    {
+      errno = savedErrno;
+      LOG_SYSERR << "TcpConnection::sendInLoop";
+      if (errno == EPIPE || errno == ECONNRESET) // FIXME: any others?
+      {
+        faultError = true;
+      }
+    }
+  }
+
+  if (faultError)
+  {
+    outputChain_.retrieveAll();
+  }
+  else if (outputChain_.readableBytes() > 0)
+  {
+    size_t newLen = outputChain_.readableBytes();
+    if (newLen >= highWaterMark_
+        && oldLen < highWaterMark_
+        && highWaterMarkCallback_)
+    {
+      loop_->queueInLoop(boost::bind(highWaterMarkCallback_, shared_from_this(), newLen));
+    }
     if (!channel_->isWriting())
     {
       channel_->enableWriting();
@@ -374,13 +467,26 @@ void TcpConnection::handleWrite()
   loop_->assertInLoopThread();
   if (channel_->isWriting())
   {
-    ssize_t n = sockets::write(channel_->fd(),
-                               outputBuffer_.peek(),
-                               outputBuffer_.readableBytes());
+    ssize_t n;
+    if (outputChain_.readableBytes() > 0)
+    {
+      int savedErrno = 0;
+      n = outputChain_.writeFd(channel_->fd(), &savedErrno);
+      errno = savedErrno;
+    }
+    else
+    {
+      n = sockets::write(channel_->fd(),
+                         outputBuffer_.peek(),
+                         outputBuffer_.readableBytes());
+      if (n > 0)
+      {
+        outputBuffer_.retrieve(n);
+      }
+    }
     if (n > 0)
     {
-      outputBuffer_.retrieve(n);
-      if (outputBuffer_.readableBytes() == 0)
+      if (outputBuffer_.readableBytes() == 0 && outputChain_.readableBytes() == 0)
       {
         channel_->disableWriting();
         if (writeCompleteCallback_)
@@ -15,6 +15,7 @@
 #include <muduo/base/Types.h>
 #include <muduo/net/Callbacks.h>
 #include <muduo/net/Buffer.h>
+#include <muduo/net/ChainBuffer.h>
 #include <muduo/net/InetAddress.h>
 
 #include <boost/any.hpp>
@@ -68,6 +69,11 @@ class TcpConnection : boost::noncopyable,
   void send(const StringPiece& message);
   // void send(Buffer&& message); // C++11
   void send(Buffer* message);  // this one will swap data
+  // takes the blocks of message without copying, and writes them with
+  // writev(2).  Once used, later output is queued in a ChainBuffer
+  // until it drains, and outputBuffer() does not show it, use
+  // pendingOutputBytes() instead.
+  void send(ChainBuffer* message);
   void shutdown(); // NOT thread safe, no simultaneous calling
   // void shutdownAndForceCloseAfter(double seconds); // NOT thread safe, no simultaneous calling
   void forceClose();
@@ -106,6 +112,11 @@ class TcpConnection : boost::noncopyable,
   Buffer* outputBuffer()
   { return &outputBuffer_; }
 
+  // bytes queued for writing, in outputBuffer() or after a
+  // send(ChainBuffer*) in the chain, call it in loop thread.
+  size_t pendingOutputBytes() const
+  { return outputBuffer_.readableBytes() + outputChain_.readableBytes(); }
+
   /// Internal use only.
   void setCloseCallback(const CloseCallback& cb)
   { closeCallback_ = cb; }
@@ -124,6 +135,7 @@ class TcpConnection : boost::noncopyable,
   // void sendInLoop(string&& message);
   void sendInLoop(const StringPiece& message);
   void sendInLoop(const void* message, size_t len);
+  void sendInLoop(const ChainBuffer& message);
   void shutdownInLoop();
   // void shutdownAndForceCloseInLoop(double seconds);
   void forceCloseInLoop();
@@ -149,6 +161,7 @@ class TcpConnection : boost::noncopyable,
   size_t highWaterMark_;
   Buffer inputBuffer_;
   Buffer outputBuffer_; // FIXME: use list<Buffer> as output buffer.
+  ChainBuffer outputChain_;  // if not empty, holds all output, outputBuffer_ is empty
   boost::any context_;
   // FIXME: creationTime_, lastReceiveTime_
   //        bytesReceived_, bytesSent_
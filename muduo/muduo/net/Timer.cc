@@ -8,6 +8,8 @@
 
 #include <muduo/net/Timer.h>
 
+#include <assert.h>
+
 using namespace muduo;
 using namespace muduo::net;
 
@@ -24,3 +26,33 @@ void Timer::restart(Timestamp now)
     expiration_ = Timestamp::invalid();
   }
 }
+
+void Timer::reset(const TimerCallback& cb, Timestamp when, double interval)
+{
+  assert(!inWheel());
+  callback_ = cb;
+  expiration_ = when;
+  interval_ = interval;
+  repeat_ = interval > 0.0;
+  sequence_ = s_numCreated_.incrementAndGet();
+  canceled_ = false;
+}
+
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+void Timer::reset(TimerCallback&& cb, Timestamp when, double interval)
+{
+  assert(!inWheel());
+  callback_ = std::move(cb);
+  expiration_ = when;
+  interval_ = interval;
+  repeat_ = interval > 0.0;
+  sequence_ = s_numCreated_.incrementAndGet();
+  canceled_ = false;
+}
+#endif
+
+void Timer::clear()
+{
+  callback_ = TimerCallback();
+  canceled_ = true;
+}
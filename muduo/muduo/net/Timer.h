@@ -32,7 +32,12 @@ class Timer : boost::noncopyable
       expiration_(when),
       interval_(interval),
       repeat_(interval > 0.0),
-      sequence_(s_numCreated_.incrementAndGet())
+      sequence_(s_numCreated_.incrementAndGet()),
+      canceled_(false),
+      tick_(0),
+      slot_(-1),
+      next_(NULL),
+      pprev_(NULL)
   { }
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
@@ -41,7 +46,12 @@ class Timer : boost::noncopyable
       expiration_(when),
       interval_(interval),
       repeat_(interval > 0.0),
-      sequence_(s_numCreated_.incrementAndGet())
+      sequence_(s_numCreated_.incrementAndGet()),
+      canceled_(false),
+      tick_(0),
+      slot_(-1),
+      next_(NULL),
+      pprev_(NULL)
   { }
 #endif
 
@@ -56,14 +66,37 @@ class Timer : boost::noncopyable
 
   void restart(Timestamp now);
 
+  // for TimerQueue's free list, a timer is reused with a new sequence
+  void reset(const TimerCallback& cb, Timestamp when, double interval);
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+  void reset(TimerCallback&& cb, Timestamp when, double interval);
+#endif
+  // drops the callback, and whatever is bound to it
+  void clear();
+
+  // only used with TimingWheel, which may not delete a canceled timer
+  // until its callback returns
+  bool canceled() const { return canceled_; }
+  void setCanceled() { canceled_ = true; }
+  bool inWheel() const { return slot_ >= 0; }
+
   static int64_t numCreated() { return s_numCreated_.get(); }
 
  private:
-  const TimerCallback callback_;
+  friend class TimingWheel;
+
+  TimerCallback callback_;
   Timestamp expiration_;
-  const double interval_;
-  const bool repeat_;
-  const int64_t sequence_;
+  double interval_;
+  bool repeat_;
+  int64_t sequence_;
+  bool canceled_;
+
+  // intrusive links of TimingWheel
+  int64_t tick_;
+  int slot_;
+  Timer* next_;
+  Timer** pprev_;
 
   static AtomicInt64 s_numCreated_;
 };
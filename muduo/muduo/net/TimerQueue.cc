@@ -16,6 +16,7 @@
 #include <muduo/net/EventLoop.h>
 #include <muduo/net/Timer.h>
 #include <muduo/net/TimerId.h>
+#include <muduo/net/TimingWheel.h>
 
 #include <boost/bind.hpp>
 
@@ -67,6 +68,27 @@ void readTimerfd(int timerfd, Timestamp now)
   }
 }
 
+const int64_t kMicroSecondsPerTick = 1000;
+const int64_t kNoTick = INT64_MAX;
+
+// the first tick at or after when, so that no timer runs early
+int64_t tickOf(Timestamp when)
+{
+  return (when.microSecondsSinceEpoch() + kMicroSecondsPerTick - 1)
+         / kMicroSecondsPerTick;
+}
+
+// the last tick that is due at now
+int64_t lastTickAt(Timestamp now)
+{
+  return now.microSecondsSinceEpoch() / kMicroSecondsPerTick;
+}
+
+Timestamp timeOfTick(int64_t tick)
+{
+  return Timestamp(tick * kMicroSecondsPerTick);
+}
+
 void resetTimerfd(int timerfd, Timestamp expiration)
 {
   // wake up loop by timerfd_settime()
@@ -95,7 +117,8 @@ TimerQueue::TimerQueue(EventLoop* loop)
     timerfd_(createTimerfd()),
     timerfdChannel_(loop, timerfd_),
     timers_(),
-    callingExpiredTimers_(false)
+    callingExpiredTimers_(false),
+    armedTick_(kNoTick)
 {
   timerfdChannel_.setReadCallback(
       boost::bind(&TimerQueue::handleRead, this));
@@ -114,13 +137,44 @@ TimerQueue::~TimerQueue()
   {
     delete it->second;
   }
+  if (wheel_)
+  {
+    std::vector<Timer*> timers;
+    wheel_->removeAll(&timers);
+    for (size_t i = 0; i < timers.size(); ++i)
+    {
+      delete timers[i];
+    }
+  }
+  for (size_t i = 0; i < freeTimers_.size(); ++i)
+  {
+    delete freeTimers_[i];
+  }
+}
+
+void TimerQueue::useTimingWheel()
+{
+  loop_->assertInLoopThread();
+  assert(timers_.empty());
+  if (!wheel_)
+  {
+    wheel_.reset(new TimingWheel(lastTickAt(Timestamp::now()) + 1));
+  }
 }
 
 TimerId TimerQueue::addTimer(const TimerCallback& cb,
                              Timestamp when,
                              double interval)
 {
-  Timer* timer = new Timer(cb, when, interval);
+  Timer* timer = takeFreeTimer();
+  if (timer)
+  {
+    timer->reset(cb, when, interval);
+  }
+  else
+  {
+    timer = new Timer(cb, when, interval);
+  }
   loop_->runInLoop(
       boost::bind(&TimerQueue::addTimerInLoop, this, timer));
   return TimerId(timer, timer->sequence());
@@ -131,7 +185,15 @@ TimerId TimerQueue::addTimer(TimerCallback&& cb,
                              Timestamp when,
                              double interval)
 {
-  Timer* timer = new Timer(std::move(cb), when, interval);
+  Timer* timer = takeFreeTimer();
+  if (timer)
+  {
+    timer->reset(std::move(cb), when, interval);
+  }
+  else
+  {
+    timer = new Timer(std::move(cb), when, interval);
+  }
   loop_->runInLoop(
       boost::bind(&TimerQueue::addTimerInLoop, this, timer));
   return TimerId(timer, timer->sequence());
@@ -147,6 +209,11 @@ void TimerQueue::cancel(TimerId timerId)
 void TimerQueue::addTimerInLoop(Timer* timer)
 {
   loop_->assertInLoopThread();
+  if (wheel_)
+  {
+    addTimerInWheel(timer);
+    return;
+  }
   bool earliestChanged = insert(timer);
 
   if (earliestChanged)
@@ -158,6 +225,11 @@ void TimerQueue::addTimerInLoop(Timer* timer)
 void TimerQueue::cancelInLoop(TimerId timerId)
 {
   loop_->assertInLoopThread();
+  if (wheel_)
+  {
+    cancelInWheel(timerId);
+    return;
+  }
   assert(timers_.size() == activeTimers_.size());
   ActiveTimer timer(timerId.timer_, timerId.sequence_);
   ActiveTimerSet::iterator it = activeTimers_.find(timer);
@@ -165,7 +237,7 @@ void TimerQueue::cancelInLoop(TimerId timerId)
   {
     size_t n = timers_.erase(Entry(it->first->expiration(), it->first));
     assert(n == 1); (void)n;
-    delete it->first; // FIXME: no delete please
+    releaseTimer(it->first);
     activeTimers_.erase(it);
   }
   else if (callingExpiredTimers_)
@@ -181,6 +253,11 @@ void TimerQueue::handleRead()
   loop_->assertInLoopThread();
   Timestamp now(Timestamp::now());
   readTimerfd(timerfd_, now);
+  if (wheel_)
+  {
+    handleReadWheel(now);
+    return;
+  }
 
   std::vector<Entry> expired = getExpired(now);
 
@@ -235,8 +312,7 @@ void TimerQueue::reset(const std::vector<Entry>& expired, Timestamp now)
     }
     else
     {
-      // FIXME move to a free list
-      delete it->second; // FIXME: no delete please
+      releaseTimer(it->second);
     }
   }
 
@@ -277,3 +353,99 @@ bool TimerQueue::insert(Timer* timer)
   return earliestChanged;
 }
 
+
+void TimerQueue::addTimerInWheel(Timer* timer)
+{
+  if (wheel_->empty())
+  {
+    // catch up with the time the wheel sat idle
+    wheel_->advance(lastTickAt(Timestamp::now()), &expiredTimers_);
+  }
+  int64_t tick = tickOf(timer->expiration());
+  wheel_->add(timer, tick);
+  if (tick < armedTick_)
+  {
+    armWheel();
+  }
+}
+
+void TimerQueue::cancelInWheel(TimerId timerId)
+{
+  Timer* timer = timerId.timer_;
+  if (timer && timer->sequence() == timerId.sequence_ && !timer->canceled())
+  {
+    if (timer->inWheel())
+    {
+      wheel_->remove(timer);
+      releaseTimer(timer);
+    }
+    else
+    {
+      // expired, handleReadWheel() neither runs nor restarts it
+      timer->setCanceled();
+    }
+  }
+}
+
+void TimerQueue::handleReadWheel(Timestamp now)
+{
+  armedTick_ = kNoTick;  // the timerfd is one shot
+  expiredTimers_.clear();
+  wheel_->advance(lastTickAt(now), &expiredTimers_);
+
+  callingExpiredTimers_ = true;
+  for (size_t i = 0; i < expiredTimers_.size(); ++i)
+  {
+    if (!expiredTimers_[i]->canceled())
+    {
+      expiredTimers_[i]->run();
+    }
+  }
+  callingExpiredTimers_ = false;
+
+  for (size_t i = 0; i < expiredTimers_.size(); ++i)
+  {
+    Timer* timer = expiredTimers_[i];
+    if (timer->repeat() && !timer->canceled())
+    {
+      timer->restart(now);
+      wheel_->add(timer, tickOf(timer->expiration()));
+    }
+    else
+    {
+      releaseTimer(timer);
+    }
+  }
+  expiredTimers_.clear();
+  armWheel();
+}
+
+void TimerQueue::armWheel()
+{
+  if (!wheel_->empty())
+  {
+    int64_t tick = wheel_->nextTick();
+    if (tick < armedTick_)
+    {
+      resetTimerfd(timerfd_, timeOfTick(tick));
+      armedTick_ = tick;
+    }
+  }
+}
+
+Timer* TimerQueue::takeFreeTimer()
+{
+  Timer* timer = NULL;
+  if (loop_->isInLoopThread() && !freeTimers_.empty())
+  {
+    timer = freeTimers_.back();
+    freeTimers_.pop_back();
+  }
+  return timer;
+}
+
+void TimerQueue::releaseTimer(Timer* timer)
+{
+  timer->clear();
+  freeTimers_.push_back(timer);
+}
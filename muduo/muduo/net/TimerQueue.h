@@ -15,6 +15,7 @@
 #include <vector>
 
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <muduo/base/Mutex.h>
 #include <muduo/base/Timestamp.h>
@@ -29,6 +30,7 @@ namespace net
 class EventLoop;
 class Timer;
 class TimerId;
+class TimingWheel;
 
 ///
 /// A best efforts timer queue.
@@ -56,6 +58,13 @@ class TimerQueue : boost::noncopyable
 
   void cancel(TimerId timerId);
 
+  ///
+  /// Keeps timers in a TimingWheel of 1ms ticks instead of two sets,
+  /// addTimer() and cancel() become O(1), timers may run up to 1ms late.
+  /// Must be called in the loop thread, before any timer is added.
+  ///
+  void useTimingWheel();
+
  private:
 
   // FIXME: use unique_ptr<Timer> instead of raw pointers.
@@ -76,6 +85,16 @@ class TimerQueue : boost::noncopyable
 
   bool insert(Timer* timer);
 
+  // with wheel_
+  void addTimerInWheel(Timer* timer);
+  void cancelInWheel(TimerId timerId);
+  void handleReadWheel(Timestamp now);
+  void armWheel();
+
+  // free list of timers, only used in the loop thread
+  Timer* takeFreeTimer();
+  void releaseTimer(Timer* timer);
+
   EventLoop* loop_;
   const int timerfd_;
   Channel timerfdChannel_;
@@ -86,6 +105,15 @@ class TimerQueue : boost::noncopyable
   ActiveTimerSet activeTimers_;
   bool callingExpiredTimers_; /* atomic */
   ActiveTimerSet cancelingTimers_;
+
+  // replaces timers_ and activeTimers_ after useTimingWheel().
+  // Timers are never deleted before ~TimerQueue(), so cancel()
+  // can look at the Timer of any TimerId.
+  boost::scoped_ptr<TimingWheel> wheel_;
+  std::vector<Timer*> expiredTimers_;
+  int64_t armedTick_;
+
+  std::vector<Timer*> freeTimers_;
 };
 
 }
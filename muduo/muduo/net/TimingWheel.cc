@@ -0,0 +1,216 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+
+#include <muduo/net/TimingWheel.h>
+
+#include <muduo/net/Timer.h>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+namespace
+{
+// level 0 has slots [0, 256), level n > 0 has [256 + 64*(n-1), 256 + 64*n)
+const int64_t kLevel0Ticks = 256;
+const int64_t kMaxTicks = 1LL << 32;
+
+int shiftOfLevel(int level)
+{
+  return 8 + 6 * (level - 1);
+}
+
+int firstSlotOfLevel(int level)
+{
+  return 256 + 64 * (level - 1);
+}
+}
+
+TimingWheel::TimingWheel(int64_t now)
+  : current_(now),
+    size_(0)
+{
+  memset(slots_, 0, sizeof slots_);
+  memset(bitmap_, 0, sizeof bitmap_);
+}
+
+void TimingWheel::add(Timer* timer, int64_t tick)
+{
+  assert(!timer->inWheel());
+  timer->tick_ = tick;
+  if (tick < current_)
+  {
+    tick = current_;
+  }
+  int64_t delta = tick - current_;
+  if (delta >= kMaxTicks)
+  {
+    // put back in the last level on every pass, until near enough
+    delta = kMaxTicks - 1;
+    tick = current_ + delta;
+  }
+
+  int slot;
+  if (delta < kLevel0Ticks)
+  {
+    slot = static_cast<int>(tick & 255);
+  }
+  else
+  {
+    int level = 1;
+    while (level < kLevels - 1 && delta >= (1LL << shiftOfLevel(level + 1)))
+    {
+      ++level;
+    }
+    slot = firstSlotOfLevel(level)
+           + static_cast<int>((tick >> shiftOfLevel(level)) & 63);
+  }
+  link(timer, slot);
+  ++size_;
+}
+
+void TimingWheel::remove(Timer* timer)
+{
+  assert(timer->inWheel());
+  int slot = timer->slot_;
+  *timer->pprev_ = timer->next_;
+  if (timer->next_)
+  {
+    timer->next_->pprev_ = timer->pprev_;
+  }
+  if (slots_[slot] == NULL)
+  {
+    bitmap_[slot / 64] &= ~(1ULL << (slot % 64));
+  }
+  timer->slot_ = -1;
+  timer->next_ = NULL;
+  timer->pprev_ = NULL;
+  --size_;
+}
+
+void TimingWheel::advance(int64_t tick, std::vector<Timer*>* expired)
+{
+  while (current_ <= tick)
+  {
+    if (size_ == 0)
+    {
+      current_ = tick + 1;
+      break;
+    }
+
+    int idx = static_cast<int>(current_ & 255);
+    if (idx == 0)
+    {
+      // level 0 wrapped, move the next slot of level 1 down, and so on
+      for (int level = 1; level < kLevels; ++level)
+      {
+        int i = static_cast<int>((current_ >> shiftOfLevel(level)) & 63);
+        cascade(firstSlotOfLevel(level) + i);
+        if (i != 0)
+        {
+          break;
+        }
+      }
+    }
+
+    while (Timer* timer = slots_[idx])
+    {
+      remove(timer);
+      expired->push_back(timer);
+    }
+
+    // skip the empty slots, but not past tick
+    int next = findNext(idx + 1, 256);
+    int64_t step = next - idx;
+    current_ = std::min(current_ + step, tick + 1);
+  }
+}
+
+int64_t TimingWheel::nextTick() const
+{
+  int idx = static_cast<int>(current_ & 255);
+  if (idx == 0)
+  {
+    return current_;  // a cascade is due
+  }
+  int next = findNext(idx, 256);
+  if (next < 256)
+  {
+    return current_ + (next - idx);
+  }
+
+  int64_t boundary = current_ + (kLevel0Ticks - idx);
+  int i = static_cast<int>((boundary >> 8) & 63);
+  if (findNext(0, idx) < idx || i == 0)
+  {
+    return boundary;
+  }
+  // level 0 is empty, sleep until level 1 has something to move down
+  int first = firstSlotOfLevel(1);
+  int n = findNext(first + i, first + 64);
+  return boundary + (static_cast<int64_t>(n - first - i) << 8);
+}
+
+void TimingWheel::removeAll(std::vector<Timer*>* timers)
+{
+  for (int slot = findNext(0, kSlots); slot < kSlots; slot = findNext(slot, kSlots))
+  {
+    while (Timer* timer = slots_[slot])
+    {
+      remove(timer);
+      timers->push_back(timer);
+    }
+  }
+  assert(size_ == 0);
+}
+
+void TimingWheel::link(Timer* timer, int slot)
+{
+  timer->slot_ = slot;
+  timer->next_ = slots_[slot];
+  timer->pprev_ = &slots_[slot];
+  if (timer->next_)
+  {
+    timer->next_->pprev_ = &timer->next_;
+  }
+  slots_[slot] = timer;
+  bitmap_[slot / 64] |= 1ULL << (slot % 64);
+}
+
+void TimingWheel::cascade(int slot)
+{
+  Timer* timer = slots_[slot];
+  slots_[slot] = NULL;
+  bitmap_[slot / 64] &= ~(1ULL << (slot % 64));
+  while (timer)
+  {
+    Timer* next = timer->next_;
+    timer->slot_ = -1;
+    timer->next_ = NULL;
+    timer->pprev_ = NULL;
+    --size_;
+    add(timer, timer->tick_);
+    timer = next;
+  }
+}
+
+int TimingWheel::findNext(int first, int last) const
+{
+  while (first < last)
+  {
+    uint64_t word = bitmap_[first / 64] >> (first % 64);
+    if (word)
+    {
+      int found = first + __builtin_ctzll(word);
+      return found < last ? found : last;
+    }
+    first = (first / 64 + 1) * 64;
+  }
+  return last;
+}
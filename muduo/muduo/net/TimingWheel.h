@@ -0,0 +1,77 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// Author: Shuo Chen (chenshuo at chenshuo dot com)
+//
+// This is an internal header file, you should not include this.
+
+#ifndef MUDUO_NET_TIMINGWHEEL_H
+#define MUDUO_NET_TIMINGWHEEL_H
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <muduo/base/Types.h>
+
+namespace muduo
+{
+namespace net
+{
+
+class Timer;
+
+///
+/// Hierarchical timing wheel of Timer, used by TimerQueue::useTimingWheel().
+///
+/// Five levels of 256, 64, 64, 64 and 64 slots cover 2^32 ticks, farther
+/// timers wait in the last level and are put back on every pass.
+/// Timers are linked into slots through their own members, so add() and
+/// remove() are O(1) and never allocate.  A timer in a higher level moves
+/// down when the lower level wraps around, as in the classic Linux kernel
+/// timers.  Does not own the timers.
+///
+class TimingWheel : boost::noncopyable
+{
+ public:
+  /// @c now is the first tick to be processed.
+  explicit TimingWheel(int64_t now);
+
+  /// Links the timer to expire at @c tick, or at the next tick processed
+  /// if that is already past.
+  void add(Timer* timer, int64_t tick);
+  void remove(Timer* timer);
+
+  /// Processes all ticks up to and including @c tick, and appends the
+  /// timers due to @c expired, unlinked.
+  void advance(int64_t tick, std::vector<Timer*>* expired);
+
+  /// The earliest tick at which advance() has something to do,
+  /// which may be a tick where timers only move down a level.
+  /// Only meaningful if !empty().
+  int64_t nextTick() const;
+
+  /// Unlinks all timers, appending them to @c timers.
+  void removeAll(std::vector<Timer*>* timers);
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+ private:
+  static const int kLevels = 5;
+  static const int kSlots = 256 + 4 * 64;
+
+  void link(Timer* timer, int slot);
+  void cascade(int slot);
+  // first non-empty slot in [first, last), or last
+  int findNext(int first, int last) const;
+
+  int64_t current_;  // next tick to process
+  size_t size_;
+  Timer* slots_[kSlots];
+  uint64_t bitmap_[kSlots / 64];  // non-empty slots
+};
+
+}
+}
+#endif  // MUDUO_NET_TIMINGWHEEL_H
@@ -9,6 +9,7 @@ project "net"
     headers {
         'Buffer.h',
         'Callbacks.h',
+        'ChainBuffer.h',
         'Channel.h',
         'Endian.h',
         'EventLoop.h',
@@ -24,6 +25,7 @@ project "net"
     files {
         'Acceptor.cc',
         'Buffer.cc',
+        'ChainBuffer.cc',
         'Channel.cc',
         'Connector.cc',
         'EventLoop.cc',
@@ -41,5 +43,6 @@ project "net"
         'TcpServer.cc',
         'Timer.cc',
         'TimerQueue.cc',
+        'TimingWheel.cc',
      }
 
@@ -0,0 +1,210 @@
+#include <muduo/net/ChainBuffer.h>
+
+#include <muduo/base/Thread.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpConnection.h>
+
+#include <boost/bind.hpp>
+
+//#define BOOST_TEST_MODULE ChainBufferTest
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using muduo::string;
+using muduo::Thread;
+using muduo::net::ChainBuffer;
+using muduo::net::EventLoop;
+using muduo::net::InetAddress;
+using muduo::net::TcpConnection;
+using muduo::net::TcpConnectionPtr;
+
+namespace
+{
+
+string pattern(size_t len, int seed)
+{
+  string result(len, '\0');
+  for (size_t i = 0; i < len; ++i)
+  {
+    result[i] = static_cast<char>('a' + (i + seed) % 26);
+  }
+  return result;
+}
+
+string content(const ChainBuffer& buf)
+{
+  string result(buf.readableBytes(), '\0');
+  if (!result.empty())
+  {
+    buf.copyOut(0, &*result.begin(), result.size());
+  }
+  return result;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(testChainBufferAppendRetrieve)
+{
+  ChainBuffer buf;
+  BOOST_CHECK_EQUAL(buf.readableBytes(), 0);
+  BOOST_CHECK_EQUAL(buf.numSlices(), 0);
+
+  buf.append(string(200, 'x'));
+  buf.append(string(300, 'y'));
+  BOOST_CHECK_EQUAL(buf.readableBytes(), 500);
+  BOOST_CHECK_EQUAL(buf.numSlices(), 1);
+  BOOST_CHECK_EQUAL(buf.front().size(), 500);
+
+  BOOST_CHECK_EQUAL(buf.retrieveAsString(50), string(50, 'x'));
+  BOOST_CHECK_EQUAL(buf.readableBytes(), 450);
+  BOOST_CHECK_EQUAL(buf.retrieveAllAsString(), string(150, 'x') + string(300, 'y'));
+  BOOST_CHECK_EQUAL(buf.readableBytes(), 0);
+
+  const string big = pattern(3 * ChainBuffer::kBlockSize + 100, 0);
+  buf.append(big);
+  BOOST_CHECK_EQUAL(buf.readableBytes(), big.size());
+  BOOST_CHECK_EQUAL(buf.numSlices(), 4);
+  BOOST_CHECK_EQUAL(buf.front().size(), ChainBuffer::kBlockSize);
+  BOOST_CHECK_EQUAL(content(buf), big);
+
+  buf.retrieve(ChainBuffer::kBlockSize + 10);
+  BOOST_CHECK_EQUAL(buf.numSlices(), 3);
+  BOOST_CHECK_EQUAL(content(buf), big.substr(ChainBuffer::kBlockSize + 10));
+}
+
+BOOST_AUTO_TEST_CASE(testChainBufferShare)
+{
+  ChainBuffer buf;
+  const string data = pattern(2 * ChainBuffer::kBlockSize, 1);
+  buf.append(data);
+
+  ChainBuffer part = buf.slice(100, ChainBuffer::kBlockSize);
+  BOOST_CHECK_EQUAL(part.readableBytes(), ChainBuffer::kBlockSize);
+  BOOST_CHECK_EQUAL(part.numSlices(), 2);
+  BOOST_CHECK_EQUAL(content(part), data.substr(100, ChainBuffer::kBlockSize));
+
+  // a shared block is not written to, appending goes to a new one
+  ChainBuffer head = buf.slice(0, 10);
+  head.append("tail", 4);
+  BOOST_CHECK_EQUAL(head.numSlices(), 2);
+  BOOST_CHECK_EQUAL(content(head), data.substr(0, 10) + "tail");
+  BOOST_CHECK_EQUAL(content(buf), data);
+  BOOST_CHECK_EQUAL(content(part), data.substr(100, ChainBuffer::kBlockSize));
+
+  ChainBuffer copy(buf);
+  buf.retrieveAll();
+  BOOST_CHECK_EQUAL(content(copy), data);
+
+  ChainBuffer dest;
+  dest.append("head", 4);
+  dest.appendAndClear(&copy);
+  BOOST_CHECK_EQUAL(copy.readableBytes(), 0);
+  BOOST_CHECK_EQUAL(dest.numSlices(), 3);
+  BOOST_CHECK_EQUAL(content(dest), "head" + data);
+
+  dest.append(dest);
+  BOOST_CHECK_EQUAL(content(dest), "head" + data + "head" + data);
+}
+
+BOOST_AUTO_TEST_CASE(testChainBufferReadWriteFd)
+{
+  int fds[2];
+  BOOST_REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  const string data = pattern(40000, 2);
+  BOOST_REQUIRE(::write(fds[1], data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+
+  ChainBuffer buf;
+  buf.append("abc", 3);
+  int savedErrno = 0;
+  ssize_t total = 0;
+  while (total < static_cast<ssize_t>(data.size()))
+  {
+    ssize_t n = buf.readFd(fds[0], &savedErrno);
+    BOOST_REQUIRE(n > 0);
+    total += n;
+  }
+  BOOST_CHECK_EQUAL(content(buf), "abc" + data);
+
+  ssize_t n = buf.writeFd(fds[0], &savedErrno);
+  BOOST_CHECK_EQUAL(n, static_cast<ssize_t>(data.size() + 3));
+  BOOST_CHECK_EQUAL(buf.readableBytes(), 0);
+  string received(data.size() + 3, '\0');
+  size_t got = 0;
+  while (got < received.size())
+  {
+    ssize_t nr = ::read(fds[1], &received[got], received.size() - got);
+    BOOST_REQUIRE(nr > 0);
+    got += nr;
+  }
+  BOOST_CHECK_EQUAL(received, "abc" + data);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+namespace
+{
+
+void readAll(EventLoop* loop, int fd, size_t len, string* result)
+{
+  char buf[65536];
+  while (result->size() < len)
+  {
+    ssize_t n = ::read(fd, buf, sizeof buf);
+    if (n <= 0)
+    {
+      break;
+    }
+    result->append(buf, n);
+  }
+  loop->quit();
+}
+
+void sendAll(const TcpConnectionPtr& conn, const string* first, ChainBuffer* chain)
+{
+  conn->send(*first);
+  conn->send(chain);
+  conn->send(" last");
+}
+
+}
+
+// Output queued as Buffer, then ChainBuffer, then Buffer again must come
+// out in order, each one larger than the socket buffer.
+BOOST_AUTO_TEST_CASE(testTcpConnectionSendChain)
+{
+  int fds[2];
+  BOOST_REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+  const string data = pattern(4 * 1024 * 1024, 3);
+  ChainBuffer chain;
+  chain.append(data);
+  const string first = pattern(1024 * 1024, 4);
+  const string expected = first + data + " last";
+
+  EventLoop loop;
+  InetAddress addr(0);
+  TcpConnectionPtr conn(new TcpConnection(&loop, "chain", fds[0], addr, addr));
+  conn->setConnectionCallback(muduo::net::defaultConnectionCallback);
+  conn->setMessageCallback(muduo::net::defaultMessageCallback);
+  conn->connectEstablished();
+
+  string received;
+  Thread reader(boost::bind(readAll, &loop, fds[1], expected.size(), &received), "reader");
+  reader.start();
+  loop.runInLoop(boost::bind(sendAll, conn, &first, &chain));
+  loop.loop();
+  reader.join();
+  BOOST_CHECK_EQUAL(chain.readableBytes(), 0);
+  BOOST_CHECK(received == expected);
+
+  conn->connectDestroyed();
+  conn.reset();
+  ::close(fds[1]);
+}
@@ -0,0 +1,142 @@
+// Throughput of TcpConnection::send() called from threads other than the
+// connection's loop, each call goes through EventLoop::queueInLoop().
+//
+// The connection is one end of a socketpair, a reader thread drains the
+// other end.  Reports messages per second, and how many loop iterations
+// it took, fewer iterations per message means more wakeups coalesced.
+//
+// usage: crossthreadsend_bench [senders] [messages per sender] [message size]
+
+#include <muduo/net/TcpConnection.h>
+
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Logging.h>
+#include <muduo/base/Thread.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThread.h>
+#include <muduo/net/InetAddress.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <fcntl.h>
+#include <stdio.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+int numSenders = 4;
+int numMessages = 100000;
+int messageSize = 64;
+
+CountDownLatch connected(1);
+CountDownLatch start(1);
+CountDownLatch destroyed(1);
+
+void onConnection(const TcpConnectionPtr& conn)
+{
+  if (conn->connected())
+  {
+    connected.countDown();
+  }
+  else
+  {
+    destroyed.countDown();
+  }
+}
+
+void sender(const TcpConnectionPtr& conn)
+{
+  string message(messageSize, 'S');
+  start.wait();
+  for (int i = 0; i < numMessages; ++i)
+  {
+    conn->send(message);
+  }
+}
+
+void reader(int fd, int64_t total, Timestamp* end)
+{
+  char buf[65536];
+  int64_t received = 0;
+  while (received < total)
+  {
+    ssize_t n = ::read(fd, buf, sizeof buf);
+    if (n <= 0)
+    {
+      LOG_SYSFATAL << "read";
+    }
+    received += n;
+  }
+  *end = Timestamp::now();
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc > 1)
+  {
+    numSenders = atoi(argv[1]);
+  }
+  if (argc > 2)
+  {
+    numMessages = atoi(argv[2]);
+  }
+  if (argc > 3)
+  {
+    messageSize = atoi(argv[3]);
+  }
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+  {
+    LOG_SYSFATAL << "socketpair";
+  }
+  ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+  EventLoopThread loopThread;
+  EventLoop* loop = loopThread.startLoop();
+  InetAddress addr(0);
+  TcpConnectionPtr conn(new TcpConnection(loop, "bench", fds[0], addr, addr));
+  conn->setConnectionCallback(onConnection);
+  conn->setMessageCallback(defaultMessageCallback);
+  loop->runInLoop(boost::bind(&TcpConnection::connectEstablished, conn));
+  connected.wait();
+
+  int64_t total = static_cast<int64_t>(numSenders) * numMessages * messageSize;
+  Timestamp end;
+  Thread readerThread(boost::bind(reader, fds[1], total, &end), "reader");
+  readerThread.start();
+
+  boost::ptr_vector<Thread> senders;
+  for (int i = 0; i < numSenders; ++i)
+  {
+    senders.push_back(new Thread(boost::bind(sender, conn)));
+    senders.back().start();
+  }
+
+  int64_t iterations = loop->iteration();
+  Timestamp begin(Timestamp::now());
+  start.countDown();
+  for_each(senders.begin(), senders.end(), boost::bind(&Thread::join, _1));
+  readerThread.join();
+  iterations = loop->iteration() - iterations;
+
+  double seconds = timeDifference(end, begin);
+  int64_t messages = static_cast<int64_t>(numSenders) * numMessages;
+  printf("%d senders, %" PRId64 " messages of %d bytes in %.3f seconds\n",
+         numSenders, messages, messageSize, seconds);
+  printf("%.0f messages/s, %.2f MiB/s, %" PRId64 " loop iterations, %.3f per 1000 messages\n",
+         static_cast<double>(messages) / seconds,
+         static_cast<double>(total) / seconds / 1024 / 1024,
+         iterations,
+         static_cast<double>(iterations) * 1000 / static_cast<double>(messages));
+
+  loop->runInLoop(boost::bind(&TcpConnection::connectDestroyed, conn));
+  destroyed.wait();
+  conn.reset();
+  ::close(fds[1]);
+}
@@ -0,0 +1,129 @@
+// runInLoop() from several threads at once, each waiting for its functor
+// before queuing the next one, some pausing so the loop goes to sleep in
+// between.  A lost wakeup leaves a functor queued until poll() times out
+// (kPollTimeMs), so every one must run well within that.
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThread.h>
+
+#include <muduo/base/Condition.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+const int kThreads = 4;
+const int kRounds = 2000;
+const double kMaxLatency = 1.0;
+
+EventLoop* g_loop;
+
+class Waiter : boost::noncopyable
+{
+ public:
+  Waiter()
+    : cond_(mutex_),
+      done_(false),
+      maxLatency_(0.0),
+      late_(0)
+  {
+  }
+
+  void run(int seed)
+  {
+    unsigned int r = seed;
+    for (int i = 0; i < kRounds; ++i)
+    {
+      if (rand_r(&r) % 4 == 0)
+      {
+        usleep(rand_r(&r) % 200);
+      }
+      {
+        MutexLockGuard lock(mutex_);
+        done_ = false;
+      }
+      Timestamp start(Timestamp::now());
+      g_loop->runInLoop(boost::bind(&Waiter::done, this));
+      MutexLockGuard lock(mutex_);
+      while (!done_)
+      {
+        if (cond_.waitForSeconds(2 * kMaxLatency))
+        {
+          break;
+        }
+      }
+      double latency = timeDifference(Timestamp::now(), start);
+      if (latency > maxLatency_)
+      {
+        maxLatency_ = latency;
+      }
+      if (latency > kMaxLatency)
+      {
+        ++late_;
+      }
+      // wait the functor out, so the next round doesn't see it
+      while (!done_)
+      {
+        cond_.wait();
+      }
+    }
+  }
+
+  double maxLatency() const { return maxLatency_; }
+  int late() const { return late_; }
+
+ private:
+  void done()
+  {
+    MutexLockGuard lock(mutex_);
+    done_ = true;
+    cond_.notify();
+  }
+
+  MutexLock mutex_;
+  Condition cond_;
+  bool done_;
+  double maxLatency_;
+  int late_;
+};
+
+int main()
+{
+  EventLoopThread loopThread;
+  g_loop = loopThread.startLoop();
+
+  boost::ptr_vector<Waiter> waiters;
+  boost::ptr_vector<Thread> threads;
+  for (int i = 0; i < kThreads; ++i)
+  {
+    waiters.push_back(new Waiter);
+    threads.push_back(new Thread(boost::bind(&Waiter::run, &waiters[i], i + 1)));
+    threads.back().start();
+  }
+
+  double maxLatency = 0.0;
+  int late = 0;
+  for (int i = 0; i < kThreads; ++i)
+  {
+    threads[i].join();
+    if (waiters[i].maxLatency() > maxLatency)
+    {
+      maxLatency = waiters[i].maxLatency();
+    }
+    late += waiters[i].late();
+  }
+  printf("%d functors, max latency %.6f seconds, %d late\n",
+         kThreads * kRounds, maxLatency, late);
+  assert(late == 0);
+  (void)late;
+}
@@ -0,0 +1,100 @@
+// Compares the default TimerQueue with EventLoop::useTimingWheel(),
+// with one idle timer per connection as in examples/idleconnection:
+// add a timer for each of N connections, then on "activity" cancel and
+// add it again, cancel them all, and finally let N short timers expire.
+//
+// usage: timerqueue_bench [timers]
+
+#include <muduo/net/EventLoop.h>
+
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+int numTimers = 500000;
+int fired = 0;
+double lateness = 0;
+
+void onIdle()
+{
+}
+
+void onShort(EventLoop* loop, Timestamp when)
+{
+  lateness += timeDifference(Timestamp::now(), when);
+  if (++fired == numTimers)
+  {
+    loop->quit();
+  }
+}
+
+void bench(bool wheel)
+{
+  EventLoop loop;
+  if (wheel)
+  {
+    loop.useTimingWheel();
+  }
+  std::vector<TimerId> timers(numTimers);
+  srand(1);
+
+  Timestamp start(Timestamp::now());
+  for (int i = 0; i < numTimers; ++i)
+  {
+    timers[i] = loop.runAfter(8.0 + rand() % 1000 / 1000.0, onIdle);
+  }
+  Timestamp added(Timestamp::now());
+  for (int i = 0; i < numTimers; ++i)
+  {
+    int j = rand() % numTimers;
+    loop.cancel(timers[j]);
+    timers[j] = loop.runAfter(8.0 + rand() % 1000 / 1000.0, onIdle);
+  }
+  Timestamp refreshed(Timestamp::now());
+  for (int i = 0; i < numTimers; ++i)
+  {
+    loop.cancel(timers[i]);
+  }
+  Timestamp canceled(Timestamp::now());
+
+  fired = 0;
+  lateness = 0;
+  Timestamp now(Timestamp::now());
+  for (int i = 0; i < numTimers; ++i)
+  {
+    Timestamp when(addTime(now, 0.05 + rand() % 200 / 1000.0));
+    loop.runAt(when, boost::bind(onShort, &loop, when));
+  }
+  loop.loop();
+  Timestamp end(Timestamp::now());
+
+  double n = numTimers;
+  printf("%-6s %8.0f %8.0f %8.0f %10.3f %12.3f\n",
+         wheel ? "wheel" : "set",
+         timeDifference(added, start) * 1e9 / n,
+         timeDifference(refreshed, added) * 1e9 / n,
+         timeDifference(canceled, refreshed) * 1e9 / n,
+         timeDifference(end, now),
+         lateness * 1e3 / n);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc > 1)
+  {
+    numTimers = atoi(argv[1]);
+  }
+  printf("%d timers\n", numTimers);
+  printf("%-6s %8s %8s %8s %10s %12s\n",
+         "queue", "add ns", "reset ns", "cancel ns", "expire s", "late ms avg");
+  bench(false);
+  bench(true);
+}
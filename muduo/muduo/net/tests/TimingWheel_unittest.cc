@@ -0,0 +1,93 @@
+#include <muduo/net/TimingWheel.h>
+#include <muduo/net/Timer.h>
+
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include <map>
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+void noop()
+{
+}
+
+// Timers far and near, some removed, the wheel advanced to nextTick()
+// every time: each timer must come out once, exactly at its tick.
+void testRandom(int64_t start, int n, int64_t range)
+{
+  boost::ptr_vector<Timer> timers;
+  std::map<Timer*, int64_t> ticks;
+  TimingWheel wheel(start);
+  for (int i = 0; i < n; ++i)
+  {
+    timers.push_back(new Timer(noop, Timestamp(), 0.0));
+    Timer* timer = &timers.back();
+    int64_t r = (static_cast<int64_t>(rand()) << 31 | rand()) % range;
+    int64_t tick = start + (i % 4 == 0 ? r % 1000 : r);
+    wheel.add(timer, tick);
+    ticks[timer] = tick;
+  }
+  for (int i = 0; i < n; i += 3)
+  {
+    wheel.remove(&timers[i]);
+    ticks.erase(&timers[i]);
+  }
+  assert(wheel.size() == ticks.size());
+
+  std::vector<Timer*> expired;
+  int64_t last = start - 1;
+  int fired = 0;
+  while (!wheel.empty())
+  {
+    int64_t tick = wheel.nextTick();
+    assert(tick > last);
+    expired.clear();
+    wheel.advance(tick, &expired);
+    for (size_t i = 0; i < expired.size(); ++i)
+    {
+      assert(ticks.count(expired[i]) == 1);
+      assert(ticks[expired[i]] == tick);
+      ticks.erase(expired[i]);
+      ++fired;
+    }
+    last = tick;
+  }
+  assert(ticks.empty());
+  printf("start %lld range %lld: %d timers fired on time\n",
+         static_cast<long long>(start), static_cast<long long>(range), fired);
+}
+
+int main()
+{
+  {
+  // past ticks fire at the next advance, big steps catch up
+  Timer a(noop, Timestamp(), 0.0);
+  Timer b(noop, Timestamp(), 0.0);
+  TimingWheel wheel(1000);
+  std::vector<Timer*> expired;
+  wheel.add(&a, 10);
+  wheel.add(&b, 1000 + 300000);
+  assert(wheel.nextTick() == 1000);
+  wheel.advance(999, &expired);
+  assert(expired.empty());
+  wheel.advance(1000, &expired);
+  assert(expired.size() == 1 && expired[0] == &a);
+  assert(!a.inWheel() && b.inWheel());
+  expired.clear();
+  wheel.advance(1000 + 299999, &expired);
+  assert(expired.empty());
+  wheel.advance(1000 + 400000, &expired);
+  assert(expired.size() == 1 && expired[0] == &b);
+  assert(wheel.empty());
+  }
+
+  testRandom(0, 100000, 1000);
+  testRandom(12345, 100000, 1LL << 20);
+  testRandom(1LL << 40, 50000, 1LL << 34);
+}